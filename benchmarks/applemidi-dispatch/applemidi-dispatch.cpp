@@ -0,0 +1,141 @@
+/**
+ * @file applemidi-dispatch.cpp
+ * @author Phil Schatzmann
+ * @brief Measures how the received AppleMIDI messages are passed to the MidiParser on a
+ * Linux host: we compare the CPU time per message of the copy into a temporary buffer
+ * which is parsed again with the direct dispatch of the decoded status and data bytes.
+ * Then we send RTP MIDI packets with 16 notes each over loopback to an AppleMidiServer
+ * and report the packets/s which it can process.
+ *
+ * @copyright Copyright (c) 2021
+ */
+#include "Midi.h"
+#include <time.h>
+
+const int count = 1000000;
+const int packet_count = 200000;
+const int notes_per_packet = 16;
+const int burst = 32;
+const uint16_t port = 5004;
+const uint32_t ssrc = 0x12345678;
+
+uint64_t cpuNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+class CountingAction : public MidiAction {
+  public:
+    uint32_t notes = 0;
+    void onNoteOn(uint8_t channel, uint8_t note, uint8_t velocity) { notes++; }
+    void onNoteOff(uint8_t channel, uint8_t note, uint8_t velocity) {}
+    void onControlChange(uint8_t channel, uint8_t controller, uint8_t value) {}
+    void onPitchBend(uint8_t channel, uint8_t value) {}
+};
+
+/// the decoded message like it is provided by the RTP MIDI decoder
+uint8_t status = 0x90;
+uint8_t data[2] = {64, 100};
+
+void copyAndParse(MidiParser &parser, uint8_t midi_status, uint8_t *remaining_message, size_t len) {
+    uint8_t message[len + 1];
+    message[0] = midi_status;
+    memmove(message + 1, remaining_message, len);
+    parser.parse(message, len + 1);
+}
+
+void dispatch() {
+    CountingAction action;
+    MidiParser parser(&action);
+
+    uint64_t start = cpuNs();
+    for (int j = 0; j < count; j++) {
+        data[0] = j & 0x7f;
+        copyAndParse(parser, status, data, 2);
+    }
+    double parse_ns = (double)(cpuNs() - start) / count;
+
+    start = cpuNs();
+    for (int j = 0; j < count; j++) {
+        data[0] = j & 0x7f;
+        parser.dispatch(status, data[0], data[1]);
+    }
+    double dispatch_ns = (double)(cpuNs() - start) / count;
+
+    printf("copy + parse: %6.1f ns/message, dispatch: %6.1f ns/message (%u notes)\n", parse_ns, dispatch_ns, action.notes);
+}
+
+void invite(MidiUdpBase &udp, uint16_t target) {
+    uint32_t packet[4 + 4] = {htonl(0xffff494eu), htonl(2u), htonl(1u), htonl(ssrc)};
+    memcpy(&packet[4], "bench", 6);
+    udp.beginPacket(IPAddress(127, 0, 0, 1), target);
+    udp.write((uint8_t *)packet, 4 * 4 + 6);
+    udp.endPacket();
+}
+
+void server() {
+    CountingAction action;
+    AppleMidiServer apple(&action);
+    apple.begin(port);
+
+    MidiUdpBase udp;
+    udp.begin(port + 10);
+    invite(udp, port);
+    invite(udp, port + 1);
+    while (apple.loop());
+
+    // 16 note on: the following ones with a delta time of 0
+    uint8_t packet[12 + 2 + notes_per_packet * 4];
+    int len = 3 + (notes_per_packet - 1) * 4;
+    packet[12] = 0x80 | (len >> 8);
+    packet[13] = len & 0xff;
+    uint8_t *midi = &packet[14];
+    for (int j = 0; j < notes_per_packet; j++) {
+        if (j > 0) *midi++ = 0;
+        *midi++ = 0x90;
+        *midi++ = j;
+        *midi++ = 100;
+    }
+
+    uint8_t buffer[512];
+    uint64_t start_cpu = cpuNs();
+    uint64_t start = nowNs();
+    uint64_t timeout = start + 20000000000ull;
+    for (int j = 0; j < packet_count; j += burst) {
+        for (int k = 0; k < burst; k++) {
+            uint32_t *words = (uint32_t *)packet;
+            words[0] = htonl(0x80610000u | ((j + k) & 0xffff));
+            words[1] = htonl((uint32_t)(j + k));
+            words[2] = htonl(ssrc);
+            udp.beginPacket(IPAddress(127, 0, 0, 1), port + 1);
+            udp.write(packet, 14 + len);
+            udp.endPacket();
+        }
+        // process the burst and drop the answers (e.g. receiver feedback)
+        while (action.notes < (uint32_t)(j + burst) * notes_per_packet && nowNs() < timeout) {
+            apple.loop();
+        }
+        while (udp.parsePacket() > 0) udp.read(buffer, sizeof(buffer));
+    }
+    double seconds = (nowNs() - start) / 1e9;
+    double cpu_ns = (double)(cpuNs() - start_cpu) / packet_count;
+
+    printf("AppleMidiServer: %8.0f packets/s, %9.0f messages/s, %6.0f ns CPU/packet (sender included), received %u of %d notes\n",
+           packet_count / seconds, (double)action.notes / seconds, cpu_ns, action.notes, packet_count * notes_per_packet);
+    udp.stop();
+    apple.end();
+}
+
+int main() {
+    MidiLogLevel = MidiError;
+    dispatch();
+    server();
+    return 0;
+}
@@ -0,0 +1,134 @@
+/**
+ * @file applemidi-peers.cpp
+ * @author Phil Schatzmann
+ * @brief Benchmark of the AppleMIDI peer table on a Linux host without network: we
+ * register simulated peers with invitations and measure the time to parse a RTP MIDI
+ * packet (which needs the lookup by SSRC and IP address) and to send a message to a peer.
+ * The broadcast to all peers is compared with sending the message to each peer in turn.
+ * We also report the memory which is used by the peer table and the pooled buffers.
+ * Compile with -DAPPLEMIDI_MAX_PEERS=65
+ *
+ * @copyright Copyright (c) 2021
+ */
+#include "Midi.h"
+#include <time.h>
+
+const int count = 200000;
+const int max_peers = APPLEMIDI_MAX_PEERS - 1;
+
+uint8_t peer_ip[max_peers][16];
+uint32_t peer_ssrc[max_peers];
+uint16_t peer_seq[max_peers];
+uint32_t received = 0;
+uint32_t sent = 0;
+applemidi_t engine;
+
+uint64_t cpuNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void onMessage(void *user_data, uint8_t port, uint32_t timestamp, uint8_t status, uint8_t *data, size_t len, size_t continued_sysex_pos) {
+    received++;
+}
+
+int32_t onSend(void *user_data, uint8_t *ip_addr, uint16_t port, uint8_t *data, size_t len, uint8_t is_dataport) {
+    sent++;
+    return 0;
+}
+
+void invite(int j) {
+    uint32_t packet[4 + 4] = {htonl(0xffff494eu), htonl(2u), htonl((uint32_t)j + 1), htonl(peer_ssrc[j])};
+    memcpy(&packet[4], "peer", 5);
+    applemidi_parse_udp_datagram(&engine, peer_ip[j], 5004, (uint8_t *)packet, 4 * 4 + 5, 0);
+    applemidi_parse_udp_datagram(&engine, peer_ip[j], 5005, (uint8_t *)packet, 4 * 4 + 5, 1);
+}
+
+void endSession(int j) {
+    uint32_t packet[4] = {htonl(0xffff4259u), htonl(2u), htonl((uint32_t)j + 1), htonl(peer_ssrc[j])};
+    applemidi_parse_udp_datagram(&engine, peer_ip[j], 5004, (uint8_t *)packet, 4 * 4, 0);
+}
+
+void run(int peerCount) {
+    applemidi_init(&engine, onMessage, onSend, nullptr);
+    applemidi_set_debug_level(&engine, 0);
+    for (int j = 0; j < peerCount; j++) {
+        invite(j);
+    }
+
+    // receive: a note on from each peer in turn
+    uint8_t packet[16];
+    received = 0;
+    uint64_t start = cpuNs();
+    for (int j = 0; j < count; j++) {
+        int p = j % peerCount;
+        uint32_t *words = (uint32_t *)packet;
+        words[0] = htonl(0x80610000u | peer_seq[p]++);
+        words[1] = htonl((uint32_t)j);
+        words[2] = htonl(peer_ssrc[p]);
+        packet[12] = 3;
+        packet[13] = 0x90;
+        packet[14] = 64;
+        packet[15] = 100;
+        applemidi_parse_udp_datagram(&engine, peer_ip[p], 5005, packet, sizeof(packet), 1);
+    }
+    double rx_ns = (double)(cpuNs() - start) / count;
+
+    // send: a note on to each peer in turn
+    uint8_t note_on[3] = {0x90, 64, 100};
+    sent = 0;
+    start = cpuNs();
+    for (int j = 0; j < count; j++) {
+        int port = 1 + j % peerCount;
+        applemidi_send_message(&engine, port, note_on, sizeof(note_on));
+        applemidi_outbuffer_flush(&engine, port);
+    }
+    double tx_ns = (double)(cpuNs() - start) / count;
+
+    // broadcast: the messages are batched in the output buffers of all peers
+    int broadcasts = count / peerCount;
+    start = cpuNs();
+    for (int j = 0; j < broadcasts; j++) {
+        for (int port = 1; port <= peerCount; port++) {
+            applemidi_send_message(&engine, port, note_on, sizeof(note_on));
+        }
+    }
+    double each_ns = (double)(cpuNs() - start) / broadcasts;
+    start = cpuNs();
+    for (int j = 0; j < broadcasts; j++) {
+        applemidi_send_message_all(&engine, note_on, sizeof(note_on));
+    }
+    double all_ns = (double)(cpuNs() - start) / broadcasts;
+
+    size_t table = sizeof(applemidi_peer_t) * APPLEMIDI_MAX_PEERS;
+    size_t buffers = sizeof(applemidi_peer_buffer_t) * applemidi_get_buffer_count(&engine);
+    printf("peers %3d: receive %6.0f ns/packet, send %6.0f ns/packet, received: %u, sent: %u, memory: %zu bytes (table %zu + buffers %zu)\n",
+           peerCount, rx_ns, tx_ns, received, sent, table + buffers, table, buffers);
+    printf("peers %3d: to each peer %8.0f ns/message, broadcast %8.0f ns/message (%5.1f ns/peer)\n", peerCount, each_ns, all_ns,
+           all_ns / peerCount);
+}
+
+int main() {
+    for (int j = 0; j < max_peers; j++) {
+        peer_ip[j][0] = 10;
+        peer_ip[j][1] = 0;
+        peer_ip[j][2] = j / 8;
+        peer_ip[j][3] = 1 + j % 8;
+        peer_ssrc[j] = 0x10000000u + 7919u * j;
+    }
+    run(1);
+    run(8);
+    run(max_peers);
+
+    // sessions which are closed and reopened are reusing the pooled buffers
+    for (int r = 0; r < 100; r++) {
+        for (int j = 0; j < max_peers; j++) endSession(j);
+        for (int j = 0; j < max_peers; j++) invite(j);
+    }
+    printf("after 100 reconnects of %d peers: %d buffers of %zu bytes\n", max_peers,
+           applemidi_get_buffer_count(&engine), sizeof(applemidi_peer_buffer_t));
+    printf("with inline buffers the table would need %zu bytes\n",
+           (sizeof(applemidi_peer_t) + sizeof(applemidi_peer_buffer_t)) * APPLEMIDI_MAX_PEERS);
+    return 0;
+}
@@ -0,0 +1,112 @@
+/**
+ * @file ble-clients.cpp
+ * @author Phil Schatzmann
+ * @brief Test of the routing of BLE notifications to multiple clients on a Linux host
+ * without BLE: the remote characteristics are simulated and each connection sends notes
+ * with its own channel. We check that every parser only receives the notes of its
+ * connection, also after a reconnect, and we measure the time which is needed to find
+ * the receiver compared to a direct call.
+ *
+ * @copyright Copyright (c) 2021
+ */
+#include "Midi.h"
+#include <time.h>
+
+const int rounds = 200000;
+
+/// stands in for BLERemoteCharacteristic
+struct FakeCharacteristic {
+    int id;
+};
+
+/// corresponds to the MidiBleParser of one MidiBleClient
+class ClientParser : public MidiParser, public MidiPacketReceiver {
+  public:
+    int channel = 0;
+    uint32_t notes = 0;
+    uint32_t misrouted = 0;
+
+    ClientParser() { decoder.begin(this); }
+    void receive(const uint8_t *data, int len) override { decoder.decode(data, len, 0); }
+    void onCommand(uint8_t channel, uint8_t status, uint8_t p1, uint8_t p2) {
+        if (channel == this->channel) notes++; else misrouted++;
+    }
+
+  protected:
+    MidiBleDecoder decoder;
+};
+
+uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/// BLE MIDI packet with one note on the indicated channel
+int notePacket(uint8_t *packet, int channel) {
+    MidiBleEncoder encoder;
+    uint8_t note[3] = {(uint8_t)(0x90 | channel), 60, 100};
+    encoder.write(0, note, 3);
+    memcpy(packet, encoder.data(), encoder.size());
+    return encoder.size();
+}
+
+/// returns false if a note was lost or misrouted
+bool run(int clientCount) {
+    MidiBleRoutes routes;
+    FakeCharacteristic characteristics[MIDI_BLE_MAX_ROUTES + 1];
+    ClientParser parsers[MIDI_BLE_MAX_ROUTES];
+    uint8_t packets[MIDI_BLE_MAX_ROUTES][16];
+    int lengths[MIDI_BLE_MAX_ROUTES];
+    for (int j = 0; j < clientCount; j++) {
+        parsers[j].channel = j;
+        lengths[j] = notePacket(packets[j], j);
+        routes.add(&characteristics[j], &parsers[j]);
+    }
+
+    // the connections notify in turn: the last one reconnects in the middle with a new characteristic
+    int unknown = 0;
+    uint64_t start = nowNs();
+    for (int r = 0; r < rounds; r++) {
+        if (r == rounds / 2) {
+            routes.remove(&characteristics[clientCount - 1]);
+            routes.add(&characteristics[MIDI_BLE_MAX_ROUTES], &parsers[clientCount - 1]);
+        }
+        for (int j = 0; j < clientCount; j++) {
+            FakeCharacteristic *characteristic = &characteristics[j];
+            if (j == clientCount - 1 && r >= rounds / 2) characteristic = &characteristics[MIDI_BLE_MAX_ROUTES];
+            if (!routes.route(characteristic, packets[j], lengths[j])) unknown++;
+        }
+    }
+    double routed_ns = (double)(nowNs() - start) / rounds / clientCount;
+
+    // the same packets passed directly to the parser
+    start = nowNs();
+    for (int r = 0; r < rounds; r++) {
+        for (int j = 0; j < clientCount; j++) {
+            parsers[j].receive(packets[j], lengths[j]);
+        }
+    }
+    double direct_ns = (double)(nowNs() - start) / rounds / clientCount;
+
+    uint32_t notes = 0, misrouted = 0;
+    for (int j = 0; j < clientCount; j++) {
+        notes += parsers[j].notes;
+        misrouted += parsers[j].misrouted;
+    }
+    // a notification from a removed characteristic is ignored
+    bool is_stale = routes.route(&characteristics[clientCount - 1], packets[0], lengths[0]);
+    printf("%d clients: routed %6.1f ns, direct %6.1f ns per packet | notes %u of %u, misrouted %u, unknown %d, stale %s\n",
+           clientCount, routed_ns, direct_ns, notes, 2u * rounds * clientCount, misrouted, unknown,
+           is_stale ? "routed" : "ignored");
+    return notes == 2u * rounds * clientCount && misrouted == 0 && unknown == 0 && !is_stale;
+}
+
+int main() {
+    MidiLogLevel = MidiError;
+    bool ok = run(1);
+    ok = run(4) && ok;
+    ok = run(MIDI_BLE_MAX_ROUTES) && ok;
+    printf("routing: %s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
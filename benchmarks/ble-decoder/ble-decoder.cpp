@@ -0,0 +1,142 @@
+/**
+ * @file ble-decoder.cpp
+ * @author Phil Schatzmann
+ * @brief Benchmark of the BLE MIDI timestamp reconstruction on a Linux host without BLE:
+ * a simulated sender creates notes at irregular times with its own clock, the packets are
+ * sent at the connection events (every 15 ms) with some radio jitter. We compare the
+ * spacing of the notes at the receiver with the spacing at the sender: when the notes are
+ * processed at arrival, with the reconstructed timestamps and when they are played by the
+ * jitter buffer. We also measure the CPU time to decode a message.
+ *
+ * @copyright Copyright (c) 2021
+ */
+#include "Midi.h"
+#include <stdlib.h>
+#include <time.h>
+
+const int note_count = 2000;
+const uint32_t interval_us = 15000;
+const uint32_t clock_offset_ms = 3456;
+const int count = 1000000;
+
+uint64_t cpuNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/// records the time of each note
+class RecordingParser : public MidiParser {
+  public:
+    MidiBleDecoder *p_decoder = nullptr;
+    uint32_t *p_now = nullptr;
+    uint32_t arrival_us[note_count];
+    uint32_t timestamp_us[note_count];
+    int notes = 0;
+    void onCommand(uint8_t channel, uint8_t status, uint8_t p1, uint8_t p2) {
+        if (notes < note_count) {
+            arrival_us[notes] = *p_now;
+            timestamp_us[notes] = p_decoder->timestampUs();
+            notes++;
+        }
+    }
+};
+
+class CountingParser : public MidiParser {
+  public:
+    uint32_t messages = 0;
+    void onCommand(uint8_t channel, uint8_t status, uint8_t p1, uint8_t p2) { messages++; }
+};
+
+uint32_t sent_us[note_count];
+RecordingParser parser;
+uint32_t now_us = 0;
+
+/// average and max difference of the spacing of the notes compared with the sender
+void report(const char *title, uint32_t *times) {
+    double sum = 0;
+    uint32_t max = 0;
+    for (int j = 1; j < parser.notes; j++) {
+        int32_t expected = sent_us[j] - sent_us[j - 1];
+        int32_t actual = times[j] - times[j - 1];
+        uint32_t error = abs(actual - expected);
+        sum += error;
+        if (error > max) max = error;
+    }
+    printf("%-26s spacing error: avg %7.0f us, max %6u us (%d notes)\n", title, sum / (parser.notes - 1), max, parser.notes);
+}
+
+void simulate(bool jitterBuffer) {
+    MidiBleDecoder decoder;
+    MidiJitterBuffer jitter;
+    jitter.begin(&parser);
+    jitter.setLatency(2000, 50000);
+    decoder.begin(&parser, jitterBuffer ? &jitter : nullptr);
+    parser.p_decoder = &decoder;
+    parser.p_now = &now_us;
+    parser.notes = 0;
+    now_us = 0;
+
+    MidiBleEncoder encoder;
+    encoder.setMtu(185);
+    srand(1);
+    uint32_t t = 100000;
+    for (int j = 0; j < note_count; j++) {
+        // irregular rhythm: 1 to 20 ms
+        t += 1000 * (1 + rand() % 20);
+        sent_us[j] = t;
+    }
+
+    // the packets are sent at the connection events and arrive with up to 2 ms jitter
+    int next = 0;
+    for (uint32_t event = 100000; next < note_count || jitter.available() > 0; event += interval_us) {
+        while (next < note_count && sent_us[next] < event) {
+            uint8_t note[3] = {0x90, (uint8_t)(next & 0x7f), 100};
+            encoder.write(sent_us[next] / 1000 + clock_offset_ms, note, 3);
+            next++;
+        }
+        // play the buffered notes until the packet arrives
+        uint32_t arrival = event + rand() % 2000;
+        for (; now_us < arrival; now_us += 100) {
+            jitter.play(now_us);
+        }
+        if (encoder.available() > 0) {
+            decoder.decode(encoder.data(), encoder.size(), now_us);
+            encoder.clear();
+        }
+    }
+    if (jitterBuffer) {
+        report("jitter buffer playout", parser.arrival_us);
+        printf("%-26s late: %u, dropped: %u, latency: %u us\n", "", jitter.statistics().late, jitter.statistics().dropped, jitter.statistics().latency_us);
+    } else {
+        report("processed at arrival", parser.arrival_us);
+        report("reconstructed timestamps", parser.timestamp_us);
+    }
+}
+
+void decode() {
+    MidiBleEncoder encoder;
+    encoder.setMtu(185);
+    MidiBleDecoder decoder;
+    CountingParser counter;
+    decoder.begin(&counter);
+    uint8_t note[3] = {0x90, 64, 100};
+    int messages = 0;
+    while (encoder.write(messages, note, 3)) messages++;
+    int packets = count / messages;
+    uint64_t start = cpuNs();
+    for (int j = 0; j < packets; j++) {
+        decoder.decode(encoder.data(), encoder.size(), j * 1000);
+    }
+    double ns = (double)(cpuNs() - start) / (packets * messages);
+    printf("decode: %5.1f ns/message (%d messages/packet), received: %u, invalid: %u\n", ns, messages, counter.messages,
+           decoder.statistics().invalid);
+}
+
+int main() {
+    MidiLogLevel = MidiError;
+    simulate(false);
+    simulate(true);
+    decode();
+    return 0;
+}
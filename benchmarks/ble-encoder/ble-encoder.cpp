@@ -0,0 +1,84 @@
+/**
+ * @file ble-encoder.cpp
+ * @author Phil Schatzmann
+ * @brief Benchmark of the BLE MIDI packet aggregation on a Linux host without BLE: we
+ * encode a chord and a stream of notes with the MidiBleEncoder and report the messages
+ * per packet and the packets per connection interval for different MTUs compared with
+ * one message per packet. We also measure the CPU time to encode a message.
+ *
+ * @copyright Copyright (c) 2021
+ */
+#include "Midi.h"
+#include <time.h>
+
+const int count = 1000000;
+const int interval_ms = 15;
+
+uint64_t cpuNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/// encodes messageCount notes which are created stepUs apart and which are flushed after each connection interval
+void aggregate(const char *title, int mtu, int messageCount, uint32_t stepUs) {
+    MidiBleEncoder encoder;
+    encoder.setMtu(mtu);
+    int packets = 0;
+    int max_per_interval = 0;
+    int per_interval = 0;
+    uint32_t interval_start = 0;
+    for (int j = 0; j < messageCount; j++) {
+        uint32_t now_us = j * stepUs;
+        if (now_us - interval_start >= interval_ms * 1000) {
+            // connection event: the packet is sent
+            if (encoder.available() > 0) {
+                packets++;
+                per_interval++;
+                encoder.clear();
+            }
+            interval_start = now_us;
+            per_interval = 0;
+        }
+        uint8_t note[3] = {0x90, (uint8_t)(j & 0x7f), 100};
+        if (!encoder.write(now_us / 1000, note, 3)) {
+            packets++;
+            per_interval++;
+            encoder.clear();
+            encoder.write(now_us / 1000, note, 3);
+        }
+        if (per_interval + 1 > max_per_interval) max_per_interval = per_interval + 1;
+    }
+    if (encoder.available() > 0) packets++;
+    printf("%-12s MTU %3d: %4d messages in %4d packets (%4.1f messages/packet, max %2d packets/interval), before: %4d packets\n",
+           title, mtu, messageCount, packets, (double)messageCount / packets, max_per_interval, messageCount);
+}
+
+void encode() {
+    MidiBleEncoder encoder;
+    encoder.setMtu(185);
+    uint8_t note[3] = {0x90, 64, 100};
+    int packets = 0;
+    uint64_t start = cpuNs();
+    for (int j = 0; j < count; j++) {
+        note[1] = j & 0x7f;
+        if (!encoder.write(j / 8, note, 3)) {
+            packets++;
+            encoder.clear();
+            encoder.write(j / 8, note, 3);
+        }
+    }
+    double ns = (double)(cpuNs() - start) / count;
+    printf("encode: %5.1f ns/message, %d packets\n", ns, packets);
+}
+
+int main() {
+    int mtus[] = {23, 185};
+    for (int mtu : mtus) {
+        aggregate("chord", mtu, 16, 0);
+        aggregate("1 note/ms", mtu, 1000, 1000);
+        aggregate("4 notes/ms", mtu, 1000, 250);
+    }
+    encode();
+    return 0;
+}
@@ -0,0 +1,115 @@
+/**
+ * @file ble-queue.cpp
+ * @author Phil Schatzmann
+ * @brief Benchmark of the BLE receive queue on a Linux host without BLE: a thread which
+ * stands in for the BLE task delivers a packet with 8 notes every 7.5 ms and the action
+ * needs 500 us per note. We compare the execution time of the callback when the packet is
+ * parsed in the callback with the time when it is only copied into the MidiPacketQueue
+ * and parsed by the application thread, and we report the queue depth.
+ * Compile with -pthread
+ *
+ * @copyright Copyright (c) 2021
+ */
+#include "Midi.h"
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+const int packet_count = 400;
+const int notes_per_packet = 8;
+const uint32_t interval_us = 7500;
+const uint32_t action_us = 500;
+
+uint32_t nowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000ull + ts.tv_nsec / 1000);
+}
+
+/// an action which needs some time (e.g. to start a sound)
+class SlowParser : public MidiParser {
+  public:
+    volatile uint32_t notes = 0;
+    void onCommand(uint8_t channel, uint8_t status, uint8_t p1, uint8_t p2) {
+        uint32_t start = nowUs();
+        while (nowUs() - start < action_us);
+        notes++;
+    }
+};
+
+SlowParser parser;
+MidiBleDecoder decoder;
+MidiPacketQueue queue;
+bool is_queue = false;
+bool is_done = false;
+uint32_t callback_max_us = 0;
+uint64_t callback_total_us = 0;
+
+/// stands in for the BLE write callback: MidiBleParser::receive() uses the queued variant
+void receive(const uint8_t *data, int len) {
+    uint32_t start = nowUs();
+    if (is_queue) {
+        queue.write(data, len, start);
+    } else {
+        decoder.decode(data, len, start);
+    }
+    uint32_t duration = nowUs() - start;
+    callback_total_us += duration;
+    if (duration > callback_max_us) callback_max_us = duration;
+}
+
+void *bleTask(void *) {
+    MidiBleEncoder encoder;
+    encoder.setMtu(185);
+    uint32_t next = nowUs();
+    for (int j = 0; j < packet_count; j++) {
+        while ((int32_t)(nowUs() - next) < 0) usleep(100);
+        next += interval_us;
+        encoder.clear();
+        for (int k = 0; k < notes_per_packet; k++) {
+            uint8_t note[3] = {0x90, (uint8_t)k, 100};
+            encoder.write(nowUs() / 1000, note, 3);
+        }
+        receive(encoder.data(), encoder.size());
+    }
+    __atomic_store_n(&is_done, true, __ATOMIC_RELEASE);
+    return nullptr;
+}
+
+void run(bool queued) {
+    is_queue = queued;
+    is_done = false;
+    parser.notes = 0;
+    callback_max_us = 0;
+    callback_total_us = 0;
+    decoder.begin(&parser);
+    queue = MidiPacketQueue();
+
+    pthread_t thread;
+    pthread_create(&thread, nullptr, bleTask, nullptr);
+    // application loop: corresponds to MidiBleParser::loop()
+    while (!__atomic_load_n(&is_done, __ATOMIC_ACQUIRE) || queue.available() > 0) {
+        int len;
+        uint32_t time_us;
+        const uint8_t *data = queue.peek(len, time_us);
+        if (data != nullptr) {
+            decoder.decode(data, len, time_us);
+            queue.pop();
+        } else {
+            usleep(100);
+        }
+    }
+    pthread_join(thread, nullptr);
+
+    MidiPacketQueueStatistics &stats = queue.statistics();
+    printf("%-22s callback avg %7.1f us, max %6u us | notes %u, queue max depth %u, dropped %u\n",
+           queued ? "queued:" : "parsed in callback:", (double)callback_total_us / packet_count, callback_max_us,
+           parser.notes, stats.max_depth, stats.dropped);
+}
+
+int main() {
+    MidiLogLevel = MidiError;
+    run(false);
+    run(true);
+    return 0;
+}
@@ -0,0 +1,462 @@
+/**
+ * @file codec.cpp
+ * @author Phil Schatzmann
+ * @brief Benchmark of the MIDI codecs on a Linux host: MidiParser::parse, MidiStreamIn::loop
+ * over a MidiMemoryStream, the MidiStreamOut encoders, the RTP MIDI encoder and decoder of
+ * the AppleMIDI engine and the BLE MIDI encoder and decoder. Each path is measured with
+ * realistic traffic: dense notes, controller floods, SysEx dumps and clock. The results are
+ * written as JSON (one result per line) with the messages/s, ns/message and the bytes which
+ * were allocated during the measurement, so that they can be compared between commits:
+ *
+ *   codec -o baseline.json             (on the old commit)
+ *   codec -c baseline.json -t 10       (on the new commit: fails if a path is 10% slower)
+ *
+ * @copyright Copyright (c) 2021
+ */
+#include "Midi.h"
+#include <time.h>
+#include <stdlib.h>
+#include <new>
+#include <string>
+#include <vector>
+
+const uint32_t ssrc = 0x12345678;
+const int mtu = 185;
+const double min_seconds = 0.1;
+const int repetitions = 5;
+
+// => allocation accounting: all heap allocations of the measured code are counted
+
+static size_t allocated_bytes = 0;
+
+#if !defined(__SANITIZE_ADDRESS__) && !defined(__SANITIZE_THREAD__)
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+
+extern "C" void *malloc(size_t size) {
+    allocated_bytes += size;
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size) {
+    allocated_bytes += count * size;
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) {
+    allocated_bytes += size;
+    return __libc_realloc(ptr, size);
+}
+#else
+// the sanitizers are replacing malloc: we can only count the C++ allocations
+void *operator new(size_t size) {
+    allocated_bytes += size;
+    void *result = malloc(size);
+    if (result == nullptr) throw std::bad_alloc();
+    return result;
+}
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+#endif
+
+/// CPU time of the thread: it does not depend on the other load of the machine
+uint64_t cpuNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// => traffic
+
+/// a sequence of complete MIDI messages (with status bytes) which are repeated
+struct Traffic {
+    const char *name;
+    std::vector<std::vector<uint8_t>> messages;
+    std::vector<uint8_t> stream;
+    bool has_sysex = false;
+
+    void add(std::vector<uint8_t> msg) {
+        stream.insert(stream.end(), msg.begin(), msg.end());
+        messages.push_back(msg);
+    }
+};
+
+uint32_t random_state = 1;
+uint8_t random7() {
+    random_state = random_state * 1103515245u + 12345u;
+    return (random_state >> 16) & 0x7F;
+}
+
+Traffic denseNotes() {
+    Traffic result;
+    result.name = "notes";
+    // chords on all channels: each note is released again
+    for (int j = 0; j < 500; j++) {
+        uint8_t channel = j % 16;
+        uint8_t note = 36 + random7() % 48;
+        result.add({(uint8_t)(0x90 | channel), note, (uint8_t)(1 + random7() % 127)});
+        result.add({(uint8_t)(0x80 | channel), note, 0});
+    }
+    return result;
+}
+
+Traffic controllerFlood() {
+    Traffic result;
+    result.name = "cc";
+    // a knob sweep which sends modulation, volume, pan, expression and cutoff
+    const uint8_t controllers[] = {1, 7, 10, 11, 74};
+    for (int j = 0; j < 1000; j++) {
+        result.add({0xB0, controllers[j % 5], (uint8_t)((j / 5) & 0x7F)});
+    }
+    return result;
+}
+
+Traffic sysexDumps() {
+    Traffic result;
+    result.name = "sysex";
+    result.has_sysex = true;
+    // patch dumps of 256 bytes
+    for (int j = 0; j < 16; j++) {
+        std::vector<uint8_t> dump = {0xF0, 0x7D, (uint8_t)j};
+        while (dump.size() < 255) dump.push_back(random7());
+        dump.push_back(0xF7);
+        result.add(dump);
+    }
+    return result;
+}
+
+Traffic midiClock() {
+    Traffic result;
+    result.name = "clock";
+    // start, 24 ppqn clock with a song position every bar
+    result.add({0xFA});
+    for (int j = 1; j < 1000; j++) {
+        if (j % 96 == 0) {
+            result.add({0xF2, (uint8_t)((j / 6) & 0x7F), (uint8_t)(j / 768)});
+        } else {
+            result.add({0xF8});
+        }
+    }
+    return result;
+}
+
+// => results
+
+struct Result {
+    std::string name;
+    uint64_t messages;
+    uint64_t bytes;
+    double ns_per_message;
+    uint64_t bytes_allocated;
+};
+
+std::vector<Result> results;
+
+/// executes the function (which processes count messages with bytes) until the min time has passed and keeps the fastest repetition
+template <typename F> void measure(const char *path, Traffic &traffic, uint64_t count, uint64_t bytes, F function) {
+    function();  // warm up: e.g. the first session setup
+    double best_ns = 0;
+    uint64_t total_messages = 0;
+    uint64_t total_bytes = 0;
+    size_t allocated = 0;
+    for (int r = 0; r < repetitions; r++) {
+        uint64_t loops = 0;
+        size_t allocated_start = allocated_bytes;
+        uint64_t start = cpuNs();
+        uint64_t end;
+        do {
+            function();
+            loops++;
+            end = cpuNs();
+        } while (end - start < min_seconds * 1e9);
+        allocated += allocated_bytes - allocated_start;
+        double ns = (double)(end - start) / (loops * count);
+        if (r == 0 || ns < best_ns) best_ns = ns;
+        total_messages += loops * count;
+        total_bytes += loops * bytes;
+    }
+    results.push_back({std::string(path) + "/" + traffic.name, total_messages, total_bytes, best_ns, allocated});
+}
+
+// => paths
+
+class CountingAction : public MidiAction {
+  public:
+    uint32_t messages = 0;
+    void onNoteOn(uint8_t channel, uint8_t note, uint8_t velocity) { messages++; }
+    void onNoteOff(uint8_t channel, uint8_t note, uint8_t velocity) { messages++; }
+    void onControlChange(uint8_t channel, uint8_t controller, uint8_t value) { messages++; }
+    void onPitchBend(uint8_t channel, uint8_t value) { messages++; }
+    void onSysEx(const uint8_t *data, int len, int pos, bool complete) { messages += complete; }
+};
+
+CountingAction action;
+MidiParser parser(&action);
+MidiSysExAssembler sysex;
+
+void parse(Traffic &traffic) {
+    std::vector<uint8_t> stream = traffic.stream;
+    measure("parser", traffic, traffic.messages.size(), stream.size(), [&]() {
+        parser.parse(stream.data(), stream.size());
+    });
+}
+
+void streamIn(Traffic &traffic) {
+    std::vector<uint8_t> data = traffic.stream;
+    MidiMemoryStream memory(data.data(), data.size(), data.size());
+    MidiStreamIn in(memory, parser);
+    measure("stream-in", traffic, traffic.messages.size(), data.size(), [&]() {
+        memory.rewind();
+        while (memory.available() > 0) in.loop();
+    });
+}
+
+void streamOut(Traffic &traffic) {
+    // MidiStreamOut only provides the channel messages
+    if (traffic.has_sysex || traffic.messages[0][0] >= 0xF0) return;
+    std::vector<uint8_t> data(traffic.stream.size());
+    MidiMemoryStream memory(data.data(), data.size());
+    MidiStreamOut out(memory);
+    measure("stream-out", traffic, traffic.messages.size(), data.size(), [&]() {
+        memory.clear();
+        for (auto &msg : traffic.messages) {
+            int8_t channel = msg[0] & 0x0F;
+            switch (msg[0] & 0xF0) {
+                case 0x90: out.noteOn(msg[1], msg[2], channel); break;
+                case 0x80: out.noteOff(msg[1], msg[2], channel); break;
+                case 0xB0: out.controlChange(msg[1], msg[2], channel); break;
+            }
+        }
+    });
+}
+
+// AppleMIDI: the encoder sends to a simulated peer and the packets are recorded for the decoder
+applemidi_t encoder;
+applemidi_t decoder;
+// the engine uses IPv6 sized addresses
+uint8_t peer_ip[16] = {127, 0, 0, 1};
+std::vector<std::vector<uint8_t>> recorded;
+bool is_recording = false;
+
+int32_t onSend(void *user_data, uint8_t *ip_addr, uint16_t port, uint8_t *data, size_t len, uint8_t is_dataport) {
+    // only the MIDI packets to the data port are recorded
+    if (is_recording && port == 5005 && len > 12 && data[0] == 0x80) {
+        std::vector<uint8_t> packet(data, data + len);
+        // the decoder knows the sender by the SSRC of the invitation
+        uint32_t sender = htonl(ssrc);
+        memcpy(&packet[8], &sender, 4);
+        recorded.push_back(packet);
+    }
+    return 0;
+}
+
+/// like AppleMidiServer::applemidi_callback_midi_message_received
+void onMessage(void *user_data, uint8_t port, uint32_t timestamp, uint8_t status, uint8_t *data, size_t len, size_t continued_sysex_pos) {
+    if (status == 0xF0) {
+        sysex.write(port, data, len, continued_sysex_pos, 0);
+    } else if (status == 0xF7) {
+        sysex.end(port);
+    } else if (len <= 2) {
+        parser.dispatch(status, len > 0 ? data[0] : 0, len > 1 ? data[1] : 0);
+    }
+}
+
+void invite(applemidi_t &engine) {
+    uint32_t packet[4 + 4] = {htonl(0xffff494eu), htonl(2u), htonl(1u), htonl(ssrc)};
+    memcpy(&packet[4], "codec", 6);
+    applemidi_parse_udp_datagram(&engine, peer_ip, 5004, (uint8_t *)packet, 4 * 4 + 6, 0);
+    applemidi_parse_udp_datagram(&engine, peer_ip, 5005, (uint8_t *)packet, 4 * 4 + 6, 1);
+}
+
+void rtpEncode(Traffic &traffic) {
+    auto encode = [&]() {
+        for (auto &msg : traffic.messages) {
+            applemidi_send_message(&encoder, 1, msg.data(), msg.size());
+        }
+        applemidi_outbuffer_flush(&encoder, 1);
+    };
+    measure("rtp-encode", traffic, traffic.messages.size(), traffic.stream.size(), encode);
+
+    recorded.clear();
+    is_recording = true;
+    encode();
+    is_recording = false;
+}
+
+void rtpDecode(Traffic &traffic) {
+    uint64_t bytes = 0;
+    for (auto &packet : recorded) bytes += packet.size();
+    uint16_t seq = 0;
+    measure("rtp-decode", traffic, traffic.messages.size(), bytes, [&]() {
+        for (auto &packet : recorded) {
+            // the sequence numbers continue, so that the packets are not seen as lost
+            packet[2] = seq >> 8;
+            packet[3] = seq & 0xFF;
+            seq++;
+            applemidi_parse_udp_datagram(&decoder, peer_ip, 5005, packet.data(), packet.size(), 1);
+        }
+    });
+}
+
+// BLE: the packets which are created by the encoder are used by the decoder
+std::vector<std::vector<uint8_t>> ble_packets;
+
+/// SysEx packets: the continuation packets only have a header, the F7 has its own timestamp
+void bleSysEx(std::vector<uint8_t> &msg, uint32_t timeMs) {
+    int max_len = mtu - 3;
+    uint8_t header = 0x80 | ((timeMs >> 7) & 0x3F);
+    uint8_t timestamp = 0x80 | (timeMs & 0x7F);
+    std::vector<uint8_t> packet = {header, timestamp};
+    for (size_t j = 0; j < msg.size() - 1; j++) {
+        if ((int)packet.size() >= max_len) {
+            ble_packets.push_back(packet);
+            packet = {header};
+        }
+        packet.push_back(msg[j]);
+    }
+    if ((int)packet.size() + 2 > max_len) {
+        ble_packets.push_back(packet);
+        packet = {header};
+    }
+    packet.push_back(timestamp);
+    packet.push_back(0xF7);
+    ble_packets.push_back(packet);
+}
+
+void bleEncode(Traffic &traffic) {
+    MidiBleEncoder ble;
+    ble.setMtu(mtu);
+    auto encode = [&](bool record) {
+        uint32_t time_ms = 0;
+        ble.clear();
+        for (auto &msg : traffic.messages) {
+            if (msg[0] == 0xF0) {
+                if (record) bleSysEx(msg, time_ms);
+                continue;
+            }
+            if (!ble.write(time_ms, msg.data(), msg.size())) {
+                if (record) ble_packets.push_back(std::vector<uint8_t>(ble.data(), ble.data() + ble.size()));
+                ble.clear();
+                ble.write(time_ms, msg.data(), msg.size());
+            }
+            time_ms++;
+        }
+        if (record && ble.size() > 0) ble_packets.push_back(std::vector<uint8_t>(ble.data(), ble.data() + ble.size()));
+    };
+    // the encoder only supports short messages: the SysEx packets are created by the benchmark
+    if (!traffic.has_sysex) {
+        measure("ble-encode", traffic, traffic.messages.size(), traffic.stream.size(), [&]() { encode(false); });
+    }
+    ble_packets.clear();
+    encode(true);
+}
+
+void bleDecode(Traffic &traffic) {
+    MidiBleDecoder ble;
+    ble.begin(&parser);
+    ble.setSysEx(&sysex);
+    uint64_t bytes = 0;
+    for (auto &packet : ble_packets) bytes += packet.size();
+    uint32_t now_us = 0;
+    measure("ble-decode", traffic, traffic.messages.size(), bytes, [&]() {
+        for (auto &packet : ble_packets) {
+            ble.decode(packet.data(), packet.size(), now_us);
+            now_us += 1000;
+        }
+    });
+}
+
+// => output
+
+void writeJson(FILE *out) {
+    fprintf(out, "{\n  \"benchmark\": \"codec\",\n  \"results\": [\n");
+    for (size_t j = 0; j < results.size(); j++) {
+        Result &r = results[j];
+        fprintf(out,
+                "    {\"name\": \"%s\", \"messages\": %llu, \"bytes\": %llu, \"ns_per_message\": %.2f, \"messages_per_s\": %.0f, "
+                "\"bytes_allocated\": %llu}%s\n",
+                r.name.c_str(), (unsigned long long)r.messages, (unsigned long long)r.bytes, r.ns_per_message,
+                1e9 / r.ns_per_message, (unsigned long long)r.bytes_allocated, j + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+/// compares the ns/message with a previous result file: returns the number of paths which are slower than the threshold
+int compare(const char *path, double thresholdPercent) {
+    FILE *in = fopen(path, "r");
+    if (in == nullptr) {
+        fprintf(stderr, "could not open %s\n", path);
+        return 1;
+    }
+    int regressions = 0;
+    char line[512];
+    fprintf(stderr, "%-22s %12s %12s %8s\n", "name", "before ns", "after ns", "change");
+    while (fgets(line, sizeof(line), in)) {
+        char name[64];
+        const char *ns = strstr(line, "\"ns_per_message\": ");
+        if (sscanf(line, " {\"name\": \"%63[^\"]\"", name) != 1 || ns == nullptr) continue;
+        double before = atof(ns + strlen("\"ns_per_message\": "));
+        for (Result &r : results) {
+            if (r.name != name) continue;
+            double change = (r.ns_per_message - before) / before * 100.0;
+            bool is_regression = change > thresholdPercent;
+            regressions += is_regression;
+            fprintf(stderr, "%-22s %12.2f %12.2f %+7.1f%%%s\n", name, before, r.ns_per_message, change,
+                    is_regression ? "  REGRESSION" : "");
+        }
+    }
+    fclose(in);
+    return regressions;
+}
+
+int main(int argc, char **argv) {
+    const char *output = nullptr;
+    const char *baseline = nullptr;
+    double threshold = 10.0;
+    for (int j = 1; j < argc; j++) {
+        if (strcmp(argv[j], "-o") == 0 && j + 1 < argc) {
+            output = argv[++j];
+        } else if (strcmp(argv[j], "-c") == 0 && j + 1 < argc) {
+            baseline = argv[++j];
+        } else if (strcmp(argv[j], "-t") == 0 && j + 1 < argc) {
+            threshold = atof(argv[++j]);
+        } else {
+            fprintf(stderr, "usage: %s [-o result.json] [-c baseline.json] [-t threshold %%]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    MidiLogLevel = MidiError;
+    sysex.begin(&parser);
+    applemidi_init(&encoder, onMessage, onSend, nullptr);
+    applemidi_set_debug_level(&encoder, 0);
+    invite(encoder);
+    applemidi_init(&decoder, onMessage, onSend, nullptr);
+    applemidi_set_debug_level(&decoder, 0);
+    invite(decoder);
+
+    Traffic mixes[] = {denseNotes(), controllerFlood(), sysexDumps(), midiClock()};
+    for (Traffic &traffic : mixes) {
+        parse(traffic);
+        streamIn(traffic);
+        streamOut(traffic);
+        rtpEncode(traffic);
+        rtpDecode(traffic);
+        bleEncode(traffic);
+        bleDecode(traffic);
+    }
+
+    if (output != nullptr) {
+        FILE *out = fopen(output, "w");
+        if (out == nullptr) {
+            fprintf(stderr, "could not write %s\n", output);
+            return 2;
+        }
+        writeJson(out);
+        fclose(out);
+    } else {
+        writeJson(stdout);
+    }
+    return baseline != nullptr && compare(baseline, threshold) > 0 ? 1 : 0;
+}
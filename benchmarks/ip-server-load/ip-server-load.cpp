@@ -0,0 +1,122 @@
+/**
+ * @file ip-server-load.cpp
+ * @author Phil Schatzmann
+ * @brief Load test of the MidiIpServer on a Linux host: 100 loopback clients are
+ * connected. In each round one client sends a note which the server broadcasts to
+ * all clients. We report the latency percentiles from the client to the server
+ * and from the client to all other clients. Compile with -pthread.
+ *
+ * @copyright Copyright (c) 2021
+ */
+#include "Midi.h"
+#include <poll.h>
+#include <time.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+const uint16_t port = 5040;
+const int client_count = 100;
+const int rounds = 1000;
+
+MidiIpServer *p_server = nullptr;
+std::atomic<uint64_t> received_ns(0);
+
+uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/// Sends each received note back to all clients
+class EchoAction : public MidiAction {
+  public:
+    void onNoteOn(uint8_t channel, uint8_t note, uint8_t velocity) {
+        received_ns = nowNs();
+        p_server->noteOn(note, velocity, channel);
+    }
+    void onNoteOff(uint8_t channel, uint8_t note, uint8_t velocity) {}
+    void onControlChange(uint8_t channel, uint8_t controller, uint8_t value) {}
+    void onPitchBend(uint8_t channel, uint8_t value) {}
+};
+
+void report(const char *title, std::vector<uint64_t> &values) {
+    std::sort(values.begin(), values.end());
+    auto pct = [&](double p) { return values[(size_t)(p * (values.size() - 1))] / 1000.0; };
+    printf("%-18s n=%-7zu p50: %7.1f us  p90: %7.1f us  p99: %7.1f us  max: %7.1f us\n", title,
+           values.size(), pct(0.5), pct(0.9), pct(0.99), pct(1.0));
+}
+
+int main() {
+    MidiLogLevel = MidiError;
+    EchoAction action;
+    MidiIpServer server(&action);
+    p_server = &server;
+    if (!server.begin(port)) {
+        return 1;
+    }
+    // event driven: loop() blocks in epoll_wait until there is something to do
+    server.setLoopTimeout(10);
+    std::atomic<bool> running(true);
+    std::thread server_thread([&]() {
+        while (running) server.loop();
+    });
+
+    MidiPosixStream *clients = new MidiPosixStream[client_count];
+    struct pollfd pfds[client_count];
+    for (int j = 0; j < client_count; j++) {
+        if (!clients[j].connect(IPAddress(127, 0, 0, 1), port)) {
+            return 1;
+        }
+        pfds[j] = {clients[j].fd(), POLLIN, 0};
+    }
+    while (server.clientCount() < client_count) {
+        delay(10);
+    }
+    // drop the greeting (reset all controllers) of the server
+    delay(100);
+    uint8_t buffer[512];
+    for (int j = 0; j < client_count; j++) {
+        while (clients[j].read(buffer, sizeof(buffer)) > 0);
+    }
+
+    std::vector<uint64_t> ingress;
+    std::vector<uint64_t> broadcast;
+    for (int r = 0; r < rounds; r++) {
+        uint8_t note_on[3] = {0x90, (uint8_t)(r % 128), 100};
+        uint64_t start = nowNs();
+        clients[r % client_count].write(note_on, sizeof(note_on));
+
+        // wait until all clients have received the echo
+        int pending[client_count];
+        int open = client_count;
+        for (int j = 0; j < client_count; j++) pending[j] = sizeof(note_on);
+        while (open > 0) {
+            if (poll(pfds, client_count, 1000) <= 0) {
+                printf("timeout in round %d\n", r);
+                return 1;
+            }
+            uint64_t now = nowNs();
+            for (int j = 0; j < client_count; j++) {
+                if (pending[j] > 0 && (pfds[j].revents & POLLIN)) {
+                    pending[j] -= clients[j].read(buffer, pending[j]);
+                    if (pending[j] == 0) {
+                        broadcast.push_back(now - start);
+                        open--;
+                    }
+                }
+            }
+        }
+        ingress.push_back(received_ns - start);
+    }
+
+    printf("clients: %d, rounds: %d\n", client_count, rounds);
+    report("client->server", ingress);
+    report("client->clients", broadcast);
+
+    running = false;
+    server_thread.join();
+    delete[] clients;
+    return 0;
+}
@@ -0,0 +1,71 @@
+/**
+ * @file posix-udp.cpp
+ * @author Phil Schatzmann
+ * @brief Loopback benchmark of MidiPosixUDP on a Linux host: we send 3 byte
+ * note messages and compare one datagram per syscall with recvmmsg/sendmmsg
+ * batching.
+ * 
+ * @copyright Copyright (c) 2021
+ */
+#include "Midi.h"
+#include <time.h>
+
+const uint16_t port = 5010;
+const int count = 200000;
+
+uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void run(int batch) {
+    IPAddress localhost(127, 0, 0, 1);
+    MidiPosixUDP receiver;
+    MidiPosixUDP sender;
+    receiver.begin(port);
+    receiver.setReceiveBatch(batch);
+    sender.setSendBatch(batch);
+
+    uint8_t msg[3] = {0x90, 64, 100};
+    uint8_t in[3];
+    int received = 0;
+    uint64_t start = nowNs();
+    for (int sent = 0; sent < count; sent += batch) {
+        for (int j = 0; j < batch; j++) {
+            sender.beginPacket(localhost, port);
+            sender.write(msg, 3);
+            sender.endPacket();
+        }
+        sender.flush();
+        while (receiver.parsePacket() > 0) {
+            receiver.read(in, 3);
+            received++;
+        }
+    }
+    // collect the late datagrams
+    for (int j = 0; j < 100 && received < count; j++) {
+        while (receiver.parsePacket() > 0) {
+            receiver.read(in, 3);
+            received++;
+        }
+    }
+    double sec = (nowNs() - start) / 1e9;
+
+    MidiPosixUdpStatistics &tx = sender.statistics();
+    MidiPosixUdpStatistics &rx = receiver.statistics();
+    printf("batch %2d: %10.0f datagrams/s, %6.2f datagrams/sendmmsg, %6.2f datagrams/recvmmsg, lost: %d\n",
+           batch, received / sec,
+           (double)tx.datagrams_sent / tx.send_calls,
+           (double)rx.datagrams_received / rx.receive_calls,
+           count - received);
+}
+
+int main() {
+    MidiLogLevel = MidiError;
+    // baseline: one datagram per syscall
+    run(1);
+    run(8);
+    run(MIDI_POSIX_UDP_BATCH_MAX);
+    return 0;
+}
@@ -0,0 +1,106 @@
+/**
+ * @file tcp-coalescing.cpp
+ * @author Phil Schatzmann
+ * @brief Measures the per message latency and the TCP data segments per second of the
+ * MidiIpServer output over loopback on a Linux host with Nagle's algorithm, without
+ * it and with different coalescing windows. The server sends a note every 50us.
+ *
+ * @copyright Copyright (c) 2021
+ */
+#include "Midi.h"
+#include <linux/tcp.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+
+const uint16_t port = 5050;
+const int message_count = 10000;
+const uint32_t interval_us = 50;
+
+uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+uint32_t segmentsIn(int fd) {
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    memset(&info, 0, sizeof(info));
+    getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len);
+    return info.tcpi_data_segs_in;
+}
+
+class NoAction : public MidiAction {
+  public:
+    void onNoteOn(uint8_t channel, uint8_t note, uint8_t velocity) {}
+    void onNoteOff(uint8_t channel, uint8_t note, uint8_t velocity) {}
+    void onControlChange(uint8_t channel, uint8_t controller, uint8_t value) {}
+    void onPitchBend(uint8_t channel, uint8_t value) {}
+};
+
+void run(const char *title, bool noDelay, uint16_t size, uint32_t maxDelayUs) {
+    NoAction action;
+    MidiIpServer server(&action);
+    server.begin(port);
+    server.setNoDelay(noDelay);
+    server.setCoalescing(size, maxDelayUs);
+
+    MidiPosixStream client;
+    client.connect(IPAddress(127, 0, 0, 1), port);
+    while (server.clientCount() == 0) server.loop();
+    // drop the greeting
+    uint8_t buffer[1024];
+    delay(50);
+    while (client.read(buffer, sizeof(buffer)) > 0);
+
+    std::vector<uint64_t> sent(message_count);
+    std::vector<uint64_t> latency;
+    latency.reserve(message_count);
+    int received_bytes = 0;
+    uint32_t segments_start = segmentsIn(client.fd());
+    uint64_t start = nowNs();
+    int next = 0;
+    while ((int)latency.size() < message_count) {
+        uint64_t now = nowNs();
+        if (next < message_count && now >= start + (uint64_t)next * interval_us * 1000) {
+            sent[next] = now;
+            server.noteOn(next % 128, 100);
+            next++;
+        }
+        server.loop();
+        int len = client.read(buffer, sizeof(buffer));
+        if (len > 0) {
+            now = nowNs();
+            received_bytes += len;
+            // each note on has 3 bytes
+            while ((int)latency.size() < received_bytes / 3) {
+                latency.push_back(now - sent[latency.size()]);
+            }
+        }
+        if (next == message_count && now - start > 10000000000ull) {
+            printf("%s: timeout\n", title);
+            break;
+        }
+    }
+    double seconds = (nowNs() - start) / 1e9;
+    uint32_t segments = segmentsIn(client.fd()) - segments_start;
+
+    std::sort(latency.begin(), latency.end());
+    auto pct = [&](double p) { return latency[(size_t)(p * (latency.size() - 1))] / 1000.0; };
+    printf("%-16s p50: %7.1f us  p99: %7.1f us  max: %7.1f us  segments/s: %7.0f  writes/msg: %4.2f\n",
+           title, pct(0.5), pct(0.99), pct(1.0), segments / seconds,
+           server.statistics().packetsPerMessage());
+    client.end();
+    server.end();
+}
+
+int main() {
+    MidiLogLevel = MidiError;
+    run("nagle", false, 0, 0);
+    run("nodelay", true, 0, 0);
+    run("coalesce 250us", true, 256, 250);
+    run("coalesce 1ms", true, 256, 1000);
+    run("coalesce 5ms", true, 256, 5000);
+    return 0;
+}
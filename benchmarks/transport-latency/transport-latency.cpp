@@ -0,0 +1,307 @@
+/**
+ * @file transport-latency.cpp
+ * @author Phil Schatzmann
+ * @brief End to end latency of the transports on a Linux host over loopback: serial over a
+ * pseudo terminal (MidiStreamOut -> MidiStreamIn), TCP (MidiStreamOut over a MidiPosixStream
+ * -> MidiIpServer), UDP (MidiUdpServer -> MidiUdpServer, without and with aggregation) and
+ * AppleMIDI (AppleMidiServer -> AppleMidiServer). Each note carries a sequence number in the
+ * note and velocity, so that the receiving MidiAction can calculate the time from the send call
+ * to the dispatch. First the notes are sent one by one and the sender and the receiver are
+ * processed in the same thread until the note arrives: we report the p50, p99, p99.9 and max
+ * latency and a histogram. Then the receiver runs in its own thread and the sender increases
+ * the rate until messages are lost or the rate can not be reached: we report the max rate
+ * which was sustained without loss. Compile with -pthread.
+ *
+ * @copyright Copyright (c) 2021
+ */
+#include "Midi.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+const int latency_count = 5000;
+const uint32_t rate_seconds_ms = 500;
+const uint32_t drain_ms = 200;
+const uint32_t rates[] = {1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000};
+// note (7 bits) and velocity - 1 (0..126) define the sequence number
+const int seq_range = 128 * 127;
+
+uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+uint64_t sent_ns[seq_range];
+std::atomic<uint32_t> received(0);
+std::vector<uint64_t> latencies;
+bool is_recording = false;
+
+/// Calculates the latency from the sequence number in the note
+class LatencyAction : public MidiAction {
+  public:
+    void onNoteOn(uint8_t channel, uint8_t note, uint8_t velocity) {
+        if (is_recording) {
+            int seq = note | ((velocity - 1) << 7);
+            latencies.push_back(nowNs() - __atomic_load_n(&sent_ns[seq], __ATOMIC_RELAXED));
+        }
+        received.fetch_add(1, std::memory_order_relaxed);
+    }
+    void onNoteOff(uint8_t channel, uint8_t note, uint8_t velocity) {}
+    void onControlChange(uint8_t channel, uint8_t controller, uint8_t value) {}
+    void onPitchBend(uint8_t channel, uint8_t value) {}
+};
+
+LatencyAction action;
+LatencyAction ignore;
+
+/// A sender and a receiver which are connected over loopback
+class Transport {
+  public:
+    const char *name;
+    Transport(const char *name) : name(name) {}
+    virtual ~Transport() = default;
+    virtual bool begin() = 0;
+    virtual void send(uint8_t note, uint8_t velocity) = 0;
+    /// e.g. to send the aggregated messages
+    virtual void senderLoop() {}
+    /// processes the received data: with wait it may block for a short time
+    virtual void receiverLoop(bool wait) = 0;
+};
+
+class SerialTransport : public Transport {
+  public:
+    SerialTransport() : Transport("serial (pty)") {}
+    bool begin() override {
+        int fd = posix_openpt(O_RDWR | O_NOCTTY);
+        if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0) return false;
+        master.begin(fd, true);
+        // the slave is the serial port of the receiver: it is switched to raw mode
+        if (!slave.open(ptsname(fd))) return false;
+        in.setup(&slave, new MidiParser(&action), true);
+        return true;
+    }
+    void send(uint8_t note, uint8_t velocity) override { out.noteOn(note, velocity); }
+    void receiverLoop(bool wait) override {
+        if (wait) {
+            struct pollfd pfd = {slave.fd(), POLLIN, 0};
+            poll(&pfd, 1, 1);
+        }
+        while (in.loop());
+    }
+
+  protected:
+    MidiPosixStream master;
+    MidiPosixStream slave;
+    MidiStreamOut out{master};
+    struct Input : public MidiStreamIn {
+        using MidiStreamIn::setup;
+    } in;
+};
+
+class TcpTransport : public Transport {
+  public:
+    TcpTransport() : Transport("tcp") {}
+    bool begin() override {
+        if (!server.begin(5050) || !client.connect(IPAddress(127, 0, 0, 1), 5050)) return false;
+        client.setNoDelay(true);
+        uint64_t timeout = nowNs() + 1000000000ull;
+        while (server.clientCount() == 0 && nowNs() < timeout) server.loop();
+        return server.clientCount() > 0;
+    }
+    void send(uint8_t note, uint8_t velocity) override {
+        out.noteOn(note, velocity);
+        // drop the output of the server (e.g. the greeting)
+        uint8_t buffer[64];
+        while (client.read(buffer, sizeof(buffer)) > 0);
+    }
+    void receiverLoop(bool wait) override {
+        server.setLoopTimeout(wait ? 1 : 0);
+        server.loop();
+    }
+
+  protected:
+    MidiIpServer server{&action};
+    MidiPosixStream client;
+    MidiStreamOut out{client};
+};
+
+class UdpTransport : public Transport {
+  public:
+    UdpTransport(bool aggregation) : Transport(aggregation ? "udp (aggregation)" : "udp"), is_aggregation(aggregation) {}
+    bool begin() override {
+        if (is_aggregation) sender.setAggregation();
+        return receiver.begin(IPAddress(127, 0, 0, 1), 5061) && sender.begin(IPAddress(127, 0, 0, 1), 5061, 5060);
+    }
+    void send(uint8_t note, uint8_t velocity) override { sender.noteOn(note, velocity); }
+    void senderLoop() override { sender.loop(); }
+    void receiverLoop(bool wait) override {
+        receiver.loop();
+        if (wait) sched_yield();
+    }
+
+  protected:
+    bool is_aggregation;
+    MidiUdpServer receiver{&action};
+    MidiUdpServer sender{&ignore};
+};
+
+class AppleMidiTransport : public Transport {
+  public:
+    AppleMidiTransport() : Transport("applemidi") {}
+    bool begin() override {
+        if (!receiver.begin(5070) || !sender.begin(5080) || !sender.connect(IPAddress(127, 0, 0, 1), 5070)) return false;
+        // the session is established when the first note arrives
+        uint64_t timeout = nowNs() + 2000000000ull;
+        uint64_t next = 0;
+        while (received == 0 && nowNs() < timeout) {
+            if (nowNs() > next) {
+                sender.noteOn(0, 1);
+                next = nowNs() + 10000000ull;
+            }
+            senderLoop();
+            receiverLoop(false);
+        }
+        return received > 0;
+    }
+    void send(uint8_t note, uint8_t velocity) override { sender.noteOn(note, velocity); }
+    void senderLoop() override { sender.loop(); }
+    void receiverLoop(bool wait) override {
+        receiver.setLoopTimeout(wait ? 1 : 0);
+        receiver.loop();
+    }
+
+  protected:
+    AppleMidiServer receiver{&action};
+    AppleMidiServer sender{&ignore};
+};
+
+void sendSeq(Transport &transport, int seq) {
+    __atomic_store_n(&sent_ns[seq], nowNs(), __ATOMIC_RELAXED);
+    transport.send(seq & 0x7F, 1 + (seq >> 7));
+}
+
+void measureLatency(Transport &transport) {
+    latencies.clear();
+    received = 0;
+    is_recording = true;
+    int lost = 0;
+    for (int j = 0; j < latency_count; j++) {
+        uint32_t expected = received + 1;
+        sendSeq(transport, j % seq_range);
+        uint64_t timeout = nowNs() + drain_ms * 1000000ull;
+        while (received < expected && nowNs() < timeout) {
+            transport.senderLoop();
+            transport.receiverLoop(false);
+        }
+        if (received < expected) {
+            lost++;
+            received = expected;
+        }
+    }
+    is_recording = false;
+
+    std::sort(latencies.begin(), latencies.end());
+    auto pct = [&](double p) { return latencies.empty() ? 0.0 : latencies[(size_t)(p * (latencies.size() - 1))] / 1000.0; };
+    printf("%-18s latency  n=%-5zu lost=%-3d p50: %8.1f us  p99: %8.1f us  p99.9: %8.1f us  max: %8.1f us\n", transport.name,
+           latencies.size(), lost, pct(0.5), pct(0.99), pct(0.999), pct(1.0));
+
+    // histogram with power of 2 buckets in us
+    int buckets[24] = {0};
+    for (uint64_t ns : latencies) {
+        int b = 0;
+        while (b < 23 && (ns / 1000) >= (1ull << b)) b++;
+        buckets[b]++;
+    }
+    printf("%-18s histogram", "");
+    for (int b = 0; b < 24; b++) {
+        if (buckets[b] > 0) printf("  <%uus: %d", 1u << b, buckets[b]);
+    }
+    printf("\n");
+}
+
+void measureRate(Transport &transport) {
+    std::atomic<bool> running(true);
+    std::thread receiver_thread([&]() {
+        while (running) transport.receiverLoop(true);
+    });
+
+    uint32_t max_rate = 0;
+    for (uint32_t rate : rates) {
+        uint32_t total = (uint64_t)rate * rate_seconds_ms / 1000;
+        received = 0;
+        uint64_t start = nowNs();
+        for (uint32_t j = 0; j < total; j++) {
+            uint64_t due = start + (uint64_t)j * 1000000000ull / rate;
+            while (nowNs() < due) {
+                transport.senderLoop();
+                sched_yield();
+            }
+            sendSeq(transport, j % seq_range);
+        }
+        double achieved = total / ((nowNs() - start) / 1e9);
+        uint64_t timeout = nowNs() + drain_ms * 1000000ull;
+        while (received < total && nowNs() < timeout) {
+            transport.senderLoop();
+            sched_yield();
+        }
+        uint32_t lost = total - received;
+        bool is_sustained = lost == 0 && achieved >= 0.95 * rate;
+        printf("%-18s rate %8u msg/s: sent at %9.0f msg/s, lost %u\n", transport.name, rate, achieved, lost);
+        if (!is_sustained) break;
+        max_rate = rate;
+        // let the receiver catch up
+        delay(50);
+    }
+    running = false;
+    receiver_thread.join();
+    printf("%-18s max sustained rate without loss: %u msg/s\n", transport.name, max_rate);
+}
+
+void run(Transport &transport) {
+    if (!transport.begin()) {
+        printf("%-18s could not be started\n", transport.name);
+        return;
+    }
+    measureLatency(transport);
+    measureRate(transport);
+}
+
+bool isSelected(int argc, char **argv, const char *name) {
+    if (argc < 2) return true;
+    for (int j = 1; j < argc; j++) {
+        if (strncmp(name, argv[j], strlen(argv[j])) == 0) return true;
+    }
+    return false;
+}
+
+/// The transports can be selected with the start of their name: e.g. transport-latency tcp udp
+int main(int argc, char **argv) {
+    MidiLogLevel = MidiError;
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+    // each transport is started and measured in turn: the sockets are released at the end
+    if (isSelected(argc, argv, "serial")) {
+        SerialTransport serial;
+        run(serial);
+    }
+    if (isSelected(argc, argv, "tcp")) {
+        TcpTransport tcp;
+        run(tcp);
+    }
+    if (isSelected(argc, argv, "udp")) {
+        UdpTransport udp(false);
+        run(udp);
+        UdpTransport aggregated(true);
+        run(aggregated);
+    }
+    if (isSelected(argc, argv, "applemidi")) {
+        AppleMidiTransport apple;
+        run(apple);
+    }
+    return 0;
+}
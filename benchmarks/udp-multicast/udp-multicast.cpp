@@ -0,0 +1,144 @@
+/**
+ * @file udp-multicast.cpp
+ * @author Phil Schatzmann
+ * @brief Loopback test of the UDP multicast transport on a Linux host: one sender
+ * distributes aggregated note messages to several MidiUdpMulticastServer receivers
+ * in the same process. The sender drops and duplicates some datagrams on purpose,
+ * so that we can verify the loss accounting of the receivers. Finally one of the
+ * receivers sends to the group: it must not receive its own notes.
+ *
+ * @copyright Copyright (c) 2021
+ */
+#include "Midi.h"
+
+const IPAddress group(239, 0, 0, 58);
+const uint16_t port = 5030;
+const int receiver_count = 8;
+const int message_count = 100000;
+const int burst = 64;       // messages which are sent before the receivers are served
+const int drop_every = 97;  // every nth datagram is not sent
+const int dup_every = 89;   // every nth datagram is sent twice
+
+/// Counts the received notes
+class CountingAction : public MidiAction {
+  public:
+    uint32_t notes = 0;
+    void onNoteOn(uint8_t channel, uint8_t note, uint8_t velocity) { notes++; }
+    void onNoteOff(uint8_t channel, uint8_t note, uint8_t velocity) { notes++; }
+    void onControlChange(uint8_t channel, uint8_t controller, uint8_t value) {}
+    void onPitchBend(uint8_t channel, uint8_t value) {}
+};
+
+/// Multicast sender which simulates lost and duplicated datagrams
+class FaultyMulticast : public MidiUdpMulticast {
+  public:
+    FaultyMulticast() : MidiUdpMulticast(group, port) {}
+    uint32_t datagrams = 0;
+    uint32_t dropped = 0;
+    uint32_t duplicated = 0;
+
+  protected:
+    size_t sendDatagram(const uint8_t *buffer, size_t size) override {
+        datagrams++;
+        if (datagrams % drop_every == 0) {
+            tx_seq++;
+            dropped++;
+            return size;
+        }
+        size_t result = MidiUdpMulticast::sendDatagram(buffer, size);
+        if (datagrams % dup_every == 0) {
+            tx_seq--;
+            MidiUdpMulticast::sendDatagram(buffer, size);
+            duplicated++;
+        }
+        return result;
+    }
+};
+
+int main() {
+    MidiLogLevel = MidiError;
+
+    CountingAction actions[receiver_count];
+    MidiUdpMulticastServer *receivers[receiver_count];
+    for (int j = 0; j < receiver_count; j++) {
+        receivers[j] = new MidiUdpMulticastServer(&actions[j]);
+        if (!receivers[j]->begin(group, port)) {
+            printf("receiver %d could not join the group\n", j);
+            return 1;
+        }
+    }
+
+    // 16 note messages of 3 bytes per datagram
+    FaultyMulticast sender;
+    sender.setAggregation(48, 1000000);
+    uint8_t note_on[3] = {0x90, 64, 100};
+
+    uint32_t start = micros();
+    for (int j = 0; j < message_count; j++) {
+        sender.write(note_on, sizeof(note_on));
+        if (j % burst == burst - 1) {
+            for (int r = 0; r < receiver_count; r++) {
+                receivers[r]->loop();
+            }
+        }
+    }
+    sender.flushPacket();
+    for (int loops = 0; loops < 100; loops++) {
+        for (int r = 0; r < receiver_count; r++) {
+            receivers[r]->loop();
+        }
+    }
+    uint32_t elapsed = micros() - start;
+
+    uint32_t expected_notes = message_count - sender.dropped * 16;
+    printf("sent: %d messages in %u datagrams (%u dropped, %u duplicated) in %u us\n",
+           message_count, sender.datagrams, sender.dropped, sender.duplicated, elapsed);
+    printf("receiver  notes    received lost  dup  reordered  loss    msg/s\n");
+    bool ok = true;
+    for (int r = 0; r < receiver_count; r++) {
+        MidiMulticastStatistics *stats = receivers[r]->receiveStatistics();
+        printf("%8d  %7u  %8u %4u  %4u %9u  %5.2f%%  %.0f\n", r, actions[r].notes,
+               stats->datagrams_received, stats->datagrams_lost, stats->datagrams_duplicated,
+               stats->datagrams_reordered, stats->lossRate() * 100.0,
+               actions[r].notes * 1000000.0 / elapsed);
+        ok = ok && actions[r].notes == expected_notes
+                && stats->datagrams_lost == sender.dropped
+                && stats->datagrams_duplicated == sender.duplicated;
+    }
+    printf("loss accounting: %s\n", ok ? "ok" : "MISMATCH");
+
+    // a member of the group sends: the group delivers the datagrams also back to it
+    const int member_notes = 1000;
+    uint32_t before[receiver_count];
+    for (int r = 0; r < receiver_count; r++) {
+        before[r] = actions[r].notes;
+    }
+    receivers[0]->setAggregation(48, 1000000);
+    for (int j = 0; j < member_notes; j++) {
+        receivers[0]->noteOn(64, 100);
+        if (j % burst == burst - 1) {
+            for (int r = 0; r < receiver_count; r++) {
+                receivers[r]->loop();
+            }
+        }
+    }
+    receivers[0]->flush();
+    for (int loops = 0; loops < 100; loops++) {
+        for (int r = 0; r < receiver_count; r++) {
+            receivers[r]->loop();
+        }
+    }
+    uint32_t own = actions[0].notes - before[0];
+    bool member_ok = own == 0 && receivers[0]->receiveStatistics()->datagrams_lost == sender.dropped;
+    for (int r = 1; r < receiver_count; r++) {
+        member_ok = member_ok && actions[r].notes - before[r] == member_notes;
+    }
+    printf("sending member: own notes received back: %u, others received: %u of %d: %s\n", own,
+           actions[1].notes - before[1], member_notes, member_ok ? "ok" : "MISMATCH");
+    ok = ok && member_ok;
+
+    for (int j = 0; j < receiver_count; j++) {
+        delete receivers[j];
+    }
+    return ok ? 0 : 1;
+}
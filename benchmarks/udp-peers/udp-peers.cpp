@@ -0,0 +1,69 @@
+/**
+ * @file udp-peers.cpp
+ * @author Phil Schatzmann
+ * @brief Loopback benchmark of a MidiUdpServer with multiple peers on a Linux host: 
+ * we measure the CPU time which is needed to send a message to all peers.
+ * To test with more then 32 peers compile with -DMIDI_UDP_MAX_PEERS=64 -DMIDI_UDP_PEER_HASH_SIZE=128
+ * 
+ * @copyright Copyright (c) 2021
+ */
+#include "Midi.h"
+#include <time.h>
+
+const uint16_t server_port = 5020;
+const uint16_t client_port = 6000;
+const int count = 2000;
+
+uint64_t cpuNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void run(int peerCount) {
+    IPAddress localhost(127, 0, 0, 1);
+    MidiCallbackAction action;
+    MidiUdpServer server(&action);
+    server.begin(localhost, server_port);
+
+    // register the peers by sending some data to the server
+    MidiPosixUDP *clients = new MidiPosixUDP[peerCount];
+    uint8_t sensing = 0xFE;
+    for (int j = 0; j < peerCount; j++) {
+        clients[j].begin(client_port + j);
+        clients[j].beginPacket(localhost, server_port);
+        clients[j].write(&sensing, 1);
+        clients[j].endPacket();
+    }
+    for (int j = 0; j < 100 && server.getPeers().size() < peerCount; j++) {
+        server.loop();
+        delay(1);
+    }
+
+    uint64_t cpu = 0;
+    int received = 0;
+    uint8_t buffer[16];
+    for (int j = 0; j < count; j++) {
+        uint64_t start = cpuNs();
+        server.noteOn(64, 100);
+        cpu += cpuNs() - start;
+        for (int c = 0; c < peerCount; c++) {
+            while (clients[c].parsePacket() > 0) {
+                clients[c].read(buffer, sizeof(buffer));
+                received++;
+            }
+        }
+    }
+    printf("peers %3d: %8.0f ns/message, %6.0f ns/message/peer, received: %d of %d\n",
+           server.getPeers().size(), (double)cpu / count,
+           (double)cpu / count / peerCount, received, count * peerCount);
+    delete[] clients;
+}
+
+int main() {
+    MidiLogLevel = MidiError;
+    run(1);
+    run(8);
+    run(MIDI_UDP_MAX_PEERS);
+    return 0;
+}
@@ -31,4 +31,6 @@ void setup() {
 }
 
 void loop() {
+  // the received messages are processed here
+  ble.loop();
 }
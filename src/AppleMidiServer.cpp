@@ -1,21 +1,25 @@
 #include "AppleMidiServer.h"
 #if TCP_ACTIVE
+#if MIDI_HOST_ACTIVE
+#include <poll.h>
+#endif
 
 namespace midi {
 
-AppleMidiServer *SelfAppleMidi = nullptr;
-
 /// Starts the listening 
 bool AppleMidiServer ::  begin(int control_port){
     MIDI_LOGI( __PRETTY_FUNCTION__);
+#if !MIDI_HOST_ACTIVE
     if (WiFi.status() != WL_CONNECTED){
         MIDI_LOGE("WIFI is not connected");
         return false;
     }
+#endif
+    applemidi_init(&engine, applemidi_callback_midi_message_received, applemidi_if_send_udp_datagram, this);
+    sysex_assembler.begin(&apple_event_handler);
     setupLogger();
     setupMDns(control_port);
     MIDI_LOGI("MIDI using port: %d", control_port);
-    applemidi_init((apple_midi_cb_t) applemidi_callback_midi_message_received, (apple_midi_cb_t) applemidi_if_send_udp_datagram);
 
     // setup udp
     udpControl.begin(control_port);  // control port
@@ -27,20 +31,33 @@ bool AppleMidiServer ::  begin(int control_port){
 /// Starts a session with the indicated address
 bool AppleMidiServer :: begin(IPAddress adress, int control_port, int data_port_opt){
     MIDI_LOGI( __PRETTY_FUNCTION__);
+#if !MIDI_HOST_ACTIVE
     if (WiFi.status() != WL_CONNECTED){
         MIDI_LOGE("WIFI is not connected");
         return false;
     }
+#endif
+    applemidi_init(&engine, applemidi_callback_midi_message_received, applemidi_if_send_udp_datagram, this);
+    sysex_assembler.begin(&apple_event_handler);
     setupLogger();
     setupMDns(control_port);
-    applemidi_init((apple_midi_cb_t) applemidi_callback_midi_message_received, (apple_midi_cb_t) applemidi_if_send_udp_datagram);
     int data_port = data_port_opt > 0 ? data_port_opt : control_port+1;
     MIDI_LOGI("MIDI using address: %s port: %d",toStr(adress), control_port);
     // listen for udp on port
     udpControl.begin(control_port);
     udpData.begin(data_port);
-    int status = applemidi_start_session(data_port, (uint8_t*) &adress, control_port);
+    return connect(adress, control_port);
+}
 
+/// Starts a session with the indicated address from the already listening server
+bool AppleMidiServer :: connect(IPAddress adress, int control_port){
+    int32_t applemidi_port = applemidi_search_free_port(&engine);
+    if (applemidi_port<1){
+        MIDI_LOGE("No free session for %s", toStr(adress));
+        return false;
+    }
+    uint8_t ip_addr[16] = {adress[0], adress[1], adress[2], adress[3]};
+    int status = applemidi_start_session(&engine, applemidi_port, ip_addr, control_port);
     return status>=0;
 }
 
@@ -53,6 +70,8 @@ const char* AppleMidiServer :: toStr(IPAddress &adress){
 
 void AppleMidiServer :: end(){
     MIDI_LOGI( __PRETTY_FUNCTION__);
+    jitter_buffer.flush();
+    sysex_assembler.clear();
     udpControl.stop();
     udpData.stop();
 }
@@ -61,35 +80,68 @@ void AppleMidiServer :: end(){
 bool AppleMidiServer ::  tick(uint32_t timestamp){
     bool active = false;
 
-    // process control port
-    int packetSize = udpControl.parsePacket();
-    remote_port = udpControl.remotePort();
-    if (packetSize>0){
-        // We got some control data
-        IPAddress remote_address = udpControl.remoteIP();
-        int len = udpControl.read(rx_buffer, MIDI_BUFFER_SIZE);
-        MIDI_LOGD("control: %d -> %d ",remote_port, len);
-        applemidi_parse_udp_datagram((uint8_t*)&remote_address, remote_port, rx_buffer, len, false);
+#if MIDI_HOST_ACTIVE
+    // sleep until a datagram arrives or the engine has something to do
+    if (loop_timeout_ms>0){
+        struct pollfd fds[2] = {{udpControl.fd(), POLLIN, 0}, {udpData.fd(), POLLIN, 0}};
+        int timeout = next_deadline_ms < (uint32_t)loop_timeout_ms ? next_deadline_ms : loop_timeout_ms;
+        poll(fds, 2, timeout);
+    }
+#endif
+
+    // process all received datagrams
+    while (receive(udpControl, false)){
         active = true;
-    } 
-
-    // process data port
-    packetSize = udpData.parsePacket();
-    if (packetSize>0){
-        int remote_port = udpData.remotePort();
-        IPAddress remote_address = udpData.remoteIP();
-        int len = udpData.read(rx_buffer, MIDI_BUFFER_SIZE);
-        MIDI_LOGD("data: %d -> %d",remote_port, len);
-        applemidi_parse_udp_datagram((uint8_t*) &remote_address, remote_port, rx_buffer, len, true);
+    }
+    while (receive(udpData, true)){
         active = true;
     }
+
+    // flush the output, synchronize and close the timed out sessions
+    next_deadline_ms = applemidi_tick(&engine);
+
+    // play the buffered events which are due
+    if (is_jitter_buffer){
+        uint32_t now_us = applemidi_get_timestamp() * 100;
+        if (jitter_buffer.play(now_us)>0){
+            active = true;
+        }
+        uint32_t due_ms = jitter_buffer.nextDueUs(now_us);
+        if (due_ms != 0xFFFFFFFF){
+            due_ms = (due_ms + 999) / 1000;
+            if (due_ms < next_deadline_ms){
+                next_deadline_ms = due_ms;
+            }
+        }
+    }
     return active;
 }
 
+/// process a received datagram
+bool AppleMidiServer :: receive(MidiUdpBase &udp, bool isDataPort){
+    if (udp.parsePacket()<=0){
+        return false;
+    }
+    int port = udp.remotePort();
+    IPAddress remote_address = udp.remoteIP();
+    uint8_t ip_addr[16] = {remote_address[0], remote_address[1], remote_address[2], remote_address[3]};
+    int len = udp.read(rx_buffer, MIDI_BUFFER_SIZE);
+    MIDI_LOGD("%s: %d -> %d", isDataPort ? "data" : "control", port, len);
+    applemidi_parse_udp_datagram(&engine, ip_addr, port, rx_buffer, len, isDataPort);
+    return true;
+}
+
 /// MidiCommon implementation
 void AppleMidiServer ::  writeData(MidiMessage *msg, int len){
     MIDI_LOGI( __PRETTY_FUNCTION__);
-    applemidi_send_message(remote_port, (uint8_t*) msg, len*sizeof(MidiMessage));
+    // the RTP MIDI command is the status followed by the len data bytes (without the BLE timestamp)
+    if (applemidi_send_message_all(&engine, &(msg->status), len+1)<=0){
+        return;
+    }
+    // the buffered message needs to be sent at the latest after the flush time
+    if (next_deadline_ms > APPLEMIDI_OUTBUFFER_FLUSH_MS){
+        next_deadline_ms = APPLEMIDI_OUTBUFFER_FLUSH_MS;
+    }
 }
 
 /// Setup MDNS apple-midi service
@@ -109,36 +161,59 @@ void AppleMidiServer :: setupMDns(int port) {
 void AppleMidiServer :: setupLogger() {
     switch(MidiLogLevel){
         case MidiInfo:
-            applemidi_set_debug_level(2);
+            applemidi_set_debug_level(&engine, 2);
             break;
         case MidiDebug:
-            applemidi_set_debug_level(3);
+            applemidi_set_debug_level(&engine, 3);
             break;
         case MidiWarning:
-            applemidi_set_debug_level(1);
+            applemidi_set_debug_level(&engine, 1);
             break;
         case MidiError:
-            applemidi_set_debug_level(1);
+            applemidi_set_debug_level(&engine, 1);
             break;
     }
 }
 
 /// Callback method to parse midi message
-void AppleMidiServer :: applemidi_callback_midi_message_received(uint8_t port, uint32_t timestamp, uint8_t midi_status, uint8_t *remaining_message, size_t len, size_t continued_sysex_pos) {
-    MIDI_LOGI("applemidi_callback_midi_message_received: port=%d", port);
-    // the parser expects a midi message with the status and the parameters
-    uint8_t message[len+1];
-    message[0]=midi_status;
-    memmove(message+1,remaining_message, len);
-    SelfAppleMidi->apple_event_handler.parse(message, len+1);
+void AppleMidiServer :: applemidi_callback_midi_message_received(void *user_data, uint8_t port, uint32_t timestamp, uint8_t midi_status, uint8_t *remaining_message, size_t len, size_t continued_sysex_pos) {
+    AppleMidiServer *self = (AppleMidiServer*) user_data;
+    MIDI_LOGD("applemidi_callback_midi_message_received: port=%d", port);
+    // SysEx parts are reassembled per session: the F7 (without data) completes the message
+    if (midi_status==0xF0){
+        self->sysex_assembler.write(port, remaining_message, len, continued_sysex_pos, millis());
+        return;
+    }
+    if (midi_status==0xF7){
+        self->sysex_assembler.end(port);
+        return;
+    }
+    if (len>2){
+        return;
+    }
+    // the decoder already provides the status and the length: so we dispatch the message directly without copy and parsing
+    uint8_t p1 = len>0 ? remaining_message[0] : 0;
+    uint8_t p2 = len>1 ? remaining_message[1] : 0;
+    // short messages are played with the timing of the sender: the timestamps are in 100us units
+    if (self->is_jitter_buffer){
+        uint8_t message[3] = {midi_status, p1, p2};
+        uint32_t remote_us = applemidi_peer_local_timestamp(&self->engine, port, timestamp) * 100;
+        uint32_t now_us = applemidi_get_timestamp() * 100;
+        self->jitter_buffer.write(remote_us, now_us, message, len+1);
+        return;
+    }
+    self->apple_event_handler.dispatch(midi_status, p1, p2);
 }
 
 /// Callback method to send UDP message with the help of the Arduino API
-int32_t AppleMidiServer :: applemidi_if_send_udp_datagram(uint8_t *ip_addr, uint16_t port, uint8_t *tx_data, size_t tx_len){
-    MIDI_LOGD( "applemidi_if_send_udp_datagram: port=%d", port);
-    IPAddress *p_adr = (IPAddress *) ip_addr;
-    WiFiUDP *p_udp = port == SelfAppleMidi->remote_port ? &(SelfAppleMidi->udpControl) :  &(SelfAppleMidi->udpData);
-    p_udp->beginPacket(*p_adr, port);
+int32_t AppleMidiServer :: applemidi_if_send_udp_datagram(void *user_data, uint8_t *ip_addr, uint16_t port, uint8_t *tx_data, size_t tx_len, uint8_t is_dataport){
+    AppleMidiServer *self = (AppleMidiServer*) user_data;
+    MIDI_LOGD( "applemidi_if_send_udp_datagram: port=%d, %s", port, is_dataport ? "data" : "control");
+    // the engine provides the 4 bytes of the IPv4 address
+    IPAddress adr(ip_addr[0], ip_addr[1], ip_addr[2], ip_addr[3]);
+    // the engine knows if the datagram belongs to the control or the data session of the peer
+    MidiUdpBase *p_udp = is_dataport ? &(self->udpData) : &(self->udpControl);
+    p_udp->beginPacket(adr, port);
     int32_t result = p_udp->write(tx_data, tx_len);
     p_udp->endPacket();
     return result;
@@ -1,30 +1,31 @@
 #pragma once
 #include "ConfigMidi.h"
 #if TCP_ACTIVE
-#include <WiFi.h>
 #include "MidiAction.h"
 #include "MidiCommon.h"
 #include "MidiLogger.h"
+#include "MidiUdp.h"
+#include "MidiJitterBuffer.h"
+#include "MidiSysExAssembler.h"
 #include "apple-midi/applemidi.h"
-#include <WiFiUdp.h>
 #if MDNS_ACTIVE
 #include <ESPmDNS.h>
 #endif
 
-#define MIDI_BUFFER_SIZE 80
+#ifndef MIDI_BUFFER_SIZE
+#define MIDI_BUFFER_SIZE 512
+#endif
 
 namespace midi {
 
-class AppleMidiServer;
-extern AppleMidiServer *SelfAppleMidi;
-typedef void* apple_midi_cb_t;
-
 /***************************************************/
 /*! \class AppleMidiServer 
 
     \brief A Sender and Receiver which supports
     Apple Midi using the implementation from midibox.
     Apple midi uses UDP on a control and a data port.
+    Each server has its own engine instance: so multiple
+    servers on different ports can run in parallel threads.
     https://github.com/midibox/esp32-idf-applemidi
     
     by Phil Schatzmann
@@ -33,15 +34,16 @@ typedef void* apple_midi_cb_t;
 
 class AppleMidiServer : public MidiCommon  {
     public:
-        AppleMidiServer() {
-            SelfAppleMidi = this;
-        };
+        AppleMidiServer() = default;
 
         AppleMidiServer(MidiAction *action, int midiPort=-1){
-            SelfAppleMidi = this;
             apple_event_handler.begin(action, midiPort);
         }
 
+        ~AppleMidiServer() {
+            applemidi_deinit(&engine);
+        }
+
         /// Defines the dns name
         void setName(const char* name){
             dns_name = name;
@@ -51,24 +53,66 @@ class AppleMidiServer : public MidiCommon  {
         bool begin(int control_port=APPLEMIDI_DEFAULT_PORT);
         /// Starts a session with the indicated address
         bool begin(IPAddress adress, int control_port=APPLEMIDI_DEFAULT_PORT, int data_port_opt=-1);
+        /// Starts a session with the indicated address from a server which is already listening (e.g. on a different local port)
+        bool connect(IPAddress adress, int control_port=APPLEMIDI_DEFAULT_PORT);
         /// Closes the connections
         void end();
         /// Processing logic to be executed in loop
         bool loop() {
             return tick(millis());
         }
+        /// Time in ms until loop() needs to be called again at the latest (e.g. to sleep in between)
+        uint32_t nextDeadlineMs() {
+            return next_deadline_ms;
+        }
+        /// Activates the adaptive jitter buffer: the received events are played with the timing of the sender
+        void setJitterBuffer(bool active, uint32_t minLatencyUs=2000, uint32_t maxLatencyUs=50000) {
+            jitter_buffer.flush();
+            jitter_buffer.begin(&apple_event_handler);
+            jitter_buffer.setLatency(minLatencyUs, maxLatencyUs);
+            is_jitter_buffer = active;
+        }
+        /// Provides the late and dropped events and the current latency of the jitter buffer
+        MidiJitterStatistics &jitterStatistics() {
+            return jitter_buffer.statistics();
+        }
+        /// SysEx messages are reassembled up to maxSize bytes (default) or passed on in parts with streaming
+        void setSysEx(bool streaming, int maxSize=MIDI_SYSEX_BUFFER_SIZE) {
+            sysex_assembler.setStreaming(streaming, maxSize);
+        }
+        /// Provides the aborted and oversize SysEx messages
+        MidiSysExStatistics &sysExStatistics() {
+            return sysex_assembler.statistics();
+        }
+        /// Provides the RTP statistics (loss, reordering, duplicates, jitter) of a session: can be called from any thread
+        bool rtpStatistics(uint8_t applemidiPort, applemidi_rtp_stats_t &stats) {
+            return applemidi_peer_get_rtp_stats(&engine, applemidiPort, &stats) >= 0;
+        }
+#if MIDI_HOST_ACTIVE
+        /// Max time in ms which loop() waits for a datagram or the next deadline (only on a Linux host): 0 returns immediatly
+        void setLoopTimeout(int timeoutMs){
+            loop_timeout_ms = timeoutMs;
+        }
+#endif
 
     protected:
+        applemidi_t engine = {};
         MidiParser apple_event_handler;
-        WiFiUDP udpControl;
-        WiFiUDP udpData;
+        MidiJitterBuffer jitter_buffer;
+        bool is_jitter_buffer = false;
+        MidiSysExAssembler sysex_assembler;
+        MidiUdpBase udpControl;
+        MidiUdpBase udpData;
         uint8_t rx_buffer[MIDI_BUFFER_SIZE];
-        int remote_port;
+        uint32_t next_deadline_ms = 0;
+        int loop_timeout_ms = 0;
         bool is_setup = false;
         const char* dns_name = "AppleMidi";
         
         /// process input from the control and the data port
         virtual bool tick(uint32_t timestamp);
+        /// process a received datagram: returns false if there is none
+        bool receive(MidiUdpBase &udp, bool isDataPort);
         /// MidiCommon implementation
         virtual void writeData(MidiMessage *msg, int len);
         /// Setup MDNS apple-midi service
@@ -78,9 +122,9 @@ class AppleMidiServer : public MidiCommon  {
         /// Activate apple midi debug messages
         void setupLogger();
         /// Callback method to parse midi message
-        static void applemidi_callback_midi_message_received(uint8_t port, uint32_t timestamp, uint8_t midi_status, uint8_t *remaining_message, size_t len, size_t continued_sysex_pos);
+        static void applemidi_callback_midi_message_received(void *user_data, uint8_t port, uint32_t timestamp, uint8_t midi_status, uint8_t *remaining_message, size_t len, size_t continued_sysex_pos);
         /// Callback method to send UDP message with the help of the Arduino API
-        static int32_t applemidi_if_send_udp_datagram(uint8_t *ip_addr, uint16_t port, uint8_t *tx_data, size_t tx_len);
+        static int32_t applemidi_if_send_udp_datagram(void *user_data, uint8_t *ip_addr, uint16_t port, uint8_t *tx_data, size_t tx_len, uint8_t is_dataport);
 
 
 };
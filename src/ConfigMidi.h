@@ -26,6 +26,14 @@
 #  define MDNS_ACTIVE false
 #  define UDP_ACTIVE false
 #  define TCP_ACTIVE false
+#elif defined(__linux__)
+// host build (e.g. Linux bridge): network access via POSIX sockets
+#  define MIDI_HOST_ACTIVE true
+#  define APPLE_MIDI_ACTIVE true
+#  define MIDI_BLE_ACTIVE false
+#  define MDNS_ACTIVE false
+#  define UDP_ACTIVE true
+#  define TCP_ACTIVE true
 #elif defined(ARDUINO)
 #  define APPLE_MIDI_ACTIVE true
 #  define MIDI_BLE_ACTIVE false
@@ -40,3 +48,6 @@
 #  define TCP_ACTIVE false
 #endif
 
+#ifndef MIDI_HOST_ACTIVE
+#  define MIDI_HOST_ACTIVE false
+#endif
@@ -1,8 +1,14 @@
 #pragma once
 #include "MidiCommon.h"
 #include "MidiParser.h"
+#include "MidiJitterBuffer.h"
+#include "MidiSysExAssembler.h"
+#include "MidiBleCodec.h"
+#include "MidiPacketQueue.h"
+#include "MidiBleRoutes.h"
 #include "MidiStreamIn.h"
 #include "MidiStreamOut.h"
+#include "MidiMemoryStream.h"
 #include "MidiCallbackAction.h"
 
 #include "MidiBleClient.h"		
@@ -13,6 +19,12 @@
 #endif
 #if UDP_ACTIVE
 #include "MidiUdpServer.h"
+#include "MidiUdpMulticastServer.h"
+#endif
+#if MIDI_HOST_ACTIVE
+#include "MidiPosixStream.h"
+#include "MidiPosixUdp.h"
+#include "MidiPosixTcpServer.h"
 #endif
 #if APPLE_MIDI_ACTIVE
 #include "AppleMidiServer.h"
@@ -22,6 +22,9 @@ class MidiAction  {
         virtual void onControlChange(uint8_t channel, uint8_t controller, uint8_t value) = 0;
 
         virtual void onPitchBend(uint8_t channel, uint8_t value) = 0;
+
+        /// SysEx data bytes (without F0 and F7) which start at pos in the message: complete is true for the last part
+        virtual void onSysEx(const uint8_t *data, int len, int pos, bool complete) {}
 };
 
 } // namespace
@@ -0,0 +1,91 @@
+#include "MidiAggregator.h"
+#if MIDI_ACTIVE
+
+#include <string.h>
+
+namespace midi {
+
+MidiAggregator :: ~MidiAggregator() {
+    if (buffer!=nullptr){
+        delete[] buffer;
+    }
+}
+
+void MidiAggregator :: setSize(uint16_t size, uint32_t maxDelayUs) {
+    flush();
+    if (buffer!=nullptr){
+        delete[] buffer;
+        buffer = nullptr;
+    }
+    capacity = size;
+    max_delay_us = maxDelayUs;
+    if (size>0){
+        buffer = new uint8_t[size];
+    }
+}
+
+size_t MidiAggregator :: write(const uint8_t *data, size_t size) {
+    stats.messages++;
+    if (buffer==nullptr){
+        return p_writer->writePacket(data, size);
+    }
+    // make room for the new message
+    if (len + size > capacity){
+        flush();
+    }
+    if (size > capacity){
+        return p_writer->writePacket(data, size);
+    }
+
+    uint32_t now = micros();
+    if (pending==0){
+        first_pending_us = now;
+    }
+    memcpy(buffer+len, data, size);
+    len += size;
+    pending++;
+    // the sum of the arrival offsets to the first message gives the total latency with one
+    // multiplication at the flush: the differences are correct also when micros() wraps around
+    pending_offset_us_sum += now - first_pending_us;
+
+    if (now - first_pending_us >= max_delay_us){
+        flush();
+    }
+    return size;
+}
+
+bool MidiAggregator :: flush() {
+    if (len==0){
+        return true;
+    }
+    uint32_t now = micros();
+    uint32_t latency = now - first_pending_us;
+    if (latency > stats.max_latency_us){
+        stats.max_latency_us = latency;
+    }
+    stats.total_latency_us += (uint64_t)latency * pending - pending_offset_us_sum;
+
+    size_t result = p_writer->writePacket(buffer, len);
+    len = 0;
+    pending = 0;
+    pending_offset_us_sum = 0;
+    return result>0;
+}
+
+void MidiAggregator :: loop() {
+    if (len>0 && micros() - first_pending_us >= max_delay_us){
+        flush();
+    }
+}
+
+int32_t MidiAggregator :: remainingUs() {
+    if (len==0){
+        return -1;
+    }
+    uint32_t waiting = micros() - first_pending_us;
+    return waiting >= max_delay_us ? 0 : max_delay_us - waiting;
+}
+
+}
+
+#endif
@@ -0,0 +1,99 @@
+#pragma once
+#include "ConfigMidi.h"
+
+#if MIDI_ACTIVE
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace midi {
+
+/**
+ * @brief Statistics of an output which collects the messages into packets: how many
+ * packets (datagrams or writes) were needed for how many messages and how long the
+ * messages were held back by the aggregation.
+ */
+struct MidiAggregationStatistics {
+    uint32_t messages = 0;
+    uint32_t packets = 0;
+    uint32_t max_latency_us = 0;
+    uint64_t total_latency_us = 0;
+
+    /// 1.0 without aggregation, smaller values mean less packets
+    float packetsPerMessage() {
+        return messages == 0 ? 0.0f : (float) packets / messages;
+    }
+
+    /// Average time in us a message was waiting in the aggregation buffer
+    float averageLatencyUs() {
+        return messages == 0 ? 0.0f : (float) total_latency_us / messages;
+    }
+};
+
+/**
+ * @brief Destination of the packets of a MidiAggregator (e.g. a datagram or a write to the clients)
+ */
+class MidiPacketWriter {
+    public:
+        virtual ~MidiPacketWriter() = default;
+        virtual size_t writePacket(const uint8_t *data, size_t len) = 0;
+};
+
+/***************************************************/
+/*! \class MidiAggregator
+    \brief Collects the encoded messages into one
+    packet which is passed to the MidiPacketWriter
+    when the size is reached, when the oldest message
+    has been waiting for the max delay or when flush()
+    is called. In this case you need to call loop()
+    regularly.
+
+    Without a size each message is written as
+    separate packet. The statistics record how long
+    the messages were held back.
+
+    by Phil Schatzmann
+*/
+/***************************************************/
+
+class MidiAggregator {
+    public:
+        MidiAggregator() = default;
+        ~MidiAggregator();
+
+        /// Defines the destination of the packets
+        void begin(MidiPacketWriter *writer) { p_writer = writer; }
+
+        /// Collects the messages up to size bytes or for max maxDelayUs microseconds: size=0 deactivates it
+        void setSize(uint16_t size, uint32_t maxDelayUs);
+
+        /// Adds the message to the packet: messages which do not fit at all are written unchanged
+        size_t write(const uint8_t *data, size_t size);
+
+        /// Writes the collected messages: returns false if this has failed
+        bool flush();
+
+        /// Writes the collected messages if the max delay has passed
+        void loop();
+
+        /// Time in us until the collected messages need to be written: -1 if there are none
+        int32_t remainingUs();
+
+        /// Provides the packets per message and latency statistics
+        MidiAggregationStatistics &statistics() { return stats; }
+
+    protected:
+        MidiPacketWriter *p_writer = nullptr;
+        MidiAggregationStatistics stats;
+        uint8_t *buffer = nullptr;
+        uint16_t capacity = 0;
+        uint16_t len = 0;
+        uint32_t max_delay_us = 0;
+        uint32_t pending = 0;
+        uint32_t first_pending_us = 0;
+        uint64_t pending_offset_us_sum = 0;
+};
+
+}
+
+#endif
@@ -5,16 +5,29 @@
 namespace midi {
 
 const char* APP_CLIENT = "MidiBleClient";
-MidiBleParser *pEventHandler;
+MidiBleRoutes MidiBleClient::routes;
 
 
 MidiBleClient :: MidiBleClient(const char* name, MidiBleParser* pEventHandler) {
     this->name = name;
+    this->pEventHandler = pEventHandler;
     this->connectionStatus = Unconnected;
 }
 
+MidiBleClient :: ~MidiBleClient() {
+    routes.remove(pRemoteCharacteristic);
+    if (is_own_parser){
+        delete pEventHandler;
+    }
+}
+
 void MidiBleClient :: begin(MidiAction &MidiAction) {
     this->pMidiAction = &MidiAction;
+    if (pEventHandler == nullptr){
+        MIDI_LOGD( "Creating new MidiBleParser for MidiAction");
+        pEventHandler = new MidiBleParser(pMidiAction, this->receivingChannel);
+        is_own_parser = true;
+    }
     BLEScan* pBLEScan = BLEDevice::getScan();
     pBLEScan->setAdvertisedDeviceCallbacks(new MidiBleClientAdvertisedDeviceCallbacks(this));
     pBLEScan->setInterval(1349);
@@ -24,15 +37,19 @@ void MidiBleClient :: begin(MidiAction &MidiAction) {
 }
 
 
-void characteristic_notify_callback(BLERemoteCharacteristic* pBLERemoteCharacteristic, uint8_t* pData, size_t length, bool isNotify){
-    if (pEventHandler)
-        pEventHandler->parse(pData,length);
+void MidiBleClient :: notifyCallback(BLERemoteCharacteristic* pCharacteristic, uint8_t* pData, size_t length, bool isNotify){
+    if (!routes.route(pCharacteristic, pData, length)){
+        MIDI_LOGD( "No client for the notification");
+    }
 }
 
 
 void MidiBleClient :: begin(BLEAdvertisedDevice *pDevice) {
     this->pDevice = pDevice;
-    BLEClient*  pClient  = BLEDevice::createClient();
+    // a reconnect provides a new characteristic
+    routes.remove(pRemoteCharacteristic);
+    pRemoteCharacteristic = nullptr;
+    pClient  = BLEDevice::createClient();
     pClient->setClientCallbacks(new MidiBleClientCallback(&connectionStatus));
     //pClient->connect(name);  // if you pass BLEAdvertisedDevice instead of address, it will be recognized type of peer device address (public or private)
     pClient->connect(pDevice);  
@@ -64,33 +81,43 @@ void MidiBleClient :: begin(BLEAdvertisedDevice *pDevice) {
         MIDI_LOGE( "The characteristic value was: %s",value.c_str());
     }
 
-    pRemoteCharacteristic->registerForNotify(characteristic_notify_callback, true);
+    if (pEventHandler != nullptr && !routes.add(pRemoteCharacteristic, pEventHandler)){
+        MIDI_LOGE( "Too many clients: the max is %d", MIDI_BLE_MAX_ROUTES);
+    }
+    pRemoteCharacteristic->registerForNotify(notifyCallback, true);
 
 }
 
 void MidiBleClient :: writeData(MidiMessage *pMsg, int len) {
     if (pRemoteCharacteristic!=nullptr){
-        updateTimestamp(&outMessage);
-        uint8_t* cp = (uint8_t*)&outMessage;
-        //int messageLen = sizeof(MidiMessage);
-        switch (len) {
-            case 1: {
-                pRemoteCharacteristic->writeValue(cp,len-1, false);
-                break;
-            }
-            case 2: {
-                pRemoteCharacteristic->writeValue(cp,len, false);
-                break;
-            }
-        }
+        send(pMsg, len);
     }
 }
 
+bool MidiBleClient :: loop() {
+    return pEventHandler!=nullptr && pEventHandler->loop();
+}
+
+void MidiBleClient :: sendPacket(uint8_t *data, int len) {
+    pRemoteCharacteristic->writeValue(data, len, false);
+}
+
+int MidiBleClient :: mtu() {
+    return pClient!=nullptr ? pClient->getMTU() : 0;
+}
+
 
 BLEAdvertisedDevice * MidiBleClient :: getBLEAdvertisedDevice() {
     return this->pDevice;
 }
 
+bool MidiBleClient :: isServer(BLEAdvertisedDevice &device) {
+    if (!device.haveServiceUUID() || !device.isAdvertisingService(BLEUUID(MIDI_SERVICE_UUID))){
+        return false;
+    }
+    return name == nullptr || *name == 0 || strcmp(device.getName().c_str(), name) == 0;
+}
+
 
 // => MidiBleClientCallback
 
@@ -112,7 +139,7 @@ MidiBleClientAdvertisedDeviceCallbacks :: MidiBleClientAdvertisedDeviceCallbacks
 }
 
 void MidiBleClientAdvertisedDeviceCallbacks :: onResult(BLEAdvertisedDevice advertisedDevice) {
-    if (advertisedDevice.haveServiceUUID() && advertisedDevice.isAdvertisingService(BLEUUID(MIDI_SERVICE_UUID))) {
+    if (pClient->isServer(advertisedDevice)) {
       BLEDevice::getScan()->stop();
       BLEAdvertisedDevice* pDevice = new BLEAdvertisedDevice(advertisedDevice);
       pClient->begin(pDevice);
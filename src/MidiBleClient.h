@@ -5,6 +5,7 @@
 
 #include "MidiCommon.h"
 #include "MidiBleParser.h"
+#include "MidiBleSender.h"
 
 
 namespace midi {
@@ -14,16 +15,23 @@ namespace midi {
     \brief A Bluetooth Low Energy BLE Client which
     can send or receive Bluetooth messages. It
     needs to connect to a running BLE Server.
+
+    Multiple clients can be connected at the same
+    time: each has its own parser and the notifications
+    are routed to it by the remote characteristic.
     
     by Phil Schatzmann
 */
 /***************************************************/
 
-class MidiBleClient : public MidiCommon {
+class MidiBleClient : public MidiCommon, public MidiBleSender {
     public:
         //! Default constructor
         MidiBleClient(const char* serverName, MidiBleParser* pEventHandler = nullptr);
 
+        //! Removes the routing of the notifications
+        virtual ~MidiBleClient();
+
         //! starts the discover and connects if the serverName was found
         void begin(MidiAction &MidiAction);
 
@@ -33,13 +41,34 @@ class MidiBleClient : public MidiCommon {
         //! Processes a message
         void writeData(MidiMessage *pMsg, int len);
 
+        //! Processes the received messages: needs to be called regularly
+        bool loop();
+
         //! determe in the BLEAdvertisedDevice 
         BLEAdvertisedDevice *getBLEAdvertisedDevice();
+
+        //! Checks if the advertised device is a MIDI server with the requested name (any name if it is empty)
+        bool isServer(BLEAdvertisedDevice &device);
+
+        //! Provides the parser of the received messages
+        MidiBleParser *parser() {
+            return pEventHandler;
+        }
         
     protected:
+        // routes the notifications of all clients to their parser
+        static MidiBleRoutes routes;
         const char *name;
-        BLERemoteCharacteristic* pRemoteCharacteristic;
-        BLEAdvertisedDevice* pDevice;
+        MidiBleParser *pEventHandler = nullptr;
+        bool is_own_parser = false;
+        BLEClient* pClient = nullptr;
+        BLERemoteCharacteristic* pRemoteCharacteristic = nullptr;
+        BLEAdvertisedDevice* pDevice = nullptr;
+
+        void sendPacket(uint8_t *data, int len) override;
+        int mtu() override;
+
+        static void notifyCallback(BLERemoteCharacteristic* pCharacteristic, uint8_t* pData, size_t length, bool isNotify);
 
 };
 
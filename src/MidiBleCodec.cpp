@@ -0,0 +1,202 @@
+#include "MidiBleCodec.h"
+#if MIDI_ACTIVE
+
+namespace midi {
+
+bool MidiBleEncoder :: write(uint32_t timeMs, const uint8_t *msg, int len){
+    uint8_t high = (timeMs >> 7) & 0x3F;
+    uint8_t low = timeMs & 0x7F;
+    if (pos + 1 + len > max_len){
+        return false;
+    }
+
+    if (pos==0){
+        // the header contains the upper 6 bits of the first timestamp
+        buffer[pos++] = 0x80 | high;
+        timestamp_high = high;
+    } else if (high != timestamp_high || low < timestamp_low) {
+        // the receiver only increments the upper bits when the lower bits wrap around
+        if (high != ((timestamp_high + 1) & 0x3F) || low >= timestamp_low){
+            return false;
+        }
+        timestamp_high = high;
+    }
+    timestamp_low = low;
+
+    buffer[pos++] = 0x80 | low;
+    memcpy(buffer + pos, msg, len);
+    pos += len;
+    count++;
+    return true;
+}
+
+int MidiBleDecoder :: decode(const uint8_t *data, int len, uint32_t nowUs){
+    // the header has the bit 7 set and the bit 6 cleared
+    if (len<2 || (data[0] & 0xC0)!=0x80){
+        stats.invalid++;
+        return 0;
+    }
+    stats.packets++;
+    int result = 0;
+    uint8_t high = data[0] & 0x3F;
+    int low = -1;
+    int pos = 1;
+    while (pos<len){
+        uint8_t value = data[pos];
+        if ((value & 0x80)==0){
+            if (is_sysex){
+                // SysEx data: it continues in the next packet without timestamp
+                int start = pos;
+                while (pos<len && (data[pos] & 0x80)==0){
+                    pos++;
+                }
+                if (p_sysex!=nullptr){
+                    p_sysex->write(sysex_source, data + start, pos - start, sysex_pos, nowUs / 1000);
+                }
+                sysex_pos += pos - start;
+                continue;
+            }
+            // running status without timestamp: same time as the previous message
+            if (running_status==0 || low<0){
+                stats.invalid++;
+                return result;
+            }
+            if (!message(running_status, data, len, pos, nowUs)){
+                return result;
+            }
+            result++;
+            continue;
+        }
+
+        // timestamp: the upper bits are incremented when the lower bits wrap around
+        uint8_t new_low = value & 0x7F;
+        if (low>=0 && new_low<low){
+            high = (high + 1) & 0x3F;
+        }
+        low = new_low;
+        updateClock((high << 7) | low, nowUs);
+        if (++pos>=len){
+            stats.invalid++;
+            return result;
+        }
+
+        value = data[pos];
+        if (value>=0xF8){
+            // real time messages can be inserted anywhere (also into SysEx)
+            pos++;
+            dispatch(&value, 1, nowUs);
+            result++;
+            continue;
+        }
+        if (is_sysex){
+            is_sysex = false;
+            if (value==0xF7){
+                pos++;
+                if (p_sysex!=nullptr){
+                    p_sysex->end(sysex_source);
+                }
+                continue;
+            }
+            // any other status terminates the SysEx
+            if (p_sysex!=nullptr){
+                p_sysex->abort(sysex_source);
+            }
+        }
+        if (value>>7 == 1){
+            pos++;
+            if (value==0xF0){
+                is_sysex = true;
+                sysex_pos = 0;
+                running_status = 0;
+                continue;
+            }
+            // system common messages cancel the running status
+            running_status = value < 0xF0 ? value : 0;
+            if (!message(value, data, len, pos, nowUs)){
+                return result;
+            }
+        } else {
+            // running status after a timestamp
+            if (running_status==0){
+                stats.invalid++;
+                return result;
+            }
+            if (!message(running_status, data, len, pos, nowUs)){
+                return result;
+            }
+        }
+        result++;
+    }
+    return result;
+}
+
+void MidiBleDecoder :: clear(){
+    is_sysex = false;
+    sysex_pos = 0;
+    running_status = 0;
+    is_clock_valid = false;
+    stats = MidiBleDecoderStatistics();
+}
+
+void MidiBleDecoder :: updateClock(uint16_t timestamp, uint32_t nowUs){
+    // after a pause of more than half of the 13 bit range we can't tell how often it wrapped around
+    if (!is_clock_valid || nowUs - last_us > 4000000){
+        remote_ms = timestamp;
+        offset_us = nowUs - remote_ms * 1000;
+        is_clock_valid = true;
+    } else {
+        int32_t delta = (timestamp - last_timestamp) & 0x1FFF;
+        if (delta >= 0x1000){
+            delta -= 0x2000;
+        }
+        remote_ms += delta;
+    }
+    last_timestamp = timestamp;
+    last_us = nowUs;
+
+    // the fastest message defines the offset: it grows slowly to follow the drift of the clocks
+    int32_t diff = (int32_t)(nowUs - remote_ms * 1000 - offset_us);
+    if (diff < 0){
+        offset_us += diff;
+    } else {
+        offset_us += diff >> 8;
+    }
+}
+
+bool MidiBleDecoder :: message(uint8_t status, const uint8_t *data, int len, int &pos, uint32_t nowUs){
+    int count = MidiParser::dataLength(status);
+    if (count<0 || pos + count > len){
+        stats.invalid++;
+        return false;
+    }
+    uint8_t msg[3] = {status, 0, 0};
+    for (int j=0; j<count; j++){
+        if (data[pos + j]>>7 == 1){
+            stats.invalid++;
+            return false;
+        }
+        msg[j + 1] = data[pos + j];
+    }
+    pos += count;
+    dispatch(msg, count + 1, nowUs);
+    return true;
+}
+
+void MidiBleDecoder :: dispatch(const uint8_t *msg, int len, uint32_t nowUs){
+    stats.messages++;
+    uint32_t remote_us = remote_ms * 1000;
+    // the message can not be from the future
+    timestamp_us = remote_us + offset_us;
+    if ((int32_t)(timestamp_us - nowUs) > 0){
+        timestamp_us = nowUs;
+    }
+    if (p_jitter_buffer!=nullptr){
+        p_jitter_buffer->write(remote_us, nowUs, msg, len);
+    } else if (p_parser!=nullptr){
+        p_parser->dispatch(msg[0], len>1 ? msg[1] : 0, len>2 ? msg[2] : 0);
+    }
+}
+
+}
+
+#endif
@@ -0,0 +1,181 @@
+#pragma once
+#include "ConfigMidi.h"
+
+#if MIDI_ACTIVE
+
+#include <stdint.h>
+#include <string.h>
+#include "MidiParser.h"
+#include "MidiJitterBuffer.h"
+#include "MidiSysExAssembler.h"
+
+#ifndef MIDI_BLE_PACKET_SIZE
+#define MIDI_BLE_PACKET_SIZE 256
+#endif
+
+#ifndef MIDI_BLE_DEFAULT_MTU
+#define MIDI_BLE_DEFAULT_MTU 23
+#endif
+
+namespace midi {
+
+/***************************************************/
+/*! \class MidiBleEncoder
+    \brief Collects multiple midi messages in one BLE MIDI
+    packet: the header contains the upper 6 bits and each
+    message is preceded by the lower 7 bits of its 13 bit
+    millisecond timestamp. The packet size is limited by
+    the MTU (minus the 3 bytes of the ATT header).
+
+    It does not use any BLE API, so it can be used
+    on any platform.
+
+    http://www.hangar42.nl/wp-content/uploads/2017/10/BLE-MIDI-spec.pdf
+
+    by Phil Schatzmann
+*/
+/***************************************************/
+
+class MidiBleEncoder {
+    public:
+        MidiBleEncoder() {
+            setMtu(MIDI_BLE_DEFAULT_MTU);
+        }
+
+        /// Defines the negotiated MTU which limits the size of the packets
+        void setMtu(int mtu) {
+            max_len = mtu - 3;
+            if (max_len > MIDI_BLE_PACKET_SIZE) max_len = MIDI_BLE_PACKET_SIZE;
+            if (max_len < 5) max_len = 5;
+        }
+
+        /// Max size of a packet
+        int maxSize() {
+            return max_len;
+        }
+
+        /// Adds a midi message with the status byte (max 3 bytes) created at timeMs: returns false if it needs a new packet
+        bool write(uint32_t timeMs, const uint8_t *msg, int len);
+
+        /// Encoded packet
+        uint8_t *data() {
+            return buffer;
+        }
+
+        /// Size of the encoded packet in bytes
+        int size() {
+            return pos;
+        }
+
+        /// Number of messages in the packet
+        int available() {
+            return count;
+        }
+
+        /// Starts a new packet
+        void clear() {
+            pos = 0;
+            count = 0;
+        }
+
+    protected:
+        uint8_t buffer[MIDI_BLE_PACKET_SIZE];
+        int max_len = 20;
+        int pos = 0;
+        int count = 0;
+        uint8_t timestamp_high = 0;
+        uint8_t timestamp_low = 0;
+};
+
+/**
+ * @brief Statistics of the MidiBleDecoder: the invalid packets have a wrong header
+ * or end in the middle of a message.
+ */
+struct MidiBleDecoderStatistics {
+    uint32_t packets = 0;
+    uint32_t messages = 0;
+    uint32_t invalid = 0;
+};
+
+/***************************************************/
+/*! \class MidiBleDecoder
+    \brief Decodes the BLE MIDI packets: the 13 bit timestamp
+    of each message is reconstructed from the header and the
+    timestamp byte and is converted to the local micros(). The
+    offset between the clocks is estimated from the fastest
+    message, so that the messages of a connection event keep
+    the spacing which they had at the sender.
+
+    The messages are passed to the MidiParser immediatly or to
+    a MidiJitterBuffer which plays them with the original
+    spacing. SysEx messages (which can span multiple packets)
+    are passed to an optional MidiSysExAssembler.
+
+    It does not use any BLE API, so it can be used
+    on any platform.
+
+    by Phil Schatzmann
+*/
+/***************************************************/
+
+class MidiBleDecoder {
+    public:
+        MidiBleDecoder() = default;
+
+        /// Defines the parser which receives the messages and optionally the jitter buffer which schedules them
+        void begin(MidiParser *parser, MidiJitterBuffer *jitterBuffer=nullptr) {
+            p_parser = parser;
+            p_jitter_buffer = jitterBuffer;
+            clear();
+        }
+
+        /// Defines the SysEx reassembly and the source id which is used for it
+        void setSysEx(MidiSysExAssembler *sysex, uint8_t source=0) {
+            p_sysex = sysex;
+            sysex_source = source;
+        }
+
+        /// Decodes a packet which was received at nowUs (micros()): returns the number of messages
+        int decode(const uint8_t *data, int len, uint32_t nowUs);
+
+        /// Local time in us of the message which is currently dispatched (when the sender created it)
+        uint32_t timestampUs() {
+            return timestamp_us;
+        }
+
+        /// Restarts the clock estimation and drops an incomplete SysEx
+        void clear();
+
+        MidiBleDecoderStatistics &statistics() {
+            return stats;
+        }
+
+    protected:
+        MidiParser *p_parser = nullptr;
+        MidiJitterBuffer *p_jitter_buffer = nullptr;
+        MidiSysExAssembler *p_sysex = nullptr;
+        uint8_t sysex_source = 0;
+        bool is_sysex = false;
+        int sysex_pos = 0;
+        uint8_t running_status = 0;
+        // sender clock extended from 13 to 32 bits
+        bool is_clock_valid = false;
+        uint16_t last_timestamp = 0;
+        uint32_t remote_ms = 0;
+        uint32_t last_us = 0;
+        // local us minus remote us
+        uint32_t offset_us = 0;
+        uint32_t timestamp_us = 0;
+        MidiBleDecoderStatistics stats;
+
+        /// updates the remote clock and the offset with the 13 bit timestamp
+        void updateClock(uint16_t timestamp, uint32_t nowUs);
+        /// passes a message with the status byte to the parser or to the jitter buffer
+        void dispatch(const uint8_t *msg, int len, uint32_t nowUs);
+        /// reads the data bytes of a message: returns false if the packet is too short
+        bool message(uint8_t status, const uint8_t *data, int len, int &pos, uint32_t nowUs);
+};
+
+} // namespace
+
+#endif
@@ -7,6 +7,9 @@ const char * APP_EVENT_HDLR = "MidiBleParser";
 
 MidiBleParser::MidiBleParser(MidiAction *p_MidiAction, int channelFilter)
 : MidiParser(p_MidiAction, channelFilter) {
+  decoder.begin(this);
+  sysex_assembler.begin(this);
+  decoder.setSysEx(&sysex_assembler);
 };
 
 MidiBleParser::~MidiBleParser(){
@@ -27,11 +30,61 @@ void MidiBleParser::onRead(BLECharacteristic* pCharacteristic) {
  */
 void MidiBleParser::onWrite(BLECharacteristic* pCharacteristic) {
 	MIDI_LOGD( "%s, onWrite",__func__);
-  const char* str = pCharacteristic->getValue().c_str();
-  int len = pCharacteristic->getValue().length();
-  parse((uint8_t*)str, len);
+  // we access the value directly: getValue() would copy it
+  receive(pCharacteristic->getData(), pCharacteristic->getLength());
 } 
 
+/**
+ * @brief Decodes a BLE MIDI packet with the header and the timestamps
+ * @param [in] data packet
+ * @param [in] len length of the packet
+ */
+void MidiBleParser::parsePacket(const uint8_t *data, int len) {
+  decoder.decode(data, len, micros());
+}
+
+void MidiBleParser::receive(const uint8_t *data, int len) {
+  uint32_t start_us = micros();
+  // the packet is parsed with the arrival time in loop(): we must not block the BLE task
+  if (!queue.write(data, len, start_us)){
+    MIDI_LOGD("MidiBleParser: packet dropped - queue full");
+  }
+
+  uint32_t duration_us = micros() - start_us;
+  callback_stats.callbacks++;
+  callback_stats.total_us += duration_us;
+  if (duration_us > callback_stats.max_us){
+    callback_stats.max_us = duration_us;
+  }
+}
+
+bool MidiBleParser::loop() {
+  if (!is_jitter_buffer && queue.available()==0){
+    return false;
+  }
+  bool result = false;
+  int len;
+  uint32_t time_us;
+  const uint8_t *data;
+  while ((data = queue.peek(len, time_us)) != nullptr){
+    decoder.decode(data, len, time_us);
+    queue.pop();
+    result = true;
+  }
+  if (is_jitter_buffer && jitter_buffer.play(micros()) > 0){
+    result = true;
+  }
+  return result;
+}
+
+void MidiBleParser::setJitterBuffer(bool active, uint32_t minLatencyUs, uint32_t maxLatencyUs) {
+  jitter_buffer.flush();
+  jitter_buffer.begin(this);
+  jitter_buffer.setLatency(minLatencyUs, maxLatencyUs);
+  is_jitter_buffer = active;
+  decoder.begin(this, active ? &jitter_buffer : nullptr);
+}
+
 } // namespace
 
-#endif
\ No newline at end of file
+#endif
@@ -6,18 +6,43 @@
 #include "Arduino.h"
 #include "MidiAction.h"
 #include "MidiParser.h"
+#include "MidiBleCodec.h"
+#include "MidiPacketQueue.h"
+#include "MidiBleRoutes.h"
 #include "BLECharacteristic.h"
 #include "MidiLogger.h"
 
 namespace midi {
 
+/**
+ * @brief Execution time of the BLE write callbacks
+ */
+struct MidiBleCallbackStatistics {
+    uint32_t callbacks = 0;
+    uint32_t max_us = 0;
+    uint64_t total_us = 0;
+
+    /// Average time in us of a callback
+    float averageUs() {
+        return callbacks == 0 ? 0.0f : (float) total_us / callbacks;
+    }
+};
+
 /***************************************************/
 /*! \class MidiBleParser
     \brief  A simple Midi Parser for BLE Midi messages
     that calls the corresponding events. 
   
     In this implementation the handler just passes the noteOn 
-    and noteOff to the MidiAction.
+    and noteOff to the MidiAction. The timestamps of the
+    messages are reconstructed: with the jitter buffer the
+    messages are played with the original spacing when
+    loop() is called.
+
+    The BLE callback only copies the packet into a lock
+    free queue and never blocks: the packets are parsed
+    and the MidiAction is called in loop(), so you need to
+    call loop() regularly.
   
     http://www.hangar42.nl/wp-content/uploads/2017/10/BLE-MIDI-spec.pdf
 
@@ -25,13 +50,58 @@ namespace midi {
 */
 /***************************************************/
 class MidiBleParser 
-: public BLECharacteristicCallbacks , public  MidiParser {
+: public BLECharacteristicCallbacks , public  MidiParser, public MidiPacketReceiver {
     public:
         MidiBleParser(MidiAction *MidiAction, int channelFilter = -1 );
         virtual ~MidiBleParser();
         virtual void onRead(BLECharacteristic* pCharacteristic);
 	    virtual void onWrite(BLECharacteristic* pCharacteristic);
 
+        /// Decodes a received BLE MIDI packet
+        void parsePacket(const uint8_t *data, int len);
+
+        /// Queues a packet from the BLE callback: it is parsed in loop()
+        void receive(const uint8_t *data, int len) override;
+
+        /// Processes the queued packets and plays the buffered messages which are due: returns true if something was processed
+        bool loop();
+
+        /// Provides the queued, dropped packets and the max queue depth
+        MidiPacketQueueStatistics &queueStatistics() {
+            return queue.statistics();
+        }
+
+        /// Provides the execution time of the BLE callbacks
+        MidiBleCallbackStatistics &callbackStatistics() {
+            return callback_stats;
+        }
+
+        /// Activates the jitter buffer: the received messages are played with the spacing of the sender
+        void setJitterBuffer(bool active, uint32_t minLatencyUs=2000, uint32_t maxLatencyUs=50000);
+
+        /// Provides the late and dropped messages and the current latency of the jitter buffer
+        MidiJitterStatistics &jitterStatistics() {
+            return jitter_buffer.statistics();
+        }
+
+        /// Provides the received packets and messages
+        MidiBleDecoderStatistics &statistics() {
+            return decoder.statistics();
+        }
+
+        /// Local time in us when the sender created the message which is currently processed
+        uint32_t timestampUs() {
+            return decoder.timestampUs();
+        }
+
+    protected:
+        MidiBleDecoder decoder;
+        MidiJitterBuffer jitter_buffer;
+        MidiSysExAssembler sysex_assembler;
+        bool is_jitter_buffer = false;
+        // the packets are received in the BLE task and parsed in the loop
+        MidiPacketQueue queue;
+        MidiBleCallbackStatistics callback_stats;
 };
 
 
@@ -0,0 +1,73 @@
+#include "MidiBleRoutes.h"
+#if MIDI_ACTIVE
+
+namespace midi {
+
+bool MidiBleRoutes :: add(const void *characteristic, MidiPacketReceiver *receiver){
+    if (characteristic==nullptr){
+        return false;
+    }
+    remove(characteristic);
+    for (int j=0; j<MIDI_BLE_MAX_ROUTES; j++){
+        Route &entry = routes[j];
+        if (__atomic_load_n(&entry.characteristic, __ATOMIC_ACQUIRE)==nullptr){
+            // the key is published after the receiver, so that the BLE task never sees a half written route
+            __atomic_store_n(&entry.receiver, receiver, __ATOMIC_RELAXED);
+            __atomic_store_n(&entry.characteristic, characteristic, __ATOMIC_RELEASE);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool MidiBleRoutes :: remove(const void *characteristic){
+    if (characteristic==nullptr){
+        return false;
+    }
+    for (int j=0; j<MIDI_BLE_MAX_ROUTES; j++){
+        Route &entry = routes[j];
+        if (__atomic_load_n(&entry.characteristic, __ATOMIC_ACQUIRE)==characteristic){
+            __atomic_store_n(&entry.characteristic, (const void*)nullptr, __ATOMIC_SEQ_CST);
+            // the BLE task might still be in the receiver
+            while (__atomic_load_n(&entry.in_use, __ATOMIC_SEQ_CST)!=0){
+                yield();
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+bool MidiBleRoutes :: route(const void *characteristic, const uint8_t *data, int len){
+    for (int j=0; j<MIDI_BLE_MAX_ROUTES; j++){
+        Route &entry = routes[j];
+        if (__atomic_load_n(&entry.characteristic, __ATOMIC_ACQUIRE)==characteristic){
+            // the route is marked as in use before it is checked again: so either remove() waits for us
+            // or we see that it has been removed
+            __atomic_add_fetch(&entry.in_use, 1, __ATOMIC_SEQ_CST);
+            bool is_valid = __atomic_load_n(&entry.characteristic, __ATOMIC_SEQ_CST)==characteristic;
+            if (is_valid){
+                __atomic_load_n(&entry.receiver, __ATOMIC_RELAXED)->receive(data, len);
+            }
+            __atomic_sub_fetch(&entry.in_use, 1, __ATOMIC_RELEASE);
+            if (is_valid){
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+int MidiBleRoutes :: size(){
+    int result = 0;
+    for (int j=0; j<MIDI_BLE_MAX_ROUTES; j++){
+        if (__atomic_load_n(&routes[j].characteristic, __ATOMIC_ACQUIRE)!=nullptr){
+            result++;
+        }
+    }
+    return result;
+}
+
+}
+
+#endif
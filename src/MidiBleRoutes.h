@@ -0,0 +1,70 @@
+#pragma once
+#include "ConfigMidi.h"
+
+#if MIDI_ACTIVE
+
+#include <stdint.h>
+
+/// Max number of BLE connections which can be routed
+#ifndef MIDI_BLE_MAX_ROUTES
+#define MIDI_BLE_MAX_ROUTES 8
+#endif
+
+namespace midi {
+
+/**
+ * @brief Receiver of the packets of one connection (e.g. MidiBleParser)
+ */
+class MidiPacketReceiver {
+    public:
+        virtual void receive(const uint8_t *data, int len) = 0;
+};
+
+/***************************************************/
+/*! \class MidiBleRoutes
+    \brief Small lookup table which routes the notifications
+    of the remote characteristics to the receiver of the
+    connection: the BLE API only provides the characteristic
+    to the callback. The routes are changed by the application
+    task and used by the BLE task without lock: each route counts
+    the notifications which are passed to its receiver, and
+    remove() waits until there is none in progress. So the receiver
+    can be deleted as soon as its route has been removed. remove()
+    must therefore not be called from the receiver itself.
+
+    It does not use any BLE API, so it can be used
+    on any platform.
+
+    by Phil Schatzmann
+*/
+/***************************************************/
+
+class MidiBleRoutes {
+    public:
+        MidiBleRoutes() = default;
+
+        /// Routes the packets of the characteristic to the receiver: returns false if the table is full
+        bool add(const void *characteristic, MidiPacketReceiver *receiver);
+
+        /// Removes the route of the characteristic: returns after the receiver has processed the current packet
+        bool remove(const void *characteristic);
+
+        /// Passes the packet to the receiver of the characteristic: returns false if there is none
+        bool route(const void *characteristic, const uint8_t *data, int len);
+
+        /// Number of routes
+        int size();
+
+    protected:
+        struct Route {
+            const void *characteristic = nullptr;
+            MidiPacketReceiver *receiver = nullptr;
+            // number of notifications which are currently passed to the receiver
+            int in_use = 0;
+        };
+        Route routes[MIDI_BLE_MAX_ROUTES];
+};
+
+} // namespace
+
+#endif
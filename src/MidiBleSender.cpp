@@ -0,0 +1,73 @@
+#include "MidiBleSender.h"
+#if MIDI_BLE_ACTIVE
+#include "MidiLogger.h"
+
+namespace midi {
+
+MidiBleSender :: ~MidiBleSender(){
+    if (timer!=nullptr){
+        esp_timer_stop(timer);
+        esp_timer_delete(timer);
+    }
+    if (mutex!=nullptr){
+        vSemaphoreDelete(mutex);
+    }
+}
+
+void MidiBleSender :: send(MidiMessage *pMsg, int len){
+    if (mutex==nullptr){
+        mutex = xSemaphoreCreateMutex();
+        esp_timer_create_args_t args = {};
+        args.callback = onFlushTimer;
+        args.arg = this;
+        args.name = "midi-ble-flush";
+        if (esp_timer_create(&args, &timer)!=ESP_OK){
+            MIDI_LOGE("MidiBleSender: could not create the flush timer");
+            timer = nullptr;
+        }
+    }
+
+    // the timestamp uses the 13 lower bits of the milliseconds: the message consists of the status and the data bytes
+    uint32_t now_ms = millis();
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    if (encoder.available()==0){
+        // the MTU is negotiated after the connection has been established
+        int negotiated_mtu = mtu();
+        encoder.setMtu(negotiated_mtu > 0 ? negotiated_mtu : MIDI_BLE_DEFAULT_MTU);
+    }
+    if (!encoder.write(now_ms, &(pMsg->status), len+1)){
+        sendEncoded();
+        encoder.write(now_ms, &(pMsg->status), len+1);
+    }
+    if (flush_interval_us==0 || timer==nullptr){
+        sendEncoded();
+    } else if (encoder.available()==1){
+        // the first message of the packet defines the latest flush time: fails if the timer is already running
+        esp_timer_start_once(timer, flush_interval_us);
+    }
+    xSemaphoreGive(mutex);
+}
+
+void MidiBleSender :: flush(){
+    if (mutex==nullptr){
+        return;
+    }
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    sendEncoded();
+    xSemaphoreGive(mutex);
+}
+
+void MidiBleSender :: sendEncoded(){
+    if (encoder.available()>0){
+        sendPacket(encoder.data(), encoder.size());
+    }
+    encoder.clear();
+}
+
+void MidiBleSender :: onFlushTimer(void *arg){
+    ((MidiBleSender*)arg)->flush();
+}
+
+} // namespace
+
+#endif
@@ -0,0 +1,62 @@
+#pragma once
+#include "ConfigMidi.h"
+
+#if MIDI_BLE_ACTIVE
+
+#include "MidiCommon.h"
+#include "MidiBleCodec.h"
+#include <esp_timer.h>
+#include <freertos/semphr.h>
+
+#ifndef MIDI_BLE_FLUSH_US
+#define MIDI_BLE_FLUSH_US 7500
+#endif
+
+namespace midi {
+
+/***************************************************/
+/*! \class MidiBleSender
+    \brief Output of the BLE Server and Client: the messages
+    are collected with a MidiBleEncoder and the packet is
+    sent when it is full or at the latest after the flush
+    interval (which should correspond to the connection
+    interval), so that we send one packet per connection
+    event. With a flush interval of 0 each message is sent
+    immediatly.
+
+    by Phil Schatzmann
+*/
+/***************************************************/
+
+class MidiBleSender {
+    public:
+        virtual ~MidiBleSender();
+
+        /// Max time in us a message is kept to be sent together with the following ones
+        void setFlushInterval(uint32_t intervalUs) {
+            flush_interval_us = intervalUs;
+        }
+
+        /// Sends the collected messages
+        void flush();
+
+    protected:
+        MidiBleEncoder encoder;
+        SemaphoreHandle_t mutex = nullptr;
+        esp_timer_handle_t timer = nullptr;
+        uint32_t flush_interval_us = MIDI_BLE_FLUSH_US;
+
+        /// Adds the status and the len data bytes of the message to the packet
+        void send(MidiMessage *pMsg, int len);
+        /// Sends a packet with the BLE API
+        virtual void sendPacket(uint8_t *data, int len) = 0;
+        /// Negotiated MTU: 0 if it is not known
+        virtual int mtu() { return 0; }
+        /// sends the packet and starts a new one: the mutex must be locked
+        void sendEncoded();
+        static void onFlushTimer(void *arg);
+};
+
+} // namespace
+
+#endif
@@ -82,20 +82,24 @@ void MidiBleServer :: begin(MidiAction &MidiAction) {
 }
 
 void MidiBleServer :: writeData(MidiMessage *pMsg, int len) {
-    updateTimestamp(&outMessage);
-
-    switch (len) {
-        case 1: 
-            pCharacteristic->setValue((uint8_t*)&outMessage, sizeof(MidiMessage)-1); 
-            pCharacteristic->notify();  
-            break;
-        case 2: 
-            pCharacteristic->setValue((uint8_t*)&outMessage, sizeof(MidiMessage)); 
-            pCharacteristic->notify();  
-            break;
+    if (pCharacteristic!=nullptr){
+        send(pMsg, len);
     }
 }
 
+bool MidiBleServer :: loop() {
+    return pEventHandler!=nullptr && pEventHandler->loop();
+}
+
+void MidiBleServer :: sendPacket(uint8_t *data, int len) {
+    pCharacteristic->setValue(data, len);
+    pCharacteristic->notify();
+}
+
+int MidiBleServer :: mtu() {
+    return pServer!=nullptr && pServer->getConnectedCount()>0 ? pServer->getPeerMTU(pServer->getConnId()) : 0;
+}
+
 
 // => MidiBleServerCallback
 
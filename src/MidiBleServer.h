@@ -5,19 +5,21 @@
 
 #include "MidiCommon.h"
 #include "MidiBleParser.h"
+#include "MidiBleSender.h"
 
 namespace midi {
 
 /***************************************************/
 /*! \class MidiBleServer
     \brief A Bluetooth Low Energy BLE Server which
-    can send or receive Bluetooth messages.
+    can send or receive Bluetooth messages. Multiple
+    messages are sent together in one notification.
     
     by Phil Schatzmann
 */
 /***************************************************/
 
-class MidiBleServer : public MidiCommon {
+class MidiBleServer : public MidiCommon, public MidiBleSender {
     public:
         //! Default constructor
         MidiBleServer(const char* name, MidiBleParser* pEventHandler=nullptr);
@@ -28,6 +30,8 @@ class MidiBleServer : public MidiCommon {
         void begin(MidiAction &MidiAction);
         void begin();
         void writeData(MidiMessage *pMsg, int len);
+        //! Processes the received messages: needs to be called regularly
+        bool loop();
 
 
     protected:
@@ -35,6 +39,9 @@ class MidiBleServer : public MidiCommon {
         BLEServer *pServer=nullptr;
         BLECharacteristic* pCharacteristic=nullptr;
         const char *name=nullptr;
+
+        void sendPacket(uint8_t *data, int len) override;
+        int mtu() override;
 };
 
 /***************************************************/
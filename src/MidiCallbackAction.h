@@ -33,6 +33,10 @@ class MidiCallbackAction : public MidiAction {
             if (callbackOnPitchBend!=nullptr) callbackOnPitchBend(channel, value);
         }
 
+        virtual void onSysEx(const uint8_t *data, int len, int pos, bool complete) {
+            if (callbackOnSysEx!=nullptr) callbackOnSysEx(data, len, pos, complete);
+        }
+
         virtual void setCallbackOnNoteOn(void (*callback)(uint8_t channel, uint8_t note, uint8_t velocity)) {
             callbackOnNoteOn = callback;
         }
@@ -49,6 +53,10 @@ class MidiCallbackAction : public MidiAction {
             callbackOnPitchBend = callback;
         }
 
+        virtual void setCallbackOnSysEx(void (*callback)(const uint8_t *data, int len, int pos, bool complete)) {
+            callbackOnSysEx = callback;
+        }
+
         virtual void setCallbacks(
                 void (*callbackOnNoteOn)(uint8_t channel, uint8_t note, uint8_t velocity),
                 void (*callbackOnNoteOff)(uint8_t channel, uint8_t note, uint8_t velocity),
@@ -66,6 +74,7 @@ class MidiCallbackAction : public MidiAction {
         void (*callbackOnNoteOff)(uint8_t channel, uint8_t note, uint8_t velocity) = nullptr;
         void (*callbackOnControlChange)(uint8_t channel, uint8_t controller, uint8_t value) = nullptr;
         void (*callbackOnPitchBend)(uint8_t channel,  uint8_t value) = nullptr;
+        void (*callbackOnSysEx)(const uint8_t *data, int len, int pos, bool complete) = nullptr;
 
 };
 
@@ -118,7 +118,7 @@ void MidiCommon :: write(MidiMessage *msg, int len){
     writeData(msg, len);
 }
 
-uint8_t MidiCommon :: getChannel(uint8_t ch) {
+uint8_t MidiCommon :: getChannel(int8_t ch) {
     uint8_t result_channel = (ch != -1) ? ch : sendingChannel;
     assert(result_channel <= 0b1111);
     return result_channel;
@@ -77,6 +77,9 @@ class MidiCommon {
         //! Default Constructor
         MidiCommon();
 
+        //! The subclasses (e.g. the servers) can be deleted with a pointer to their base class
+        virtual ~MidiCommon() = default;
+
         //! Activates a filter on receiving messages to the indicated channel
         virtual void setFilterReceivingChannel(int channel);
 
@@ -132,7 +135,7 @@ class MidiCommon {
         void setConnectionStatus(ConnectionStatus status) {connectionStatus=status; }
         void updateTimestamp(MidiMessage *pMsg);
         virtual void writeData(MidiMessage *msg, int len);
-        uint8_t getChannel(uint8_t ch);
+        uint8_t getChannel(int8_t ch);
         
         ConnectionStatus connectionStatus;
         MidiAction *pMidiAction;
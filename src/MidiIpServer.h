@@ -3,16 +3,154 @@
 
 #if MIDI_ACTIVE && TCP_ACTIVE
 
+#if MIDI_HOST_ACTIVE
+#include "MidiPosixStream.h"
+#include "MidiPosixTcpServer.h"
+#include <unistd.h>
+#else
 #include <WiFi.h>
+#endif
 #include "MidiLogger.h"
 #include "MidiServer.h"
+#include "MidiAggregator.h"
+
+/// Max number of concurrent TCP clients
+#ifndef MIDI_IP_MAX_CLIENTS
+#  if MIDI_HOST_ACTIVE
+#    define MIDI_IP_MAX_CLIENTS 128
+#  else
+#    define MIDI_IP_MAX_CLIENTS 4
+#  endif
+#endif
+
+/// Default size of the coalescing buffer
+#ifndef MIDI_IP_COALESCING_SIZE
+#define MIDI_IP_COALESCING_SIZE 256
+#endif
+
+/// Default max time in microseconds a message may wait in the coalescing buffer
+#ifndef MIDI_IP_COALESCING_US
+#define MIDI_IP_COALESCING_US 1000
+#endif
+
+/// Size of the input buffer of each client
+#ifndef MIDI_IP_CLIENT_BUFFER
+#define MIDI_IP_CLIENT_BUFFER 64
+#endif
 
 namespace midi {
 
+/// TCP connection of the platform
+#if MIDI_HOST_ACTIVE
+typedef MidiPosixStream MidiIpClientStream;
+#else
+typedef WiFiClient MidiIpClientStream;
+#endif
+
+/**
+ * @brief Connection and input state of a client of the MidiIpServer: the parser
+ * is reused for all connections which are using the same slot.
+ */
+struct MidiIpClient {
+    MidiIpClientStream stream;
+    MidiParser parser;
+    uint8_t buffer[MIDI_IP_CLIENT_BUFFER];
+    int len = 0;
+    bool active = false;
+};
+
+/**
+ * @brief Output which writes the encoded data to all active clients (or only to the target client).
+ * With coalescing the messages are collected and written together when the buffer is full or when 
+ * the oldest message has been waiting for the max delay.
+ */
+class MidiIpBroadcast : public Print, public MidiPacketWriter {
+    public:
+        void begin(MidiIpClient *clients, int count) {
+            this->clients = clients;
+            this->count = count;
+            aggregator.begin(this);
+        }
+
+        /// Limits the output to one client: -1 for all clients
+        void setTarget(int slot) { 
+            flush();
+            target = slot; 
+        }
+
+        /// Activates the coalescing of messages: size=0 deactivates it
+        void setCoalescing(uint16_t size, uint32_t maxDelayUs) {
+            aggregator.setSize(size, maxDelayUs);
+        }
+
+        size_t write(uint8_t value) override {
+            return write(&value, 1);
+        }
+
+        size_t write(const uint8_t *data, size_t size) override {
+            // the messages for a single client are not collected
+            if (target>=0){
+                aggregator.statistics().messages++;
+                return writePacket(data, size);
+            }
+            return aggregator.write(data, size);
+        }
+
+        /// Writes the collected messages to the clients
+        void flush() override {
+            aggregator.flush();
+        }
+
+        /// Writes the collected messages if the max delay has passed
+        void loop() {
+            aggregator.loop();
+        }
+
+        /// Time in us until the collected messages need to be written: -1 if there are none
+        int32_t remainingUs() {
+            return aggregator.remainingUs();
+        }
+
+        /// Statistics of the output: the packets are the writes to the clients
+        MidiAggregationStatistics &statistics() { return aggregator.statistics(); }
+
+    protected:
+        MidiIpClient *clients = nullptr;
+        int count = 0;
+        int target = -1;
+        MidiAggregator aggregator;
+
+        size_t writePacket(const uint8_t *data, size_t size) override {
+            size_t result = 0;
+            for (int j=0; j<count; j++){
+                if (clients[j].active && (target<0 || target==j)){
+                    result = clients[j].stream.write(data, size);
+                    aggregator.statistics().packets++;
+                }
+            }
+            return result;
+        }
+};
+
 /***************************************************/
 /*! \class MidiIpServer
-    \brief  A simple IP Server which which receives
-    and creates MIDI messages
+    \brief  An IP Server which receives and creates
+    MIDI messages for multiple TCP clients.
+
+    Each client has its own input buffer, so that
+    incomplete messages are not mixed up. The output
+    is encoded once and sent to all clients.
+
+    On a Linux host the connections with data are
+    reported by epoll, on a microcontroller we poll
+    the (few) connected clients.
+
+    By default each message is written separately and
+    the TCP stack decides with Nagle's algorithm when 
+    to send it. With setNoDelay(true) each write is 
+    sent immediatly. With setCoalescing() the messages
+    are collected up to the indicated size or delay, 
+    so that less but bigger segments are sent.
 
     by Phil Schatzmann
 */
@@ -21,17 +159,19 @@ namespace midi {
 class MidiIpServer : public MidiServer {
     public:
         MidiIpServer(MidiAction *action) : MidiServer(action){
-        } 
+        }
 
         ~MidiIpServer() {
-            if (p_wifi_server!=nullptr){
-                delete p_wifi_server;
-            }
+            end();
         }
-         
+
         bool begin(int serverPort=5008){
             MIDI_LOGI( __PRETTY_FUNCTION__);
-        
+#if MIDI_HOST_ACTIVE
+            if (!tcp.begin(serverPort)){
+                return false;
+            }
+#else
             if (WiFi.status() != WL_CONNECTED){
                 MIDI_LOGE("WiFi not connected");
                 return false;
@@ -41,41 +181,211 @@ class MidiIpServer : public MidiServer {
                 p_wifi_server = new WiFiServer(serverPort);
             }
             p_wifi_server->begin();
+#endif
+            // the parsers are assigned once and reused by all connections
+            for (int j=0; j<MIDI_IP_MAX_CLIENTS; j++){
+                clients[j].parser.begin(p_action);
+            }
+            broadcast.begin(clients, MIDI_IP_MAX_CLIENTS);
+            out.setup(&broadcast);
             MIDI_LOGI("server started on port %d", serverPort);
             return true;
         }
 
         void end() {
+            for (int j=0; j<MIDI_IP_MAX_CLIENTS; j++){
+                if (clients[j].active){
+                    closeClient(j);
+                }
+            }
+#if MIDI_HOST_ACTIVE
+            tcp.end();
+#else
             if (p_wifi_server!=nullptr){
                 delete p_wifi_server;
                 p_wifi_server = nullptr;
             }
+#endif
         }
 
         void loop() {
-            if (p_wifi_server!=nullptr){
-                if (!client.connected()){
-                    client = p_wifi_server->accept();
-                    if (client.connected()){
-                        MIDI_LOGI("MidiIpServer->connected");
-                        in.setup(&client, new MidiParser(p_action), true);
-                        out.setup(&client);
-                        out.resetAllControllers();
-                    }
+#if MIDI_HOST_ACTIVE
+            // do not wait longer then the coalescing allows
+            int timeoutMs = loopTimeoutMs;
+            int32_t remainingUs = broadcast.remainingUs();
+            if (remainingUs>=0 && (remainingUs+999)/1000 < timeoutMs){
+                timeoutMs = (remainingUs+999)/1000;
+            }
+            int ids[MIDI_POSIX_TCP_MAX_EVENTS];
+            int count = tcp.wait(ids, MIDI_POSIX_TCP_MAX_EVENTS, timeoutMs);
+            for (int j=0; j<count; j++){
+                if (ids[j]==MidiPosixTcpServer::LISTEN_ID){
+                    acceptClients();
                 } else {
-                    MIDI_LOGD("MidiIpServer::loop");
-                    in.loop();
+                    receive(ids[j]);
+                }
+            }
+#else
+            if (p_wifi_server==nullptr){
+                return;
+            }
+            acceptClients();
+            for (int j=0; j<MIDI_IP_MAX_CLIENTS; j++){
+                if (clients[j].active){
+                    if (clients[j].stream.available()>0){
+                        receive(j);
+                    } else if (!clients[j].stream.connected()){
+                        closeClient(j);
+                    }
                 }
             }
+#endif
+            // write the coalesced messages which are due
+            broadcast.loop();
+        }
+
+        /// Disables Nagle's algorithm, so that each write is sent immediatly
+        void setNoDelay(bool active){
+            noDelay = active;
+            for (int j=0; j<MIDI_IP_MAX_CLIENTS; j++){
+                if (clients[j].active){
+                    clients[j].stream.setNoDelay(active);
+                }
+            }
+        }
+
+        /// Collects the output messages up to size bytes or for max maxDelayUs microseconds: size=0 deactivates it
+        void setCoalescing(uint16_t size=MIDI_IP_COALESCING_SIZE, uint32_t maxDelayUs=MIDI_IP_COALESCING_US){
+            broadcast.setCoalescing(size, maxDelayUs);
+        }
+
+        /// Writes the collected output messages
+        void flush() {
+            broadcast.flush();
+        }
+
+        /// Provides the writes per message and latency statistics of the output
+        MidiAggregationStatistics &statistics() {
+            return broadcast.statistics();
+        }
+
+        /// Number of connected clients
+        int clientCount() {
+            return client_count;
+        }
+
+        /// Max time in ms which loop() waits for data (only on a Linux host): 0 returns immediatly
+        void setLoopTimeout(int timeoutMs){
+            loopTimeoutMs = timeoutMs;
         }
 
     protected:
+#if MIDI_HOST_ACTIVE
+        MidiPosixTcpServer tcp;
+#else
         WiFiServer *p_wifi_server = nullptr;
-        WiFiClient client;
+#endif
+        MidiIpClient clients[MIDI_IP_MAX_CLIENTS];
+        MidiIpBroadcast broadcast;
+        int client_count = 0;
+        int loopTimeoutMs = 0;
+        bool noDelay = false;
+
+        void acceptClients() {
+            while (true){
+#if MIDI_HOST_ACTIVE
+                int fd = tcp.accept();
+                if (fd<0){
+                    return;
+                }
+                int slot = freeSlot();
+                if (slot<0 || !tcp.add(fd, slot)){
+                    MIDI_LOGW("MidiIpServer: too many clients");
+                    close(fd);
+                    continue;
+                }
+                clients[slot].stream.begin(fd, true);
+#else
+                WiFiClient client = p_wifi_server->accept();
+                if (!client.connected()){
+                    return;
+                }
+                int slot = freeSlot();
+                if (slot<0){
+                    MIDI_LOGW("MidiIpServer: too many clients");
+                    client.stop();
+                    continue;
+                }
+                clients[slot].stream = client;
+#endif
+                MIDI_LOGI("MidiIpServer->connected %d", slot);
+                clients[slot].stream.setNoDelay(noDelay);
+                clients[slot].active = true;
+                clients[slot].len = 0;
+                // the parser of the slot still has the running status of the previous connection
+                clients[slot].parser.reset();
+                client_count++;
+                // the new client only
+                broadcast.setTarget(slot);
+                out.resetAllControllers();
+                broadcast.setTarget(-1);
+            }
+        }
+
+        void receive(int slot) {
+            MidiIpClient &client = clients[slot];
+            if (!client.active){
+                return;
+            }
+            int len;
+            do {
+                int space = MIDI_IP_CLIENT_BUFFER - client.len;
+                len = client.stream.read(client.buffer + client.len, space);
+                if (len<=0){
+                    break;
+                }
+                int endPos = client.len + len;
+                int complete = MidiParser::completeLength(client.buffer, endPos);
+                // a message which does not fit into the buffer (e.g. sysex) is not kept
+                if (complete==0 && endPos==MIDI_IP_CLIENT_BUFFER){
+                    complete = endPos;
+                }
+                if (complete>0){
+                    client.parser.parse(client.buffer, complete);
+                }
+                client.len = endPos - complete;
+                memmove(client.buffer, client.buffer+complete, client.len);
+            } while (len > 0);
+
+            if (!client.stream.connected()){
+                closeClient(slot);
+            }
+        }
+
+        void closeClient(int slot) {
+            MIDI_LOGI("MidiIpServer->disconnected %d", slot);
+#if MIDI_HOST_ACTIVE
+            tcp.remove(clients[slot].stream.fd());
+            clients[slot].stream.end();
+#else
+            clients[slot].stream.stop();
+#endif
+            clients[slot].active = false;
+            client_count--;
+        }
+
+        int freeSlot() {
+            for (int j=0; j<MIDI_IP_MAX_CLIENTS; j++){
+                if (!clients[j].active){
+                    return j;
+                }
+            }
+            return -1;
+        }
 
 };
 
 
 }
 
-#endif
\ No newline at end of file
+#endif
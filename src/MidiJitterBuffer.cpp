@@ -0,0 +1,144 @@
+#include "MidiJitterBuffer.h"
+#if MIDI_ACTIVE
+#include "MidiLogger.h"
+
+namespace midi {
+
+bool MidiJitterBuffer :: write(uint32_t remoteUs, uint32_t nowUs, const uint8_t *msg, int len){
+    if (len<=0 || len>3){
+        return false;
+    }
+    stats.events++;
+
+    // the transit contains the network delay and the unknown clock offset: only the differences matter
+    uint32_t transit = nowUs - remoteUs;
+    if (window_count==0){
+        transit_ref = transit;
+    }
+    updateOffset((int32_t)(transit - transit_ref));
+
+    uint32_t due = remoteUs + transit_ref + playout_offset;
+    int32_t late_us = (int32_t)(nowUs - due);
+    if (late_us > 0){
+        // too late: we play it immediatly
+        stats.late++;
+        if ((uint32_t)late_us > stats.max_late_us){
+            stats.max_late_us = late_us;
+        }
+        due = nowUs;
+    }
+
+    if (!insert(due, msg, len)){
+        stats.dropped++;
+        MIDI_LOGD("MidiJitterBuffer: event dropped - buffer full");
+        return false;
+    }
+    return true;
+}
+
+int MidiJitterBuffer :: play(uint32_t nowUs){
+    int result = 0;
+    while (count>0 && (int32_t)(nowUs - events[head].due_us) >= 0){
+        Event &event = events[head];
+        head = (head + 1) % MIDI_JITTER_BUFFER_SIZE;
+        count--;
+        dispatch(event);
+        result++;
+    }
+    return result;
+}
+
+uint32_t MidiJitterBuffer :: nextDueUs(uint32_t nowUs){
+    if (count==0){
+        return 0xFFFFFFFF;
+    }
+    int32_t diff = (int32_t)(events[head].due_us - nowUs);
+    return diff > 0 ? diff : 0;
+}
+
+void MidiJitterBuffer :: flush(){
+    while (count>0){
+        Event &event = events[head];
+        head = (head + 1) % MIDI_JITTER_BUFFER_SIZE;
+        count--;
+        dispatch(event);
+    }
+}
+
+void MidiJitterBuffer :: clear(){
+    head = 0;
+    count = 0;
+    window_pos = 0;
+    window_count = 0;
+    playout_offset = 0;
+    fastest_transit = 0;
+    stats = MidiJitterStatistics();
+}
+
+void MidiJitterBuffer :: updateOffset(int32_t transit){
+    window[window_pos] = transit;
+    window_pos = (window_pos + 1) % MIDI_JITTER_WINDOW;
+    if (window_count < MIDI_JITTER_WINDOW){
+        window_count++;
+    }
+    // the sort is only needed for every 4th transit or if the transit is outside of the expected range
+    if (window_count>1 && window_pos%4!=0 && transit>=fastest_transit && transit<=playout_offset){
+        return;
+    }
+
+    // determine the minimum and the percentile of the transit times with an insertion sort
+    int32_t sorted[MIDI_JITTER_WINDOW];
+    for (int j=0; j<window_count; j++){
+        int32_t value = window[j];
+        int k = j;
+        while (k>0 && sorted[k-1] > value){
+            sorted[k] = sorted[k-1];
+            k--;
+        }
+        sorted[k] = value;
+    }
+    int32_t fastest = sorted[0];
+    fastest_transit = fastest;
+    int32_t jitter = sorted[(window_count - 1) * percentile / 100] - fastest;
+
+    uint32_t latency = jitter + margin_us;
+    if (latency < min_latency_us) latency = min_latency_us;
+    if (latency > max_latency_us) latency = max_latency_us;
+    int32_t target = fastest + (int32_t)latency;
+
+    // grow immediatly to avoid late events, shrink slowly to avoid gaps
+    if (window_count==1 || target > playout_offset){
+        playout_offset = target;
+    } else {
+        playout_offset -= (playout_offset - target + 7) / 8;
+    }
+
+    stats.jitter_us = jitter;
+    stats.latency_us = playout_offset - fastest;
+}
+
+bool MidiJitterBuffer :: insert(uint32_t dueUs, const uint8_t *msg, int len){
+    if (count>=MIDI_JITTER_BUFFER_SIZE){
+        return false;
+    }
+    // events mostly arrive in order: so we search from the end and keep equal times in arrival order
+    int pos = count;
+    while (pos>0){
+        Event &prev = events[(head + pos - 1) % MIDI_JITTER_BUFFER_SIZE];
+        if ((int32_t)(dueUs - prev.due_us) >= 0){
+            break;
+        }
+        events[(head + pos) % MIDI_JITTER_BUFFER_SIZE] = prev;
+        pos--;
+    }
+    Event &event = events[(head + pos) % MIDI_JITTER_BUFFER_SIZE];
+    event.due_us = dueUs;
+    event.len = len;
+    memcpy(event.msg, msg, len);
+    count++;
+    return true;
+}
+
+}
+
+#endif
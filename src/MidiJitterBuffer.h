@@ -0,0 +1,136 @@
+#pragma once
+#include "ConfigMidi.h"
+
+#if MIDI_ACTIVE
+
+#include "MidiParser.h"
+
+#ifndef MIDI_JITTER_BUFFER_SIZE
+#define MIDI_JITTER_BUFFER_SIZE 64
+#endif
+
+#ifndef MIDI_JITTER_WINDOW
+#define MIDI_JITTER_WINDOW 64
+#endif
+
+namespace midi {
+
+/**
+ * @brief Statistics of the playout: the events which were played too late because they
+ * arrived after their playout time and the events which were dropped because the buffer
+ * was full. The latency is the current delay on top of the fastest transit.
+ */
+struct MidiJitterStatistics {
+    uint32_t events = 0;
+    uint32_t late = 0;
+    uint32_t dropped = 0;
+    uint32_t latency_us = 0;
+    uint32_t jitter_us = 0;
+    uint32_t max_late_us = 0;
+
+    /// Share of the events which were not played in time
+    float lateRatio() {
+        return events == 0 ? 0.0f : (float) (late + dropped) / events;
+    }
+};
+
+/***************************************************/
+/*! \class MidiJitterBuffer
+    \brief Playout stage which delays the received midi events
+    so that they are played with the timing of the sender.
+    Each event is scheduled at its sender timestamp plus the
+    transit time which covers the configured percentile of the
+    recently observed transit times: the latency grows fast
+    when the jitter increases and shrinks slowly when it goes
+    down. The events are kept in a fixed ring, so nothing is
+    allocated: SysEx is not buffered.
+
+    All times are in us and may wrap around.
+
+    by Phil Schatzmann
+*/
+/***************************************************/
+
+class MidiJitterBuffer {
+    public:
+        MidiJitterBuffer() = default;
+
+        /// Defines the parser which receives the events when they are due
+        void begin(MidiParser *parser) {
+            p_parser = parser;
+            clear();
+        }
+
+        /// Defines the range of the latency on top of the fastest transit and the additional safety margin
+        void setLatency(uint32_t minUs, uint32_t maxUs, uint32_t marginUs=1000) {
+            min_latency_us = minUs;
+            max_latency_us = maxUs;
+            margin_us = marginUs;
+        }
+
+        /// Percentile (0-100) of the transit times which should be played in time
+        void setPercentile(uint8_t percent) {
+            percentile = percent > 100 ? 100 : percent;
+        }
+
+        /// Schedules a midi message with the status byte (max 3 bytes) which was sent at remoteUs and received at nowUs: returns false if it was dropped
+        bool write(uint32_t remoteUs, uint32_t nowUs, const uint8_t *msg, int len);
+
+        /// Plays all events which are due: returns the number of played events
+        int play(uint32_t nowUs);
+
+        /// Time in us until the next event is due: 0xFFFFFFFF if the buffer is empty
+        uint32_t nextDueUs(uint32_t nowUs);
+
+        /// Number of buffered events
+        int available() {
+            return count;
+        }
+
+        /// Plays all buffered events immediatly
+        void flush();
+
+        /// Removes all events and restarts the latency estimation
+        void clear();
+
+        MidiJitterStatistics &statistics() {
+            return stats;
+        }
+
+    protected:
+        struct Event {
+            uint32_t due_us;
+            uint8_t msg[3];
+            uint8_t len;
+        };
+        MidiParser *p_parser = nullptr;
+        Event events[MIDI_JITTER_BUFFER_SIZE];
+        int head = 0;
+        int count = 0;
+        // transit times relative to the first one
+        int32_t window[MIDI_JITTER_WINDOW];
+        int window_pos = 0;
+        int window_count = 0;
+        uint32_t transit_ref = 0;
+        int32_t playout_offset = 0;
+        int32_t fastest_transit = 0;
+        uint32_t min_latency_us = 2000;
+        uint32_t max_latency_us = 50000;
+        uint32_t margin_us = 1000;
+        uint8_t percentile = 95;
+        MidiJitterStatistics stats;
+
+        /// records the transit time and recalculates the playout offset
+        void updateOffset(int32_t transit);
+        /// inserts the event sorted by the due time
+        bool insert(uint32_t dueUs, const uint8_t *msg, int len);
+        void dispatch(Event &event) {
+            if (p_parser!=nullptr){
+                p_parser->dispatch(event.msg[0], event.len>1 ? event.msg[1] : 0, event.len>2 ? event.msg[2] : 0);
+            }
+        }
+};
+
+} // namespace
+
+#endif
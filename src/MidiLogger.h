@@ -6,9 +6,10 @@ extern MidiLogLevel_t MidiLogLevel;
 
 void midi_log(MidiLogLevel_t level, const char* fmr,...);
 
-#define MIDI_LOGD(fmt,...) midi_log(MidiDebug, fmt, ##__VA_ARGS__)
-#define MIDI_LOGI(fmt,...) midi_log(MidiInfo, fmt, ##__VA_ARGS__)
-#define MIDI_LOGW(fmt,...) midi_log(MidiWarning, fmt, ##__VA_ARGS__)
+// the level is checked before the call, so that the arguments are not evaluated in the hot paths
+#define MIDI_LOGD(fmt,...) do { if (MidiLogLevel<=MidiDebug) midi_log(MidiDebug, fmt, ##__VA_ARGS__); } while(0)
+#define MIDI_LOGI(fmt,...) do { if (MidiLogLevel<=MidiInfo) midi_log(MidiInfo, fmt, ##__VA_ARGS__); } while(0)
+#define MIDI_LOGW(fmt,...) do { if (MidiLogLevel<=MidiWarning) midi_log(MidiWarning, fmt, ##__VA_ARGS__); } while(0)
 #define MIDI_LOGE(fmt,...) midi_log(MidiError, fmt, ##__VA_ARGS__)
 
 
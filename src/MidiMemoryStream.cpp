@@ -0,0 +1,53 @@
+#include "MidiMemoryStream.h"
+#if MIDI_ACTIVE
+
+namespace midi {
+
+void MidiMemoryStream :: begin(uint8_t *buffer, size_t size, size_t len) {
+    p_buffer = buffer;
+    buffer_size = size;
+    read_pos = 0;
+    write_pos = len < size ? len : size;
+}
+
+int MidiMemoryStream :: read() {
+    if (read_pos>=write_pos){
+        return -1;
+    }
+    return p_buffer[read_pos++];
+}
+
+int MidiMemoryStream :: peek() {
+    if (read_pos>=write_pos){
+        return -1;
+    }
+    return p_buffer[read_pos];
+}
+
+size_t MidiMemoryStream :: readBytes(uint8_t *buffer, size_t length) {
+    size_t len = write_pos - read_pos;
+    if (length < len){
+        len = length;
+    }
+    memcpy(buffer, p_buffer + read_pos, len);
+    read_pos += len;
+    return len;
+}
+
+size_t MidiMemoryStream :: write(uint8_t value) {
+    return write(&value, 1);
+}
+
+size_t MidiMemoryStream :: write(const uint8_t *buffer, size_t size) {
+    size_t len = buffer_size - write_pos;
+    if (size < len){
+        len = size;
+    }
+    memcpy(p_buffer + write_pos, buffer, len);
+    write_pos += len;
+    return len;
+}
+
+}
+
+#endif
@@ -0,0 +1,62 @@
+#pragma once
+#include "ConfigMidi.h"
+#if MIDI_ACTIVE
+
+#include "Stream.h"
+
+namespace midi {
+
+/***************************************************/
+/*! \class MidiMemoryStream
+    \brief Arduino Stream over a memory buffer which
+    can be used with MidiStreamIn and MidiStreamOut
+    without any device: e.g. to replay recorded MIDI
+    data in tests and benchmarks or to capture the
+    output. The written bytes are appended and the
+    read bytes are consumed: rewind() replays them.
+
+    by Phil Schatzmann
+*/
+/***************************************************/
+
+class MidiMemoryStream : public Stream {
+    public:
+        MidiMemoryStream() = default;
+        /// Uses the buffer with the indicated size: the first len bytes are available for reading
+        MidiMemoryStream(uint8_t *buffer, size_t size, size_t len=0) {
+            begin(buffer, size, len);
+        }
+
+        /// Uses the buffer with the indicated size: the first len bytes are available for reading
+        void begin(uint8_t *buffer, size_t size, size_t len=0);
+        /// Makes the read data available again
+        void rewind() { read_pos = 0; }
+        /// Removes all data
+        void clear() { read_pos = 0; write_pos = 0; }
+        /// Provides the buffer
+        uint8_t *data() { return p_buffer; }
+        /// Number of written bytes
+        size_t size() { return write_pos; }
+
+        int available() override { return write_pos - read_pos; }
+        int read() override;
+        int peek() override;
+        /// Copies the available data without waiting for the timeout
+        size_t readBytes(uint8_t *buffer, size_t length);
+        size_t readBytes(char *buffer, size_t length) {
+            return readBytes((uint8_t*)buffer, length);
+        }
+        size_t write(uint8_t value) override;
+        size_t write(const uint8_t *buffer, size_t size) override;
+        using Print::write;
+
+    protected:
+        uint8_t *p_buffer = nullptr;
+        size_t buffer_size = 0;
+        size_t read_pos = 0;
+        size_t write_pos = 0;
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,53 @@
+#include "MidiPacketQueue.h"
+#if MIDI_ACTIVE
+
+namespace midi {
+
+bool MidiPacketQueue :: write(const uint8_t *data, int len, uint32_t timeUs){
+    if (len > MIDI_PACKET_QUEUE_SLOT_SIZE){
+        stats.oversize++;
+        return false;
+    }
+    uint16_t pos = head;
+    uint16_t depth = pos - __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+    if (depth >= MIDI_PACKET_QUEUE_SIZE){
+        stats.dropped++;
+        return false;
+    }
+
+    Slot &slot = slots[pos % MIDI_PACKET_QUEUE_SIZE];
+    slot.time_us = timeUs;
+    slot.len = len;
+    memcpy(slot.data, data, len);
+    // the slot is published after it has been filled
+    __atomic_store_n(&head, (uint16_t)(pos + 1), __ATOMIC_RELEASE);
+
+    stats.packets++;
+    if (depth + 1 > stats.max_depth){
+        stats.max_depth = depth + 1;
+    }
+    return true;
+}
+
+const uint8_t *MidiPacketQueue :: peek(int &len, uint32_t &timeUs){
+    uint16_t pos = tail;
+    if (pos == __atomic_load_n(&head, __ATOMIC_ACQUIRE)){
+        return nullptr;
+    }
+    Slot &slot = slots[pos % MIDI_PACKET_QUEUE_SIZE];
+    len = slot.len;
+    timeUs = slot.time_us;
+    return slot.data;
+}
+
+void MidiPacketQueue :: pop(){
+    uint16_t pos = tail;
+    if (pos != __atomic_load_n(&head, __ATOMIC_ACQUIRE)){
+        // the slot can be reused by the writer after this
+        __atomic_store_n(&tail, (uint16_t)(pos + 1), __ATOMIC_RELEASE);
+    }
+}
+
+}
+
+#endif
@@ -0,0 +1,83 @@
+#pragma once
+#include "ConfigMidi.h"
+
+#if MIDI_ACTIVE
+
+#include <stdint.h>
+#include <string.h>
+
+// number of slots: must be a power of 2
+#ifndef MIDI_PACKET_QUEUE_SIZE
+#define MIDI_PACKET_QUEUE_SIZE 16
+#endif
+
+#ifndef MIDI_PACKET_QUEUE_SLOT_SIZE
+#define MIDI_PACKET_QUEUE_SLOT_SIZE 128
+#endif
+
+namespace midi {
+
+/**
+ * @brief Statistics of the MidiPacketQueue: the dropped packets did not fit into the
+ * queue because it was full, the oversize ones did not fit into a slot. The counters
+ * are only updated by the writer.
+ */
+struct MidiPacketQueueStatistics {
+    uint32_t packets = 0;
+    uint32_t dropped = 0;
+    uint32_t oversize = 0;
+    uint16_t max_depth = 0;
+};
+
+/***************************************************/
+/*! \class MidiPacketQueue
+    \brief Lock free queue for one writer and one reader
+    task (e.g. a BLE callback and the loop) which hands
+    over the received packets together with their
+    arrival time. The packets are copied once into a
+    fixed slot: the reader processes them in place. The
+    writer never waits: if the queue is full the packet
+    is dropped.
+
+    by Phil Schatzmann
+*/
+/***************************************************/
+
+class MidiPacketQueue {
+    public:
+        MidiPacketQueue() = default;
+
+        /// Adds a packet which was received at timeUs (writer task): returns false if it was dropped
+        bool write(const uint8_t *data, int len, uint32_t timeUs);
+
+        /// Provides the oldest packet and its arrival time without removing it (reader task): nullptr if the queue is empty
+        const uint8_t *peek(int &len, uint32_t &timeUs);
+
+        /// Removes the oldest packet (reader task)
+        void pop();
+
+        /// Number of queued packets
+        int available() {
+            return (uint16_t)(__atomic_load_n(&head, __ATOMIC_ACQUIRE) - __atomic_load_n(&tail, __ATOMIC_ACQUIRE));
+        }
+
+        MidiPacketQueueStatistics &statistics() {
+            return stats;
+        }
+
+    protected:
+        struct Slot {
+            uint32_t time_us;
+            uint16_t len;
+            uint8_t data[MIDI_PACKET_QUEUE_SLOT_SIZE];
+        };
+        Slot slots[MIDI_PACKET_QUEUE_SIZE];
+        // free running positions: head is only changed by the writer, tail only by the reader
+        uint16_t head = 0;
+        uint16_t tail = 0;
+        MidiPacketQueueStatistics stats;
+};
+
+} // namespace
+
+#endif
@@ -14,6 +14,12 @@ MidiParser::~MidiParser(){
 void MidiParser::begin(MidiAction *p_MidiAction, int filter_channel){
   this->p_MidiAction = p_MidiAction;
   this->filter_channel = filter_channel;
+  reset();
+}
+
+void MidiParser::reset(){
+  running_status = 0;
+  running_channel = 0;
 }
 
 /**
@@ -22,7 +28,7 @@ void MidiParser::begin(MidiAction *p_MidiAction, int filter_channel){
  * @param [in] len length of the msg
  */
 
-void MidiParser::parse(uint8_t* msg, uint8_t len){
+void MidiParser::parse(uint8_t* msg, int len){
   // log hex values of msg
   if (MidiLogLevel==MidiDebug){
     char msg_hex[len*3+1];
@@ -31,39 +37,97 @@ void MidiParser::parse(uint8_t* msg, uint8_t len){
     }
     MIDI_LOGD( "parse: len: %d - %s", len, msg_hex);
   } 
+  // the running status is kept from the last call: the data bytes can arrive in a later read
+  uint8_t status = running_status;
+  uint8_t channel = running_channel;
   int pos = 0;
-  uint8_t status=0;
-  uint8_t channel=0;
-  uint8_t p1=0;
-  uint8_t p2=0;
 
   while (pos<len){
-    // find status ingnoring headers and timestamps
-    while (msg[pos]>>7 == 1) {
-      // if next is data we have a status record
-      if (pos+1<len && msg[pos+1]>>7 == 0){
+    uint8_t value = msg[pos++];
+    if (value >= 0xF8){
+      // real time messages can be inserted anywhere and do not change the running status
+      continue;
+    }
+    if (value>>7 == 1){
+      if (value >= 0xF0){
+        // system common messages cancel the running status
+        status = 0;
+      } else {
         // status: 0b1001 << 4 | channel;
-        status = msg[pos] >> 4;  // high 4 bits
-        channel = msg[pos] & 0x0F; // lower 4 bits
-        p1 = 0;
-        p2 = 0;
+        status = value >> 4;  // high 4 bits
+        channel = value & 0x0F; // lower 4 bits
       }
-      pos++;
+      continue;
+    }
+
+    // data bytes without status are ignored
+    if (status==0){
+      continue;
     }
-     
-    // process data bytes
-    if (msg[pos]>>7 == 0) { // data
-      p1 = msg[pos];
-      // check if we have 2 data bytes
-      if (pos+1<len && msg[pos+1]>>7 == 0) {
+    uint8_t p1 = value;
+    uint8_t p2 = 0;
+    if (dataLength(status << 4)==2){
+      while (pos<len && msg[pos] >= 0xF8){
         pos++;
-        p2 = msg[pos];
-        onCommand(channel, status, p1, p2);
-      } else {
-        onCommand(channel, status, p1, 0);
-      }    
+      }
+      if (pos<len && msg[pos]>>7 == 0){
+        p2 = msg[pos++];
+      }
+    }
+    onCommand(channel, status, p1, p2);
+  }
+  running_status = status;
+  running_channel = channel;
+}
+
+/**
+ * @brief Determines the length of the complete messages in a byte stream, so that
+ * an incomplete message at the end can be kept until the missing bytes arrive
+ * @param [in] msg byte stream
+ * @param [in] len length of the msg
+ */
+int MidiParser::completeLength(uint8_t* msg, int len){
+  int result = 0;
+  int needed = 0;
+  int count = 0;
+  for (int pos=0; pos<len; pos++){
+    uint8_t value = msg[pos];
+    if (value >= 0xF8){
+      // real time messages can be inserted anywhere
+      if (count==0 && needed>=0) result = pos+1;
+    } else if (value >> 7 == 1){
+      needed = dataLength(value);
+      count = 0;
+      if (needed==0) result = pos+1;
+    } else if (needed>0){
+      // running status: the next message starts after needed data bytes
+      if (++count == needed) {
+        result = pos+1;
+        count = 0;
+      }
+    } else if (needed==0){
+      // data without status: nothing to wait for
+      result = pos+1;
     }
-    pos++;
+  }
+  return result;
+}
+
+int MidiParser::dataLength(uint8_t status){
+  switch(status & 0xF0){
+    case 0xC0:
+    case 0xD0:
+      return 1;
+    case 0xF0:
+      switch(status){
+        case 0xF0: return -1;
+        case 0xF1: 
+        case 0xF3: return 1;
+        case 0xF2: return 2;
+        default: return 0;
+      }
+    default:
+      return 2;
   }
 }
 
@@ -114,6 +178,11 @@ void MidiParser::onPitchBend(uint8_t channel, uint8_t value){
     p_MidiAction->onPitchBend(channel, value);
 };
 
+void MidiParser::onSysEx(const uint8_t *data, int len, int pos, bool complete){
+    MIDI_LOGI( "onSysEx len:%d, pos:%d, complete:%d", len, pos, (int)complete);
+    p_MidiAction->onSysEx(data, len, pos, complete);
+};
+
 
 } // namespace
 
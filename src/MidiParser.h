@@ -35,17 +35,32 @@ class MidiParser  {
         /// Assigns the MidiAction and optinally defines a midi channel
         void begin(MidiAction *MidiAction, int filter_channel = -1 );
 
-        /// Parse a string into midi messages
-        void parse(uint8_t*  msg, uint8_t len);
+        /// Parse a string into midi messages: the running status is kept for the next call
+        void parse(uint8_t*  msg, int len);
+        /// Forgets the running status: e.g. for a new connection or a datagram which must not continue the previous one
+        void reset();
+        /// Provides the number of bytes from the start which contain only complete midi messages
+        static int completeLength(uint8_t* msg, int len);
+        /// Provides the number of data bytes which follow the status byte (-1 for sysex)
+        static int dataLength(uint8_t status);
+        /// Dispatches a decoded message with the complete status byte: e.g. for decoders which already know the status and the length
+        void dispatch(uint8_t status, uint8_t p1=0, uint8_t p2=0) {
+            onCommand(status & 0x0F, status >> 4, p1, p2);
+        }
         virtual void onCommand(uint8_t channel, uint8_t status, uint8_t p1,uint8_t p2 );
         virtual void onNoteOn(uint8_t note, uint8_t velocity,uint8_t channel);
         virtual void onNoteOff(uint8_t note, uint8_t velocity,uint8_t channel);
         virtual void onPitchBend( uint8_t value, uint8_t channel);
         virtual void onControlChange( uint8_t controller, uint8_t controllerValue, uint8_t channel);
+        /// Reassembled SysEx message or a part of a streamed one (without F0 and F7)
+        virtual void onSysEx(const uint8_t *data, int len, int pos, bool complete);
 
     protected:
         MidiAction *p_MidiAction = nullptr; 
         int filter_channel = -1;
+        // status (high 4 bits) and channel of the last channel message: 0 if there is none
+        uint8_t running_status = 0;
+        uint8_t running_channel = 0;
 
 };
 
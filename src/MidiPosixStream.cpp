@@ -0,0 +1,164 @@
+#include "MidiPosixStream.h"
+#if MIDI_ACTIVE && MIDI_HOST_ACTIVE
+
+#include "MidiLogger.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <termios.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+namespace midi {
+
+MidiPosixStream :: MidiPosixStream(int fd, bool closeOnEnd) {
+    begin(fd, closeOnEnd);
+}
+
+MidiPosixStream :: ~MidiPosixStream() {
+    end();
+}
+
+bool MidiPosixStream :: begin(int fd, bool closeOnEnd) {
+    end();
+    if (fd<0){
+        return false;
+    }
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    file_fd = fd;
+    close_on_end = closeOnEnd;
+    is_eof = false;
+    rx_len = 0;
+    rx_pos = 0;
+    return true;
+}
+
+bool MidiPosixStream :: open(const char* path) {
+    int fd = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd<0){
+        MIDI_LOGE("open %s: %s", path, strerror(errno));
+        return false;
+    }
+    // serial devices and pseudo terminals: MIDI is binary, so the line discipline must not change or echo any byte
+    if (isatty(fd)){
+        struct termios tio;
+        if (tcgetattr(fd, &tio)==0){
+            cfmakeraw(&tio);
+            tcsetattr(fd, TCSANOW, &tio);
+        }
+    }
+    return begin(fd, true);
+}
+
+bool MidiPosixStream :: connect(IPAddress ip, uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd<0){
+        MIDI_LOGE("socket: %s", strerror(errno));
+        return false;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    uint8_t *a = (uint8_t*) &addr.sin_addr.s_addr;
+    a[0] = ip[0]; a[1] = ip[1]; a[2] = ip[2]; a[3] = ip[3];
+    addr.sin_port = htons(port);
+    if (::connect(fd, (struct sockaddr*)&addr, sizeof(addr))<0){
+        MIDI_LOGE("connect %d: %s", port, strerror(errno));
+        close(fd);
+        return false;
+    }
+    return begin(fd, true);
+}
+
+bool MidiPosixStream :: setNoDelay(bool active) {
+    int on = active ? 1 : 0;
+    return file_fd>=0 && setsockopt(file_fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on))==0;
+}
+
+void MidiPosixStream :: end() {
+    if (file_fd>=0 && close_on_end){
+        close(file_fd);
+    }
+    file_fd = -1;
+    rx_len = 0;
+    rx_pos = 0;
+}
+
+int MidiPosixStream :: fill() {
+    if (rx_pos < rx_len){
+        return rx_len - rx_pos;
+    }
+    rx_len = 0;
+    rx_pos = 0;
+    if (file_fd<0 || is_eof){
+        return 0;
+    }
+    int len = ::read(file_fd, rx_buffer, MIDI_POSIX_STREAM_BUFFER);
+    if (len>0){
+        rx_len = len;
+    } else if (len==0 || (errno!=EAGAIN && errno!=EWOULDBLOCK && errno!=EINTR)){
+        is_eof = true;
+    }
+    return rx_len;
+}
+
+int MidiPosixStream :: available() {
+    return fill();
+}
+
+int MidiPosixStream :: read() {
+    if (fill()<=0){
+        return -1;
+    }
+    return rx_buffer[rx_pos++];
+}
+
+int MidiPosixStream :: peek() {
+    if (fill()<=0){
+        return -1;
+    }
+    return rx_buffer[rx_pos];
+}
+
+int MidiPosixStream :: read(uint8_t *buffer, size_t len) {
+    int avail = fill();
+    if ((int)len > avail){
+        len = avail;
+    }
+    memcpy(buffer, rx_buffer+rx_pos, len);
+    rx_pos += len;
+    return len;
+}
+
+size_t MidiPosixStream :: write(uint8_t value) {
+    return write(&value, 1);
+}
+
+size_t MidiPosixStream :: write(const uint8_t *buffer, size_t size) {
+    size_t pos = 0;
+    while (file_fd>=0 && pos < size){
+        int len = ::write(file_fd, buffer+pos, size-pos);
+        if (len>0){
+            pos += len;
+        } else if (len<0 && (errno==EAGAIN || errno==EWOULDBLOCK)){
+            // output buffer full: wait until it becomes writable
+            struct pollfd pfd = {file_fd, POLLOUT, 0};
+            if (poll(&pfd, 1, 100)<=0){
+                break;
+            }
+        } else if (len<0 && errno==EINTR){
+            continue;
+        } else {
+            is_eof = true;
+            break;
+        }
+    }
+    return pos;
+}
+
+} // namespace
+
+#endif
@@ -0,0 +1,73 @@
+#pragma once
+#include "ConfigMidi.h"
+#if MIDI_ACTIVE && MIDI_HOST_ACTIVE
+
+#include "Stream.h"
+#include "IPAddress.h"
+
+#ifndef MIDI_POSIX_STREAM_BUFFER
+#define MIDI_POSIX_STREAM_BUFFER 512
+#endif
+
+namespace midi {
+
+/***************************************************/
+/*! \class MidiPosixStream
+    \brief Arduino Stream over a non blocking POSIX
+    file descriptor which can be used on a Linux host
+    with MidiStreamIn and MidiStreamOut: e.g. a serial
+    device, a pseudo terminal, a pipe or a TCP socket.
+
+    Input is read with one read() call per available()
+    into an internal buffer, so that the single byte
+    Stream API does not cost a syscall per byte.
+
+    by Phil Schatzmann
+*/
+/***************************************************/
+
+class MidiPosixStream : public Stream {
+    public:
+        MidiPosixStream() = default;
+        /// Uses an already open file descriptor
+        MidiPosixStream(int fd, bool closeOnEnd=true);
+        ~MidiPosixStream();
+
+        /// Uses an already open file descriptor which is switched to non blocking
+        bool begin(int fd, bool closeOnEnd=true);
+        /// Opens a device or file: e.g. /dev/ttyUSB0 or a pseudo terminal (which is switched to raw mode)
+        bool open(const char* path);
+        /// Opens a TCP connection
+        bool connect(IPAddress ip, uint16_t port);
+        /// Closes the file descriptor
+        void end();
+        /// Returns true as long as the file descriptor is open and no EOF was reported
+        bool connected() { return file_fd>=0 && !is_eof; }
+        /// Provides the file descriptor (e.g. for poll or epoll) or -1
+        int fd() { return file_fd; }
+        /// Disables Nagle's algorithm of a TCP connection (like WiFiClient::setNoDelay)
+        bool setNoDelay(bool active);
+
+        int available() override;
+        int read() override;
+        int peek() override;
+        /// Reads only the buffered and immediatly available bytes
+        int read(uint8_t *buffer, size_t len);
+        size_t write(uint8_t value) override;
+        size_t write(const uint8_t *buffer, size_t size) override;
+        using Print::write;
+
+    protected:
+        int file_fd = -1;
+        bool close_on_end = true;
+        bool is_eof = false;
+        uint8_t rx_buffer[MIDI_POSIX_STREAM_BUFFER];
+        int rx_len = 0;
+        int rx_pos = 0;
+
+        int fill();
+};
+
+} // namespace
+
+#endif
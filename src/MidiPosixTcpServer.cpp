@@ -0,0 +1,105 @@
+#include "MidiPosixTcpServer.h"
+#if MIDI_ACTIVE && MIDI_HOST_ACTIVE
+
+#include "MidiLogger.h"
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+namespace midi {
+
+MidiPosixTcpServer :: ~MidiPosixTcpServer() {
+    end();
+}
+
+bool MidiPosixTcpServer :: begin(uint16_t port) {
+    end();
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listen_fd<0){
+        MIDI_LOGE("socket: %s", strerror(errno));
+        return false;
+    }
+    int on = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr))<0 || listen(listen_fd, SOMAXCONN)<0){
+        MIDI_LOGE("bind/listen %d: %s", port, strerror(errno));
+        end();
+        return false;
+    }
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd<0 || !add(listen_fd, LISTEN_ID)){
+        MIDI_LOGE("epoll: %s", strerror(errno));
+        end();
+        return false;
+    }
+    return true;
+}
+
+void MidiPosixTcpServer :: end() {
+    if (epoll_fd>=0){
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+    if (listen_fd>=0){
+        close(listen_fd);
+        listen_fd = -1;
+    }
+}
+
+int MidiPosixTcpServer :: accept() {
+    if (listen_fd<0){
+        return -1;
+    }
+    int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK);
+    if (fd<0 && errno!=EAGAIN && errno!=EWOULDBLOCK){
+        MIDI_LOGE("accept: %s", strerror(errno));
+    }
+    return fd;
+}
+
+bool MidiPosixTcpServer :: add(int fd, int id) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.u32 = (uint32_t) id;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event)==0;
+}
+
+void MidiPosixTcpServer :: remove(int fd) {
+    if (epoll_fd>=0){
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    }
+}
+
+int MidiPosixTcpServer :: wait(int *ids, int maxIds, int timeoutMs) {
+    if (epoll_fd<0){
+        return 0;
+    }
+    struct epoll_event events[MIDI_POSIX_TCP_MAX_EVENTS];
+    if (maxIds > MIDI_POSIX_TCP_MAX_EVENTS){
+        maxIds = MIDI_POSIX_TCP_MAX_EVENTS;
+    }
+    int count = epoll_wait(epoll_fd, events, maxIds, timeoutMs);
+    if (count<0){
+        if (errno!=EINTR){
+            MIDI_LOGE("epoll_wait: %s", strerror(errno));
+        }
+        return 0;
+    }
+    for (int j=0; j<count; j++){
+        ids[j] = (int) events[j].data.u32;
+    }
+    return count;
+}
+
+} // namespace
+
+#endif
@@ -0,0 +1,57 @@
+#pragma once
+#include "ConfigMidi.h"
+#if MIDI_ACTIVE && MIDI_HOST_ACTIVE
+
+#include <stdint.h>
+
+/// Max number of events which are reported by one wait() call
+#ifndef MIDI_POSIX_TCP_MAX_EVENTS
+#define MIDI_POSIX_TCP_MAX_EVENTS 64
+#endif
+
+namespace midi {
+
+/***************************************************/
+/*! \class MidiPosixTcpServer
+    \brief Non blocking TCP server socket for a Linux
+    host which uses epoll to report the readable
+    connections, so that the effort does not grow with
+    the number of idle connections.
+
+    The connections are registered with an id (e.g.
+    the index in the client table) which is reported
+    by wait(). The server socket reports LISTEN_ID
+    when new connections can be accepted.
+
+    by Phil Schatzmann
+*/
+/***************************************************/
+
+class MidiPosixTcpServer {
+    public:
+        /// Id which is reported for the server socket
+        static const int LISTEN_ID = -1;
+
+        ~MidiPosixTcpServer();
+
+        /// Listens on the indicated port
+        bool begin(uint16_t port);
+        /// Closes the server socket
+        void end();
+        /// Accepts a new connection: returns the non blocking file descriptor or -1
+        int accept();
+        /// Registers a connection so that it is reported by wait()
+        bool add(int fd, int id);
+        /// Unregisters a connection (before it is closed)
+        void remove(int fd);
+        /// Waits max timeoutMs for data: provides the ids of the ready connections and returns their number
+        int wait(int *ids, int maxIds, int timeoutMs=0);
+
+    protected:
+        int listen_fd = -1;
+        int epoll_fd = -1;
+};
+
+} // namespace
+
+#endif
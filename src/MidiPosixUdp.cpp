@@ -0,0 +1,316 @@
+#include "MidiPosixUdp.h"
+#if MIDI_ACTIVE && MIDI_HOST_ACTIVE
+
+#include "MidiLogger.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+
+namespace midi {
+
+MidiPosixUDP :: MidiPosixUDP() {
+    rx = new Batch();
+    tx = new Batch();
+    for (int j=0; j<MIDI_POSIX_UDP_BATCH_MAX; j++){
+        rx->iov[j].iov_base = rx->data[j];
+        rx->iov[j].iov_len = MIDI_POSIX_UDP_MAX_PACKET;
+        struct msghdr &hdr = rx->msgs[j].msg_hdr;
+        hdr.msg_name = &rx->addr[j];
+        hdr.msg_iov = &rx->iov[j];
+        hdr.msg_iovlen = 1;
+    }
+}
+
+MidiPosixUDP :: ~MidiPosixUDP() {
+    stop();
+    delete rx;
+    delete tx;
+}
+
+bool MidiPosixUDP :: openSocket() {
+    if (socket_fd>=0){
+        return true;
+    }
+    socket_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (socket_fd<0){
+        MIDI_LOGE("socket: %s", strerror(errno));
+        return false;
+    }
+    if (multicast_if != IPAddress()){
+        struct in_addr addr;
+        toInAddr(multicast_if, addr);
+        setsockopt(socket_fd, IPPROTO_IP, IP_MULTICAST_IF, &addr, sizeof(addr));
+    }
+    return true;
+}
+
+uint8_t MidiPosixUDP :: begin(uint16_t port) {
+    stop();
+    if (!openSocket()){
+        return 0;
+    }
+    int on = 1;
+    setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(socket_fd, (struct sockaddr*)&addr, sizeof(addr))<0){
+        MIDI_LOGE("bind %d: %s", port, strerror(errno));
+        stop();
+        return 0;
+    }
+    return 1;
+}
+
+uint8_t MidiPosixUDP :: beginMulticast(IPAddress group, uint16_t port) {
+    if (!begin(port)){
+        return 0;
+    }
+    struct ip_mreq mreq;
+    toInAddr(group, mreq.imr_multiaddr);
+    toInAddr(multicast_if, mreq.imr_interface);
+    if (setsockopt(socket_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq))<0){
+        MIDI_LOGE("IP_ADD_MEMBERSHIP: %s", strerror(errno));
+        stop();
+        return 0;
+    }
+    // receivers in the same process or on the same host get a copy as well
+    int on = 1;
+    setsockopt(socket_fd, IPPROTO_IP, IP_MULTICAST_LOOP, &on, sizeof(on));
+    return 1;
+}
+
+void MidiPosixUDP :: setMulticastInterface(IPAddress address) {
+    multicast_if = address;
+    if (socket_fd>=0){
+        struct in_addr addr;
+        toInAddr(address, addr);
+        setsockopt(socket_fd, IPPROTO_IP, IP_MULTICAST_IF, &addr, sizeof(addr));
+    }
+}
+
+void MidiPosixUDP :: toInAddr(IPAddress &ip, struct in_addr &result) {
+    uint8_t *a = (uint8_t*) &result.s_addr;
+    a[0] = ip[0]; a[1] = ip[1]; a[2] = ip[2]; a[3] = ip[3];
+}
+
+void MidiPosixUDP :: stop() {
+    if (socket_fd>=0){
+        sendQueued();
+        close(socket_fd);
+        socket_fd = -1;
+    }
+    rx_count = 0;
+    rx_index = -1;
+    tx_count = 0;
+    tx_open = false;
+}
+
+void MidiPosixUDP :: setReceiveBatch(int count) {
+    rx_batch = count < 1 ? 1 : count > MIDI_POSIX_UDP_BATCH_MAX ? MIDI_POSIX_UDP_BATCH_MAX : count;
+}
+
+void MidiPosixUDP :: setSendBatch(int count) {
+    sendQueued();
+    tx_batch = count < 1 ? 1 : count > MIDI_POSIX_UDP_BATCH_MAX ? MIDI_POSIX_UDP_BATCH_MAX : count;
+}
+
+int MidiPosixUDP :: beginPacket(IPAddress ip, uint16_t port) {
+    if (!openSocket()){
+        return 0;
+    }
+    if (tx_open){
+        endPacket();
+    }
+    struct sockaddr_in &addr = tx->addr[tx_count];
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    toInAddr(ip, addr.sin_addr);
+    addr.sin_port = htons(port);
+    tx->iov[tx_count].iov_base = tx->data[tx_count];
+    tx->iov[tx_count].iov_len = 0;
+    tx_open = true;
+    return 1;
+}
+
+int MidiPosixUDP :: beginPacket(const char *host, uint16_t port) {
+    IPAddress ip;
+    if (!hostByName(host, ip)){
+        return 0;
+    }
+    return beginPacket(ip, port);
+}
+
+size_t MidiPosixUDP :: write(uint8_t value) {
+    return write(&value, 1);
+}
+
+size_t MidiPosixUDP :: write(const uint8_t *buffer, size_t size) {
+    if (!tx_open){
+        return 0;
+    }
+    struct iovec &iov = tx->iov[tx_count];
+    size_t len = size;
+    if (iov.iov_len + len > MIDI_POSIX_UDP_MAX_PACKET){
+        len = MIDI_POSIX_UDP_MAX_PACKET - iov.iov_len;
+    }
+    memcpy((uint8_t*)iov.iov_base + iov.iov_len, buffer, len);
+    iov.iov_len += len;
+    return len;
+}
+
+int MidiPosixUDP :: endPacket() {
+    if (!tx_open){
+        return 0;
+    }
+    struct mmsghdr &msg = tx->msgs[tx_count];
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_hdr.msg_name = &tx->addr[tx_count];
+    msg.msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    msg.msg_hdr.msg_iov = &tx->iov[tx_count];
+    msg.msg_hdr.msg_iovlen = 1;
+    tx_count++;
+    tx_open = false;
+    if (tx_count >= tx_batch){
+        return sendQueued() ? 1 : 0;
+    }
+    return 1;
+}
+
+void MidiPosixUDP :: flush() {
+    sendQueued();
+}
+
+bool MidiPosixUDP :: sendQueued() {
+    int start = 0;
+    bool result = true;
+    while (start < tx_count){
+        int sent = sendmmsg(socket_fd, &tx->msgs[start], tx_count-start, MSG_DONTWAIT);
+        stats.send_calls++;
+        if (sent>0){
+            stats.datagrams_sent += sent;
+            start += sent;
+        } else if (sent<0 && (errno==EAGAIN || errno==EWOULDBLOCK)){
+            // socket buffer is full: wait a bit until it becomes writable
+            struct pollfd pfd = {socket_fd, POLLOUT, 0};
+            if (poll(&pfd, 1, 10)<=0){
+                break;
+            }
+        } else {
+            MIDI_LOGE("sendmmsg: %s", strerror(errno));
+            break;
+        }
+    }
+    if (start < tx_count){
+        stats.datagrams_dropped += tx_count - start;
+        result = false;
+    }
+    tx_count = 0;
+    return result;
+}
+
+int MidiPosixUDP :: parsePacket() {
+    if (tx_count>0){
+        sendQueued();
+    }
+    if (socket_fd<0){
+        return 0;
+    }
+    // use the next already received datagram
+    if (rx_index+1 < rx_count){
+        rx_index++;
+        rx_pos = 0;
+        return rxLen();
+    }
+
+    // fetch the next batch: the kernel only updates the address length
+    for (int j=0; j<rx_batch; j++){
+        rx->msgs[j].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    }
+    int count = recvmmsg(socket_fd, rx->msgs, rx_batch, MSG_DONTWAIT, nullptr);
+    stats.receive_calls++;
+    if (count<=0){
+        rx_count = 0;
+        rx_index = -1;
+        return 0;
+    }
+    stats.datagrams_received += count;
+    rx_count = count;
+    rx_index = 0;
+    rx_pos = 0;
+    return rxLen();
+}
+
+int MidiPosixUDP :: available() {
+    return rxLen() - rx_pos;
+}
+
+int MidiPosixUDP :: read() {
+    if (available()<=0){
+        return -1;
+    }
+    return rx->data[rx_index][rx_pos++];
+}
+
+int MidiPosixUDP :: read(unsigned char* buffer, size_t len) {
+    int avail = available();
+    if (avail<=0){
+        return 0;
+    }
+    if ((int)len > avail){
+        len = avail;
+    }
+    memcpy(buffer, rx->data[rx_index]+rx_pos, len);
+    rx_pos += len;
+    return len;
+}
+
+int MidiPosixUDP :: read(char* buffer, size_t len) {
+    return read((unsigned char*)buffer, len);
+}
+
+int MidiPosixUDP :: peek() {
+    if (available()<=0){
+        return -1;
+    }
+    return rx->data[rx_index][rx_pos];
+}
+
+IPAddress MidiPosixUDP :: remoteIP() {
+    if (rx_index<0 || rx_index>=rx_count){
+        return IPAddress();
+    }
+    uint8_t *a = (uint8_t*) &rx->addr[rx_index].sin_addr.s_addr;
+    return IPAddress(a[0], a[1], a[2], a[3]);
+}
+
+uint16_t MidiPosixUDP :: remotePort() {
+    if (rx_index<0 || rx_index>=rx_count){
+        return 0;
+    }
+    return ntohs(rx->addr[rx_index].sin_port);
+}
+
+bool MidiPosixUDP :: hostByName(const char* host, IPAddress &result) {
+    struct addrinfo hints;
+    struct addrinfo *info = nullptr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(host, nullptr, &hints, &info)!=0 || info==nullptr){
+        return false;
+    }
+    uint8_t *a = (uint8_t*) &((struct sockaddr_in*)info->ai_addr)->sin_addr.s_addr;
+    result = IPAddress(a[0], a[1], a[2], a[3]);
+    freeaddrinfo(info);
+    return true;
+}
+
+} // namespace
+
+#endif
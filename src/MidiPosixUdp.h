@@ -0,0 +1,120 @@
+#pragma once
+#include "ConfigMidi.h"
+#if MIDI_ACTIVE && MIDI_HOST_ACTIVE
+
+#include "Udp.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/// Max number of datagrams which are moved with one recvmmsg/sendmmsg call
+#ifndef MIDI_POSIX_UDP_BATCH_MAX
+#define MIDI_POSIX_UDP_BATCH_MAX 32
+#endif
+
+/// Max size of a single datagram
+#ifndef MIDI_POSIX_UDP_MAX_PACKET
+#define MIDI_POSIX_UDP_MAX_PACKET 1500
+#endif
+
+namespace midi {
+
+/**
+ * @brief Number of syscalls and datagrams of a MidiPosixUDP
+ */
+struct MidiPosixUdpStatistics {
+    uint32_t send_calls = 0;
+    uint32_t datagrams_sent = 0;
+    uint32_t datagrams_dropped = 0;
+    uint32_t receive_calls = 0;
+    uint32_t datagrams_received = 0;
+};
+
+/***************************************************/
+/*! \class MidiPosixUDP
+    \brief Implementation of the Arduino UDP API with
+    non blocking POSIX sockets which is used on a
+    Linux host instead of WiFiUDP.
+
+    parsePacket() fetches up to the receive batch size
+    of datagrams with one recvmmsg() call.
+
+    With a send batch size > 1, endPacket() only queues
+    the datagram: the queued datagrams are sent with one
+    sendmmsg() call when the batch is full, on flush()
+    or at the latest on the next parsePacket().
+
+    by Phil Schatzmann
+*/
+/***************************************************/
+
+class MidiPosixUDP : public UDP {
+    public:
+        MidiPosixUDP();
+        ~MidiPosixUDP();
+
+        uint8_t begin(uint16_t port) override;
+        /// Listens on the port and joins the multicast group
+        uint8_t beginMulticast(IPAddress group, uint16_t port);
+        void stop() override;
+        int beginPacket(IPAddress ip, uint16_t port) override;
+        int beginPacket(const char *host, uint16_t port) override;
+        int endPacket() override;
+        size_t write(uint8_t value) override;
+        size_t write(const uint8_t *buffer, size_t size) override;
+        using Print::write;
+        int parsePacket() override;
+        int available() override;
+        int read() override;
+        int read(unsigned char* buffer, size_t len) override;
+        int read(char* buffer, size_t len) override;
+        int peek() override;
+        /// Sends the queued datagrams
+        void flush() override;
+        IPAddress remoteIP() override;
+        uint16_t remotePort() override;
+
+        /// Defines the max number of datagrams fetched by one recvmmsg call (1 to MIDI_POSIX_UDP_BATCH_MAX)
+        void setReceiveBatch(int count);
+        /// Defines the number of datagrams which are queued for one sendmmsg call (1 = send immediatly)
+        void setSendBatch(int count);
+        /// Defines the local interface address which is used for multicast (default: any)
+        void setMulticastInterface(IPAddress address);
+        /// Provides the socket file descriptor (e.g. for poll) or -1
+        int fd() { return socket_fd; }
+        /// Provides the syscall and datagram statistics
+        MidiPosixUdpStatistics &statistics() { return stats; }
+        /// Resolves the host name to an IPv4 address
+        static bool hostByName(const char* host, IPAddress &result);
+
+    protected:
+        struct Batch {
+            struct mmsghdr msgs[MIDI_POSIX_UDP_BATCH_MAX];
+            struct iovec iov[MIDI_POSIX_UDP_BATCH_MAX];
+            struct sockaddr_in addr[MIDI_POSIX_UDP_BATCH_MAX];
+            uint8_t data[MIDI_POSIX_UDP_BATCH_MAX][MIDI_POSIX_UDP_MAX_PACKET];
+        };
+
+        int socket_fd = -1;
+        IPAddress multicast_if;
+        MidiPosixUdpStatistics stats;
+        Batch *rx = nullptr;
+        Batch *tx = nullptr;
+        int rx_batch = MIDI_POSIX_UDP_BATCH_MAX;
+        int tx_batch = 1;
+        // received datagrams
+        int rx_count = 0;
+        int rx_index = -1;
+        int rx_pos = 0;
+        // queued datagrams: the one at tx_count is open
+        int tx_count = 0;
+        bool tx_open = false;
+
+        bool openSocket();
+        static void toInAddr(IPAddress &ip, struct in_addr &result);
+        bool sendQueued();
+        int rxLen() { return rx_index>=0 && rx_index<rx_count ? (int) rx->msgs[rx_index].msg_len : 0; }
+};
+
+} // namespace
+
+#endif
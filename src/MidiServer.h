@@ -3,8 +3,12 @@
 
 #if MIDI_ACTIVE && TCP_ACTIVE
 
+#if !MIDI_HOST_ACTIVE
 #include <WiFi.h>
+#endif
 #include "MidiLogger.h"
+#include "MidiStreamIn.h"
+#include "MidiStreamOut.h"
 
 namespace midi {
 
@@ -39,34 +39,32 @@ void MidiStreamIn :: setup(Stream *stream, MidiParser *handler, bool releaseHand
 bool MidiStreamIn :: loop() {
     MIDI_LOGD( __PRETTY_FUNCTION__);
     bool processed = false;
-    if (pStream->available()>0){
-        int lenRead = pStream->readBytes(buffer+startPos, BUFFER_LEN-startPos);
+    int available = pStream->available();
+    if (available>0){
+        // read only what is available, so that readBytes does not wait for the timeout
+        int lenRequested = available < BUFFER_LEN-startPos ? available : BUFFER_LEN-startPos;
+        int lenRead = pStream->readBytes(buffer+startPos, lenRequested);
         if (lenRead>0){
-            MIDI_LOGI( "readBytes: %len", lenRead);
+            MIDI_LOGI( "readBytes: %d", lenRead);
             int endPos = startPos+lenRead;
-            int lastStatusPos = getLastStatusPos(buffer, endPos);
-            if (lastStatusPos>=0) {
-                pHandler->parse(buffer, lastStatusPos);
-                int lenUnprocessed = endPos-lastStatusPos;
-                // move unprocessed bytes to head
-                memmove(buffer, buffer+lastStatusPos, lenUnprocessed);
-                startPos = lenUnprocessed;
+            int len = MidiParser::completeLength(buffer, endPos);
+            // a message which does not fit into the buffer (e.g. sysex) is not kept
+            if (len==0 && endPos==BUFFER_LEN){
+                len = endPos;
+            }
+            if (len>0) {
+                pHandler->parse(buffer, len);
                 processed = true;
             }
+            // move incomplete message to head
+            int lenUnprocessed = endPos-len;
+            memmove(buffer, buffer+len, lenUnprocessed);
+            startPos = lenUnprocessed;
         }
     }
     return processed;
 }
 
-int MidiStreamIn :: getLastStatusPos(uint8_t* buffer, int pos){
-    while (pos>=0){
-        if (buffer[pos]>>7 == 1){
-            return pos; 
-        }
-        pos--;
-    }
-    return -1;
-} 
 
 
 } // namespace
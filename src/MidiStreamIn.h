@@ -39,8 +39,8 @@ class MidiStreamIn : public MidiCommon {
         friend class MidiServer;
         friend class MidiIpServer;
         friend class MidiUdpServer;
+        friend class MidiUdpMulticastServer;
 
-        int getLastStatusPos(uint8_t *buffer, int endPos);
         Stream *pStream = nullptr;
         MidiParser *pHandler = nullptr;
         bool ownsHandler = false;
@@ -23,6 +23,7 @@ class MidiStreamOut : public MidiCommon {
         friend class MidiServer;
         friend class MidiIpServer;
         friend class MidiUdpServer;
+        friend class MidiUdpMulticastServer;
 
         MidiStreamOut() = default;
 
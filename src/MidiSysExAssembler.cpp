@@ -0,0 +1,145 @@
+#include "MidiSysExAssembler.h"
+#if MIDI_ACTIVE
+#include "MidiLogger.h"
+
+namespace midi {
+
+void MidiSysExAssembler :: write(uint8_t source, const uint8_t *data, int len, int pos, uint32_t nowMs){
+    stats.chunks++;
+    Buffer *buffer = find(source);
+    if (pos==0){
+        // a new message while the last one was not completed
+        if (buffer!=nullptr){
+            stats.aborted++;
+            MIDI_LOGD("MidiSysExAssembler: message of %d aborted", source);
+            release(buffer);
+        }
+        buffer = alloc(source, nowMs);
+        if (buffer==nullptr && !is_streaming){
+            stats.exhausted++;
+            MIDI_LOGD("MidiSysExAssembler: message of %d dropped - no buffer", source);
+            return;
+        }
+    }
+
+    if (is_streaming){
+        // the buffer is only used to track the position: so we can stream even if there is none
+        if (buffer!=nullptr){
+            buffer->len = pos + len;
+            buffer->last_ms = nowMs;
+        }
+        if (p_parser!=nullptr){
+            p_parser->onSysEx(data, len, pos, false);
+        }
+        return;
+    }
+
+    // the start of the message was dropped or it is already too big
+    if (buffer==nullptr || buffer->is_oversize){
+        return;
+    }
+    buffer->last_ms = nowMs;
+    if (buffer->len + len > max_size){
+        stats.oversize++;
+        MIDI_LOGD("MidiSysExAssembler: message of %d is bigger than %d bytes", source, max_size);
+        buffer->is_oversize = true;
+        return;
+    }
+    memcpy(buffer->data + buffer->len, data, len);
+    buffer->len += len;
+}
+
+void MidiSysExAssembler :: end(uint8_t source){
+    Buffer *buffer = find(source);
+    if (is_streaming){
+        int len = buffer!=nullptr ? buffer->len : 0;
+        if (buffer!=nullptr){
+            release(buffer);
+        }
+        stats.messages++;
+        if ((uint32_t)len > stats.max_len){
+            stats.max_len = len;
+        }
+        if (p_parser!=nullptr){
+            p_parser->onSysEx(nullptr, 0, len, true);
+        }
+        return;
+    }
+
+    if (buffer==nullptr){
+        return;
+    }
+    if (!buffer->is_oversize){
+        stats.messages++;
+        if ((uint32_t)buffer->len > stats.max_len){
+            stats.max_len = buffer->len;
+        }
+        if (p_parser!=nullptr){
+            p_parser->onSysEx(buffer->data, buffer->len, 0, true);
+        }
+    }
+    release(buffer);
+}
+
+void MidiSysExAssembler :: abort(uint8_t source){
+    Buffer *buffer = find(source);
+    if (buffer!=nullptr){
+        stats.aborted++;
+        release(buffer);
+    }
+}
+
+int MidiSysExAssembler :: available(){
+    int result = 0;
+    for (int j=0; j<MIDI_SYSEX_POOL_SIZE; j++){
+        if (buffers[j].is_used){
+            result++;
+        }
+    }
+    return result;
+}
+
+void MidiSysExAssembler :: clear(){
+    for (int j=0; j<MIDI_SYSEX_POOL_SIZE; j++){
+        release(&buffers[j]);
+    }
+    stats = MidiSysExStatistics();
+}
+
+MidiSysExAssembler::Buffer *MidiSysExAssembler :: find(uint8_t source){
+    for (int j=0; j<MIDI_SYSEX_POOL_SIZE; j++){
+        if (buffers[j].is_used && buffers[j].source==source){
+            return &buffers[j];
+        }
+    }
+    return nullptr;
+}
+
+MidiSysExAssembler::Buffer *MidiSysExAssembler :: alloc(uint8_t source, uint32_t nowMs){
+    Buffer *result = nullptr;
+    for (int j=0; j<MIDI_SYSEX_POOL_SIZE && result==nullptr; j++){
+        if (!buffers[j].is_used){
+            result = &buffers[j];
+        }
+    }
+    // reuse the buffer of a source which stopped in the middle of a message
+    for (int j=0; j<MIDI_SYSEX_POOL_SIZE && result==nullptr; j++){
+        if (nowMs - buffers[j].last_ms > timeout_ms){
+            stats.aborted++;
+            MIDI_LOGD("MidiSysExAssembler: message of %d timed out", buffers[j].source);
+            result = &buffers[j];
+        }
+    }
+    if (result!=nullptr){
+        result->source = source;
+        result->len = 0;
+        result->last_ms = nowMs;
+        result->is_used = true;
+        result->is_oversize = false;
+    }
+    return result;
+}
+
+}
+
+#endif
@@ -0,0 +1,121 @@
+#pragma once
+#include "ConfigMidi.h"
+
+#if MIDI_ACTIVE
+
+#include "MidiParser.h"
+
+#ifndef MIDI_SYSEX_POOL_SIZE
+#define MIDI_SYSEX_POOL_SIZE 2
+#endif
+
+#ifndef MIDI_SYSEX_BUFFER_SIZE
+#define MIDI_SYSEX_BUFFER_SIZE 1024
+#endif
+
+#ifndef MIDI_SYSEX_TIMEOUT_MS
+#define MIDI_SYSEX_TIMEOUT_MS 2000
+#endif
+
+namespace midi {
+
+/**
+ * @brief Statistics of the SysEx reassembly: the aborted messages were restarted or timed
+ * out before the F7 was received, the oversize messages did not fit into the maximum size
+ * and the exhausted ones were dropped because all buffers were in use.
+ */
+struct MidiSysExStatistics {
+    uint32_t messages = 0;
+    uint32_t chunks = 0;
+    uint32_t aborted = 0;
+    uint32_t oversize = 0;
+    uint32_t exhausted = 0;
+    uint32_t max_len = 0;
+};
+
+/***************************************************/
+/*! \class MidiSysExAssembler
+    \brief Reassembles the SysEx messages which are received
+    in parts (e.g. in multiple AppleMIDI packets) for each
+    source. The messages are collected in a fixed pool of
+    buffers and passed to MidiParser::onSysEx() when they
+    are complete. In streaming mode the parts are passed on
+    immediatly without buffering, so that there is no size
+    limit.
+
+    A buffer of a source which did not send anything within
+    the timeout is reused for a new message.
+
+    by Phil Schatzmann
+*/
+/***************************************************/
+
+class MidiSysExAssembler {
+    public:
+        MidiSysExAssembler() = default;
+
+        /// Defines the parser which receives the SysEx messages
+        void begin(MidiParser *parser) {
+            p_parser = parser;
+            clear();
+        }
+
+        /// Passes the parts on without buffering (true) or collects the complete messages up to maxSize bytes (false)
+        void setStreaming(bool active, int maxSize=MIDI_SYSEX_BUFFER_SIZE) {
+            clear();
+            is_streaming = active;
+            max_size = maxSize > MIDI_SYSEX_BUFFER_SIZE ? MIDI_SYSEX_BUFFER_SIZE : maxSize;
+        }
+
+        /// Time in ms after which an incomplete message can be discarded
+        void setTimeout(uint32_t timeoutMs) {
+            timeout_ms = timeoutMs;
+        }
+
+        /// Adds the data bytes of a SysEx part which start at pos in the message of the source: pos 0 starts a new message
+        void write(uint8_t source, const uint8_t *data, int len, int pos, uint32_t nowMs);
+
+        /// The F7 of the source has been received: the message is complete
+        void end(uint8_t source);
+
+        /// Discards the incomplete message of the source (e.g. when the session has been closed)
+        void abort(uint8_t source);
+
+        /// Number of incomplete messages
+        int available();
+
+        /// Discards all incomplete messages and resets the statistics
+        void clear();
+
+        MidiSysExStatistics &statistics() {
+            return stats;
+        }
+
+    protected:
+        struct Buffer {
+            uint8_t data[MIDI_SYSEX_BUFFER_SIZE];
+            int len = 0;
+            uint32_t last_ms = 0;
+            uint8_t source = 0;
+            bool is_used = false;
+            bool is_oversize = false;
+        };
+        MidiParser *p_parser = nullptr;
+        Buffer buffers[MIDI_SYSEX_POOL_SIZE];
+        MidiSysExStatistics stats;
+        bool is_streaming = false;
+        int max_size = MIDI_SYSEX_BUFFER_SIZE;
+        uint32_t timeout_ms = MIDI_SYSEX_TIMEOUT_MS;
+
+        /// the buffer with the incomplete message of the source
+        Buffer *find(uint8_t source);
+        /// a free buffer or one which has timed out
+        Buffer *alloc(uint8_t source, uint32_t nowMs);
+        void release(Buffer *buffer) {
+            buffer->is_used = false;
+        }
+};
+
+} // namespace
+
+#endif
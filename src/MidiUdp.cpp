@@ -8,16 +8,25 @@ namespace midi {
 const char* APP_MidiUdp = "MidiUdp";
 
 MidiUdp :: MidiUdp(char* addessStr,int targetPort) {
+#if MIDI_HOST_ACTIVE
+    this->isValidHostFlag = MidiPosixUDP::hostByName(addessStr, targetUdpAddress);
+#else
     this->isValidHostFlag = WiFi.hostByName(addessStr, targetUdpAddress);
+#endif
     if (!this->isValidHostFlag){
         MIDI_LOGE( "x%x, Could not resolve host %s ", __func__, addessStr);
     }
     this->targetPort = targetPort;    
+    aggregator.begin(this);
 }
 
 MidiUdp :: MidiUdp(IPAddress address,int targetPort) {
     this->targetUdpAddress = address;
     this->targetPort = targetPort;    
+    aggregator.begin(this);
+}
+
+MidiUdp :: ~MidiUdp() {
 }
 
 bool MidiUdp :: isValidHost() {
@@ -28,12 +37,46 @@ void MidiUdp :: setTargetPort(int port){
     targetPort = port;   
 }
 
+void MidiUdp :: setAggregation(uint16_t mtu, uint32_t flushUs){
+    aggregator.setSize(mtu, flushUs);
+    MIDI_LOGI("aggregation mtu: %d, flush: %u us", mtu, flushUs);
+}
+
 size_t MidiUdp :: write(const uint8_t * buffer, size_t size ) {
+    return aggregator.write(buffer, size);
+}
+
+bool MidiUdp :: flushPacket() {
+    return aggregator.flush();
+}
+
+void MidiUdp :: loop() {
+    aggregator.loop();
+}
+
+size_t MidiUdp :: sendDatagram(const uint8_t * buffer, size_t size ) {
+    if (p_peers!=nullptr && p_peers->size()>0){
+        // the same encoded data is sent to all peers
+        size_t result = 0;
+        for (int j=0; j<p_peers->size(); j++){
+            MidiUdpPeer &peer = (*p_peers)[j];
+            if (sendDatagram(peer.address, peer.port, buffer, size)>0){
+                peer.datagrams_sent++;
+                result = size;
+            }
+        }
+        return result;
+    }
+    return sendDatagram(targetUdpAddress, targetPort, buffer, size);
+}
+
+size_t MidiUdp :: sendDatagram(IPAddress &address, int port, const uint8_t * buffer, size_t size ) {
     size_t result = 0;
-    if (this->beginPacket(targetUdpAddress, targetPort) == 1){
-        result = WiFiUDP::write(buffer, size);
+    if (this->beginPacket(address, port) == 1){
+        result = MidiUdpBase::write(buffer, size);
         if (result>0){
             bool packetOk = this->endPacket();
+            if (packetOk) aggregator.statistics().packets++;
             MIDI_LOGD( "x%x, Number of bytes have %s been sent out: %d ", __func__, packetOk?"":"not", result);
         }
         //this->flush();
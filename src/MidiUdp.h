@@ -2,12 +2,35 @@
 #include "ConfigMidi.h"
 #if MIDI_ACTIVE && TCP_ACTIVE
 
+#if MIDI_HOST_ACTIVE
+#include "MidiPosixUdp.h"
+#else
 #include <WiFi.h>
 #include <WiFiClient.h>
 #include <WiFiUdp.h>
+#endif
+#include "MidiUdpPeers.h"
+#include "MidiAggregator.h"
+
+/// Default maximum payload of an aggregated datagram (1500 byte ethernet MTU - 28 bytes IP/UDP header)
+#ifndef MIDI_UDP_MTU
+#define MIDI_UDP_MTU 1472
+#endif
+
+/// Default time in microseconds a message may wait in the aggregation buffer
+#ifndef MIDI_UDP_FLUSH_US
+#define MIDI_UDP_FLUSH_US 1000
+#endif
 
 namespace midi {
 
+/// UDP implementation of the platform
+#if MIDI_HOST_ACTIVE
+typedef MidiPosixUDP MidiUdpBase;
+#else
+typedef WiFiUDP MidiUdpBase;
+#endif
+
 /***************************************************/
 /*! \class MidiUdp
     \brief Simple UDP wrapper class which sends all 
@@ -16,25 +39,54 @@ namespace midi {
     This is useful when the API asks for a stream
     as parameter to output data.
 
+    By default each write is sent as separate datagram.
+    With setAggregation() the messages are collected
+    into one datagram which is sent when the mtu is 
+    reached, when the flush time has passed or when 
+    flushPacket() is called. In this case you need to
+    call loop() regularly.
+
+    If some peers have been assigned with setPeers(), 
+    each datagram is sent to all of them instead of
+    the target address.
+
     by Phil Schatzmann
 
 */
 /***************************************************/
 
-class MidiUdp : public WiFiUDP { // EthernetUDP {
+class MidiUdp : public MidiUdpBase, public MidiPacketWriter { // EthernetUDP {
     public:
         MidiUdp(char* targetUdpAddressStr,int targetPort);
         MidiUdp(IPAddress targetUdpAddress,int targetPort);
+        virtual ~MidiUdp();
         size_t write(const uint8_t * buffer,size_t size );
         bool isValidHost();
         void setTargetPort(int port);
 
+        /// Activates the aggregation of messages into one datagram: mtu=0 deactivates it
+        void setAggregation(uint16_t mtu=MIDI_UDP_MTU, uint32_t flushUs=MIDI_UDP_FLUSH_US);
+        /// Sends the collected messages
+        bool flushPacket();
+        /// Sends the collected messages if the flush time has passed
+        void loop();
+        /// Provides the datagram and latency statistics
+        MidiAggregationStatistics &statistics() { return aggregator.statistics(); }
+        /// Sends the datagrams to all peers (if there are any) instead of the target address
+        void setPeers(MidiUdpPeers *peers) { p_peers = peers; }
+
     protected:
         IPAddress targetUdpAddress;
         int targetPort;
         bool isValidHostFlag;
+        MidiAggregator aggregator;
+        MidiUdpPeers *p_peers = nullptr;
+
+        size_t writePacket(const uint8_t *data, size_t len) override { return sendDatagram(data, len); }
+        virtual size_t sendDatagram(const uint8_t * buffer,size_t size);
+        size_t sendDatagram(IPAddress &address, int port, const uint8_t * buffer,size_t size);
 };
 
 }
 
-#endif
\ No newline at end of file
+#endif
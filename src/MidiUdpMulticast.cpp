@@ -0,0 +1,113 @@
+#include "MidiUdpMulticast.h"
+#if MIDI_ACTIVE && TCP_ACTIVE
+
+#include "MidiLogger.h"
+
+namespace midi {
+
+MidiUdpMulticast :: MidiUdpMulticast(IPAddress group, int port) : MidiUdp(group, port) {
+    // the group also delivers our own datagrams: they are recognized by the id which differs for each instance
+    static uint16_t instances = 0;
+    uint32_t seed = micros() * 2654435761u + (++instances) * 40503u + (uint32_t)(uintptr_t)this;
+    sender_id = seed >> 16;
+    if (sender_id==0){
+        sender_id = 1;
+    }
+}
+
+bool MidiUdpMulticast :: begin() {
+    if (!beginMulticast(targetUdpAddress, targetPort)){
+        MIDI_LOGE("could not join multicast group on port %d", targetPort);
+        return false;
+    }
+    rx_stats = MidiMulticastStatistics();
+    sender_table.clear();
+    return true;
+}
+
+size_t MidiUdpMulticast :: sendDatagram(const uint8_t * buffer, size_t size) {
+    uint8_t header[MIDI_MULTICAST_HEADER_SIZE] = {MIDI_MULTICAST_MAGIC_0, MIDI_MULTICAST_MAGIC_1, (uint8_t)(sender_id >> 8), (uint8_t)(sender_id & 0xFF), (uint8_t)(tx_seq >> 8), (uint8_t)(tx_seq & 0xFF)};
+    size_t result = 0;
+    if (this->beginPacket(targetUdpAddress, targetPort) == 1){
+        MidiUdpBase::write(header, MIDI_MULTICAST_HEADER_SIZE);
+        result = MidiUdpBase::write(buffer, size);
+        if (result>0 && this->endPacket()){
+            aggregator.statistics().packets++;
+        }
+    } else {
+        MIDI_LOGD( "x%x, beginPacked has failed ", __func__);
+        this->isValidHostFlag = false;
+    }
+    // the sequence number is also incremented on failures, so that the receivers see the loss
+    tx_seq++;
+    return result;
+}
+
+int MidiUdpMulticast :: parsePacket() {
+    int len;
+    while ((len = MidiUdpBase::parsePacket()) > 0){
+        uint8_t header[MIDI_MULTICAST_HEADER_SIZE];
+        if (len < MIDI_MULTICAST_HEADER_SIZE
+        || MidiUdpBase::read(header, MIDI_MULTICAST_HEADER_SIZE) != MIDI_MULTICAST_HEADER_SIZE
+        || header[0] != MIDI_MULTICAST_MAGIC_0 || header[1] != MIDI_MULTICAST_MAGIC_1){
+            rx_stats.datagrams_invalid++;
+            continue;
+        }
+        // our own datagram which was sent back by the group
+        if (((uint16_t)header[2] << 8 | header[3]) == sender_id){
+            continue;
+        }
+        uint16_t seq = (uint16_t)header[4] << 8 | header[5];
+        MidiUdpPeer *sender = sender_table.update(remoteIP(), remotePort(), millis());
+        // without free slot we can not track the sender, but we still provide the data
+        if (sender==nullptr || accept(*sender, seq)){
+            return len - MIDI_MULTICAST_HEADER_SIZE;
+        }
+    }
+    return 0;
+}
+
+bool MidiUdpMulticast :: accept(MidiUdpPeer &sender, uint16_t seq) {
+    rx_stats.datagrams_received++;
+    if (!sender.seq_valid){
+        sender.seq_valid = true;
+        sender.seq_max = seq;
+        sender.seq_window = 1;
+        return true;
+    }
+
+    int16_t diff = (int16_t)(seq - sender.seq_max);
+    if (diff > 0){
+        // new datagram: the skipped sequence numbers are lost until they arrive late
+        rx_stats.datagrams_lost += diff - 1;
+        sender.seq_window = diff < 32 ? (sender.seq_window << diff) | 1 : 1;
+        sender.seq_max = seq;
+        return true;
+    }
+
+    int back = -diff;
+    if (back >= 32){
+        // outside of the window: we assume that the sender has been restarted
+        MIDI_LOGI("multicast sender on port %d restarted", sender.port);
+        rx_stats.sender_restarts++;
+        sender.seq_max = seq;
+        sender.seq_window = 1;
+        return true;
+    }
+    uint32_t bit = 1u << back;
+    if (sender.seq_window & bit){
+        rx_stats.datagrams_duplicated++;
+        return false;
+    }
+    // late datagram which had been counted as lost
+    sender.seq_window |= bit;
+    rx_stats.datagrams_reordered++;
+    if (rx_stats.datagrams_lost > 0){
+        rx_stats.datagrams_lost--;
+    }
+    return true;
+}
+
+} // namespace
+
+#endif
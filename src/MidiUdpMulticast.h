@@ -0,0 +1,79 @@
+#pragma once
+#include "ConfigMidi.h"
+#if MIDI_ACTIVE && TCP_ACTIVE
+
+#include "MidiUdp.h"
+
+/// Size of the header which is put in front of each multicast datagram: 2 bytes magic + 16 bit sender id + 16 bit sequence number
+#define MIDI_MULTICAST_HEADER_SIZE 6
+#define MIDI_MULTICAST_MAGIC_0 'M'
+#define MIDI_MULTICAST_MAGIC_1 'C'
+
+namespace midi {
+
+/**
+ * @brief Receive statistics of a multicast group which are derived from the sequence numbers.
+ * Datagrams which arrive late are counted as reordered and are removed from the lost count.
+ */
+struct MidiMulticastStatistics {
+    uint32_t datagrams_received = 0;
+    uint32_t datagrams_lost = 0;
+    uint32_t datagrams_duplicated = 0;
+    uint32_t datagrams_reordered = 0;
+    uint32_t datagrams_invalid = 0;
+    uint32_t sender_restarts = 0;
+
+    /// Lost datagrams relative to the expected datagrams (0.0 - 1.0)
+    float lossRate() {
+        uint32_t expected = datagrams_received - datagrams_duplicated + datagrams_lost;
+        return expected == 0 ? 0.0f : (float) datagrams_lost / expected;
+    }
+};
+
+/***************************************************/
+/*! \class MidiUdpMulticast
+    \brief UDP which sends each (aggregated) datagram
+    only once to a multicast group.
+
+    A header with a sender id and a sequence number is
+    put in front of each datagram. parsePacket() removes
+    the header, drops duplicates and the own datagrams
+    which the group sends back and maintains the loss
+    statistics for each sender, so that the remaining
+    data can be read as usual.
+
+    by Phil Schatzmann
+
+*/
+/***************************************************/
+
+class MidiUdpMulticast : public MidiUdp {
+    public:
+        MidiUdpMulticast(IPAddress group, int port);
+
+        /// Joins the group: needed to receive the data
+        bool begin();
+        /// Provides the next datagram of the group: returns the length without the header
+        int parsePacket() override;
+        /// Provides the loss statistics of the received datagrams
+        MidiMulticastStatistics &receiveStatistics() { return rx_stats; }
+        /// Provides the senders of the received datagrams
+        MidiUdpPeers &senders() { return sender_table; }
+        /// Sequence number of the next datagram which will be sent
+        uint16_t sequenceNumber() { return tx_seq; }
+        /// Random id which identifies our datagrams
+        uint16_t senderId() { return sender_id; }
+
+    protected:
+        uint16_t tx_seq = 0;
+        uint16_t sender_id = 0;
+        MidiMulticastStatistics rx_stats;
+        MidiUdpPeers sender_table;
+
+        size_t sendDatagram(const uint8_t * buffer,size_t size) override;
+        bool accept(MidiUdpPeer &sender, uint16_t seq);
+};
+
+}
+
+#endif
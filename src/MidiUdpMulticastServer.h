@@ -0,0 +1,122 @@
+#pragma once
+#include "ConfigMidi.h"
+
+#if MIDI_ACTIVE && TCP_ACTIVE
+
+#include "MidiLogger.h"
+#include "MidiServer.h"
+#include "MidiUdpMulticast.h"
+
+namespace midi {
+
+/***************************************************/
+/*! \class MidiUdpMulticastServer
+    \brief A UDP Server which distributes the MIDI
+    messages to all members of a multicast group and
+    receives the messages of the group.
+
+    Each (optionally aggregated) datagram is sent only
+    once. The receivers use the sequence numbers to
+    detect lost, duplicated and reordered datagrams.
+
+    by Phil Schatzmann
+*/
+/***************************************************/
+
+class MidiUdpMulticastServer : public MidiServer {
+    public:
+        MidiUdpMulticastServer(MidiAction *action):MidiServer(action){
+        }
+
+        ~MidiUdpMulticastServer() {
+            if (udp!=nullptr){
+                delete udp;
+            }
+        }
+
+        bool begin(IPAddress group=IPAddress(239,0,0,58), int port=5008){
+            MIDI_LOGI( __PRETTY_FUNCTION__);
+#if !MIDI_HOST_ACTIVE
+            if (WiFi.status() != WL_CONNECTED){
+                MIDI_LOGE("WiFi not connected");
+                return false;
+            }
+#endif
+            if (udp!=nullptr){
+                delete udp;
+            }
+            udp = new MidiUdpMulticast(group, port);
+            if (!udp->begin()){
+                return false;
+            }
+            if (mtu>0){
+                udp->setAggregation(mtu, flushUs);
+            }
+            in.setup(udp, new MidiParser(p_action), true);
+            out.setup(udp);
+            return true;
+        }
+
+        void loop() {
+            if (udp!=nullptr){
+                // process all received datagrams: each datagram contains complete messages
+                int len;
+                for (int j=0; j<MIDI_UDP_MAX_PEERS && (len = udp->parsePacket())>0; j++){
+                    len = udp->read(rx_buffer, MIDI_UDP_MTU);
+                    if (len>0){
+                        // the group members share the parser: a running status of another sender
+                        // or of the datagram before a gap must not be continued
+                        in.pHandler->reset();
+                        in.pHandler->parse(rx_buffer, len);
+                    }
+                }
+
+                // forget about senders which went away
+                uint32_t now = millis();
+                if (now - lastExpiryMs > 1000){
+                    udp->senders().expire(now, MIDI_UDP_PEER_TIMEOUT_MS);
+                    lastExpiryMs = now;
+                }
+
+                // send aggregated messages which are due
+                udp->loop();
+            }
+        }
+
+        /// Collects the output messages into one datagram up to the mtu or for max flushUs microseconds
+        void setAggregation(uint16_t mtu=MIDI_UDP_MTU, uint32_t flushUs=MIDI_UDP_FLUSH_US){
+            this->mtu = mtu;
+            this->flushUs = flushUs;
+            if (udp!=nullptr){
+                udp->setAggregation(mtu, flushUs);
+            }
+        }
+
+        /// Sends the collected output messages
+        bool flush() {
+            return udp!=nullptr ? udp->flushPacket() : false;
+        }
+
+        /// Provides the datagrams per message and latency statistics of the output
+        MidiAggregationStatistics *statistics() {
+            return udp!=nullptr ? &udp->statistics() : nullptr;
+        }
+
+        /// Provides the loss statistics of the received datagrams
+        MidiMulticastStatistics *receiveStatistics() {
+            return udp!=nullptr ? &udp->receiveStatistics() : nullptr;
+        }
+
+    protected:
+        MidiUdpMulticast *udp=nullptr;
+        uint32_t lastExpiryMs = 0;
+        uint8_t rx_buffer[MIDI_UDP_MTU];
+        uint16_t mtu = 0;
+        uint32_t flushUs = 0;
+
+};
+
+
+}
+
+#endif
@@ -0,0 +1,123 @@
+#include "MidiUdpPeers.h"
+#if MIDI_ACTIVE && TCP_ACTIVE
+
+#include "MidiLogger.h"
+
+namespace midi {
+
+static_assert((MIDI_UDP_PEER_HASH_SIZE & (MIDI_UDP_PEER_HASH_SIZE-1)) == 0, "MIDI_UDP_PEER_HASH_SIZE must be a power of 2");
+static_assert(MIDI_UDP_PEER_HASH_SIZE > MIDI_UDP_MAX_PEERS, "MIDI_UDP_PEER_HASH_SIZE must be bigger then MIDI_UDP_MAX_PEERS");
+static_assert(MIDI_UDP_MAX_PEERS < 0xFF, "MIDI_UDP_MAX_PEERS must be smaller then 255");
+
+MidiUdpPeers :: MidiUdpPeers() {
+    clear();
+}
+
+void MidiUdpPeers :: clear() {
+    memset(index, EMPTY, sizeof(index));
+    count = 0;
+}
+
+uint32_t MidiUdpPeers :: hash(IPAddress &address, uint16_t port) {
+    uint32_t key = ((uint32_t)address[0] << 24) | ((uint32_t)address[1] << 16) | ((uint32_t)address[2] << 8) | address[3];
+    key ^= (uint32_t) port * 0x9E3779B1u;
+    return (key * 0x85EBCA6Bu) >> 16;
+}
+
+int MidiUdpPeers :: findSlot(IPAddress &address, uint16_t port) {
+    uint32_t slot = hash(address, port) & (MIDI_UDP_PEER_HASH_SIZE-1);
+    while (index[slot] != EMPTY){
+        MidiUdpPeer &peer = peers[index[slot]];
+        if (peer.port == port && peer.address == address){
+            return slot;
+        }
+        slot = (slot + 1) & (MIDI_UDP_PEER_HASH_SIZE-1);
+    }
+    // not found: return the free slot as negative value
+    return -1 - (int)slot;
+}
+
+MidiUdpPeer *MidiUdpPeers :: find(IPAddress address, uint16_t port) {
+    int slot = findSlot(address, port);
+    return slot >= 0 ? &peers[index[slot]] : nullptr;
+}
+
+MidiUdpPeer *MidiUdpPeers :: update(IPAddress address, uint16_t port, uint32_t nowMs) {
+    int slot = findSlot(address, port);
+    MidiUdpPeer *peer = nullptr;
+    if (slot >= 0){
+        peer = &peers[index[slot]];
+    } else {
+        if (count >= MIDI_UDP_MAX_PEERS){
+            MIDI_LOGW("MidiUdpPeers: no free slot for port %d", port);
+            return nullptr;
+        }
+        index[-1 - slot] = count;
+        peer = &peers[count++];
+        *peer = MidiUdpPeer();
+        peer->address = address;
+        peer->port = port;
+        MIDI_LOGI("MidiUdpPeers: new peer on port %d", port);
+    }
+    peer->last_seen_ms = nowMs;
+    peer->datagrams_received++;
+    return peer;
+}
+
+bool MidiUdpPeers :: remove(IPAddress address, uint16_t port) {
+    int slot = findSlot(address, port);
+    if (slot < 0){
+        return false;
+    }
+    removeAt(slot);
+    return true;
+}
+
+void MidiUdpPeers :: removeAt(int slot) {
+    // move the last peer into the gap of the dense array
+    int pos = index[slot];
+    int last = count - 1;
+    if (pos != last){
+        int lastSlot = findSlot(peers[last].address, peers[last].port);
+        peers[pos] = peers[last];
+        index[lastSlot] = pos;
+    }
+    count--;
+
+    // backward shift deletion, so that no tombstones are needed
+    uint32_t gap = slot;
+    uint32_t next = (gap + 1) & (MIDI_UDP_PEER_HASH_SIZE-1);
+    index[gap] = EMPTY;
+    while (index[next] != EMPTY){
+        MidiUdpPeer &peer = peers[index[next]];
+        uint32_t home = hash(peer.address, peer.port) & (MIDI_UDP_PEER_HASH_SIZE-1);
+        // move the entry if its home is not between the gap and its position
+        if (((next - home) & (MIDI_UDP_PEER_HASH_SIZE-1)) >= ((next - gap) & (MIDI_UDP_PEER_HASH_SIZE-1))){
+            index[gap] = index[next];
+            index[next] = EMPTY;
+            gap = next;
+        }
+        next = (next + 1) & (MIDI_UDP_PEER_HASH_SIZE-1);
+    }
+}
+
+int MidiUdpPeers :: expire(uint32_t nowMs, uint32_t timeoutMs) {
+    int result = 0;
+    int pos = 0;
+    while (pos < count){
+        MidiUdpPeer &peer = peers[pos];
+        if (nowMs - peer.last_seen_ms > timeoutMs){
+            MIDI_LOGI("MidiUdpPeers: removing idle peer on port %d", peer.port);
+            removeAt(findSlot(peer.address, peer.port));
+            result++;
+            // the last peer has been moved to pos: check it as well
+        } else {
+            pos++;
+        }
+    }
+    return result;
+}
+
+} // namespace
+
+#endif
@@ -0,0 +1,83 @@
+#pragma once
+#include "ConfigMidi.h"
+#if MIDI_ACTIVE && TCP_ACTIVE
+
+#include "IPAddress.h"
+
+/// Max number of remote peers of a MidiUdpServer
+#ifndef MIDI_UDP_MAX_PEERS
+#define MIDI_UDP_MAX_PEERS 32
+#endif
+
+/// Number of hash slots: must be a power of 2 and bigger then MIDI_UDP_MAX_PEERS
+#ifndef MIDI_UDP_PEER_HASH_SIZE
+#define MIDI_UDP_PEER_HASH_SIZE 64
+#endif
+
+/// Peers which did not send anything for this time are removed
+#ifndef MIDI_UDP_PEER_TIMEOUT_MS
+#define MIDI_UDP_PEER_TIMEOUT_MS 60000
+#endif
+
+namespace midi {
+
+/**
+ * @brief A remote UDP address which has sent us some data
+ */
+struct MidiUdpPeer {
+    IPAddress address;
+    uint16_t port = 0;
+    uint32_t last_seen_ms = 0;
+    uint32_t datagrams_received = 0;
+    uint32_t datagrams_sent = 0;
+    // sequence number tracking of a multicast sender
+    bool seq_valid = false;
+    uint16_t seq_max = 0;
+    uint32_t seq_window = 0;
+};
+
+/***************************************************/
+/*! \class MidiUdpPeers
+    \brief Fixed capacity table of the remote UDP
+    peers: the peers are stored in a dense array which
+    is used to send the data to all peers and are found
+    with the help of an open addressing hash index
+    with the address and port as key.
+
+    by Phil Schatzmann
+*/
+/***************************************************/
+
+class MidiUdpPeers {
+    public:
+        MidiUdpPeers();
+
+        /// Finds or registers the peer and updates the last seen time: returns nullptr if the table is full
+        MidiUdpPeer *update(IPAddress address, uint16_t port, uint32_t nowMs);
+        /// Finds the peer: returns nullptr if it is not registered
+        MidiUdpPeer *find(IPAddress address, uint16_t port);
+        /// Removes the peer
+        bool remove(IPAddress address, uint16_t port);
+        /// Removes all peers which were idle for more then the timeout: returns the number of removed peers
+        int expire(uint32_t nowMs, uint32_t timeoutMs=MIDI_UDP_PEER_TIMEOUT_MS);
+        /// Removes all peers
+        void clear();
+        /// Number of registered peers
+        int size() { return count; }
+        /// Provides the peer at the indicated position (0 to size()-1)
+        MidiUdpPeer &operator[](int pos) { return peers[pos]; }
+
+    protected:
+        static const uint8_t EMPTY = 0xFF;
+        MidiUdpPeer peers[MIDI_UDP_MAX_PEERS];
+        uint8_t index[MIDI_UDP_PEER_HASH_SIZE];
+        int count = 0;
+
+        static uint32_t hash(IPAddress &address, uint16_t port);
+        int findSlot(IPAddress &address, uint16_t port);
+        void removeAt(int slot);
+};
+
+} // namespace
+
+#endif
@@ -3,8 +3,8 @@
 
 #if MIDI_ACTIVE && TCP_ACTIVE
 
-#include <WiFi.h>
 #include "MidiLogger.h"
+#include "MidiServer.h"
 #include "MidiUdp.h"
 
 namespace midi {
@@ -14,6 +14,13 @@ namespace midi {
     \brief  A simple UDP Server which receives
     and creates MIDI messages
 
+    All remote addresses which send us some data are
+    registered as peers: the output is encoded once and
+    sent to all of them. Peers which have been idle for
+    longer then the peer timeout are removed. As long as
+    there are no peers, the output is sent to the address
+    which was indicated in begin().
+
     by Phil Schatzmann
 */
 /***************************************************/
@@ -29,15 +36,28 @@ class MidiUdpServer : public MidiServer {
             }
         }
          
-        bool begin(IPAddress ip, int serverPort=5008){
+        /// Sends to the ip and serverPort as long as there are no peers and listens on the serverPort (or on the localPort if it is >0)
+        bool begin(IPAddress ip, int serverPort=5008, int localPort=-1){
             MIDI_LOGI( __PRETTY_FUNCTION__);
-        
+#if !MIDI_HOST_ACTIVE
             if (WiFi.status() != WL_CONNECTED){
                 MIDI_LOGE("WiFi not connected");
                 return false;
             }
+#endif
 
+            if (localPort<=0){
+                localPort = serverPort;
+            }
             udp = new MidiUdp(ip, serverPort);
+            if (!udp->begin(localPort)){
+                MIDI_LOGE("could not listen on port %d", localPort);
+            }
+            if (mtu>0){
+                udp->setAggregation(mtu, flushUs);
+            }
+            peers.clear();
+            udp->setPeers(&peers);
             in.setup(udp, new MidiParser(p_action), true);
             out.setup(udp);
             return true;
@@ -45,27 +65,67 @@ class MidiUdpServer : public MidiServer {
 
         void loop() {
             if (udp!=nullptr){
-                int len = udp->parsePacket();
-                if (!is_connected){
-                    remote_port = udp->remotePort();
-                    if (remote_port!=0){
-                        is_connected = true;
-                        // we might use a different port on the server
-                        udp->setTargetPort(remote_port);
-                        MIDI_LOGI("setting traget port: %d", remote_port);
-                    } 
+                uint32_t now = millis();
+                // process all received datagrams: each datagram contains complete messages
+                int len;
+                for (int j=0; j<MIDI_UDP_MAX_PEERS && (len = udp->parsePacket())>0; j++){
+                    peers.update(udp->remoteIP(), udp->remotePort(), now);
+                    len = udp->read(rx_buffer, MIDI_UDP_MTU);
+                    if (len>0){
+                        // the datagrams of the peers are independent: the running status of another peer is not valid
+                        in.pHandler->reset();
+                        in.pHandler->parse(rx_buffer, len);
+                    }
                 }
 
-                if (udp->available()){
-                    in.loop();
+                // remove idle peers
+                if (now - lastExpiryMs > 1000){
+                    peers.expire(now, peerTimeoutMs);
+                    lastExpiryMs = now;
                 }
+
+                // send aggregated messages which are due
+                udp->loop();
             }
         }
 
+        /// Defines after how many ms without any received data a peer is removed
+        void setPeerTimeout(uint32_t timeoutMs){
+            peerTimeoutMs = timeoutMs;
+        }
+
+        /// Provides the registered remote peers
+        MidiUdpPeers &getPeers() {
+            return peers;
+        }
+
+        /// Collects the output messages into one datagram up to the mtu or for max flushUs microseconds
+        void setAggregation(uint16_t mtu=MIDI_UDP_MTU, uint32_t flushUs=MIDI_UDP_FLUSH_US){
+            this->mtu = mtu;
+            this->flushUs = flushUs;
+            if (udp!=nullptr){
+                udp->setAggregation(mtu, flushUs);
+            }
+        }
+
+        /// Sends the collected output messages 
+        bool flush() {
+            return udp!=nullptr ? udp->flushPacket() : false;
+        }
+
+        /// Provides the datagrams per message and latency statistics of the output
+        MidiAggregationStatistics *statistics() {
+            return udp!=nullptr ? &udp->statistics() : nullptr;
+        }
+
     protected:
         MidiUdp *udp=nullptr;
-        bool is_connected = false;
-        int remote_port = 0;
+        MidiUdpPeers peers;
+        uint32_t peerTimeoutMs = MIDI_UDP_PEER_TIMEOUT_MS;
+        uint32_t lastExpiryMs = 0;
+        uint8_t rx_buffer[MIDI_UDP_MTU];
+        uint16_t mtu = 0;
+        uint32_t flushUs = 0;
 
 };
 
@@ -37,7 +37,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <sys/time.h>
+#include <inttypes.h>
+#include <time.h>
 // from https://en.wikipedia.org/wiki/RTP-MIDI#Apple's_session_protocol
 #define APPLEMIDI_COMMAND_INVITATION            0x494e  // IN
 #define APPLEMIDI_COMMAND_INVITATION_ACCEPTED   0x4f4b  // OK
@@ -47,28 +48,131 @@
 #define APPLEMIDI_COMMAND_RECEIVER_FEEDBACK     0x5253  // RS
 #define APPLEMIDI_COMMAND_BITRATE_RECEIVE_LIMIT 0x524c  // RL
 
+// RTP header + long MIDI command section header
+#define APPLEMIDI_HEADER_SIZE (3*4+2)
 
-static applemidi_peer_t applemidi_peer[APPLEMIDI_MAX_PEERS];
+// the space for the journal is reserved in the output buffer
+#if APPLEMIDI_JOURNAL_ACTIVE
+#define APPLEMIDI_JOURNAL_RESERVE APPLEMIDI_JOURNAL_MAX_SIZE
+#else
+#define APPLEMIDI_JOURNAL_RESERVE 0
+#endif
+
+#if APPLEMIDI_OUTBUFFER_SIZE < (APPLEMIDI_HEADER_SIZE + APPLEMIDI_JOURNAL_RESERVE + 16)
+#error "APPLEMIDI_OUTBUFFER_SIZE is too small for the APPLEMIDI_JOURNAL_MAX_SIZE"
+#endif
 
-static uint8_t applemidi_debug_level = APPLEMIDI_DEFAULT_DEBUG_LEVEL;
+#if APPLEMIDI_MAX_PEERS > 255
+#error "APPLEMIDI_MAX_PEERS must not be bigger then 255"
+#endif
+
+#if (APPLEMIDI_PEER_HASH_SIZE & (APPLEMIDI_PEER_HASH_SIZE-1)) != 0 || APPLEMIDI_PEER_HASH_SIZE <= APPLEMIDI_MAX_PEERS
+#error "APPLEMIDI_PEER_HASH_SIZE must be a power of 2 and bigger then APPLEMIDI_MAX_PEERS"
+#endif
 
-// callbacks
-static void (*applemidi_callback_midi_message_received)(uint8_t applemidi_port, uint32_t timestamp, uint8_t midi_status, uint8_t *remaining_message, size_t len, size_t continued_sysex_pos);
-static int32_t (*applemidi_callback_send_udp_datagram)(uint8_t *ip_addr, uint16_t port, uint8_t *tx_data, size_t tx_len);
+
+// RTP sequence numbers (RFC 3550 A.1): bigger jumps are handled as restart of the sender
+#define APPLEMIDI_RTP_MAX_DROPOUT  3000
+#define APPLEMIDI_RTP_MAX_MISORDER 100
+
+// forward declarations
+static uint64_t get_timestamp_100us();
+static applemidi_peer_t *applemidi_release_peer_slot(applemidi_t *ctx, applemidi_peer_t *peer);
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Seqlock for the RTP statistics: the receive path only increments the counter, the readers retry
+// if it was odd or if it has changed while they were copying
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static void applemidi_rtp_stats_begin(applemidi_peer_t *peer)
+{
+  __atomic_store_n(&peer->rtp_stats_seq, peer->rtp_stats_seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void applemidi_rtp_stats_end(applemidi_peer_t *peer)
+{
+  __atomic_store_n(&peer->rtp_stats_seq, peer->rtp_stats_seq + 1, __ATOMIC_RELEASE);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Returns 1 if the session of the peer is established on both ports: a master has received both
+// invitation accepted messages, a slave has received the invitation on the data port
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static uint8_t applemidi_peer_is_connected(applemidi_peer_t *peer)
+{
+  if( peer->connection_state != APPLEMIDI_CONNECTION_STATE_SLAVE )
+    return peer->connection_state == APPLEMIDI_CONNECTION_STATE_MASTER_CONNECTED;
+
+  return peer->ssrc != 0 && peer->data_port != peer->control_port;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Resets the state of the RTP streams from and to a peer (e.g. for a new session)
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static void applemidi_reset_streams(applemidi_peer_t *peer)
+{
+  peer->seq_nr = 0;
+  peer->tx_seq_nr = rand(); // random start as recommended by RFC 3550
+  peer->continued_sysex_pos = 0;
+  peer->outbuffer_len = 0;
+  peer->outbuffer_timestamp_flush = 0;
+  peer->outbuffer_timestamp_last_message = 0;
+  peer->clock_offset = 0;
+  peer->clock_rtt = 0;
+  peer->clock_rtt_min = 0;
+  peer->clock_sync_count = 0;
+  applemidi_rtp_stats_begin(peer);
+  memset(&peer->rtp_stats, 0, sizeof(peer->rtp_stats));
+  peer->rtp_initialized = 0;
+  applemidi_rtp_stats_end(peer);
+#if APPLEMIDI_JOURNAL_ACTIVE
+  peer->journal_len = 0;
+  peer->journal_checkpoint = peer->tx_seq_nr;
+  peer->journal_guard_ctr = APPLEMIDI_JOURNAL_GUARD_COUNT;
+  peer->journal_timestamp_last_packet = 0;
+  if( peer->buffer != NULL ) {
+    memset(peer->buffer->rx_notes, 0, sizeof(peer->buffer->rx_notes));
+  }
+  peer->rx_feedback_packets = 0;
+  peer->rx_feedback_timestamp = 0;
+#endif
+}
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Initialization
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-int32_t applemidi_init(void *_callback_midi_message_received, void *_callback_send_udp_datagram)
+int32_t applemidi_init(applemidi_t *ctx, applemidi_midi_message_received_t _callback_midi_message_received, applemidi_send_udp_datagram_t _callback_send_udp_datagram, void *user_data)
 {
   int i;
 
-  applemidi_callback_midi_message_received = _callback_midi_message_received;
-  applemidi_callback_send_udp_datagram = _callback_send_udp_datagram;
+  ctx->callback_midi_message_received = _callback_midi_message_received;
+  ctx->callback_send_udp_datagram = _callback_send_udp_datagram;
+  ctx->user_data = user_data;
+  ctx->debug_level = APPLEMIDI_DEFAULT_DEBUG_LEVEL;
 
-  applemidi_peer_t *peer = &applemidi_peer[0];
+  memset(ctx->peer_index, 0, sizeof(ctx->peer_index));
+  ctx->free_ports_count = 0;
+  ctx->deadline_valid = 0;
+
+  applemidi_peer_t *peer = &ctx->peer[0];
   for(i=0; i<APPLEMIDI_MAX_PEERS; ++i, ++peer) {
+    // the buffers of a previous initialization are moved into the pool
+    if( peer->buffer != NULL ) {
+      peer->buffer->next = ctx->buffer_pool;
+      ctx->buffer_pool = peer->buffer;
+      peer->buffer = NULL;
+    }
+
+    // all ports are free: port 1 is the next one
+    if( i > 0 ) {
+      int port = APPLEMIDI_MAX_PEERS - i;
+      ctx->ports_pos[port] = ctx->free_ports_count;
+      ctx->ports[ctx->free_ports_count++] = port;
+    }
+
     if( i == 0 ) {
       peer->ssrc = rand();
       if( peer->ssrc == 0 ) // just to ensure that we never get SSRC=0
@@ -83,16 +187,14 @@ int32_t applemidi_init(void *_callback_midi_message_received, void *_callback_se
     peer->applemidi_port = i; // internal port number, don't touch!
     memset(peer->ip_addr, 0, sizeof(peer->ip_addr));
     peer->token = 0;
-    peer->seq_nr = 0;
-    peer->continued_sysex_pos = 0;
     peer->connection_state = APPLEMIDI_CONNECTION_STATE_SLAVE;
     peer->connection_sync_ctr = 0;
     peer->connection_sync_done_timestamp = 0;
-    peer->outbuffer_len = 0;
-    peer->outbuffer_timestamp_last_flush = 0;
+    applemidi_reset_streams(peer);
     peer->packets_sent = 0;
     peer->packets_received = 0;
     peer->packets_loss = 0;
+    peer->packets_recovered = 0;
   }
 
 
@@ -100,12 +202,34 @@ int32_t applemidi_init(void *_callback_midi_message_received, void *_callback_se
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Releases the peer buffers of the sessions and of the pool
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void applemidi_deinit(applemidi_t *ctx)
+{
+  int i;
+  for(i=0; i<APPLEMIDI_MAX_PEERS; ++i) {
+    if( ctx->peer[i].buffer != NULL ) {
+      free(ctx->peer[i].buffer);
+      ctx->peer[i].buffer = NULL;
+    }
+  }
+
+  while( ctx->buffer_pool != NULL ) {
+    applemidi_peer_buffer_t *buffer = ctx->buffer_pool;
+    ctx->buffer_pool = buffer->next;
+    free(buffer);
+  }
+  ctx->buffer_count = 0;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Debug Level can be changed during runtime
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-int32_t applemidi_set_debug_level(uint8_t verbosity)
+int32_t applemidi_set_debug_level(applemidi_t *ctx, uint8_t verbosity)
 {
-  applemidi_debug_level = verbosity;
+  ctx->debug_level = verbosity;
 
   return 0; // no error
 }
@@ -114,21 +238,21 @@ int32_t applemidi_set_debug_level(uint8_t verbosity)
  * @brief Returns the verbosity level
  *
  */
-int32_t applemidi_get_debug_level(void)
+int32_t applemidi_get_debug_level(applemidi_t *ctx)
 {
-  return applemidi_debug_level;
+  return ctx->debug_level;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Returns information about a peer
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-applemidi_peer_t *applemidi_peer_get_info(uint8_t applemidi_port)
+applemidi_peer_t *applemidi_peer_get_info(applemidi_t *ctx, uint8_t applemidi_port)
 {
   if( applemidi_port >= APPLEMIDI_MAX_PEERS )
     return NULL; // invalid port
 
-  applemidi_peer_t *peer = &applemidi_peer[applemidi_port];
+  applemidi_peer_t *peer = &ctx->peer[applemidi_port];
   return peer;
 }
 
@@ -136,48 +260,241 @@ applemidi_peer_t *applemidi_peer_get_info(uint8_t applemidi_port)
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Returns free applemidi_port which can be used to initiate a new session
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-extern int32_t applemidi_search_free_port(void)
+extern int32_t applemidi_search_free_port(applemidi_t *ctx)
 {
-  int i;
-  applemidi_peer_t *peer = &applemidi_peer[1]; // starting at 1 (because I'm 0)
-  for(i=1; i<APPLEMIDI_MAX_PEERS; ++i, ++peer) {
-    if( peer->ssrc == 0 ) {
-      return i;
+  if( ctx->free_ports_count == 0 ) {
+    return -1;
+  }
+
+  return ctx->ports[ctx->free_ports_count - 1];
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Copies the RTP statistics of a peer without locking
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int32_t applemidi_peer_get_rtp_stats(applemidi_t *ctx, uint8_t applemidi_port, applemidi_rtp_stats_t *stats)
+{
+  if( applemidi_port >= APPLEMIDI_MAX_PEERS )
+    return -1; // invalid port
+
+  applemidi_peer_t *peer = &ctx->peer[applemidi_port];
+  uint32_t seq1, seq2;
+  do {
+    seq1 = __atomic_load_n(&peer->rtp_stats_seq, __ATOMIC_ACQUIRE);
+    memcpy(stats, &peer->rtp_stats, sizeof(applemidi_rtp_stats_t));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    seq2 = __atomic_load_n(&peer->rtp_stats_seq, __ATOMIC_RELAXED);
+  } while( (seq1 & 1) || seq1 != seq2 );
+
+  return 0; // no error
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Returns the number of allocated peer buffers
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int32_t applemidi_get_buffer_count(applemidi_t *ctx)
+{
+  return ctx->buffer_count;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Takes a packet from the pool, returns NULL if all packets are in use
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static uint8_t *applemidi_packet_alloc(applemidi_t *ctx)
+{
+  uint8_t i;
+  for(i=0; i<APPLEMIDI_PACKET_POOL_SIZE; ++i) {
+    if( !(ctx->packet_pool_used & (1UL << i)) ) {
+      ctx->packet_pool_used |= (1UL << i);
+      ctx->packet_pool_stats.allocs += 1;
+      ctx->packet_pool_stats.in_use += 1;
+      if( ctx->packet_pool_stats.in_use > ctx->packet_pool_stats.max_in_use ) {
+        ctx->packet_pool_stats.max_in_use = ctx->packet_pool_stats.in_use;
+      }
+      return (uint8_t *)ctx->packet_pool[i];
+    }
+  }
+
+  if( ctx->packet_pool_stats.exhausted != ~0 ) {
+    ctx->packet_pool_stats.exhausted += 1;
+  }
+  if( ctx->debug_level >= 2 ) {
+    printf(APPLEMIDI_LOG_TAG "packet_alloc: all %d packets are in use\n", APPLEMIDI_PACKET_POOL_SIZE);
+  }
+  return NULL;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Returns a packet to the pool
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static void applemidi_packet_free(applemidi_t *ctx, uint8_t *packet)
+{
+  uint8_t i;
+  for(i=0; i<APPLEMIDI_PACKET_POOL_SIZE; ++i) {
+    if( packet == (uint8_t *)ctx->packet_pool[i] && (ctx->packet_pool_used & (1UL << i)) ) {
+      ctx->packet_pool_used &= ~(1UL << i);
+      ctx->packet_pool_stats.in_use -= 1;
+      return;
+    }
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Returns the usage of the packet pool
+////////////////////////////////////////////////////////////////////////////////////////////////////
+applemidi_packet_pool_stats_t *applemidi_get_packet_pool_stats(applemidi_t *ctx)
+{
+  return &ctx->packet_pool_stats;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Swaps two entries of the port list
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static void applemidi_ports_swap(applemidi_t *ctx, uint8_t pos1, uint8_t pos2)
+{
+  uint8_t port1 = ctx->ports[pos1];
+  uint8_t port2 = ctx->ports[pos2];
+  ctx->ports[pos1] = port2;
+  ctx->ports_pos[port2] = pos1;
+  ctx->ports[pos2] = port1;
+  ctx->ports_pos[port1] = pos2;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Allocates the given applemidi_port for a session, returns NULL if it is already in use or if there is no memory
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static applemidi_peer_t *applemidi_peer_alloc(applemidi_t *ctx, uint8_t applemidi_port)
+{
+  if( applemidi_port == 0 || applemidi_port >= APPLEMIDI_MAX_PEERS )
+    return NULL; // invalid port
+
+  uint8_t pos = ctx->ports_pos[applemidi_port];
+  if( pos >= ctx->free_ports_count )
+    return NULL; // port already in use
+
+  // take the buffer from the pool, or allocate a new one
+  applemidi_peer_buffer_t *buffer = ctx->buffer_pool;
+  if( buffer != NULL ) {
+    ctx->buffer_pool = buffer->next;
+  } else {
+    buffer = malloc(sizeof(applemidi_peer_buffer_t));
+    if( buffer == NULL ) {
+      if( ctx->debug_level >= 1 ) {
+        printf(APPLEMIDI_LOG_TAG "peer_alloc: no memory for applemidi_port=%d\n", applemidi_port);
+      }
+      return NULL;
+    }
+    ctx->buffer_count += 1;
+  }
+  buffer->next = NULL;
+
+  // move the port behind the free ports: it is swapped with the last free one
+  uint8_t last_pos = --ctx->free_ports_count;
+  applemidi_ports_swap(ctx, pos, last_pos);
+
+  applemidi_peer_t *peer = &ctx->peer[applemidi_port];
+  peer->buffer = buffer;
+  peer->timestamp_last_activity = get_timestamp_100us();
+  ctx->deadline_valid = 0;
+  return peer;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Peer index by SSRC and IP address
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static uint32_t applemidi_peer_hash(uint8_t *ip_addr, uint32_t ssrc)
+{
+  uint32_t key = ((uint32_t)ip_addr[0] << 24) | ((uint32_t)ip_addr[1] << 16) | ((uint32_t)ip_addr[2] << 8) | ip_addr[3]; // TODO: support for IPv6
+  key ^= ssrc * 0x9E3779B1u;
+  return ((key * 0x85EBCA6Bu) >> 16) & (APPLEMIDI_PEER_HASH_SIZE-1);
+}
+
+// returns the slot of the peer, or -1-slot of the free slot where it can be inserted
+static int32_t applemidi_peer_index_find(applemidi_t *ctx, uint8_t *ip_addr, uint32_t ssrc)
+{
+  uint32_t slot = applemidi_peer_hash(ip_addr, ssrc);
+  while( ctx->peer_index[slot] != 0 ) {
+    applemidi_peer_t *peer = &ctx->peer[ctx->peer_index[slot]];
+    if( peer->ssrc == ssrc && memcmp(peer->ip_addr, ip_addr, 4) == 0 ) { // TODO: support for IPv6
+      return slot;
     }
+    slot = (slot + 1) & (APPLEMIDI_PEER_HASH_SIZE-1);
   }
 
-  return -1;
+  return -1 - (int32_t)slot;
+}
+
+static void applemidi_peer_index_insert(applemidi_t *ctx, applemidi_peer_t *peer)
+{
+  int32_t slot = applemidi_peer_index_find(ctx, peer->ip_addr, peer->ssrc);
+  if( slot < 0 ) {
+    slot = -1 - slot;
+  }
+  ctx->peer_index[slot] = peer->applemidi_port;
+}
+
+static void applemidi_peer_index_remove(applemidi_t *ctx, applemidi_peer_t *peer)
+{
+  int32_t slot = applemidi_peer_index_find(ctx, peer->ip_addr, peer->ssrc);
+  if( slot < 0 || ctx->peer_index[slot] != peer->applemidi_port ) {
+    return; // not indexed
+  }
+
+  // backward shift deletion, so that no tombstones are needed
+  uint32_t gap = slot;
+  uint32_t next = (gap + 1) & (APPLEMIDI_PEER_HASH_SIZE-1);
+  ctx->peer_index[gap] = 0;
+  while( ctx->peer_index[next] != 0 ) {
+    applemidi_peer_t *other = &ctx->peer[ctx->peer_index[next]];
+    uint32_t home = applemidi_peer_hash(other->ip_addr, other->ssrc);
+    // move the entry if its home is not between the gap and its position
+    if( ((next - home) & (APPLEMIDI_PEER_HASH_SIZE-1)) >= ((next - gap) & (APPLEMIDI_PEER_HASH_SIZE-1)) ) {
+      ctx->peer_index[gap] = ctx->peer_index[next];
+      ctx->peer_index[next] = 0;
+      gap = next;
+    }
+    next = (next + 1) & (APPLEMIDI_PEER_HASH_SIZE-1);
+  }
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Dummy Callbacks
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-void applemidi_receive_packet_callback_for_debugging(uint8_t applemidi_port, uint32_t timestamp, uint8_t midi_status, uint8_t *remaining_message, size_t len, size_t continued_sysex_pos)
+void applemidi_receive_packet_callback_for_debugging(void *user_data, uint8_t applemidi_port, uint32_t timestamp, uint8_t midi_status, uint8_t *remaining_message, size_t len, size_t continued_sysex_pos)
 {
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-// Always send packets via this function to ensure proper statistics
+// Always send packets via this function to ensure proper statistics: is_dataport tells the
+// application from which of its sockets the datagram needs to be sent
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-static int32_t applemidi_send_udp_datagram(applemidi_peer_t *peer, uint8_t *ip_addr, uint16_t port, uint8_t *tx_data, size_t tx_len)
+static int32_t applemidi_send_udp_datagram(applemidi_t *ctx, applemidi_peer_t *peer, uint8_t *ip_addr, uint16_t port, uint8_t *tx_data, size_t tx_len, uint8_t is_dataport)
 {
-  if( applemidi_callback_send_udp_datagram ) {
+  if( ctx->callback_send_udp_datagram ) {
     // peer stats
     if( peer != NULL && peer->packets_sent != ~0 ) {
       peer->packets_sent += 1;
     }
 
     // my own stats
-    if( applemidi_peer[0].packets_sent != ~0 ) {
-      applemidi_peer[0].packets_sent += 1;
+    if( ctx->peer[0].packets_sent != ~0 ) {
+      ctx->peer[0].packets_sent += 1;
     }
 
-    int32_t status = applemidi_callback_send_udp_datagram(ip_addr, port, tx_data, tx_len);
+    int32_t status = ctx->callback_send_udp_datagram(ctx->user_data, ip_addr, port, tx_data, tx_len, is_dataport);
 
     if( status < 0 ) {
-      if( applemidi_debug_level >= 1 ) {
+      if( ctx->debug_level >= 1 ) {
         printf(APPLEMIDI_LOG_TAG "applemidi_send_udp_datagram ERROR: failed to send data\n"); // TODO: more info required?
       }
     }
@@ -192,7 +509,7 @@ static int32_t applemidi_send_udp_datagram(applemidi_peer_t *peer, uint8_t *ip_a
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Some util functions
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-static int32_t applemidi_send_invitation(applemidi_peer_t *peer, uint8_t *ip_addr, uint16_t port, uint32_t token, uint32_t ssrc, char *name)
+static int32_t applemidi_send_invitation(applemidi_t *ctx, applemidi_peer_t *peer, uint8_t *ip_addr, uint16_t port, uint8_t is_dataport, uint32_t token, uint32_t ssrc, char *name)
 {
   uint32_t tx_buffer[4 + (APPLEMIDI_MAX_NAME_LEN+1)/4] = {
     htonl(0xffff0000 | APPLEMIDI_COMMAND_INVITATION),
@@ -200,12 +517,14 @@ static int32_t applemidi_send_invitation(applemidi_peer_t *peer, uint8_t *ip_add
     htonl(token),
     htonl(ssrc)
   };
-  strncpy((void *)&tx_buffer[4], name, APPLEMIDI_MAX_NAME_LEN);
-  size_t tx_len = 4*4 + strlen(name) + 1;
-  return applemidi_send_udp_datagram(peer, ip_addr, port, (uint8_t *)tx_buffer, tx_len);
+  // the name is zero terminated by the initialization of the buffer
+  size_t name_len = strnlen(name, APPLEMIDI_MAX_NAME_LEN-1);
+  memcpy(&tx_buffer[4], name, name_len);
+  size_t tx_len = 4*4 + name_len + 1;
+  return applemidi_send_udp_datagram(ctx, peer, ip_addr, port, (uint8_t *)tx_buffer, tx_len, is_dataport);
 }
 
-static int32_t applemidi_send_invitation_accepted(applemidi_peer_t *peer, uint8_t *ip_addr, uint16_t port, uint32_t token, uint32_t ssrc)
+static int32_t applemidi_send_invitation_accepted(applemidi_t *ctx, applemidi_peer_t *peer, uint8_t *ip_addr, uint16_t port, uint8_t is_dataport, uint32_t token, uint32_t ssrc)
 {
   uint32_t tx_buffer[4] = {
     htonl(0xffff0000 | APPLEMIDI_COMMAND_INVITATION_ACCEPTED),
@@ -213,10 +532,10 @@ static int32_t applemidi_send_invitation_accepted(applemidi_peer_t *peer, uint8_
     htonl(token),
     htonl(ssrc)
   };
-  return applemidi_send_udp_datagram(peer, ip_addr, port, (uint8_t *)tx_buffer, 4*4);
+  return applemidi_send_udp_datagram(ctx, peer, ip_addr, port, (uint8_t *)tx_buffer, 4*4, is_dataport);
 }
 
-static int32_t applemidi_send_invitation_rejected(applemidi_peer_t *peer, uint8_t *ip_addr, uint16_t port, uint32_t token, uint32_t ssrc)
+static int32_t applemidi_send_invitation_rejected(applemidi_t *ctx, applemidi_peer_t *peer, uint8_t *ip_addr, uint16_t port, uint8_t is_dataport, uint32_t token, uint32_t ssrc)
 {
   uint32_t tx_buffer[4] = {
     htonl(0xffff0000 | APPLEMIDI_COMMAND_INVITATION_REJECTED),
@@ -224,65 +543,569 @@ static int32_t applemidi_send_invitation_rejected(applemidi_peer_t *peer, uint8_
     htonl(token),
     htonl(ssrc)
   };
-  return applemidi_send_udp_datagram(peer, ip_addr, port, (uint8_t *)tx_buffer, 4*4);
+  return applemidi_send_udp_datagram(ctx, peer, ip_addr, port, (uint8_t *)tx_buffer, 4*4, is_dataport);
+}
+
+static int32_t applemidi_send_endsession(applemidi_t *ctx, applemidi_peer_t *peer, uint8_t *ip_addr, uint16_t port, uint8_t is_dataport, uint32_t token, uint32_t ssrc)
+{
+  uint32_t tx_buffer[4] = {
+    htonl(0xffff0000 | APPLEMIDI_COMMAND_ENDSESSION),
+    htonl(0x00000002),
+    htonl(token),
+    htonl(ssrc)
+  };
+  return applemidi_send_udp_datagram(ctx, peer, ip_addr, port, (uint8_t *)tx_buffer, 4*4, is_dataport);
+}
+
+#ifdef APPLEMIDI_BITRATE_RECEIVE_LIMIT
+static int32_t applemidi_send_bitrate_receive_limit(applemidi_t *ctx, applemidi_peer_t *peer, uint8_t *ip_addr, uint16_t port, uint8_t is_dataport, uint32_t ssrc, uint32_t receive_limit)
+{
+  uint32_t tx_buffer[3] = {
+    htonl(0xffff0000 | APPLEMIDI_COMMAND_BITRATE_RECEIVE_LIMIT),
+    htonl(ssrc),
+    htonl(receive_limit)
+  };
+  return applemidi_send_udp_datagram(ctx, peer, ip_addr, port, (uint8_t *)tx_buffer, 3*4, is_dataport);
+}
+#endif
+
+static int32_t applemidi_send_synchronization(applemidi_t *ctx, applemidi_peer_t *peer, uint8_t *ip_addr, uint16_t port, uint8_t is_dataport, uint32_t ssrc, uint8_t count, uint64_t timestamp1, uint64_t timestamp2, uint64_t timestamp3)
+{
+  uint32_t tx_buffer[9] = {
+    htonl(0xffff0000 | APPLEMIDI_COMMAND_SYNCHRONIZATION),
+    htonl(ssrc),
+    htonl((uint32_t)count << 24),
+    htonl(timestamp1 >> 32),
+    htonl(timestamp1),
+    htonl(timestamp2 >> 32),
+    htonl(timestamp2),
+    htonl(timestamp3 >> 32),
+    htonl(timestamp3)
+  };
+  return applemidi_send_udp_datagram(ctx, peer, ip_addr, port, (uint8_t *)tx_buffer, 9*4, is_dataport);
+}
+
+static int32_t applemidi_send_receiver_feedback(applemidi_t *ctx, applemidi_peer_t *peer, uint8_t *ip_addr, uint16_t port, uint8_t is_dataport, uint32_t ssrc, uint16_t seq_nr)
+{
+  uint32_t tx_buffer[3] = {
+    htonl(0xffff0000 | APPLEMIDI_COMMAND_RECEIVER_FEEDBACK),
+    htonl(ssrc),
+    htons(seq_nr),
+  };
+  return applemidi_send_udp_datagram(ctx, peer, ip_addr, port, (uint8_t *)tx_buffer, 3*4, is_dataport);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Returns the 100 uS based Timestamp of a monotonic clock: it doesn't jump when the system time is set
+////////////////////////////////////////////////////////////////////////////////////////////////////
+#ifndef CLOCK_MONOTONIC
+extern unsigned long micros(void);
+#endif
+
+static uint64_t get_timestamp_100us()
+{
+#ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 10000 + (ts.tv_nsec / 100000)); // 100 uS per increment
+#else
+  // the 32bit micros() are extended to 64bit with the signed difference to the last result, which
+  // is shared by all engines and threads: we are called often enough (< 35 minutes) to see each overflow
+  static uint64_t last_us = 0;
+  uint64_t last = __atomic_load_n(&last_us, __ATOMIC_RELAXED);
+  uint64_t now;
+  do {
+    uint32_t now_us = micros();
+    now = last == 0 ? now_us : last + (int32_t)(now_us - (uint32_t)last);
+    if( now <= last ) {
+      return last / 100; // another thread has stored a later reading
+    }
+  } while( !__atomic_compare_exchange_n(&last_us, &last, now, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED) );
+  return now / 100;
+#endif
+}
+
+uint64_t applemidi_get_timestamp(void)
+{
+  return get_timestamp_100us();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Updates the clock offset and round trip time of a peer with the result of a CK exchange
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static void applemidi_clock_update(applemidi_peer_t *peer, int64_t offset, int64_t rtt)
+{
+  if( rtt < 0 ) {
+    return; // invalid exchange
+  }
+
+  peer->clock_rtt = rtt;
+  if( peer->clock_sync_count == 0 || peer->clock_rtt < peer->clock_rtt_min ) {
+    peer->clock_rtt_min = peer->clock_rtt;
+  }
+
+  // an exchange with a long round trip time has an unknown asymmetry: it is not used for the offset
+  if( peer->clock_sync_count == 0 ) {
+    peer->clock_offset = offset;
+  } else if( peer->clock_rtt <= 2*peer->clock_rtt_min + 10 ) {
+    peer->clock_offset += (offset - peer->clock_offset) / 4;
+  }
+
+  if( peer->clock_sync_count != ~0 ) {
+    peer->clock_sync_count += 1;
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Converts the RTP timestamp of a peer to the local time base
+////////////////////////////////////////////////////////////////////////////////////////////////////
+uint32_t applemidi_peer_local_timestamp(applemidi_t *ctx, uint8_t applemidi_port, uint32_t remote_timestamp)
+{
+  if( applemidi_port >= APPLEMIDI_MAX_PEERS )
+    return remote_timestamp; // invalid port
+
+  return remote_timestamp - (uint32_t)ctx->peer[applemidi_port].clock_offset;
+}
+
+#if APPLEMIDI_JOURNAL_ACTIVE
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Recovery Journal (RFC 6295)
+// We keep the latest state of each program, controller, pitch wheel and note which has been sent
+// since the checkpoint. Each outgoing packet contains the channel journals (chapter P, C, W and N)
+// for this state, so that the receiver can repair a lost packet with the next one. The checkpoint
+// is moved forward with the receiver feedback (RS) of the peer.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// removes all entries up to and including the indicated sequence number
+static void applemidi_journal_trim(applemidi_peer_t *peer, uint16_t seq_nr)
+{
+  int i, j = 0;
+  for(i=0; i<peer->journal_len; ++i) {
+    if( (int16_t)(peer->buffer->journal[i].seq_nr - seq_nr) > 0 ) {
+      peer->buffer->journal[j++] = peer->buffer->journal[i];
+    }
+  }
+  peer->journal_len = j;
+
+  if( (int16_t)((uint16_t)(seq_nr + 1) - peer->journal_checkpoint) > 0 ) {
+    peer->journal_checkpoint = seq_nr + 1;
+  }
+}
+
+// records a channel message which will be sent with the next packet
+static void applemidi_journal_record(applemidi_peer_t *peer, uint8_t status, uint8_t data1, uint8_t data2)
+{
+  uint8_t type = status & 0xf0;
+  if( type == 0x90 && data2 == 0 ) {
+    type = 0x80; // Note On with velocity 0 is a Note Off
+  }
+  status = type | (status & 0x0f);
+
+  // the new state replaces the entry of the same program, controller, pitch wheel or note
+  int i, j = 0;
+  for(i=0; i<peer->journal_len; ++i) {
+    applemidi_journal_entry_t *entry = &peer->buffer->journal[i];
+    uint8_t entry_type = entry->status & 0xf0;
+    uint8_t same = 0;
+    if( (entry->status & 0x0f) == (status & 0x0f) ) {
+      if( type == 0xc0 || type == 0xe0 ) {
+        same = entry_type == type;
+      } else if( type == 0xb0 ) {
+        same = entry_type == 0xb0 && entry->data1 == data1;
+      } else {
+        same = (entry_type == 0x80 || entry_type == 0x90) && entry->data1 == data1;
+      }
+    }
+    if( !same ) {
+      peer->buffer->journal[j++] = *entry;
+    }
+  }
+  peer->journal_len = j;
+
+  // no space left: the oldest packet can't be recovered anymore
+  if( peer->journal_len >= APPLEMIDI_JOURNAL_MAX_ENTRIES ) {
+    applemidi_journal_trim(peer, peer->buffer->journal[0].seq_nr);
+    if( peer->journal_len >= APPLEMIDI_JOURNAL_MAX_ENTRIES ) {
+      return; // all entries belong to the current packet
+    }
+  }
+
+  applemidi_journal_entry_t *entry = &peer->buffer->journal[peer->journal_len++];
+  entry->seq_nr = peer->tx_seq_nr;
+  entry->status = status;
+  entry->data1 = data1 & 0x7f;
+  entry->data2 = data2 & 0x7f;
+}
+
+// records the channel messages of an outgoing MIDI stream (SysEx and system messages are not journalled)
+static void applemidi_journal_record_stream(applemidi_peer_t *peer, uint8_t *stream, size_t len)
+{
+  uint8_t status = 0;
+  size_t pos = 0;
+  while( pos < len ) {
+    if( stream[pos] & 0x80 ) {
+      status = stream[pos++];
+      if( status >= 0xf0 ) {
+        return;
+      }
+    } else if( status == 0 ) {
+      return;
+    } else {
+      uint8_t type = status & 0xf0;
+      size_t num_bytes = (type == 0xc0 || type == 0xd0) ? 1 : 2;
+      if( pos + num_bytes > len ) {
+        return;
+      }
+      if( type != 0xa0 && type != 0xd0 ) {
+        applemidi_journal_record(peer, status, stream[pos], (num_bytes > 1) ? stream[pos+1] : 0);
+      }
+      pos += num_bytes;
+    }
+  }
+}
+
+// encodes the channel journal of the given channel, returns 0 if there is nothing to send and < 0 if it doesn't fit
+static int32_t applemidi_journal_encode_channel(applemidi_peer_t *peer, uint8_t chn, uint8_t *buf, size_t max_len)
+{
+  applemidi_journal_entry_t *program = NULL;
+  applemidi_journal_entry_t *wheel = NULL;
+  size_t num_controllers = 0;
+  size_t num_notes_on = 0;
+  uint8_t low = 15;
+  uint8_t high = 0;
+
+  int i;
+  for(i=0; i<peer->journal_len; ++i) {
+    applemidi_journal_entry_t *entry = &peer->buffer->journal[i];
+    if( (entry->status & 0x0f) != chn || entry->seq_nr == peer->tx_seq_nr ) {
+      continue; // the commands of the current packet are not part of its journal
+    }
+    switch( entry->status & 0xf0 ) {
+    case 0xc0: program = entry; break;
+    case 0xe0: wheel = entry; break;
+    case 0xb0: ++num_controllers; break;
+    case 0x90: ++num_notes_on; break;
+    case 0x80: {
+      uint8_t octet = entry->data1 >> 3;
+      if( octet < low ) low = octet;
+      if( octet > high ) high = octet;
+    } break;
+    }
+  }
+
+  uint8_t has_offbits = low <= high;
+  if( program == NULL && wheel == NULL && num_controllers == 0 && num_notes_on == 0 && !has_offbits ) {
+    return 0;
+  }
+
+  size_t len = 3;
+  if( program ) len += 3;
+  if( num_controllers ) len += 1 + 2*num_controllers;
+  if( wheel ) len += 2;
+  if( num_notes_on || has_offbits ) len += 2 + 2*num_notes_on + (has_offbits ? (high - low + 1) : 0);
+  if( len > max_len ) {
+    return -1;
+  }
+
+  // channel journal header: S=0, CHAN, H=0, LENGTH, followed by the table of contents
+  buf[0] = (chn << 3) | ((len >> 8) & 0x03);
+  buf[1] = len & 0xff;
+  buf[2] = (program ? 0x80 : 0) | (num_controllers ? 0x40 : 0) | (wheel ? 0x10 : 0) | ((num_notes_on || has_offbits) ? 0x08 : 0);
+  size_t pos = 3;
+
+  // chapter P: program change without bank select
+  if( program ) {
+    buf[pos++] = program->data1;
+    buf[pos++] = 0x00;
+    buf[pos++] = 0x00;
+  }
+
+  // chapter C: controller logs with absolute values
+  if( num_controllers ) {
+    buf[pos++] = num_controllers - 1;
+    for(i=0; i<peer->journal_len; ++i) {
+      applemidi_journal_entry_t *entry = &peer->buffer->journal[i];
+      if( entry->status == (0xb0 | chn) && entry->seq_nr != peer->tx_seq_nr ) {
+        buf[pos++] = entry->data1;
+        buf[pos++] = entry->data2;
+      }
+    }
+  }
+
+  // chapter W: pitch wheel
+  if( wheel ) {
+    buf[pos++] = wheel->data1;
+    buf[pos++] = wheel->data2;
+  }
+
+  // chapter N: note logs for the active notes and offbits for the released ones
+  if( num_notes_on || has_offbits ) {
+    buf[pos++] = num_notes_on;
+    buf[pos++] = has_offbits ? ((low << 4) | high) : 0xf0;
+    for(i=0; i<peer->journal_len; ++i) {
+      applemidi_journal_entry_t *entry = &peer->buffer->journal[i];
+      if( entry->status == (0x90 | chn) && entry->seq_nr != peer->tx_seq_nr ) {
+        buf[pos++] = entry->data1;
+        buf[pos++] = 0x80 | entry->data2; // Y flag: play the note
+      }
+    }
+    if( has_offbits ) {
+      uint8_t *offbits = &buf[pos];
+      memset(offbits, 0, high - low + 1);
+      for(i=0; i<peer->journal_len; ++i) {
+        applemidi_journal_entry_t *entry = &peer->buffer->journal[i];
+        if( entry->status == (0x80 | chn) && entry->seq_nr != peer->tx_seq_nr ) {
+          offbits[(entry->data1 >> 3) - low] |= 0x80 >> (entry->data1 & 0x07);
+        }
+      }
+      pos += high - low + 1;
+    }
+  }
+
+  return pos;
+}
+
+// appends the recovery journal to a packet, returns the new packet length
+static size_t applemidi_journal_append(applemidi_t *ctx, applemidi_peer_t *peer, uint8_t *packet, size_t len, size_t max_len)
+{
+  if( peer->journal_len == 0 || (len + 3) > max_len ) {
+    return len;
+  }
+
+  uint8_t *buf = &packet[len];
+  size_t journal_max_len = max_len - len;
+  if( journal_max_len > APPLEMIDI_JOURNAL_MAX_SIZE ) {
+    journal_max_len = APPLEMIDI_JOURNAL_MAX_SIZE;
+  }
+
+  size_t pos = 3;
+  uint8_t totchan = 0;
+  uint8_t chn;
+  for(chn=0; chn<16; ++chn) {
+    int32_t chn_len = applemidi_journal_encode_channel(peer, chn, &buf[pos], journal_max_len - pos);
+    if( chn_len < 0 ) {
+      if( ctx->debug_level >= 2 ) {
+        printf(APPLEMIDI_LOG_TAG "journal_append: journal exceeds %d bytes - not sent\n", APPLEMIDI_JOURNAL_MAX_SIZE);
+      }
+      return len;
+    }
+    if( chn_len > 0 ) {
+      pos += chn_len;
+      ++totchan;
+    }
+  }
+
+  if( totchan == 0 ) {
+    return len;
+  }
+
+  // journal header: S=0, Y=0 (no system journal), A=1, H=0, TOTCHAN, checkpoint
+  buf[0] = 0x20 | (totchan - 1);
+  buf[1] = peer->journal_checkpoint >> 8;
+  buf[2] = peer->journal_checkpoint & 0xff;
+
+  packet[3*4] |= 0x40; // J flag of the MIDI command section
+  return len + pos;
+}
+
+// keeps track of the notes which are on at the receiver side
+static void applemidi_journal_rx_note(applemidi_peer_t *peer, uint8_t midi_status, uint8_t *data, size_t len)
+{
+  if( (midi_status & 0xe0) == 0x80 && len >= 2 ) {
+    uint8_t *notes = peer->buffer->rx_notes[midi_status & 0x0f];
+    uint8_t note = data[0] & 0x7f;
+    if( (midi_status & 0xf0) == 0x90 && data[1] > 0 ) {
+      notes[note >> 3] |= 1 << (note & 0x07);
+    } else {
+      notes[note >> 3] &= ~(1 << (note & 0x07));
+    }
+  }
+}
+
+// forwards a recovered MIDI message to the application
+static void applemidi_journal_emit(applemidi_t *ctx, applemidi_peer_t *peer, uint32_t timestamp, uint8_t midi_status, uint8_t data1, uint8_t data2, size_t len)
+{
+  uint8_t data[2] = { data1 & 0x7f, data2 & 0x7f };
+  applemidi_journal_rx_note(peer, midi_status, data, len);
+  if( ctx->callback_midi_message_received != NULL ) {
+    ctx->callback_midi_message_received(ctx->user_data, peer->applemidi_port, timestamp, midi_status, data, len, 0);
+  }
 }
 
-static int32_t applemidi_send_endsession(applemidi_peer_t *peer, uint8_t *ip_addr, uint16_t port, uint32_t token, uint32_t ssrc)
-{
-  uint32_t tx_buffer[4] = {
-    htonl(0xffff0000 | APPLEMIDI_COMMAND_ENDSESSION),
-    htonl(0x00000002),
-    htonl(token),
-    htonl(ssrc)
-  };
-  return applemidi_send_udp_datagram(peer, ip_addr, port, (uint8_t *)tx_buffer, 4*4);
-}
+// recovers the state from the journal of a received packet
+// the system journal and the chapters M, E, T and A are not supported
+static int32_t applemidi_journal_decode(applemidi_t *ctx, applemidi_peer_t *peer, uint32_t timestamp, uint8_t *journal, size_t len)
+{
+  if( len < 3 ) {
+    return -1;
+  }
+
+  uint8_t header = journal[0];
+  size_t pos = 3;
+
+  // Y flag: skip the system journal
+  if( header & 0x40 ) {
+    if( pos + 2 > len ) {
+      return -1;
+    }
+    pos += ((journal[pos] & 0x03) << 8) | journal[pos+1];
+  }
+
+  // A flag: channel journals
+  if( !(header & 0x20) ) {
+    return 0;
+  }
+
+  int totchan = (header & 0x0f) + 1;
+  int i;
+  for(i=0; i<totchan; ++i) {
+    if( pos + 3 > len ) {
+      return -1;
+    }
+    uint8_t chn = (journal[pos] >> 3) & 0x0f;
+    size_t chn_len = ((journal[pos] & 0x03) << 8) | journal[pos+1];
+    uint8_t toc = journal[pos+2];
+    if( chn_len < 3 || pos + chn_len > len ) {
+      return -1;
+    }
+    size_t end = pos + chn_len;
+    size_t p = pos + 3;
+    pos = end;
+
+    // chapter P
+    if( toc & 0x80 ) {
+      if( p + 3 > end ) {
+        return -1;
+      }
+      applemidi_journal_emit(ctx, peer, timestamp, 0xc0 | chn, journal[p], 0, 1);
+      p += 3;
+    }
+
+    // chapter C: only absolute values are supported (A=0)
+    if( toc & 0x40 ) {
+      if( p + 1 > end ) {
+        return -1;
+      }
+      size_t num = (journal[p++] & 0x7f) + 1;
+      if( p + 2*num > end ) {
+        return -1;
+      }
+      size_t n;
+      for(n=0; n<num; ++n, p += 2) {
+        if( !(journal[p+1] & 0x80) ) {
+          applemidi_journal_emit(ctx, peer, timestamp, 0xb0 | chn, journal[p], journal[p+1], 2);
+        }
+      }
+    }
+
+    // chapter M has a variable layout which we don't parse, the following chapters can't be located
+    if( toc & 0x20 ) {
+      continue;
+    }
+
+    // chapter W
+    if( toc & 0x10 ) {
+      if( p + 2 > end ) {
+        return -1;
+      }
+      applemidi_journal_emit(ctx, peer, timestamp, 0xe0 | chn, journal[p], journal[p+1], 2);
+      p += 2;
+    }
+
+    // chapter N
+    if( toc & 0x08 ) {
+      if( p + 2 > end ) {
+        return -1;
+      }
+      size_t num_logs = journal[p] & 0x7f;
+      uint8_t low = journal[p+1] >> 4;
+      uint8_t high = journal[p+1] & 0x0f;
+      if( num_logs == 127 && low == 15 && high == 0 ) {
+        num_logs = 128;
+      }
+      size_t num_offbits = (low <= high) ? (high - low + 1) : 0;
+      p += 2;
+      if( p + 2*num_logs + num_offbits > end ) {
+        return -1;
+      }
+
+      uint8_t *notes = peer->buffer->rx_notes[chn];
+      size_t n;
+      for(n=0; n<num_logs; ++n, p += 2) {
+        uint8_t note = journal[p] & 0x7f;
+        uint8_t velocity = journal[p+1] & 0x7f;
+        uint8_t is_on = notes[note >> 3] & (1 << (note & 0x07));
+        if( (journal[p+1] & 0x80) && velocity > 0 && !is_on ) {
+          applemidi_journal_emit(ctx, peer, timestamp, 0x90 | chn, note, velocity, 2);
+        }
+      }
 
-static int32_t applemidi_send_bitrate_receive_limit(applemidi_peer_t *peer, uint8_t *ip_addr, uint16_t port, uint32_t ssrc, uint32_t receive_limit)
-{
-  uint32_t tx_buffer[3] = {
-    htonl(0xffff0000 | APPLEMIDI_COMMAND_BITRATE_RECEIVE_LIMIT),
-    htonl(ssrc),
-    htonl(receive_limit)
-  };
-  return applemidi_send_udp_datagram(peer, ip_addr, port, (uint8_t *)tx_buffer, 3*4);
-}
+      for(n=0; n<num_offbits; ++n, ++p) {
+        uint8_t bit;
+        for(bit=0; bit<8; ++bit) {
+          uint8_t note = 8*(low + n) + bit;
+          if( (journal[p] & (0x80 >> bit)) && (notes[note >> 3] & (1 << (note & 0x07))) ) {
+            applemidi_journal_emit(ctx, peer, timestamp, 0x80 | chn, note, 0, 2);
+          }
+        }
+      }
+    }
+  }
 
-static int32_t applemidi_send_synchronization(applemidi_peer_t *peer, uint8_t *ip_addr, uint16_t port, uint32_t ssrc, uint8_t count, uint64_t timestamp1, uint64_t timestamp2, uint64_t timestamp3)
-{
-  uint32_t tx_buffer[9] = {
-    htonl(0xffff0000 | APPLEMIDI_COMMAND_SYNCHRONIZATION),
-    htonl(ssrc),
-    htonl(count << 24),
-    htonl(timestamp1 >> 32),
-    htonl(timestamp1),
-    htonl(timestamp2 >> 32),
-    htonl(timestamp2),
-    htonl(timestamp3 >> 32),
-    htonl(timestamp3)
-  };
-  return applemidi_send_udp_datagram(peer, ip_addr, port, (uint8_t *)tx_buffer, 9*4);
+  return 0; // no error
 }
+#endif
+
 
-static int32_t applemidi_send_receiver_feedback(applemidi_peer_t *peer, uint8_t *ip_addr, uint16_t port, uint32_t ssrc, uint16_t seq_nr)
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Starts a new packet in the output buffer
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static void applemidi_outbuffer_init(applemidi_t *ctx, applemidi_peer_t *peer, uint32_t timestamp)
 {
-  uint32_t tx_buffer[3] = {
-    htonl(0xffff0000 | APPLEMIDI_COMMAND_RECEIVER_FEEDBACK),
-    htonl(ssrc),
-    htons(seq_nr),
-  };
-  return applemidi_send_udp_datagram(peer, ip_addr, port, (uint8_t *)tx_buffer, 3*4);
+  uint8_t *buf = (uint8_t *)peer->buffer->outbuffer;
+  peer->buffer->outbuffer[0] = htonl(0x80610000 | peer->tx_seq_nr); // the seq_nr is incremented when the packet has been sent
+  peer->buffer->outbuffer[1] = htonl(timestamp);
+  peer->buffer->outbuffer[2] = htonl(ctx->peer[0].ssrc);
+  buf[3*4 + 0] = 0x80; // always use long header so that we can insert the actual length later
+  buf[3*4 + 1] = 0x00;
+  peer->outbuffer_len = APPLEMIDI_HEADER_SIZE;
+  peer->outbuffer_timestamp_last_message = timestamp;
+  peer->outbuffer_timestamp_flush = timestamp + 10*APPLEMIDI_OUTBUFFER_FLUSH_MS;
+  ctx->deadline_valid = 0;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-// Returns the 100 uS based Timestamp
+// Writes the delta time to the previous MIDI message in the output buffer, returns the number of bytes
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-static uint64_t get_timestamp_100us()
+static uint8_t applemidi_outbuffer_delta_time(applemidi_peer_t *peer, uint32_t timestamp)
 {
-  struct timeval tv;
-  gettimeofday(&tv, NULL);
-  return (tv.tv_sec * 10000 + (tv.tv_usec / 100)); // 100 uS per increment
+  // same variable length encoding like in MIDI files: 7bit per byte, MSB set if more bytes follow
+  uint32_t delta = timestamp - peer->outbuffer_timestamp_last_message;
+  if( (int32_t)delta < 0 ) {
+    delta = 0; // clock went backwards
+  } else if( delta > 0x0fffffff ) {
+    delta = 0x0fffffff;
+  }
+  peer->outbuffer_timestamp_last_message = timestamp;
+
+  uint8_t *buf = (uint8_t *)peer->buffer->outbuffer;
+  uint8_t num_bytes = 1;
+  uint32_t tmp;
+  for(tmp = delta >> 7; tmp; tmp >>= 7) {
+    ++num_bytes;
+  }
+
+  int i;
+  for(i=num_bytes-1; i>=0; --i) {
+    uint8_t value = (delta >> (7*i)) & 0x7f;
+    buf[peer->outbuffer_len++] = i ? (value | 0x80) : value;
+  }
+
+  return num_bytes;
 }
 
 
@@ -290,52 +1113,155 @@ static uint64_t get_timestamp_100us()
 // Output Buffer and Synchronization Handling
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-// should be called each mS
-void applemidi_tick(void)
+// returns 1 if the deadline has been reached
+static uint8_t applemidi_deadline_reached(uint32_t deadline, uint32_t now)
+{
+  return (int32_t)(deadline - now) <= 0;
+}
+
+// updates the earliest deadline
+static void applemidi_deadline_min(uint32_t deadline, uint32_t *next_deadline)
+{
+  if( (int32_t)(deadline - *next_deadline) < 0 ) {
+    *next_deadline = deadline;
+  }
+}
+
+// the next point in time when applemidi_tick(ctx) has something to do for the peer
+static void applemidi_peer_deadline(applemidi_peer_t *peer, uint32_t *next_deadline)
+{
+#if APPLEMIDI_SESSION_TIMEOUT_MS > 0
+  applemidi_deadline_min(peer->timestamp_last_activity + 10*APPLEMIDI_SESSION_TIMEOUT_MS, next_deadline);
+#endif
+
+  if( peer->outbuffer_len > 0 ) {
+    applemidi_deadline_min(peer->outbuffer_timestamp_flush, next_deadline);
+  }
+
+  if( peer->connection_state == APPLEMIDI_CONNECTION_STATE_MASTER_CONNECTED ) {
+    uint32_t sync_delay = (peer->connection_sync_ctr < 10) ? (10*APPLEMIDI_MASTER_START_SYNC_MS) : (10*APPLEMIDI_MASTER_REGULAR_SYNC_MS);
+    applemidi_deadline_min(peer->connection_sync_done_timestamp + sync_delay, next_deadline);
+  }
+
+#if APPLEMIDI_JOURNAL_ACTIVE
+  if( peer->ssrc != 0 ) {
+    if( peer->journal_len > 0 && peer->outbuffer_len == 0 && peer->journal_guard_ctr < APPLEMIDI_JOURNAL_GUARD_COUNT ) {
+      applemidi_deadline_min(peer->journal_timestamp_last_packet + 10*APPLEMIDI_JOURNAL_GUARD_MS, next_deadline);
+    }
+    if( peer->rx_feedback_packets != peer->packets_received ) {
+      applemidi_deadline_min(peer->rx_feedback_timestamp + 10*APPLEMIDI_FEEDBACK_MS, next_deadline);
+    }
+  }
+#endif
+}
+
+// should be called at the latest after the returned number of mS
+uint32_t applemidi_tick(applemidi_t *ctx)
 {
   uint32_t now = get_timestamp_100us(); // 32bit is enough...
 
-  int i;
-  applemidi_peer_t *peer = &applemidi_peer[0];
-  for(i=0; i<APPLEMIDI_MAX_PEERS; ++i, ++peer) {
+  // nothing to do until the next deadline
+  if( ctx->deadline_valid && !applemidi_deadline_reached(ctx->deadline, now) ) {
+    return (ctx->deadline - now + 9) / 10;
+  }
+
+  uint32_t next_deadline = now + 10*APPLEMIDI_TICK_MAX_MS;
+
+  // we only visit the used ports: a released port is swapped with a port which has already been visited
+  int pos;
+  for(pos=ctx->free_ports_count; pos<APPLEMIDI_MAX_PEERS-1; ++pos) {
+    uint8_t i = ctx->ports[pos];
+    applemidi_peer_t *peer = &ctx->peer[i];
+
+#if APPLEMIDI_SESSION_TIMEOUT_MS > 0
+    // session timeout: the peer didn't send anything (e.g. no synchronization)
+    if( applemidi_deadline_reached(peer->timestamp_last_activity + 10*APPLEMIDI_SESSION_TIMEOUT_MS, now) ) {
+      if( ctx->debug_level >= 1 ) {
+        printf(APPLEMIDI_LOG_TAG "tick: session timeout of peer at applemidi_port=%d: IP=%d.%d.%d.%d:%d, SSRC=0x%08x, Name='%s'\n",
+          peer->applemidi_port,
+          peer->ip_addr[0], peer->ip_addr[1], peer->ip_addr[2], peer->ip_addr[3], peer->control_port,
+          peer->ssrc,
+          peer->name);
+      }
+      applemidi_send_endsession(ctx, peer, peer->ip_addr, peer->control_port, 0, peer->token, ctx->peer[0].ssrc);
+      applemidi_release_peer_slot(ctx, peer);
+      continue;
+    }
+#endif
+
     // output buffers
-    if( (peer->outbuffer_timestamp_last_flush > now) ||
-      (now > (peer->outbuffer_timestamp_last_flush + (10*APPLEMIDI_OUTBUFFER_FLUSH_MS))) ) {
-      applemidi_outbuffer_flush(i);
-      peer->outbuffer_timestamp_last_flush = now;
+    if( peer->outbuffer_len > 0 && applemidi_deadline_reached(peer->outbuffer_timestamp_flush, now) ) {
+      applemidi_outbuffer_flush(ctx, i);
     }
 
     // clock synchronization (if master)
     if( peer->connection_state == APPLEMIDI_CONNECTION_STATE_MASTER_CONNECTED ) {
       uint32_t sync_delay = (peer->connection_sync_ctr < 10) ? (10*APPLEMIDI_MASTER_START_SYNC_MS) : (10*APPLEMIDI_MASTER_REGULAR_SYNC_MS);
 
-      if( (peer->connection_sync_done_timestamp > now) ||
-          (now > (peer->connection_sync_done_timestamp + sync_delay)) ) {
-
+      if( applemidi_deadline_reached(peer->connection_sync_done_timestamp + sync_delay, now) ) {
         peer->connection_sync_done_timestamp = now;
         if( peer->connection_sync_ctr < 10 )
           peer->connection_sync_ctr += 1;
 
         // initiate new synchronization
-        applemidi_send_synchronization(peer, peer->ip_addr, peer->data_port, applemidi_peer[0].ssrc, 0, now, 0, 0);
+        applemidi_send_synchronization(ctx, peer, peer->ip_addr, peer->data_port, 1, ctx->peer[0].ssrc, 0, get_timestamp_100us(), 0, 0);
+      }
+    }
+
+#if APPLEMIDI_JOURNAL_ACTIVE
+    if( peer->ssrc != 0 ) {
+      // guard packets: empty packets with the journal, so that a lost last packet can be recovered
+      if( peer->journal_len > 0 && peer->outbuffer_len == 0 &&
+          peer->journal_guard_ctr < APPLEMIDI_JOURNAL_GUARD_COUNT &&
+          applemidi_deadline_reached(peer->journal_timestamp_last_packet + 10*APPLEMIDI_JOURNAL_GUARD_MS, now) ) {
+        peer->journal_guard_ctr += 1;
+        applemidi_outbuffer_init(ctx, peer, now);
+        applemidi_outbuffer_flush(ctx, i);
+      }
+
+      // receiver feedback: confirms the received packets, so that the peer can trim its journal
+      if( peer->rx_feedback_packets != peer->packets_received &&
+          applemidi_deadline_reached(peer->rx_feedback_timestamp + 10*APPLEMIDI_FEEDBACK_MS, now) ) {
+        peer->rx_feedback_packets = peer->packets_received;
+        peer->rx_feedback_timestamp = now;
+        applemidi_send_receiver_feedback(ctx, peer, peer->ip_addr, peer->control_port, 0, ctx->peer[0].ssrc, peer->seq_nr);
       }
     }
+#endif
+
+    applemidi_peer_deadline(peer, &next_deadline);
   }
+
+  ctx->deadline = next_deadline;
+  ctx->deadline_valid = 1;
+
+  return (uint32_t)(next_deadline - now + 9) / 10;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-// Flush Output Buffer (normally done by blemidi_tick_ms each 1 mS)
+// Flush Output Buffer (normally done by applemidi_tick after APPLEMIDI_OUTBUFFER_FLUSH_MS)
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-int32_t applemidi_outbuffer_flush(uint8_t applemidi_port)
+int32_t applemidi_outbuffer_flush(applemidi_t *ctx, uint8_t applemidi_port)
 {
   if( applemidi_port >= APPLEMIDI_MAX_PEERS )
     return -1; // invalid port
 
-  applemidi_peer_t *peer = &applemidi_peer[applemidi_port];
+  applemidi_peer_t *peer = &ctx->peer[applemidi_port];
 
   if( peer->outbuffer_len > 0 ) {
-    applemidi_send_udp_datagram(peer, peer->ip_addr, peer->data_port, (uint8_t *)peer->outbuffer, peer->outbuffer_len);
+    size_t len = peer->outbuffer_len;
+#if APPLEMIDI_JOURNAL_ACTIVE
+    uint8_t *buf = (uint8_t *)peer->buffer->outbuffer;
+    if( ((buf[3*4 + 0] & 0x0f) | buf[3*4 + 1]) != 0 ) {
+      peer->journal_guard_ctr = 0; // not a guard packet: restart the guard packets
+    }
+    peer->journal_timestamp_last_packet = get_timestamp_100us();
+    len = applemidi_journal_append(ctx, peer, buf, len, APPLEMIDI_OUTBUFFER_SIZE);
+#endif
+    applemidi_send_udp_datagram(ctx, peer, peer->ip_addr, peer->data_port, (uint8_t *)peer->buffer->outbuffer, len, 1);
     peer->outbuffer_len = 0;
+    peer->tx_seq_nr += 1;
+    ctx->deadline_valid = 0;
   }
 
   return 0; // no error
@@ -343,65 +1269,130 @@ int32_t applemidi_outbuffer_flush(uint8_t applemidi_port)
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-// Push a new MIDI message to the output buffer
+// Sends a pooled packet with the MIDI command section of the given length, the header is written here
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static void applemidi_packet_send(applemidi_t *ctx, applemidi_peer_t *peer, uint8_t *packet, size_t len)
+{
+  uint32_t *header = (uint32_t *)packet;
+  uint32_t now = get_timestamp_100us();
+  header[0] = htonl(0x80610000 | peer->tx_seq_nr);
+  header[1] = htonl(now);
+  header[2] = htonl(ctx->peer[0].ssrc);
+  packet[3*4 + 0] = 0x80 | ((len >> 8) & 0x0f); // long header
+  packet[3*4 + 1] = len;
+
+  size_t packet_len = APPLEMIDI_HEADER_SIZE + len;
+#if APPLEMIDI_JOURNAL_ACTIVE
+  peer->journal_guard_ctr = 0;
+  peer->journal_timestamp_last_packet = now;
+  packet_len = applemidi_journal_append(ctx, peer, packet, packet_len, APPLEMIDI_OUTBUFFER_SIZE);
+#endif
+  applemidi_send_udp_datagram(ctx, peer, peer->ip_addr, peer->data_port, packet, packet_len, 1);
+  peer->tx_seq_nr += 1;
+  ctx->deadline_valid = 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Appends a MIDI message which fits into the output buffer of the peer, the timestamp is provided
+// by the caller so that a broadcast only needs to read the clock once
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static void applemidi_outbuffer_append(applemidi_t *ctx, applemidi_peer_t *peer, uint8_t *stream, size_t len, uint32_t now)
+{
+  const size_t max_header_size = APPLEMIDI_HEADER_SIZE + APPLEMIDI_JOURNAL_RESERVE;
+
+  // flush buffer before adding new message (+4 for the delta time)
+  if( (peer->outbuffer_len + 4 + len) >= (APPLEMIDI_OUTBUFFER_SIZE-max_header_size) )
+    applemidi_outbuffer_flush(ctx, peer->applemidi_port);
+
+  // adding new message
+  uint8_t *buf = (uint8_t *)peer->buffer->outbuffer;
+  uint16_t header_len = len;
+  if( peer->outbuffer_len > 0 ) {
+    // the first message uses the RTP timestamp, the following ones the delta time to the previous message
+    header_len += applemidi_outbuffer_delta_time(peer, now);
+  } else {
+    // write initial header
+    applemidi_outbuffer_init(ctx, peer, now);
+  }
+
+  // update length field
+  header_len += (((uint16_t)buf[3*4 + 0] & 0x0f) << 8) | buf[3*4 + 1];
+  buf[3*4 + 0] = (buf[3*4 + 0] & 0xf0) | ((header_len >> 8) & 0x0f);
+  buf[3*4 + 1] = header_len;
+  // TODO: we could shorten the header length if it's <16, but is it worth the time consuming copy operation?
+
+  memcpy(&buf[peer->outbuffer_len], stream, len);
+  peer->outbuffer_len += len;
+
+#if APPLEMIDI_JOURNAL_ACTIVE
+  applemidi_journal_record_stream(peer, stream, len);
+#endif
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Push a new MIDI message to the output buffer: bigger messages are sent with applemidi_send_sysex
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-static int32_t applemidi_outbuffer_push(uint8_t applemidi_port, uint8_t *stream, size_t len)
+static int32_t applemidi_outbuffer_push(applemidi_t *ctx, uint8_t applemidi_port, uint8_t *stream, size_t len)
 {
-  const size_t max_header_size = 3*4+2;
+  const size_t max_header_size = APPLEMIDI_HEADER_SIZE + APPLEMIDI_JOURNAL_RESERVE;
 
   if( applemidi_port >= APPLEMIDI_MAX_PEERS )
     return -1; // invalid port
 
-  applemidi_peer_t *peer = &applemidi_peer[applemidi_port];
-
-  // if len >= buffer size, it makes sense to send out immediately
-  if( len >= (APPLEMIDI_OUTBUFFER_SIZE-max_header_size) ) {
-    // this is very unlikely, since applemidi_send_message() maintains the size
-    // but just in case of future extensions, we prepare dynamic memory allocation for "big packets"
-    applemidi_outbuffer_flush(applemidi_port);
-    {
-      size_t packet_len = max_header_size + len;
-      uint32_t *packet = malloc(packet_len);
-      if( packet == NULL ) {
-        return -1; // couldn't create temporary packet
-      } else {
-        packet[0] = htonl(0x80610000 | applemidi_peer[0].seq_nr++);
-        packet[1] = htonl(get_timestamp_100us());
-        packet[2] = htonl(applemidi_peer[0].ssrc);
-        packet[3] = (0x80 | (len >> 8)) | ((len & 0xff) << 8);
-        memcpy((uint8_t *)packet + max_header_size, stream, len);
-        applemidi_send_udp_datagram(peer, peer->ip_addr, peer->data_port, (uint8_t *)packet, packet_len);
-        free(packet);
-      }
+  applemidi_peer_t *peer = &ctx->peer[applemidi_port];
+  if( peer->buffer == NULL )
+    return -1; // no session
+
+  if( len >= (APPLEMIDI_OUTBUFFER_SIZE-max_header_size) )
+    return -1; // doesn't fit into the output buffer
+
+  applemidi_outbuffer_append(ctx, peer, stream, len, get_timestamp_100us());
+
+  return 0; // no error
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Writes the SysEx chunks into a packet from the pool and sends each chunk to the given peers,
+// so that we don't need any stack or heap for them and a chunk is only written once
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static int32_t applemidi_send_sysex(applemidi_t *ctx, applemidi_peer_t **peers, int num_peers, uint8_t *stream, size_t len)
+{
+  const size_t max_header_size = APPLEMIDI_HEADER_SIZE + APPLEMIDI_JOURNAL_RESERVE;
+
+  int i;
+  for(i=0; i<num_peers; ++i) {
+    applemidi_outbuffer_flush(ctx, peers[i]->applemidi_port); // keep the order of the messages
+  }
+
+  uint8_t *packet = applemidi_packet_alloc(ctx);
+  if( packet == NULL ) {
+    return -1; // no packet available
+  }
+
+  size_t max_size = APPLEMIDI_OUTBUFFER_SIZE - max_header_size - 2; // -2 since we have to add F7/F0 at begin/end
+  uint8_t *buf = &packet[APPLEMIDI_HEADER_SIZE];
+  size_t pos = 0;
+  while( pos < len ) {
+    size_t chunk_len = 0;
+    if( pos > 0 ) {
+      buf[chunk_len++] = 0xf7; // continue stream
     }
-  } else {
-    // flush buffer before adding new message
-    if( (peer->outbuffer_len + len) >= (APPLEMIDI_OUTBUFFER_SIZE-max_header_size) )
-      applemidi_outbuffer_flush(applemidi_port);
-
-    // adding new message
-    uint8_t *buf = (uint8_t *)peer->outbuffer;
-    if( peer->outbuffer_len > 0 ) {
-      buf[peer->outbuffer_len++] = 0x00; // TODO no support for delta timestamps yet - always assume that we send at the same time
-
-      // update length field
-      uint16_t header_len = (((uint16_t)buf[3*4 + 0] & 0x0f) << 8) | buf[3*4 + 1];
-      header_len += len + 1;
-      buf[3*4 + 0] = (buf[3*4 + 0] & 0xf0) | ((header_len >> 8) & 0x0f);
-      buf[3*4 + 1] = header_len;
-      // TODO: we could shorten the header length if it's <16, but is it worth the time consuming copy operation?
-    } else {
-      // write initial header
-      peer->outbuffer[0] = htonl(0x80610000 | applemidi_peer[0].seq_nr++);
-      peer->outbuffer[1] = htonl(get_timestamp_100us());
-      peer->outbuffer[2] = htonl(applemidi_peer[0].ssrc);
-      peer->outbuffer[3] = (0x80 | (len >> 8)) | ((len & 0xff) << 8); // always use long header so that we can insert the actual length later
-      peer->outbuffer_len = 3*4 + 2;
+    size_t size = (len - pos) > max_size ? max_size : (len - pos);
+    memcpy(&buf[chunk_len], &stream[pos], size);
+    chunk_len += size;
+    pos += size;
+    if( pos < len ) {
+      buf[chunk_len++] = 0xf0; // tail status octet
+    }
+    // only the header and the journal behind the chunk are different for each peer
+    for(i=0; i<num_peers; ++i) {
+      applemidi_packet_send(ctx, peers[i], packet, chunk_len);
     }
-
-    memcpy(&buf[peer->outbuffer_len], stream, len);
-    peer->outbuffer_len += len;
   }
+  applemidi_packet_free(ctx, packet);
 
   return 0; // no error
 }
@@ -410,55 +1401,75 @@ static int32_t applemidi_outbuffer_push(uint8_t applemidi_port, uint8_t *stream,
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Sends a Apple MIDI message
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-int32_t applemidi_send_message(uint8_t applemidi_port, uint8_t *stream, size_t len)
+int32_t applemidi_send_message(applemidi_t *ctx, uint8_t applemidi_port, uint8_t *stream, size_t len)
 {
-  const size_t max_header_size = 3*4+2;
+  const size_t max_header_size = APPLEMIDI_HEADER_SIZE + APPLEMIDI_JOURNAL_RESERVE;
 
   if( applemidi_port >= APPLEMIDI_MAX_PEERS )
     return -1; // invalid port
 
-  applemidi_peer_t *peer = &applemidi_peer[applemidi_port];
-
-  // we've to consider blemidi_mtu
-  // if more bytes need to be sent, split over multiple packets
-  // this will cost some extra stack space :-/ therefore handled separatly?
+  applemidi_peer_t *peer = &ctx->peer[applemidi_port];
 
   if( len < (APPLEMIDI_OUTBUFFER_SIZE-max_header_size) ) {
     // just add to output buffer
-    applemidi_outbuffer_push(applemidi_port, stream, len);
-  } else {
-    // TODO: currently only supports SysEx
-    // sending packets
-    size_t max_size = APPLEMIDI_OUTBUFFER_SIZE - max_header_size - 2; // -2 since we have to add F0/F7 at begin/end
-    uint8_t packet[APPLEMIDI_OUTBUFFER_SIZE]; // now it becomes stack hungry...
-    int pos;
-    for(pos=0; pos<len; pos += max_size) {
-      if( pos == 0 ) {
-        memcpy(&packet[0], stream, max_size);
-        packet[max_size] = 0xf0; // tail status octet
-        applemidi_outbuffer_push(applemidi_port, packet, max_size+1);
-      } else {
-        packet[0] = 0xf7; // continue stream
-        memcpy(&packet[1], &stream[pos], max_size);
-        size_t packet_len = max_size + 2;
-        if( (pos+max_size+1) >= len ) {
-          packet_len = len-pos+1;
-        } else {
-          packet[max_size+1] = 0xf0; // tail status octet
-        }
-        applemidi_outbuffer_push(applemidi_port, packet, packet_len);
-      }
+    return applemidi_outbuffer_push(ctx, applemidi_port, stream, len);
+  }
+
+  // TODO: currently only supports SysEx
+  if( peer->buffer == NULL )
+    return -1; // no session
+
+  return applemidi_send_sysex(ctx, &peer, 1, stream, len);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Sends a Apple MIDI message to all peers with an established session
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int32_t applemidi_send_message_all(applemidi_t *ctx, uint8_t *stream, size_t len)
+{
+  const size_t max_header_size = APPLEMIDI_HEADER_SIZE + APPLEMIDI_JOURNAL_RESERVE;
+
+  // we only visit the used ports
+  uint8_t first_pos = ctx->free_ports_count;
+  int num_peers = (APPLEMIDI_MAX_PEERS-1) - first_pos;
+  if( num_peers <= 0 )
+    return 0; // no session
+
+  // the peers which are still connecting are skipped
+  applemidi_peer_t *peers[APPLEMIDI_MAX_PEERS];
+  int connected = 0;
+  int pos;
+  for(pos=first_pos; pos<APPLEMIDI_MAX_PEERS-1; ++pos) {
+    applemidi_peer_t *peer = &ctx->peer[ctx->ports[pos]];
+    if( applemidi_peer_is_connected(peer) ) {
+      peers[connected++] = peer;
     }
   }
+  if( connected == 0 )
+    return 0; // no established session
 
-  return 0; // no error
+  if( len < (APPLEMIDI_OUTBUFFER_SIZE-max_header_size) ) {
+    // the message is already encoded: each peer only needs its delta time and a copy in its output buffer
+    uint32_t now = get_timestamp_100us();
+    for(pos=0; pos<connected; ++pos) {
+      applemidi_outbuffer_append(ctx, peers[pos], stream, len, now);
+    }
+    return connected;
+  }
+
+  // TODO: currently only supports SysEx
+  if( applemidi_send_sysex(ctx, peers, connected, stream, len) < 0 )
+    return -1;
+
+  return connected;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Decodes a RTP MIDI Message
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-static int32_t applemidi_decode_rtp_midi(uint8_t applemidi_port, uint32_t timestamp, uint32_t ssrc, uint8_t *stream, size_t len)
+static int32_t applemidi_decode_rtp_midi(applemidi_t *ctx, uint8_t applemidi_port, uint32_t timestamp, uint32_t ssrc, uint8_t *stream, size_t len)
 {
   //! Number if expected bytes for a common MIDI event - 1
   const uint8_t midi_expected_bytes_common[8] = {
@@ -496,8 +1507,8 @@ static int32_t applemidi_decode_rtp_midi(uint8_t applemidi_port, uint32_t timest
 
   // inspired from https://github.com/lathoub/Arduino-AppleMIDI-Library/blob/master/src/utility/packet-rtp-midi.h
 
-  uint8_t cmd = stream[0]; // layout: BJZP<LEN> - JZP are ignored so far!
-  // J: journal leads to complicated handling, currently we discard this section... TODO
+  uint8_t cmd = stream[0]; // layout: BJZP<LEN> - ZP are ignored so far!
+  // J: the journal is only evaluated on packet loss, see applemidi_journal_decode(ctx)
   // Z: delta time for first MIDI event
   // P: status byte was present in original MIDI command... TODO
 
@@ -510,7 +1521,7 @@ static int32_t applemidi_decode_rtp_midi(uint8_t applemidi_port, uint32_t timest
     stream += 1;
   }
 
-  if( applemidi_debug_level >= 3 ) {
+  if( ctx->debug_level >= 3 ) {
     printf("decode_rtp_midi: RTP MIDI port #%d (%d bytes)\n", applemidi_port, cmd_len);
     //esp_log_buffer_hex(APPLEMIDI_LOG_TAG, stream, cmd_len);
   }
@@ -531,19 +1542,17 @@ static int32_t applemidi_decode_rtp_midi(uint8_t applemidi_port, uint32_t timest
       timestamp += delta;
     }
 
-    if( applemidi_callback_midi_message_received != NULL ) {
+    if( ctx->callback_midi_message_received != NULL ) {
       if( stream[0] & 0x80 ) {
         midi_status = *(stream++);
         cmd_len -= 1;
       }
 
       // detect continued SysEx
-      uint8_t continued_sysex = 0;
       if( cmd_len > 1 && midi_status == 0xf7) {
-        continued_sysex = 1;
         midi_status = 0xf0;
       } else {
-        applemidi_peer[applemidi_port].continued_sysex_pos = 0;
+        ctx->peer[applemidi_port].continued_sysex_pos = 0;
       }
 
       if( midi_status == 0xf0 ) {
@@ -554,11 +1563,11 @@ static int32_t applemidi_decode_rtp_midi(uint8_t applemidi_port, uint32_t timest
           }
         }
 
-        applemidi_callback_midi_message_received(applemidi_port, timestamp, midi_status, stream, num_bytes, applemidi_peer[applemidi_port].continued_sysex_pos);
+        ctx->callback_midi_message_received(ctx->user_data, applemidi_port, timestamp, midi_status, stream, num_bytes, ctx->peer[applemidi_port].continued_sysex_pos);
         stream += num_bytes;
         cmd_len -= num_bytes;
         ++cmd_count;
-        applemidi_peer[applemidi_port].continued_sysex_pos += num_bytes; // we expect another packet with the remaining SysEx stream
+        ctx->peer[applemidi_port].continued_sysex_pos += num_bytes; // we expect another packet with the remaining SysEx stream
 
         if( stream[0] == 0xf0 ) {
           // expect continued sysex...
@@ -569,10 +1578,10 @@ static int32_t applemidi_decode_rtp_midi(uint8_t applemidi_port, uint32_t timest
           midi_status = 0xf7;
           stream += 1;
           cmd_len -= 1;
-          applemidi_peer[applemidi_port].continued_sysex_pos = 0;
-          applemidi_callback_midi_message_received(applemidi_port, timestamp, midi_status, stream, 0, applemidi_peer[applemidi_port].continued_sysex_pos);
+          ctx->peer[applemidi_port].continued_sysex_pos = 0;
+          ctx->callback_midi_message_received(ctx->user_data, applemidi_port, timestamp, midi_status, stream, 0, ctx->peer[applemidi_port].continued_sysex_pos);
         } else {
-          if( applemidi_debug_level >= 1 ) {
+          if( ctx->debug_level >= 1 ) {
             printf("decode_rtp_midi ERROR: unexpected termination of SysEx message\n");
           }
           return -1;
@@ -584,12 +1593,15 @@ static int32_t applemidi_decode_rtp_midi(uint8_t applemidi_port, uint32_t timest
         }
 
         if( num_bytes > cmd_len ) {
-          if( applemidi_debug_level >= 1 ) {
+          if( ctx->debug_level >= 1 ) {
             printf("decode_rtp_midi ERROR: missing %d bytes in parsed message\n", num_bytes);
           }
           return -1;
         } else {
-          applemidi_callback_midi_message_received(applemidi_port, timestamp, midi_status, stream, num_bytes, applemidi_peer[applemidi_port].continued_sysex_pos);
+          ctx->callback_midi_message_received(ctx->user_data, applemidi_port, timestamp, midi_status, stream, num_bytes, ctx->peer[applemidi_port].continued_sysex_pos);
+#if APPLEMIDI_JOURNAL_ACTIVE
+          applemidi_journal_rx_note(&ctx->peer[applemidi_port], midi_status, stream, num_bytes);
+#endif
           ++cmd_count;
           stream += num_bytes;
           cmd_len -= num_bytes;
@@ -603,49 +1615,208 @@ static int32_t applemidi_decode_rtp_midi(uint8_t applemidi_port, uint32_t timest
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-// Searches for a matching peer
+// Evaluates the journal of the packet seq_nr after the loss of the packets from expected_seq_nr:
+// the packets which are covered by the journal are marked as recovered, so that they are dropped
+// if they still arrive
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-static applemidi_peer_t *applemidi_search_peer_slot(uint8_t *ip_addr, uint32_t ssrc)
+#if APPLEMIDI_JOURNAL_ACTIVE
+static void applemidi_journal_recover(applemidi_t *ctx, applemidi_peer_t *peer, uint16_t expected_seq_nr, uint16_t seq_nr, uint32_t timestamp, uint8_t *stream, size_t len)
 {
-  int i;
-  applemidi_peer_t *peer = &applemidi_peer[1]; // starting at 1 (because I'm 0)
-  for(i=1; i<APPLEMIDI_MAX_PEERS; ++i, ++peer) {
-    if( peer->ssrc == ssrc && memcmp(peer->ip_addr, ip_addr, 4) == 0 ) { // TODO: support for IPv6
-      return peer;
+  if( len < 1 || !(stream[0] & 0x40) ) {
+    if( ctx->debug_level >= 1 ) {
+      printf(APPLEMIDI_LOG_TAG "journal_recover: no journal - lost packets can't be recovered\n");
+    }
+    return;
+  }
+
+  // the journal follows the MIDI command section
+  size_t header_len = (stream[0] & 0x80) ? 2 : 1;
+  size_t cmd_len = stream[0] & 0x0f;
+  if( header_len == 2 ) {
+    cmd_len = (cmd_len << 8) | stream[1];
+  }
+  if( len < header_len + cmd_len + 3 ) {
+    return;
+  }
+  uint8_t *journal = &stream[header_len + cmd_len];
+  size_t journal_len = len - header_len - cmd_len;
+
+  uint16_t checkpoint = ((uint16_t)journal[1] << 8) | journal[2];
+  uint16_t first_recovered = expected_seq_nr;
+  if( (int16_t)(checkpoint - expected_seq_nr) > 0 ) {
+    first_recovered = checkpoint;
+    if( ctx->debug_level >= 1 ) {
+      printf(APPLEMIDI_LOG_TAG "journal_recover: journal starts at seq_nr=%d, packet %d can't be recovered completely\n", checkpoint, expected_seq_nr);
+    }
+  }
+
+  if( applemidi_journal_decode(ctx, peer, timestamp, journal, journal_len) < 0 ) {
+    if( ctx->debug_level >= 1 ) {
+      printf(APPLEMIDI_LOG_TAG "journal_recover: invalid journal\n");
+    }
+    return;
+  }
+
+  // the lost packets from the checkpoint on: packet seq_nr-n is bit n of the mask
+  uint16_t n;
+  for(n = 1; n < 64 && (int16_t)((uint16_t)(seq_nr - n) - first_recovered) >= 0; ++n) {
+    peer->rtp_recovered_mask |= 1ULL << n;
+  }
+
+  // peer stats
+  if( peer->packets_recovered != ~0 ) {
+    peer->packets_recovered += 1;
+  }
+
+  // my own stats
+  if( ctx->peer[0].packets_recovered != ~0 ) {
+    ctx->peer[0].packets_recovered += 1;
+  }
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Updates the RTP statistics with a received packet (RFC 3550 A.1 and A.8)
+// Returns the number of missing packets in front of it, or < 0 if the packet should be dropped: -1 for
+// a duplicate and -2 for a late packet which has already been recovered with the journal
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static int32_t applemidi_rtp_update(applemidi_peer_t *peer, uint16_t seq_nr, uint32_t timestamp, uint32_t now)
+{
+  applemidi_rtp_stats_t *stats = &peer->rtp_stats;
+  int32_t missing = 0;
+  uint8_t restart = 0;
+
+  applemidi_rtp_stats_begin(peer);
+
+  int32_t delta = (int16_t)(seq_nr - peer->seq_nr);
+  if( !peer->rtp_initialized || delta >= APPLEMIDI_RTP_MAX_DROPOUT || delta <= -APPLEMIDI_RTP_MAX_MISORDER ) {
+    // first packet, or the sender has restarted the sequence numbers
+    restart = 1;
+  } else if( delta > 0 ) {
+    // in order or after a gap
+    if( seq_nr < peer->seq_nr ) {
+      peer->rtp_cycles += 0x10000;
+    }
+    peer->rtp_received_mask = (delta >= 64) ? 1 : ((peer->rtp_received_mask << delta) | 1);
+    peer->rtp_recovered_mask = (delta >= 64) ? 0 : (peer->rtp_recovered_mask << delta);
+    peer->seq_nr = seq_nr;
+    missing = delta - 1;
+  } else if( delta > -64 && (peer->rtp_received_mask & (1ULL << -delta)) ) {
+    missing = -1;
+  } else {
+    // a late packet: it fills a gap, its content is only dropped if the journal of a later packet has recovered it
+    if( delta > -64 ) {
+      peer->rtp_received_mask |= 1ULL << -delta;
+      if( peer->rtp_recovered_mask & (1ULL << -delta) ) {
+        missing = -2;
+      }
+    }
+    if( stats->packets_reordered != ~0 ) {
+      stats->packets_reordered += 1;
+    }
+  }
+
+  if( restart ) {
+    peer->rtp_initialized = 1;
+    peer->rtp_base_seq_nr = seq_nr;
+    peer->rtp_cycles = 0;
+    peer->rtp_received_mask = 1;
+    peer->rtp_recovered_mask = 0;
+    peer->rtp_transit = now - timestamp;
+    peer->rtp_jitter_q4 = 0;
+    peer->rtp_rate_timestamp = now;
+    peer->rtp_rate_count = 0;
+    peer->seq_nr = seq_nr;
+    stats->packets_received = 0;
+  }
+
+  if( missing == -1 ) {
+    if( stats->packets_duplicate != ~0 ) {
+      stats->packets_duplicate += 1;
+    }
+  } else {
+    stats->packets_received += 1;
+
+    // interarrival jitter: both timestamps are in 100 uS units
+    uint32_t transit = now - timestamp;
+    int32_t d = (int32_t)(transit - peer->rtp_transit);
+    peer->rtp_transit = transit;
+    if( d < 0 ) {
+      d = -d;
     }
+    peer->rtp_jitter_q4 += d - ((peer->rtp_jitter_q4 + 8) >> 4);
+    stats->jitter = peer->rtp_jitter_q4 >> 4;
+
+    // packet rate over at least one second
+    peer->rtp_rate_count += 1;
+    uint32_t elapsed = now - peer->rtp_rate_timestamp;
+    if( elapsed >= 10000 ) {
+      stats->packet_rate = (uint64_t)peer->rtp_rate_count * 10000 / elapsed;
+      peer->rtp_rate_timestamp = now;
+      peer->rtp_rate_count = 0;
+    }
+  }
+
+  stats->highest_seq_nr = peer->rtp_cycles + peer->seq_nr;
+  stats->packets_expected = stats->highest_seq_nr - peer->rtp_base_seq_nr + 1;
+  stats->packets_lost = (stats->packets_expected > stats->packets_received) ? (stats->packets_expected - stats->packets_received) : 0;
+  peer->packets_loss = stats->packets_lost;
+
+  applemidi_rtp_stats_end(peer);
+
+  return missing;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Searches for a matching peer
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static applemidi_peer_t *applemidi_search_peer_slot(applemidi_t *ctx, uint8_t *ip_addr, uint32_t ssrc)
+{
+  int32_t slot = applemidi_peer_index_find(ctx, ip_addr, ssrc);
+  if( slot >= 0 ) {
+    return &ctx->peer[ctx->peer_index[slot]];
   }
 
   return NULL; // no slot found
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-// Searches for a free peer slot, returns pointer to peer slot if a free one has been found, otherwise NULL
+// Copies the name of a received invitation: it ends at the terminator or at the end of the datagram
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-static applemidi_peer_t *applemidi_get_free_peer_slot(uint8_t *ip_addr, uint16_t port, uint32_t token, uint32_t ssrc, char *name, size_t name_len)
+static void applemidi_copy_name(char *name, const char *rx_name, size_t len)
 {
-  int32_t applemidi_port = applemidi_search_free_port();
+  if( len > APPLEMIDI_MAX_NAME_LEN-1 )
+    len = APPLEMIDI_MAX_NAME_LEN-1;
+  size_t i;
+  for(i=0; i<len && rx_name[i] != 0; ++i) {
+    name[i] = rx_name[i];
+  }
+  name[i] = 0;
+}
 
-  if( applemidi_port >= 1 ) {
-    applemidi_peer_t *peer = &applemidi_peer[applemidi_port];
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Searches for a free peer slot, returns pointer to peer slot if a free one has been found, otherwise NULL
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static applemidi_peer_t *applemidi_get_free_peer_slot(applemidi_t *ctx, uint8_t *ip_addr, uint16_t port, uint32_t token, uint32_t ssrc, char *name, size_t name_len)
+{
+  int32_t applemidi_port = applemidi_search_free_port(ctx);
+  applemidi_peer_t *peer = (applemidi_port >= 1) ? applemidi_peer_alloc(ctx, applemidi_port) : NULL;
 
+  if( peer != NULL ) {
     peer->control_port = port;
     peer->data_port = port; // we expect an update with the next invitation message
     peer->token = token;
     peer->ssrc = ssrc;
     memcpy(&peer->ip_addr, ip_addr, sizeof(peer->ip_addr));
 
-    if( name_len > APPLEMIDI_MAX_NAME_LEN )
-      name_len = APPLEMIDI_MAX_NAME_LEN;
-    strncpy(peer->name, name, APPLEMIDI_MAX_NAME_LEN);
-    peer->name[name_len-1] = 0;
+    applemidi_copy_name(peer->name, name, name_len);
 
     peer->connection_state = APPLEMIDI_CONNECTION_STATE_SLAVE;
     peer->connection_sync_done_timestamp = 0;
 
-    peer->continued_sysex_pos = 0;
-    peer->outbuffer_len = 0;
-    peer->seq_nr = 0;
-    peer->outbuffer_timestamp_last_flush = 0;
+    applemidi_reset_streams(peer);
+    applemidi_peer_index_insert(ctx, peer);
 
     return peer;
   }
@@ -656,36 +1827,47 @@ static applemidi_peer_t *applemidi_get_free_peer_slot(uint8_t *ip_addr, uint16_t
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Releases a peer slot
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-static applemidi_peer_t *applemidi_release_peer_slot(uint32_t ssrc)
+static applemidi_peer_t *applemidi_release_peer_slot(applemidi_t *ctx, applemidi_peer_t *peer)
 {
-  int i;
-  applemidi_peer_t *peer = &applemidi_peer[1]; // starting at 1 (because I'm 0)
-  for(i=1; i<APPLEMIDI_MAX_PEERS; ++i, ++peer) {
-    if( peer->ssrc == ssrc ) {
-      peer->ssrc = 0;
-      peer->connection_state = APPLEMIDI_CONNECTION_STATE_SLAVE;
-      return peer;
-    }
+  if( peer == NULL || peer->buffer == NULL ) {
+    return NULL; // peer not allocated
   }
 
-  return NULL; // peer not found
+  applemidi_peer_index_remove(ctx, peer);
+  peer->ssrc = 0;
+  peer->connection_state = APPLEMIDI_CONNECTION_STATE_SLAVE;
+  peer->outbuffer_len = 0;
+#if APPLEMIDI_JOURNAL_ACTIVE
+  peer->journal_len = 0;
+#endif
+
+  // recycle the buffer and move the port to the free ports: it is swapped with the first used one
+  peer->buffer->next = ctx->buffer_pool;
+  ctx->buffer_pool = peer->buffer;
+  peer->buffer = NULL;
+  applemidi_ports_swap(ctx, ctx->ports_pos[peer->applemidi_port], ctx->free_ports_count++);
+
+  return peer;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Parses a UDP Datagram for RTP and Apple MIDI messages
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-int32_t applemidi_parse_udp_datagram(uint8_t *ip_addr, uint16_t port, uint8_t *rx_data, size_t rx_len, uint8_t is_dataport)
+int32_t applemidi_parse_udp_datagram(applemidi_t *ctx, uint8_t *ip_addr, uint16_t port, uint8_t *rx_data, size_t rx_len, uint8_t is_dataport)
 {
   uint32_t *rx_data_words = (uint32_t *)rx_data;
 
+  // each datagram might change the deadlines of applemidi_tick(ctx)
+  ctx->deadline_valid = 0;
+
   if( rx_len >= 4 && (rx_data_words[0] & 0xffff) == 0xffff ) {
     uint16_t cmd = htons(rx_data_words[0] >> 16);
     switch( cmd ) {
 
     ///////////////////////////////////////////////////////////////////////////////////////////////
     case APPLEMIDI_COMMAND_INVITATION: {
-      if( applemidi_debug_level >= 2 ) {
+      if( ctx->debug_level >= 2 ) {
         printf(APPLEMIDI_LOG_TAG "APPLEMIDI_COMMAND_INVITATION\n");
       }
       if( rx_len >= 16 ) {
@@ -693,15 +1875,15 @@ int32_t applemidi_parse_udp_datagram(uint8_t *ip_addr, uint16_t port, uint8_t *r
         uint32_t token = htonl(rx_data_words[2]);
         uint32_t ssrc = htonl(rx_data_words[3]);
         if( rx_len > 16 ) {
-          applemidi_peer_t *peer = applemidi_search_peer_slot(ip_addr, ssrc);
+          applemidi_peer_t *peer = applemidi_search_peer_slot(ctx, ip_addr, ssrc);
           if( peer == NULL ) {
-            peer = applemidi_get_free_peer_slot(ip_addr, port, token, ssrc, (char *)&rx_data[16], rx_len-16);
+            peer = applemidi_get_free_peer_slot(ctx, ip_addr, port, token, ssrc, (char *)&rx_data[16], rx_len-16);
             if( peer == NULL ) {
-              if( applemidi_debug_level >= 1 ) {
+              if( ctx->debug_level >= 1 ) {
                 printf(APPLEMIDI_LOG_TAG "COMMAND_INVITATION: no free slot for peer: Version=0x%08x, Token=0x%08x, SSRC=0x%08x\n", version, token, ssrc);
               }
             } else {
-              if( applemidi_debug_level >= 1 ) {
+              if( ctx->debug_level >= 1 ) {
                 printf(APPLEMIDI_LOG_TAG "COMMAND_INVITATION: new peer at applemidi_port=%d: IP=%d.%d.%d.%d:%d, Version=0x%08x, Token=0x%08x, SSRC=0x%08x, Name='%s'\n",
                   peer->applemidi_port,
                   ip_addr[0], ip_addr[1], ip_addr[2], ip_addr[3], port,
@@ -712,7 +1894,7 @@ int32_t applemidi_parse_udp_datagram(uint8_t *ip_addr, uint16_t port, uint8_t *r
               }
             }
           } else {
-            if( applemidi_debug_level >= 1 ) {
+            if( ctx->debug_level >= 1 ) {
               printf(APPLEMIDI_LOG_TAG "COMMAND_INVITATION: peer already registered for applemidi_port=%d: IP=%d.%d.%d.%d:%d, Version=0x%08x, Token=0x%08x, SSRC=0x%08x, Name='%s'\n",
                 peer->applemidi_port,
                 ip_addr[0], ip_addr[1], ip_addr[2], ip_addr[3], port,
@@ -729,18 +1911,19 @@ int32_t applemidi_parse_udp_datagram(uint8_t *ip_addr, uint16_t port, uint8_t *r
             } else {
               peer->control_port = port;
             }
+            peer->timestamp_last_activity = get_timestamp_100us();
           }
 
           // send confirmation
           if( peer != NULL ) {
-            applemidi_send_invitation_accepted(peer, ip_addr, port, token, applemidi_peer[0].ssrc);
+            applemidi_send_invitation_accepted(ctx, peer, ip_addr, port, is_dataport, token, ctx->peer[0].ssrc);
           } else {
-            applemidi_send_invitation_rejected(peer, ip_addr, port, token, applemidi_peer[0].ssrc); // function can handle peer == NULL
+            applemidi_send_invitation_rejected(ctx, peer, ip_addr, port, is_dataport, token, ctx->peer[0].ssrc); // function can handle peer == NULL
           }
 
 #ifdef APPLEMIDI_BITRATE_RECEIVE_LIMIT
           if( !is_dataport ) {
-            applemidi_send_bitrate_receive_limit(peer, ip_addr, port, applemidi_peer[0].ssrc, APPLEMIDI_BITRATE_RECEIVE_LIMIT);
+            applemidi_send_bitrate_receive_limit(ctx, peer, ip_addr, port, 0, ctx->peer[0].ssrc, APPLEMIDI_BITRATE_RECEIVE_LIMIT);
           }
 #endif
         }
@@ -749,7 +1932,7 @@ int32_t applemidi_parse_udp_datagram(uint8_t *ip_addr, uint16_t port, uint8_t *r
 
     ///////////////////////////////////////////////////////////////////////////////////////////////
     case APPLEMIDI_COMMAND_INVITATION_ACCEPTED: {
-      if( applemidi_debug_level >= 2 ) {
+      if( ctx->debug_level >= 2 ) {
         printf(APPLEMIDI_LOG_TAG "APPLEMIDI_COMMAND_ACCEPTED\n");
       }
 
@@ -760,7 +1943,7 @@ int32_t applemidi_parse_udp_datagram(uint8_t *ip_addr, uint16_t port, uint8_t *r
 
         // check for invites
         int i;
-        applemidi_peer_t *peer = &applemidi_peer[1]; // starting at 1 (because I'm 0)
+        applemidi_peer_t *peer = &ctx->peer[1]; // starting at 1 (because I'm 0)
         for(i=1; i<APPLEMIDI_MAX_PEERS; ++i, ++peer) {
           if( peer->connection_state == APPLEMIDI_CONNECTION_STATE_MASTER_CONNECT_CTRL &&
               !is_dataport &&
@@ -768,15 +1951,12 @@ int32_t applemidi_parse_udp_datagram(uint8_t *ip_addr, uint16_t port, uint8_t *r
               peer->token == token ) {
 
             peer->ssrc = ssrc;
+            applemidi_peer_index_insert(ctx, peer);
             if( rx_len > 16 ) {
-              size_t name_len = rx_len - 16;
-              if( name_len > APPLEMIDI_MAX_NAME_LEN )
-                name_len = APPLEMIDI_MAX_NAME_LEN;
-              strncpy(peer->name, (char *)&rx_data[16], APPLEMIDI_MAX_NAME_LEN);
-              peer->name[name_len-1] = 0;
+              applemidi_copy_name(peer->name, (char *)&rx_data[16], rx_len - 16);
             }
 
-            if( applemidi_debug_level >= 1 ) {
+            if( ctx->debug_level >= 1 ) {
               printf(APPLEMIDI_LOG_TAG "COMMAND_ACCEPTED: new peer at applemidi_port=%d: IP=%d.%d.%d.%d:%d, Version=0x%08x, Token=0x%08x, SSRC=0x%08x, Name='%s'\n",
                 peer->applemidi_port,
                 ip_addr[0], ip_addr[1], ip_addr[2], ip_addr[3], port,
@@ -788,9 +1968,9 @@ int32_t applemidi_parse_udp_datagram(uint8_t *ip_addr, uint16_t port, uint8_t *r
 
             // send session invite over data port
             peer->connection_state = APPLEMIDI_CONNECTION_STATE_MASTER_CONNECT_DATA;
-            applemidi_send_invitation(peer, peer->ip_addr, peer->data_port, token, applemidi_peer[0].ssrc, applemidi_peer[0].name);
+            applemidi_send_invitation(ctx, peer, peer->ip_addr, peer->data_port, 1, token, ctx->peer[0].ssrc, ctx->peer[0].name);
 
-            if( applemidi_debug_level >= 1 ) {
+            if( ctx->debug_level >= 1 ) {
               printf(APPLEMIDI_LOG_TAG "COMMAND_ACCEPTED: Invited peer at applemidi_port=%d: IP=%d.%d.%d.%d:%d\n",
                 peer->applemidi_port,
                 peer->ip_addr[0], peer->ip_addr[1], peer->ip_addr[2], peer->ip_addr[3], peer->data_port);
@@ -802,7 +1982,7 @@ int32_t applemidi_parse_udp_datagram(uint8_t *ip_addr, uint16_t port, uint8_t *r
 
             // got response
             peer->connection_state = APPLEMIDI_CONNECTION_STATE_MASTER_CONNECTED;
-            if( applemidi_debug_level >= 1 ) {
+            if( ctx->debug_level >= 1 ) {
               printf(APPLEMIDI_LOG_TAG "COMMAND_ACCEPTED: new peer at applemidi_port=%d: IP=%d.%d.%d.%d:%d, Version=0x%08x, Token=0x%08x, SSRC=0x%08x, Name='%s'\n",
                 peer->applemidi_port,
                 ip_addr[0], ip_addr[1], ip_addr[2], ip_addr[3], port,
@@ -812,7 +1992,7 @@ int32_t applemidi_parse_udp_datagram(uint8_t *ip_addr, uint16_t port, uint8_t *r
                 peer->name);
             }
 
-            if( applemidi_debug_level >= 1 ) {
+            if( ctx->debug_level >= 1 ) {
               printf(APPLEMIDI_LOG_TAG "COMMAND_ACCEPTED: Invited peer at applemidi_port=%d: IP=%d.%d.%d.%d:%d\n",
                 peer->applemidi_port,
                 peer->ip_addr[0], peer->ip_addr[1], peer->ip_addr[2], peer->ip_addr[3], peer->data_port);
@@ -828,7 +2008,7 @@ int32_t applemidi_parse_udp_datagram(uint8_t *ip_addr, uint16_t port, uint8_t *r
 
     ///////////////////////////////////////////////////////////////////////////////////////////////
     case APPLEMIDI_COMMAND_INVITATION_REJECTED: {
-      if( applemidi_debug_level >= 2 ) {
+      if( ctx->debug_level >= 2 ) {
         printf(APPLEMIDI_LOG_TAG "APPLEMIDI_COMMAND_REJECTED\n");
 
         if( rx_len >= 16 ) {
@@ -838,22 +2018,22 @@ int32_t applemidi_parse_udp_datagram(uint8_t *ip_addr, uint16_t port, uint8_t *r
 
           // check for invites
           int i;
-          applemidi_peer_t *peer = &applemidi_peer[1]; // starting at 1 (because I'm 0)
+          applemidi_peer_t *peer = &ctx->peer[1]; // starting at 1 (because I'm 0)
           for(i=1; i<APPLEMIDI_MAX_PEERS; ++i, ++peer) {
             if( (peer->connection_state == APPLEMIDI_CONNECTION_STATE_MASTER_CONNECT_CTRL ||
                 peer->connection_state == APPLEMIDI_CONNECTION_STATE_MASTER_CONNECT_DATA ) &&
                 peer->token == token ) {
-              if( applemidi_debug_level >= 1 ) {
+              if( ctx->debug_level >= 1 ) {
                 printf(APPLEMIDI_LOG_TAG "COMMAND_REJECTED: peer at applemidi_port=%d: IP=%d.%d.%d.%d:%d doesn't like us - skip him\n",
                   peer->applemidi_port,
                   peer->ip_addr[0], peer->ip_addr[1], peer->ip_addr[2], peer->ip_addr[3], peer->control_port);
               }
 
               // send endsession
-              applemidi_send_endsession(peer, peer->ip_addr, peer->control_port, peer->token, applemidi_peer[0].ssrc);
+              applemidi_send_endsession(ctx, peer, peer->ip_addr, peer->control_port, 0, peer->token, ctx->peer[0].ssrc);
 
-              if( applemidi_release_peer_slot(peer->ssrc) == NULL ) {
-                if( applemidi_debug_level >= 1 ) {
+              if( applemidi_release_peer_slot(ctx, peer) == NULL ) {
+                if( ctx->debug_level >= 1 ) {
                   printf(APPLEMIDI_LOG_TAG "COMMAND_REJECTED: failed to release slot for SSRC=0x%08x\n",
                     peer->ssrc);
                 }
@@ -866,7 +2046,7 @@ int32_t applemidi_parse_udp_datagram(uint8_t *ip_addr, uint16_t port, uint8_t *r
 
     ///////////////////////////////////////////////////////////////////////////////////////////////
     case APPLEMIDI_COMMAND_ENDSESSION: {
-      if( applemidi_debug_level >= 2 ) {
+      if( ctx->debug_level >= 2 ) {
         printf(APPLEMIDI_LOG_TAG "APPLEMIDI_COMMAND_ENDSESSION\n");
       }
 
@@ -875,9 +2055,9 @@ int32_t applemidi_parse_udp_datagram(uint8_t *ip_addr, uint16_t port, uint8_t *r
         uint32_t token = htonl(rx_data_words[2]);
         uint32_t ssrc = htonl(rx_data_words[3]);
 
-        applemidi_peer_t *peer = applemidi_release_peer_slot(ssrc);
+        applemidi_peer_t *peer = applemidi_release_peer_slot(ctx, applemidi_search_peer_slot(ctx, ip_addr, ssrc));
         if( peer != NULL ) {
-          if( applemidi_debug_level >= 1 ) {
+          if( ctx->debug_level >= 1 ) {
             printf(APPLEMIDI_LOG_TAG "COMMAND_ENDSESSION: Removed peer at applemidi_port=%d: IP=%d.%d.%d.%d:%d, SSRC=0x%08x, Name='%s'\n",
               peer->applemidi_port,
               ip_addr[0], ip_addr[1], ip_addr[2], ip_addr[3], port,
@@ -885,7 +2065,7 @@ int32_t applemidi_parse_udp_datagram(uint8_t *ip_addr, uint16_t port, uint8_t *r
               peer->name);
           }
         } else {
-          if( applemidi_debug_level >= 1 ) {
+          if( ctx->debug_level >= 1 ) {
             printf(APPLEMIDI_LOG_TAG "COMMAND_ENDSESSION: peer with SSRC:0x%08x isn't registered!\n", ssrc);
           }
         }
@@ -894,7 +2074,7 @@ int32_t applemidi_parse_udp_datagram(uint8_t *ip_addr, uint16_t port, uint8_t *r
 
     ///////////////////////////////////////////////////////////////////////////////////////////////
     case APPLEMIDI_COMMAND_SYNCHRONIZATION: {
-      if( applemidi_debug_level >= 3 ) {
+      if( ctx->debug_level >= 3 ) {
         printf(APPLEMIDI_LOG_TAG "APPLEMIDI_COMMAND_SYNCHRONIZATION\n");
       }
 
@@ -904,8 +2084,8 @@ int32_t applemidi_parse_udp_datagram(uint8_t *ip_addr, uint16_t port, uint8_t *r
         uint64_t timestamp1 = ((uint64_t)htonl(rx_data_words[3]) << 32) | htonl(rx_data_words[4]);
         uint64_t timestamp2 = ((uint64_t)htonl(rx_data_words[5]) << 32) | htonl(rx_data_words[6]);
         uint64_t timestamp3 = ((uint64_t)htonl(rx_data_words[7]) << 32) | htonl(rx_data_words[8]);
-        if( applemidi_debug_level >= 3 ) {
-          printf(APPLEMIDI_LOG_TAG "COMMAND_SYNCHRONIZATION: SSRC=0x%08x, Count=%d, Timestamp1=0x%016llx, Timestamp2=0x%016llx, Timestamp3=0x%016llx\n", ssrc, count, timestamp1, timestamp2, timestamp3);
+        if( ctx->debug_level >= 3 ) {
+          printf(APPLEMIDI_LOG_TAG "COMMAND_SYNCHRONIZATION: SSRC=0x%08x, Count=%d, Timestamp1=0x%016" PRIx64 ", Timestamp2=0x%016" PRIx64 ", Timestamp3=0x%016" PRIx64 "\n", ssrc, count, timestamp1, timestamp2, timestamp3);
         }
 
         {
@@ -915,23 +2095,37 @@ int32_t applemidi_parse_udp_datagram(uint8_t *ip_addr, uint16_t port, uint8_t *r
           uint64_t my_timestamp3 = timestamp3;
           uint64_t now = get_timestamp_100us();
 
+          applemidi_peer_t *peer = applemidi_search_peer_slot(ctx, ip_addr, ssrc); // Note: send_udp_datagram can handle peer == NULL
+          if( peer != NULL ) {
+            peer->timestamp_last_activity = now;
+          }
+
           switch( count ) {
           case 0: {
             my_count = 1;
             my_timestamp2 = now;
           } break;
           case 1: {
+            // we are the initiator: timestamp1 and now are from our clock, timestamp2 from the peer
             my_count = 2;
             my_timestamp3 = now;
+            if( peer != NULL ) {
+              int64_t rtt = now - timestamp1;
+              applemidi_clock_update(peer, (int64_t)(timestamp2 - timestamp1) - rtt/2, rtt);
+            }
           } break;
           case 2: {
-            my_count = 3;
+            // the exchange is complete: timestamp1 and timestamp3 are from the peer, timestamp2 from our clock
+            if( peer != NULL ) {
+              int64_t rtt = timestamp3 - timestamp1;
+              applemidi_clock_update(peer, (int64_t)(timestamp1 - timestamp2) + rtt/2, rtt);
+            }
 
-            if( applemidi_debug_level >= 3 ) {
+            if( ctx->debug_level >= 3 ) {
               uint64_t peer_diff = timestamp3 - timestamp1;
               uint64_t my_diff = now - timestamp2;
 
-              printf(APPLEMIDI_LOG_TAG "COMMAND_SYNCHRONIZATION: Peer Diff=%lld.%04lld, my Diff= %lld.%04lld\n", peer_diff/10000, peer_diff%10000, my_diff/10000, my_diff%10000);
+              printf(APPLEMIDI_LOG_TAG "COMMAND_SYNCHRONIZATION: Peer Diff=%" PRIu64 ".%04" PRIu64 ", my Diff= %" PRIu64 ".%04" PRIu64 "\n", peer_diff/10000, peer_diff%10000, my_diff/10000, my_diff%10000);
             }
           } break;
           default: {
@@ -940,15 +2134,17 @@ int32_t applemidi_parse_udp_datagram(uint8_t *ip_addr, uint16_t port, uint8_t *r
           }
           }
 
-          applemidi_peer_t *peer = applemidi_search_peer_slot(ip_addr, ssrc); // Note: send_udp_datagram can handle peer == NULL
-          applemidi_send_synchronization(peer, ip_addr, port, applemidi_peer[0].ssrc, my_count, my_timestamp1, my_timestamp2, my_timestamp3);
+          // CK2 finishes the exchange: a reply would start a new one
+          if( count != 2 ) {
+            applemidi_send_synchronization(ctx, peer, ip_addr, port, is_dataport, ctx->peer[0].ssrc, my_count, my_timestamp1, my_timestamp2, my_timestamp3);
+          }
         }
       }
     } break;
 
     ///////////////////////////////////////////////////////////////////////////////////////////////
     case APPLEMIDI_COMMAND_RECEIVER_FEEDBACK: {
-      if( applemidi_debug_level >= 2 ) {
+      if( ctx->debug_level >= 2 ) {
         printf(APPLEMIDI_LOG_TAG "APPLEMIDI_COMMAND_RECEIVER_FEEDBACK\n");
       }
 
@@ -956,55 +2152,45 @@ int32_t applemidi_parse_udp_datagram(uint8_t *ip_addr, uint16_t port, uint8_t *r
         uint32_t ssrc = htonl(rx_data_words[1]);
         uint16_t seq_nr = htons(rx_data_words[2]);
 
-        // check if the incoming seq_nr is matching with that of peer #0 (myself)
-        applemidi_peer_t *peer = applemidi_search_peer_slot(ip_addr, ssrc);
+        // the peer confirms all packets up to seq_nr which we have sent to it
+        applemidi_peer_t *peer = applemidi_search_peer_slot(ctx, ip_addr, ssrc);
         if( peer == NULL ) {
-          if( applemidi_debug_level >= 1 ) {
+          if( ctx->debug_level >= 1 ) {
             printf(APPLEMIDI_LOG_TAG "RECEIVER_FEEDBACK: unregistered peer with SSRC=0x%08x tried to give feedback!\n", ssrc);
           }
         } else {
-          if( applemidi_peer[0].seq_nr > 0 ) {
-            uint16_t expected_seq_nr = applemidi_peer[0].seq_nr - 1;
-            uint16_t expected_seq_nr2 = applemidi_peer[0].seq_nr - 2;
-            if( seq_nr != expected_seq_nr &&
-                seq_nr != expected_seq_nr2 ) { // in case we already transmitted a new one, but peer hasn't received yet
-              if( applemidi_debug_level >= 1 ) {
-                printf(APPLEMIDI_LOG_TAG "RECEIVER_FEEDBACK: detected packet loss at applemidi_port=%d: IP=%d.%d.%d.%d:%d, SSRC=0x%08x, Name='%s' (seq_nr=%d instead of %d)\n",
-                  peer->applemidi_port,
-                  ip_addr[0], ip_addr[1], ip_addr[2], ip_addr[3], port,
-                  ssrc,
-                  peer->name,
-                  seq_nr, expected_seq_nr);
-              }
-
-              // peer stats
-              if( peer->packets_loss != ~0 ) {
-                peer->packets_loss += 1;
-              }
+          peer->timestamp_last_activity = get_timestamp_100us();
 
-              // my own stats
-              if( applemidi_peer[0].packets_loss != ~0 ) {
-                applemidi_peer[0].packets_loss += 1;
-              }
+          if( (int16_t)((uint16_t)(peer->tx_seq_nr - 1) - seq_nr) < 0 ) {
+            if( ctx->debug_level >= 1 ) {
+              printf(APPLEMIDI_LOG_TAG "RECEIVER_FEEDBACK: peer at applemidi_port=%d confirmed seq_nr=%d which hasn't been sent yet\n",
+                peer->applemidi_port, seq_nr);
             }
+          } else {
+#if APPLEMIDI_JOURNAL_ACTIVE
+            applemidi_journal_trim(peer, seq_nr);
+#endif
+            applemidi_rtp_stats_begin(peer);
+            peer->rtp_stats.feedback_seq_nr = seq_nr;
+            if( peer->rtp_stats.feedback_count != ~0 ) {
+              peer->rtp_stats.feedback_count += 1;
+            }
+            applemidi_rtp_stats_end(peer);
           }
-
-          // feedback the seq_nr that we know from the peer
-          applemidi_send_receiver_feedback(peer, ip_addr, port, applemidi_peer[0].ssrc, peer->seq_nr);
         }
       }
     } break;
 
     ///////////////////////////////////////////////////////////////////////////////////////////////
     case APPLEMIDI_COMMAND_BITRATE_RECEIVE_LIMIT: {
-      if( applemidi_debug_level >= 2 ) {
+      if( ctx->debug_level >= 2 ) {
         printf(APPLEMIDI_LOG_TAG "APPLEMIDI_COMMAND_BITRATE_RECEIVE_LIMIT\n");
       }
     } break;
 
     ///////////////////////////////////////////////////////////////////////////////////////////////
     default: {
-      if( applemidi_debug_level >= 1 ) {
+      if( ctx->debug_level >= 1 ) {
         printf(APPLEMIDI_LOG_TAG "APPLEMIDI_COMMAND unknown: 0x%04x\n", cmd);
       }
     }
@@ -1015,38 +2201,45 @@ int32_t applemidi_parse_udp_datagram(uint8_t *ip_addr, uint16_t port, uint8_t *r
       uint32_t timestamp = htonl(rx_data_words[1]);
       uint32_t ssrc = htonl(rx_data_words[2]);
 
-      applemidi_peer_t *peer = applemidi_search_peer_slot(ip_addr, ssrc);
+      applemidi_peer_t *peer = applemidi_search_peer_slot(ctx, ip_addr, ssrc);
       if( peer == NULL ) {
-        if( applemidi_debug_level >= 1 ) {
+        if( ctx->debug_level >= 1 ) {
           printf(APPLEMIDI_LOG_TAG "parse_udb_datagram: unregistered peer with SSRC=0x%08x tried to send a MIDI message!\n", ssrc);
         }
       } else {
-        if( peer->seq_nr > 0 ) {
-          uint16_t expected_seq_nr = peer->seq_nr + 1;
-          if( seq_nr != expected_seq_nr ) {
-            if( applemidi_debug_level >= 1 ) {
-              printf(APPLEMIDI_LOG_TAG "parse_udb_datagram: detected packet loss at applemidi_port=%d: IP=%d.%d.%d.%d:%d, SSRC=0x%08x, Name='%s' (seq_nr=%d instead of %d)\n",
-                peer->applemidi_port,
-                ip_addr[0], ip_addr[1], ip_addr[2], ip_addr[3], port,
-                ssrc,
-                peer->name,
-                seq_nr, expected_seq_nr);
-            }
-
-            // peer stats
-            if( peer->packets_loss != ~0 ) {
-              peer->packets_loss += 1;
-            }
+        uint32_t now = get_timestamp_100us();
+        peer->timestamp_last_activity = now;
+
+        uint16_t expected_seq_nr = peer->seq_nr + 1;
+        int32_t missing = applemidi_rtp_update(peer, seq_nr, timestamp, now);
+        if( missing < 0 ) {
+          if( ctx->debug_level >= 2 ) {
+            printf(APPLEMIDI_LOG_TAG "parse_udb_datagram: dropped %s packet at applemidi_port=%d (seq_nr=%d)\n",
+              (missing == -1) ? "duplicate" : "late", peer->applemidi_port, seq_nr);
+          }
+          return 0;
+        }
 
-            // my own stats
-            if( applemidi_peer[0].packets_loss != ~0 ) {
-              applemidi_peer[0].packets_loss += 1;
-            }
+        if( missing > 0 ) {
+          if( ctx->debug_level >= 1 ) {
+            printf(APPLEMIDI_LOG_TAG "parse_udb_datagram: detected packet loss at applemidi_port=%d: IP=%d.%d.%d.%d:%d, SSRC=0x%08x, Name='%s' (seq_nr=%d instead of %d)\n",
+              peer->applemidi_port,
+              ip_addr[0], ip_addr[1], ip_addr[2], ip_addr[3], port,
+              ssrc,
+              peer->name,
+              seq_nr, expected_seq_nr);
+          }
 
-            // TODO: how to handle packet loss? Using the Journal?
+          // my own stats
+          if( ctx->peer[0].packets_loss < (~0 - missing) ) {
+            ctx->peer[0].packets_loss += missing;
           }
+
+#if APPLEMIDI_JOURNAL_ACTIVE
+          // recover the lost packets with the journal
+          applemidi_journal_recover(ctx, peer, expected_seq_nr, seq_nr, timestamp, (uint8_t *)&rx_data[3*4], rx_len-12);
+#endif
         }
-        peer->seq_nr = seq_nr;
 
         // peer stats
         if( peer->packets_received != ~0 ) {
@@ -1054,16 +2247,16 @@ int32_t applemidi_parse_udp_datagram(uint8_t *ip_addr, uint16_t port, uint8_t *r
         }
 
         // my own stats
-        if( applemidi_peer[0].packets_received != ~0 ) {
-          applemidi_peer[0].packets_received += 1;
+        if( ctx->peer[0].packets_received != ~0 ) {
+          ctx->peer[0].packets_received += 1;
         }
 
         // the actual RTP MIDI Stream is starting here - create pointer and max len (might include journal which has to be discarded)
-        applemidi_decode_rtp_midi(peer->applemidi_port, timestamp, ssrc, (uint8_t *)&rx_data[3*4], rx_len-12);
+        applemidi_decode_rtp_midi(ctx, peer->applemidi_port, timestamp, ssrc, (uint8_t *)&rx_data[3*4], rx_len-12);
       }
 
     } else {
-      if( applemidi_debug_level >= 1 ) {
+      if( ctx->debug_level >= 1 ) {
         printf(APPLEMIDI_LOG_TAG "parse_udb_datagram: unknown command: 0x%08x\n", rx_data_words[0]);
       }
     }
@@ -1075,17 +2268,17 @@ int32_t applemidi_parse_udp_datagram(uint8_t *ip_addr, uint16_t port, uint8_t *r
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Invites a peer for the given applemidi_port
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-int32_t applemidi_start_session(uint8_t applemidi_port, uint8_t *ip_addr, uint16_t control_port)
+int32_t applemidi_start_session(applemidi_t *ctx, uint8_t applemidi_port, uint8_t *ip_addr, uint16_t control_port)
 {
   if( applemidi_port == 0 || applemidi_port >= APPLEMIDI_MAX_PEERS ) {
     return -1; // invalid port
   }
-  applemidi_peer_t *peer = &applemidi_peer[applemidi_port];
+  applemidi_peer_t *peer = applemidi_peer_alloc(ctx, applemidi_port);
 
-  if( peer->ssrc != 0 ) {
-    if( applemidi_debug_level >= 1 ) {
+  if( peer == NULL ) {
+    if( ctx->debug_level >= 1 ) {
       printf(APPLEMIDI_LOG_TAG "start_session: can't invited peer at applemidi_port=%d (port already allocated)\n",
-        peer->applemidi_port);
+        applemidi_port);
     }
     return -2; // port already allocated - we should terminate it first!
   }
@@ -1093,15 +2286,16 @@ int32_t applemidi_start_session(uint8_t applemidi_port, uint8_t *ip_addr, uint16
   memcpy(peer->ip_addr, ip_addr, 4); // TODO: support for IPv6
   peer->control_port = control_port;
   peer->data_port = control_port + 1;
+  applemidi_reset_streams(peer);
   peer->token = rand();
   if( peer->token == 0 ) // just to ensure that we never get a token with 0
     peer->token = 42;
 
   // send session invite
   peer->connection_state = APPLEMIDI_CONNECTION_STATE_MASTER_CONNECT_CTRL;
-  applemidi_send_invitation(peer, peer->ip_addr, peer->control_port, peer->token, applemidi_peer[0].ssrc, applemidi_peer[0].name);
+  applemidi_send_invitation(ctx, peer, peer->ip_addr, peer->control_port, 0, peer->token, ctx->peer[0].ssrc, ctx->peer[0].name);
 
-  if( applemidi_debug_level >= 1 ) {
+  if( ctx->debug_level >= 1 ) {
     printf(APPLEMIDI_LOG_TAG "start_session: Invited peer at applemidi_port=%d: IP=%d.%d.%d.%d:%d\n",
       peer->applemidi_port,
       peer->ip_addr[0], peer->ip_addr[1], peer->ip_addr[2], peer->ip_addr[3], peer->control_port);
@@ -1113,15 +2307,15 @@ int32_t applemidi_start_session(uint8_t applemidi_port, uint8_t *ip_addr, uint16
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Terminates a session for the given applemidi_port
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-int32_t applemidi_terminate_session(uint8_t applemidi_port)
+int32_t applemidi_terminate_session(applemidi_t *ctx, uint8_t applemidi_port)
 {
   if( applemidi_port == 0 || applemidi_port >= APPLEMIDI_MAX_PEERS ) {
     return -1; // invalid port
   }
-  applemidi_peer_t *peer = &applemidi_peer[applemidi_port];
+  applemidi_peer_t *peer = &ctx->peer[applemidi_port];
 
   if( peer->ssrc == 0 ) {
-    if( applemidi_debug_level >= 1 ) {
+    if( ctx->debug_level >= 1 ) {
       printf(APPLEMIDI_LOG_TAG "terminate_session: no known peer at applemidi_port=%d\n",
         peer->applemidi_port);
     }
@@ -1129,16 +2323,16 @@ int32_t applemidi_terminate_session(uint8_t applemidi_port)
   }
 
   // send endsession
-  applemidi_send_endsession(peer, peer->ip_addr, peer->control_port, peer->token, applemidi_peer[0].ssrc);
+  applemidi_send_endsession(ctx, peer, peer->ip_addr, peer->control_port, 0, peer->token, ctx->peer[0].ssrc);
 
-  if( applemidi_debug_level >= 1 ) {
+  if( ctx->debug_level >= 1 ) {
     printf(APPLEMIDI_LOG_TAG "terminate_session: with peer at applemidi_port=%d: IP=%d.%d.%d.%d:%d\n",
       peer->applemidi_port,
       peer->ip_addr[0], peer->ip_addr[1], peer->ip_addr[2], peer->ip_addr[3], peer->control_port);
   }
 
-  if( applemidi_release_peer_slot(peer->ssrc) == NULL ) {
-    if( applemidi_debug_level >= 1 ) {
+  if( applemidi_release_peer_slot(ctx, peer) == NULL ) {
+    if( ctx->debug_level >= 1 ) {
       printf(APPLEMIDI_LOG_TAG "terminate_session: failed to release slot for SSRC=0x%08x\n",
         peer->ssrc);
     }
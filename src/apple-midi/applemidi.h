@@ -63,6 +63,17 @@ extern "C" {
 #define APPLEMIDI_MAX_PEERS 5 // including myself
 #endif
 
+// number of slots of the peer index (by SSRC and IP address): must be a power of 2 and bigger then APPLEMIDI_MAX_PEERS
+#ifndef APPLEMIDI_PEER_HASH_SIZE
+#if APPLEMIDI_MAX_PEERS <= 8
+#define APPLEMIDI_PEER_HASH_SIZE 16
+#elif APPLEMIDI_MAX_PEERS <= 32
+#define APPLEMIDI_PEER_HASH_SIZE 64
+#else
+#define APPLEMIDI_PEER_HASH_SIZE 256
+#endif
+#endif
+
 #ifndef APPLEMIDI_DEFAULT_PORT
 #define APPLEMIDI_DEFAULT_PORT 5004
 #endif
@@ -88,10 +99,60 @@ extern "C" {
 #define APPLEMIDI_OUTBUFFER_SIZE 512
 #endif
 
+// number of packet buffers for the packets which are not collected in the output buffer of a peer (e.g. SysEx chunks)
+#ifndef APPLEMIDI_PACKET_POOL_SIZE
+#define APPLEMIDI_PACKET_POOL_SIZE 1
+#endif
+
+// the packets in use are marked in the uint32_t bitmask packet_pool_used
+#if APPLEMIDI_PACKET_POOL_SIZE < 1 || APPLEMIDI_PACKET_POOL_SIZE > 32
+#error "APPLEMIDI_PACKET_POOL_SIZE must be between 1 and 32"
+#endif
+
+// max time for collecting messages in one packet: the timing of the messages is kept with delta times
 #ifndef APPLEMIDI_OUTBUFFER_FLUSH_MS
 #define APPLEMIDI_OUTBUFFER_FLUSH_MS 1
 #endif
 
+// RTP-MIDI recovery journal (RFC 6295) with the chapters P, C, W and N
+#ifndef APPLEMIDI_JOURNAL_ACTIVE
+#define APPLEMIDI_JOURNAL_ACTIVE 1
+#endif
+
+// max number of channel commands which are kept until the receiver confirms them
+#ifndef APPLEMIDI_JOURNAL_MAX_ENTRIES
+#define APPLEMIDI_JOURNAL_MAX_ENTRIES 64
+#endif
+
+// max size of the journal in a packet: this space is reserved in the output buffer
+#ifndef APPLEMIDI_JOURNAL_MAX_SIZE
+#define APPLEMIDI_JOURNAL_MAX_SIZE 160
+#endif
+
+// after the last packet we send some empty packets with the journal, so that the loss of the last packet can be recovered
+#ifndef APPLEMIDI_JOURNAL_GUARD_MS
+#define APPLEMIDI_JOURNAL_GUARD_MS 50
+#endif
+
+#ifndef APPLEMIDI_JOURNAL_GUARD_COUNT
+#define APPLEMIDI_JOURNAL_GUARD_COUNT 2
+#endif
+
+// how often do we confirm the received packets with a receiver feedback?
+#ifndef APPLEMIDI_FEEDBACK_MS
+#define APPLEMIDI_FEEDBACK_MS 1000
+#endif
+
+// a session is terminated if the peer didn't send anything (e.g. synchronization) for this time: 0 deactivates it
+#ifndef APPLEMIDI_SESSION_TIMEOUT_MS
+#define APPLEMIDI_SESSION_TIMEOUT_MS 60*1000
+#endif
+
+// max time which is reported by applemidi_tick() if there is nothing to do
+#ifndef APPLEMIDI_TICK_MAX_MS
+#define APPLEMIDI_TICK_MAX_MS 1000
+#endif
+
 // if master: how often do we want to synchronize?
 #ifndef APPLEMIDI_MASTER_START_SYNC_MS
 #define APPLEMIDI_MASTER_START_SYNC_MS 100
@@ -102,6 +163,13 @@ extern "C" {
 #endif
 
 
+typedef struct {
+  uint32_t allocs;
+  uint32_t exhausted; // allocations which failed since all packets were in use: the message was not sent
+  uint8_t  in_use;
+  uint8_t  max_in_use;
+} applemidi_packet_pool_stats_t;
+
 typedef enum {
   APPLEMIDI_CONNECTION_STATE_SLAVE = 0,
   APPLEMIDI_CONNECTION_STATE_MASTER_CONNECT_CTRL,
@@ -109,6 +177,40 @@ typedef enum {
   APPLEMIDI_CONNECTION_STATE_MASTER_CONNECTED,
 } applemidi_connection_state_t;
 
+//! a channel command which we have sent: used to create the recovery journal
+typedef struct {
+  uint16_t seq_nr; // packet which contained the command
+  uint8_t  status;
+  uint8_t  data1;
+  uint8_t  data2;
+} applemidi_journal_entry_t;
+
+//! RTP statistics of the packets received from a peer (RFC 3550): a consistent copy is provided by applemidi_peer_get_rtp_stats()
+typedef struct {
+  uint32_t packets_expected; // from the first to the highest sequence number
+  uint32_t packets_received; // without duplicates
+  uint32_t packets_lost; // expected - received: packets which arrive late are not lost
+  uint32_t packets_reordered; // packets which arrived after a packet with a higher sequence number
+  uint32_t packets_duplicate;
+  uint32_t jitter; // interarrival jitter in 100 uS units
+  uint32_t packet_rate; // received packets per second
+  uint32_t highest_seq_nr; // extended by the number of sequence number cycles
+  uint16_t feedback_seq_nr; // the last packet which the peer has confirmed with the receiver feedback (RS)
+  uint32_t feedback_count;
+} applemidi_rtp_stats_t;
+
+//! the big buffers of a peer: they are only allocated for active sessions and recycled in a pool
+typedef struct applemidi_peer_buffer_s {
+  struct applemidi_peer_buffer_s *next; // next free buffer in the pool
+  uint32_t outbuffer[APPLEMIDI_OUTBUFFER_SIZE/4];
+#if APPLEMIDI_JOURNAL_ACTIVE
+  // sent commands which have not been confirmed by the receiver feedback yet
+  applemidi_journal_entry_t journal[APPLEMIDI_JOURNAL_MAX_ENTRIES];
+  // notes which are on for the receiver: needed to recover lost note on/off commands
+  uint8_t  rx_notes[16][16];
+#endif
+} applemidi_peer_buffer_t;
+
 //! contains information about the peers
 //! Peer 0 is always myself, peer 1..APPLEMIDI_MAX_NAME_LEN-1 are remote connections
 typedef struct {
@@ -120,59 +222,172 @@ typedef struct {
   uint32_t token;
   char name[APPLEMIDI_MAX_NAME_LEN];
   uint8_t  ip_addr[16]; // for IPv4 and IPv6
+  uint32_t timestamp_last_activity; // used for the session timeout
   uint16_t control_port; // if 0: no connection, if >0: peer is active
   uint16_t data_port; // if 0: no connection, if >0: peer is active
   uint8_t  applemidi_port; // internal port number
-  uint16_t seq_nr;
+  uint16_t seq_nr; // last received sequence number
+  uint16_t tx_seq_nr; // sequence number of the next packet which we send
   uint32_t continued_sysex_pos;
 
   // we buffer outgoing MIDI messages for 2 mS - this should avoid that multiple packets have to be queued for small messages
-  uint32_t outbuffer_timestamp_last_flush;
-  uint32_t outbuffer[APPLEMIDI_OUTBUFFER_SIZE/4];
+  // the timing of the buffered messages is preserved with delta times (100 uS resolution)
+  uint32_t outbuffer_timestamp_flush; // deadline for sending the buffered messages
+  uint32_t outbuffer_timestamp_last_message;
   uint16_t outbuffer_len;
 
+  // NULL if the port is not used by a session
+  applemidi_peer_buffer_t *buffer;
+
+#if APPLEMIDI_JOURNAL_ACTIVE
+  uint8_t  journal_len;
+  uint16_t journal_checkpoint;
+  uint8_t  journal_guard_ctr;
+  uint32_t journal_timestamp_last_packet;
+  uint32_t rx_feedback_packets;
+  uint32_t rx_feedback_timestamp;
+#endif
+
   // statistics
   uint32_t packets_sent;
   uint32_t packets_received;
   uint32_t packets_loss;
+  uint32_t packets_recovered;
+
+  // RTP sequence tracking: rtp_stats is only written between an odd and the next even rtp_stats_seq (seqlock)
+  applemidi_rtp_stats_t rtp_stats;
+  uint32_t rtp_stats_seq;
+  uint8_t  rtp_initialized;
+  uint16_t rtp_base_seq_nr;
+  uint32_t rtp_cycles;
+  uint64_t rtp_received_mask; // bit n: packet highest_seq_nr-n has been received
+  uint64_t rtp_recovered_mask; // bit n: packet highest_seq_nr-n has been recovered with the journal of a later packet
+  uint32_t rtp_transit;
+  uint32_t rtp_jitter_q4; // jitter * 16
+  uint32_t rtp_rate_timestamp;
+  uint32_t rtp_rate_count;
+
+  // clock synchronization (CK) in 100 uS units: remote timestamp = local timestamp + clock_offset
+  int64_t  clock_offset;
+  uint32_t clock_rtt; // round trip time of the last exchange
+  uint32_t clock_rtt_min;
+  uint32_t clock_sync_count; // number of completed exchanges
 } applemidi_peer_t;
 
+//! callback which is called whenever a new MIDI message has been received
+typedef void (*applemidi_midi_message_received_t)(void *user_data, uint8_t applemidi_port, uint32_t timestamp, uint8_t midi_status, uint8_t *remaining_message, size_t len, size_t continued_sysex_pos);
+//! callback which is called whenever a UDP datagram should be sent: is_dataport selects the socket of the data port (RTP MIDI, CK) instead of the control port
+typedef int32_t (*applemidi_send_udp_datagram_t)(void *user_data, uint8_t *ip_addr, uint16_t port, uint8_t *tx_data, size_t tx_len, uint8_t is_dataport);
+
+//! the complete state of an Apple MIDI engine: each instance is independent, so multiple engines can be used in parallel threads
+//! it must be zero initialized before the first applemidi_init() (e.g. static or with memset)
+typedef struct {
+  applemidi_peer_t peer[APPLEMIDI_MAX_PEERS];
+
+  // open addressing index of the peers by SSRC and IP address: contains the applemidi_port, 0 if empty
+  uint8_t peer_index[APPLEMIDI_PEER_HASH_SIZE];
+
+  // the applemidi_ports 1..APPLEMIDI_MAX_PEERS-1: the free ports are stored in front of the used ones
+  uint8_t ports[APPLEMIDI_MAX_PEERS];
+  uint8_t ports_pos[APPLEMIDI_MAX_PEERS];
+  uint8_t free_ports_count;
+
+  // cached deadline of applemidi_tick(): it is invalidated by each event which might need an earlier one
+  uint32_t deadline;
+  uint8_t  deadline_valid;
+
+  // released peer buffers which can be reused
+  applemidi_peer_buffer_t *buffer_pool;
+  int32_t buffer_count;
+
+  // packets which are sent directly (big messages and SysEx chunks): the bits of packet_pool_used mark the packets in use
+  uint32_t packet_pool[APPLEMIDI_PACKET_POOL_SIZE][APPLEMIDI_OUTBUFFER_SIZE/4];
+  uint32_t packet_pool_used;
+  applemidi_packet_pool_stats_t packet_pool_stats;
+
+  uint8_t debug_level;
+
+  // callbacks
+  applemidi_midi_message_received_t callback_midi_message_received;
+  applemidi_send_udp_datagram_t callback_send_udp_datagram;
+  void *user_data;
+} applemidi_t;
+
 
 /**
  * @brief Initializes the Apple MIDI Driver
  *
+ * @param  ctx the engine instance which is passed to all other functions
  * @param  callback_midi_message_received References the callback function which is called whenever a new MIDI message has been received.
  *         API see applemidi_receive_packet_callback_for_debugging
  *         Specify NULL if no callback required in your application.
  * @param  callback_send_packet References the callback function which is called whenever a UDP datagram should be sent.
  *         API see applemidi_send_udp_datagram_for_debugging
  *         Specify NULL if no callback required in your application (very unlikely... ;-)
+ * @param  user_data is passed to the callbacks
  */
-extern int32_t applemidi_init(void *callback_midi_message_received, void *_callback_send_udp_datagram);
+extern int32_t applemidi_init(applemidi_t *ctx, applemidi_midi_message_received_t callback_midi_message_received, applemidi_send_udp_datagram_t callback_send_udp_datagram, void *user_data);
+
+/**
+ * @brief Releases the memory of the peer buffers: the instance can be initialized again with applemidi_init()
+ *
+ */
+extern void applemidi_deinit(applemidi_t *ctx);
 
 /**
  * @brief Returns information about a peer
  *
  */
-extern applemidi_peer_t *applemidi_peer_get_info(uint8_t applemidi_port);
+extern applemidi_peer_t *applemidi_peer_get_info(applemidi_t *ctx, uint8_t applemidi_port);
 
 /**
  * @brief Returns free applemidi_port (1..APPLEMIDI_MAX_PEERS-1), or < 0 if all ports allocated
  *
  */
-extern int32_t applemidi_search_free_port(void);
+extern int32_t applemidi_search_free_port(applemidi_t *ctx);
+
+/**
+ * @brief Copies the RTP statistics of a peer: this doesn't lock the receive path, so it can be called from any thread
+ *
+ * @return < 0 on errors
+ */
+extern int32_t applemidi_peer_get_rtp_stats(applemidi_t *ctx, uint8_t applemidi_port, applemidi_rtp_stats_t *stats);
+
+/**
+ * @brief Returns the number of allocated peer buffers (used by sessions or available in the pool)
+ *
+ */
+extern int32_t applemidi_get_buffer_count(applemidi_t *ctx);
+
+/**
+ * @brief Returns the usage of the packet pool which is used for big messages and SysEx
+ *
+ */
+extern applemidi_packet_pool_stats_t *applemidi_get_packet_pool_stats(applemidi_t *ctx);
+
+/**
+ * @brief Returns the local RTP clock: a monotonic clock in 100 uS units
+ *
+ */
+extern uint64_t applemidi_get_timestamp(void);
+
+/**
+ * @brief Converts a RTP timestamp of a peer to the local clock with the offset which was measured with the synchronization (CK)
+ *
+ */
+extern uint32_t applemidi_peer_local_timestamp(applemidi_t *ctx, uint8_t applemidi_port, uint32_t remote_timestamp);
 
 /**
  * @brief Sets the verbosity level
  *
  */
-extern int32_t applemidi_set_debug_level(uint8_t verbosity);
+extern int32_t applemidi_set_debug_level(applemidi_t *ctx, uint8_t verbosity);
 
 /**
  * @brief Returns the verbosity level
  *
  */
-extern int32_t applemidi_get_debug_level(void);
+extern int32_t applemidi_get_debug_level(applemidi_t *ctx);
 
 /**
  * @brief Sends a Apple MIDI packet
@@ -184,24 +399,39 @@ extern int32_t applemidi_get_debug_level(void);
  * @return < 0 on errors
  *
  */
-extern int32_t applemidi_send_message(uint8_t applemidi_port, uint8_t *stream, size_t len);
+extern int32_t applemidi_send_message(applemidi_t *ctx, uint8_t applemidi_port, uint8_t *stream, size_t len);
 
 /**
- * @brief This function should be called each mS to handle the output buffers and synchronization
+ * @brief Sends a Apple MIDI packet to all peers with an established session: the message is appended
+ *        to the output buffer of each peer (SysEx chunks are written once and sent with a header per peer).
+ *        The peers which are still exchanging the invitations are skipped.
  *
- * @return < 0 on errors
+ * @param  stream       output stream
+ * @param  len          output stream length
+ *
+ * @return the number of connected peers, < 0 on errors
+ *
+ */
+extern int32_t applemidi_send_message_all(applemidi_t *ctx, uint8_t *stream, size_t len);
+
+/**
+ * @brief Handles the output buffers, the synchronization and the session timeouts which are due
+ *        If nothing is due, the function returns immediately: so it can be called in each loop.
+ *        It needs to be called again at the latest after the returned time, or when a UDP datagram has been received.
+ *
+ * @return the time in mS until the next deadline (max APPLEMIDI_TICK_MAX_MS)
  */
-extern void applemidi_tick(void);
+extern uint32_t applemidi_tick(applemidi_t *ctx);
 
 /**
- * @brief Flush Output Buffer (normally done by applemidi_tick each 5 mS)
+ * @brief Flush Output Buffer (normally done by applemidi_tick after APPLEMIDI_OUTBUFFER_FLUSH_MS)
  *
  * @param  applemidi_port currently always 0 expected (we might support multiple ports in future)
  *
  * @return < 0 on errors
  *
  */
-extern int32_t applemidi_outbuffer_flush(uint8_t applemidi_port);
+extern int32_t applemidi_outbuffer_flush(applemidi_t *ctx, uint8_t applemidi_port);
 
 /**
  * @brief A dummy callback which demonstrates the usage.
@@ -216,7 +446,7 @@ extern int32_t applemidi_outbuffer_flush(uint8_t applemidi_port);
  *
  * @return < 0 on errors
  */
-extern void applemidi_receive_packet_callback_for_debugging(uint8_t applemidi_port, uint32_t timestamp, uint8_t midi_status, uint8_t *remaining_message, size_t len, size_t continued_sysex_pos);
+extern void applemidi_receive_packet_callback_for_debugging(void *user_data, uint8_t applemidi_port, uint32_t timestamp, uint8_t midi_status, uint8_t *remaining_message, size_t len, size_t continued_sysex_pos);
 
 /**
  * @brief A dummy callback which demonstrates the usage.
@@ -227,30 +457,31 @@ extern void applemidi_receive_packet_callback_for_debugging(uint8_t applemidi_po
  * @param  port port number
  * @param  tx_data data which should be sent
  * @param  tx_len packet size
+ * @param  is_dataport 1 if the datagram needs to be sent from the data port, 0 for the control port
  *
  * @return < 0 on errors
  */
-extern int32_t applemidi_callback_send_udp_datagram_for_debugging(uint8_t *ip_addr, uint16_t port, uint8_t *tx_data, size_t tx_len);
+extern int32_t applemidi_callback_send_udp_datagram_for_debugging(void *user_data, uint8_t *ip_addr, uint16_t port, uint8_t *tx_data, size_t tx_len, uint8_t is_dataport);
 
 /**
  * @brief Parses an incoming UDP Datagram for RTP and Apple MIDI messages
  *
  * @return < 0 on errors
  */
-extern int32_t applemidi_parse_udp_datagram(uint8_t *ip_addr, uint16_t port, uint8_t *rx_data, size_t rx_len, uint8_t is_dataport);
+extern int32_t applemidi_parse_udp_datagram(applemidi_t *ctx, uint8_t *ip_addr, uint16_t port, uint8_t *rx_data, size_t rx_len, uint8_t is_dataport);
 
 
 /**
  * @brief Invites a peer for the given applemidi_port
  *
  */
-extern int32_t applemidi_start_session(uint8_t applemidi_port, uint8_t *ip_addr, uint16_t control_port);
+extern int32_t applemidi_start_session(applemidi_t *ctx, uint8_t applemidi_port, uint8_t *ip_addr, uint16_t control_port);
 
 /**
  * @brief Terminates a session for the given applemidi_port
  *
  */
-extern int32_t applemidi_terminate_session(uint8_t applemidi_port);
+extern int32_t applemidi_terminate_session(applemidi_t *ctx, uint8_t applemidi_port);
 
 
 #ifdef __cplusplus
@@ -0,0 +1,66 @@
+#pragma once
+/**
+ * Minimal Arduino API which is used to compile and run the library on a Linux
+ * host (see CMakeLists.txt): it is also included by the C sources.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <assert.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Milliseconds since the start of the program (monotonic clock)
+unsigned long millis(void);
+/// Microseconds since the start of the program (monotonic clock)
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield(void);
+
+#ifdef __cplusplus
+}
+
+#include "Print.h"
+#include "Stream.h"
+#include "IPAddress.h"
+
+/***************************************************/
+/*! \class HostSerial
+    \brief Serial of the host build: the output goes
+    to stdout and the input is read from stdin without
+    blocking.
+
+    by Phil Schatzmann
+*/
+/***************************************************/
+
+class HostSerial : public Stream {
+    public:
+        void begin(unsigned long baud = 0) {}
+        void end() {}
+        operator bool() { return true; }
+
+        int available() override;
+        int read() override;
+        int peek() override;
+        size_t write(uint8_t value) override;
+        size_t write(const uint8_t *buffer, size_t size) override;
+        void flush() override;
+
+    protected:
+        int peek_value = -1;
+};
+
+extern HostSerial Serial;
+
+#endif
@@ -0,0 +1,125 @@
+// Arduino API of the host build: it is not used on the microcontrollers
+#if defined(__linux__) && !defined(ARDUINO)
+
+#include "Arduino.h"
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+
+static uint64_t monotonicUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+// the clock starts with the program like on the microcontrollers
+static const uint64_t start_us = monotonicUs();
+
+HostSerial Serial;
+
+extern "C" unsigned long millis(void) {
+    return (monotonicUs() - start_us) / 1000;
+}
+
+extern "C" unsigned long micros(void) {
+    return monotonicUs() - start_us;
+}
+
+extern "C" void delay(unsigned long ms) {
+    struct timespec ts = {(time_t)(ms / 1000), (long)(ms % 1000) * 1000000l};
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR);
+}
+
+extern "C" void delayMicroseconds(unsigned int us) {
+    struct timespec ts = {(time_t)(us / 1000000), (long)(us % 1000000) * 1000l};
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR);
+}
+
+extern "C" void yield(void) {
+    sched_yield();
+}
+
+// => Print
+
+size_t Print :: printf(const char *fmt, ...) {
+    char buffer[256];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(buffer, sizeof(buffer), fmt, args);
+    va_end(args);
+    if (len < 0) {
+        return 0;
+    }
+    return write((const uint8_t *)buffer, (size_t)len < sizeof(buffer) ? len : sizeof(buffer) - 1);
+}
+
+// => Stream
+
+int Stream :: timedRead() {
+    unsigned long start = millis();
+    do {
+        int result = read();
+        if (result >= 0) {
+            return result;
+        }
+        yield();
+    } while (millis() - start < timeout_ms);
+    return -1;
+}
+
+size_t Stream :: readBytes(char *buffer, size_t length) {
+    size_t count = 0;
+    while (count < length) {
+        int value = timedRead();
+        if (value < 0) {
+            break;
+        }
+        buffer[count++] = (char)value;
+    }
+    return count;
+}
+
+// => HostSerial
+
+int HostSerial :: available() {
+    int result = 0;
+    if (ioctl(STDIN_FILENO, FIONREAD, &result) < 0) {
+        result = 0;
+    }
+    return result + (peek_value >= 0 ? 1 : 0);
+}
+
+int HostSerial :: read() {
+    int result = peek();
+    peek_value = -1;
+    return result;
+}
+
+int HostSerial :: peek() {
+    if (peek_value < 0) {
+        uint8_t value;
+        int available_len = 0;
+        if (ioctl(STDIN_FILENO, FIONREAD, &available_len) == 0 && available_len > 0 && ::read(STDIN_FILENO, &value, 1) == 1) {
+            peek_value = value;
+        }
+    }
+    return peek_value;
+}
+
+size_t HostSerial :: write(uint8_t value) {
+    return write(&value, 1);
+}
+
+size_t HostSerial :: write(const uint8_t *buffer, size_t size) {
+    // stdio is used, so that the output is ordered with printf() of the application
+    return fwrite(buffer, 1, size, stdout);
+}
+
+void HostSerial :: flush() {
+    fflush(stdout);
+}
+
+#endif
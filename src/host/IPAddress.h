@@ -0,0 +1,35 @@
+#pragma once
+#include <stdint.h>
+
+/***************************************************/
+/*! \class IPAddress
+    \brief IPv4 address of the Arduino API for the host
+    build: the uint32_t value is in network byte order.
+
+    by Phil Schatzmann
+*/
+/***************************************************/
+
+class IPAddress {
+    public:
+        IPAddress() { address.dword = 0; }
+        IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+            address.bytes[0] = a;
+            address.bytes[1] = b;
+            address.bytes[2] = c;
+            address.bytes[3] = d;
+        }
+        IPAddress(uint32_t value) { address.dword = value; }
+
+        operator uint32_t() const { return address.dword; }
+        uint8_t operator[](int index) const { return address.bytes[index]; }
+        uint8_t &operator[](int index) { return address.bytes[index]; }
+        bool operator==(const IPAddress &other) const { return address.dword == other.address.dword; }
+        bool operator!=(const IPAddress &other) const { return address.dword != other.address.dword; }
+
+    protected:
+        union {
+            uint8_t bytes[4];
+            uint32_t dword;
+        } address;
+};
@@ -0,0 +1,55 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+
+/***************************************************/
+/*! \class Print
+    \brief Arduino Print API for the host build: only
+    write(uint8_t) needs to be implemented.
+
+    by Phil Schatzmann
+*/
+/***************************************************/
+
+class Print {
+    public:
+        virtual ~Print() = default;
+
+        virtual size_t write(uint8_t value) = 0;
+
+        virtual size_t write(const uint8_t *buffer, size_t size) {
+            size_t result = 0;
+            while (size--) {
+                if (write(*buffer++) == 0) break;
+                result++;
+            }
+            return result;
+        }
+
+        size_t write(const char *str) {
+            return str == nullptr ? 0 : write((const uint8_t *)str, strlen(str));
+        }
+
+        size_t write(const char *buffer, size_t size) {
+            return write((const uint8_t *)buffer, size);
+        }
+
+        virtual int availableForWrite() { return 0; }
+        virtual void flush() {}
+
+        size_t print(const char *str) { return write(str); }
+        size_t print(char value) { return write((uint8_t)value); }
+        size_t print(int value) { return printf("%d", value); }
+        size_t print(unsigned value) { return printf("%u", value); }
+        size_t print(long value) { return printf("%ld", value); }
+        size_t print(unsigned long value) { return printf("%lu", value); }
+        size_t print(double value, int digits = 2) { return printf("%.*f", digits, value); }
+
+        size_t println() { return write("\r\n"); }
+        template <typename T> size_t println(T value) { return print(value) + println(); }
+
+        /// Formatted output: not part of all Arduino cores but of the ESP32 one
+        size_t printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+};
@@ -0,0 +1,33 @@
+#pragma once
+#include "Print.h"
+
+/***************************************************/
+/*! \class Stream
+    \brief Arduino Stream API for the host build: the
+    readBytes() methods wait up to the timeout for the
+    requested data like on the microcontrollers.
+
+    by Phil Schatzmann
+*/
+/***************************************************/
+
+class Stream : public Print {
+    public:
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int peek() = 0;
+
+        void setTimeout(unsigned long timeoutMs) { timeout_ms = timeoutMs; }
+        unsigned long getTimeout() { return timeout_ms; }
+
+        virtual size_t readBytes(char *buffer, size_t length);
+        virtual size_t readBytes(uint8_t *buffer, size_t length) {
+            return readBytes((char *)buffer, length);
+        }
+
+    protected:
+        unsigned long timeout_ms = 1000;
+
+        /// read() which waits up to the timeout: -1 if no data has arrived
+        int timedRead();
+};
@@ -0,0 +1,85 @@
+/**
+ * @file MidiTest.h
+ * @author Phil Schatzmann
+ * @brief Minimal checks for the host unit tests: a failed check is reported with the
+ * file and line and the test returns a non zero exit code with midiTestResult().
+ *
+ * @copyright Copyright (c) 2021
+ */
+#pragma once
+#include "Midi.h"
+#include <stdio.h>
+#include <vector>
+
+static int midi_test_checks = 0;
+static int midi_test_failures = 0;
+
+#define MIDI_CHECK(condition)                                                         \
+    do {                                                                              \
+        midi_test_checks++;                                                           \
+        if (!(condition)) {                                                           \
+            midi_test_failures++;                                                     \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);      \
+        }                                                                             \
+    } while (0)
+
+#define MIDI_CHECK_EQUAL(expected, actual)                                            \
+    do {                                                                              \
+        midi_test_checks++;                                                           \
+        long long midi_expected = (long long)(expected);                              \
+        long long midi_actual = (long long)(actual);                                  \
+        if (midi_expected != midi_actual) {                                           \
+            midi_test_failures++;                                                     \
+            printf("%s:%d: %s: expected %lld but was %lld\n", __FILE__, __LINE__,     \
+                   #actual, midi_expected, midi_actual);                              \
+        }                                                                             \
+    } while (0)
+
+/// Reports the number of checks: returns the exit code of the test
+inline int midiTestResult(const char *name) {
+    printf("%s: %d checks, %d failed\n", name, midi_test_checks, midi_test_failures);
+    return midi_test_failures == 0 ? 0 : 1;
+}
+
+/// Records the events of the parser, so that they can be compared with the expected messages
+class MidiTestAction : public midi::MidiAction {
+  public:
+    struct Event {
+        uint8_t status; // 0x90, 0x80, 0xB0 or 0xE0
+        uint8_t channel;
+        uint8_t p1;
+        uint8_t p2;
+    };
+    std::vector<Event> events;
+    std::vector<uint8_t> sysex;
+    int sysex_complete = 0;
+
+    void onNoteOn(uint8_t channel, uint8_t note, uint8_t velocity) { events.push_back({0x90, channel, note, velocity}); }
+    void onNoteOff(uint8_t channel, uint8_t note, uint8_t velocity) { events.push_back({0x80, channel, note, velocity}); }
+    void onControlChange(uint8_t channel, uint8_t controller, uint8_t value) { events.push_back({0xB0, channel, controller, value}); }
+    void onPitchBend(uint8_t channel, uint8_t value) { events.push_back({0xE0, channel, value, 0}); }
+    void onSysEx(const uint8_t *data, int len, int pos, bool complete) {
+        if (complete) {
+            sysex_complete++;
+        }
+        if (data != nullptr) {
+            sysex.resize(pos);
+            sysex.insert(sysex.end(), data, data + len);
+        }
+    }
+
+    /// Number of events with the status
+    int count(uint8_t status) {
+        int result = 0;
+        for (Event &event : events) {
+            if (event.status == status) result++;
+        }
+        return result;
+    }
+
+    void clear() {
+        events.clear();
+        sysex.clear();
+        sysex_complete = 0;
+    }
+};
@@ -0,0 +1,235 @@
+/**
+ * @file applemidi-journal.cpp
+ * @author Phil Schatzmann
+ * @brief Unit test of the AppleMIDI engine without network: two engines establish a
+ * session over an in memory datagram queue. Then some RTP MIDI packets are dropped and
+ * we check that the receiver recovers the lost note on, note off and controller messages
+ * from the recovery journal (RFC 6295) of the next packet. Late packets are only dropped
+ * if their content has been recovered. Messages to all peers are only
+ * sent when the session has been established, and each datagram is sent from the right
+ * socket (control or data) also with several peers.
+ *
+ * @copyright Copyright (c) 2021
+ */
+#include "MidiTest.h"
+#include <deque>
+
+/// An engine with its address and the received messages
+struct Endpoint {
+    applemidi_t engine;
+    uint8_t ip[16];
+    uint16_t control_port;
+    MidiTestAction received;
+};
+
+struct Datagram {
+    Endpoint *from;
+    uint8_t to_host;
+    uint16_t port;
+    uint8_t is_data;
+    std::vector<uint8_t> data;
+};
+
+std::deque<Datagram> queue;
+Endpoint a, b, c;
+Endpoint *endpoints[] = {&a, &b, &c};
+
+void onMessage(void *userData, uint8_t port, uint32_t timestamp, uint8_t status, uint8_t *data, size_t len, size_t continuedSysExPos) {
+    MidiTestAction &action = ((Endpoint *)userData)->received;
+    action.events.push_back({(uint8_t)(status & 0xF0), (uint8_t)(status & 0x0F), len > 0 ? data[0] : (uint8_t)0, len > 1 ? data[1] : (uint8_t)0});
+}
+
+int32_t onSend(void *userData, uint8_t *ipAddr, uint16_t port, uint8_t *data, size_t len, uint8_t isDataPort) {
+    queue.push_back({(Endpoint *)userData, ipAddr[3], port, isDataPort, std::vector<uint8_t>(data, data + len)});
+    return 0;
+}
+
+/// Number of queued RTP MIDI packets (AppleMIDI commands start with 0xFFFF)
+int rtpPackets() {
+    int result = 0;
+    for (Datagram &datagram : queue) {
+        if (datagram.data[0] != 0xFF) result++;
+    }
+    return result;
+}
+
+/// Passes the datagram to the remote engine: the data port is the control port + 1
+void deliver(Datagram &datagram) {
+    Endpoint *to = nullptr;
+    for (Endpoint *endpoint : endpoints) {
+        if (endpoint->ip[3] == datagram.to_host) to = endpoint;
+    }
+    MIDI_CHECK(to != nullptr);
+    // the datagram is sent from the socket which belongs to the port of the receiver
+    uint8_t is_data = datagram.port == to->control_port + 1;
+    MIDI_CHECK_EQUAL(is_data, datagram.is_data);
+    uint16_t from_port = datagram.from->control_port + datagram.is_data;
+    applemidi_parse_udp_datagram(&to->engine, datagram.from->ip, from_port, datagram.data.data(), datagram.data.size(), is_data);
+}
+
+/// Passes the first queued datagram to the remote engine
+void deliverOne() {
+    Datagram datagram = queue.front();
+    queue.pop_front();
+    deliver(datagram);
+}
+
+/// Passes all queued datagrams to the remote engines
+void deliver() {
+    while (!queue.empty()) {
+        deliverOne();
+    }
+}
+
+void begin(Endpoint &endpoint, uint8_t host, uint16_t controlPort) {
+    memset(&endpoint.engine, 0, sizeof(endpoint.engine));
+    applemidi_init(&endpoint.engine, onMessage, onSend, &endpoint);
+    applemidi_set_debug_level(&endpoint.engine, 0);
+    memset(endpoint.ip, 0, sizeof(endpoint.ip));
+    endpoint.ip[0] = 10;
+    endpoint.ip[3] = host;
+    endpoint.control_port = controlPort;
+}
+
+void send(uint8_t status, uint8_t data1, uint8_t data2) {
+    uint8_t msg[3] = {status, data1, data2};
+    applemidi_send_message(&a.engine, 1, msg, sizeof(msg));
+    applemidi_outbuffer_flush(&a.engine, 1);
+}
+
+/// the last packet is lost
+void drop() {
+    MIDI_CHECK_EQUAL(1, rtpPackets());
+    queue.pop_back();
+}
+
+/// the last packet is delayed: it is returned to be delivered later
+Datagram hold() {
+    MIDI_CHECK_EQUAL(1, rtpPackets());
+    Datagram result = queue.back();
+    queue.pop_back();
+    return result;
+}
+
+int countEvents(MidiTestAction &action, uint8_t status, uint8_t p1, uint8_t p2) {
+    int result = 0;
+    for (MidiTestAction::Event &event : action.events) {
+        if (event.status == status && event.p1 == p1 && event.p2 == p2) result++;
+    }
+    return result;
+}
+
+bool hasEvent(MidiTestAction &action, uint8_t status, uint8_t p1, uint8_t p2) {
+    for (MidiTestAction::Event &event : action.events) {
+        if (event.status == status && event.p1 == p1 && event.p2 == p2) return true;
+    }
+    return false;
+}
+
+void testSession() {
+    begin(a, 1, 5004);
+    begin(b, 2, 6004);
+    MIDI_CHECK_EQUAL(0, applemidi_start_session(&a.engine, 1, b.ip, b.control_port));
+    // no broadcast before the invitations on both ports have been accepted
+    uint8_t msg[3] = {0x90, 61, 100};
+    MIDI_CHECK_EQUAL(0, applemidi_send_message_all(&a.engine, msg, sizeof(msg)));
+    deliverOne();
+    MIDI_CHECK_EQUAL(0, applemidi_send_message_all(&b.engine, msg, sizeof(msg)));
+    deliver();
+    MIDI_CHECK_EQUAL(APPLEMIDI_CONNECTION_STATE_MASTER_CONNECTED, applemidi_peer_get_info(&a.engine, 1)->connection_state);
+    applemidi_peer_t *peer = applemidi_peer_get_info(&b.engine, 1);
+    MIDI_CHECK(peer->ssrc != 0);
+    MIDI_CHECK_EQUAL(a.control_port, peer->control_port);
+    MIDI_CHECK_EQUAL(a.control_port + 1, peer->data_port);
+
+    send(0x90, 60, 100);
+    deliver();
+    MIDI_CHECK(hasEvent(b.received, 0x90, 60, 100));
+    MIDI_CHECK(!hasEvent(b.received, 0x90, 61, 100));
+    MIDI_CHECK(!hasEvent(a.received, 0x90, 61, 100));
+}
+
+void testRecovery() {
+    b.received.clear();
+    // a lost note on
+    send(0x90, 62, 90);
+    drop();
+    send(0xB0, 7, 99);
+    deliver();
+    MIDI_CHECK(hasEvent(b.received, 0x90, 62, 90));
+    MIDI_CHECK(hasEvent(b.received, 0xB0, 7, 99));
+    MIDI_CHECK_EQUAL(1, applemidi_peer_get_info(&b.engine, 1)->packets_recovered);
+
+    // a lost note off and controller
+    b.received.clear();
+    send(0x80, 62, 0);
+    drop();
+    send(0xB0, 10, 20);
+    drop();
+    send(0x90, 64, 80);
+    deliver();
+    MIDI_CHECK(hasEvent(b.received, 0x80, 62, 0));
+    MIDI_CHECK(hasEvent(b.received, 0xB0, 10, 20));
+    MIDI_CHECK(hasEvent(b.received, 0x90, 64, 80));
+    MIDI_CHECK_EQUAL(2, applemidi_peer_get_info(&b.engine, 1)->packets_recovered);
+    // the note 60 which is still on is not repeated
+    MIDI_CHECK(!hasEvent(b.received, 0x90, 60, 100));
+
+    applemidi_rtp_stats_t stats;
+    MIDI_CHECK_EQUAL(0, applemidi_peer_get_rtp_stats(&b.engine, 1, &stats));
+    MIDI_CHECK_EQUAL(3, stats.packets_lost);
+}
+
+void testLatePackets() {
+    // a late packet which has been recovered by the journal of the next packet is dropped
+    b.received.clear();
+    send(0x90, 70, 60);
+    Datagram late = hold();
+    send(0x90, 71, 60);
+    deliver();
+    MIDI_CHECK_EQUAL(1, countEvents(b.received, 0x90, 70, 60));
+    deliver(late);
+    MIDI_CHECK_EQUAL(1, countEvents(b.received, 0x90, 70, 60));
+
+    // the next packet has no journal (e.g. because it was too big): the late packet is used
+    b.received.clear();
+    send(0x90, 72, 60);
+    late = hold();
+    send(0x90, 73, 60);
+    Datagram next = hold();
+    next.data[12] &= ~0x40;
+    deliver(next);
+    MIDI_CHECK(!hasEvent(b.received, 0x90, 72, 60));
+    deliver(late);
+    MIDI_CHECK_EQUAL(1, countEvents(b.received, 0x90, 72, 60));
+    MIDI_CHECK(hasEvent(b.received, 0x90, 73, 60));
+}
+
+void testBroadcast() {
+    // b has a second peer which has started the session from another port
+    begin(c, 3, 7004);
+    MIDI_CHECK_EQUAL(0, applemidi_start_session(&c.engine, 1, b.ip, b.control_port));
+    deliver();
+    MIDI_CHECK_EQUAL(APPLEMIDI_CONNECTION_STATE_MASTER_CONNECTED, applemidi_peer_get_info(&c.engine, 1)->connection_state);
+
+    a.received.clear();
+    uint8_t msg[3] = {0x90, 66, 70};
+    MIDI_CHECK_EQUAL(2, applemidi_send_message_all(&b.engine, msg, sizeof(msg)));
+    for (int port = 1; port < APPLEMIDI_MAX_PEERS; port++) {
+        applemidi_outbuffer_flush(&b.engine, port);
+    }
+    deliver();
+    MIDI_CHECK(hasEvent(a.received, 0x90, 66, 70));
+    MIDI_CHECK(hasEvent(c.received, 0x90, 66, 70));
+}
+
+int main() {
+    testSession();
+    testRecovery();
+    testLatePackets();
+    testBroadcast();
+    applemidi_deinit(&a.engine);
+    applemidi_deinit(&b.engine);
+    applemidi_deinit(&c.engine);
+    return midiTestResult("applemidi-journal");
+}
@@ -0,0 +1,158 @@
+/**
+ * @file ble-decoder.cpp
+ * @author Phil Schatzmann
+ * @brief Unit test of the BLE MIDI decoder without BLE: round trip of the encoded
+ * messages, the reconstruction of their timestamps, running status, SysEx which spans
+ * several packets, invalid packets and the playout with the jitter buffer.
+ *
+ * @copyright Copyright (c) 2021
+ */
+#include "MidiTest.h"
+
+using namespace midi;
+
+/// Keeps the reconstructed timestamp of each message
+class TimestampParser : public MidiParser {
+  public:
+    MidiBleDecoder *p_decoder = nullptr;
+    std::vector<uint32_t> timestamps;
+    TimestampParser(MidiAction *action) : MidiParser(action) {}
+    void onCommand(uint8_t channel, uint8_t status, uint8_t p1, uint8_t p2) override {
+        if (p_decoder != nullptr) timestamps.push_back(p_decoder->timestampUs());
+        MidiParser::onCommand(channel, status, p1, p2);
+    }
+};
+
+void testRoundTrip() {
+    MidiBleEncoder encoder;
+    encoder.setMtu(23);
+    uint8_t note_on[3] = {0x90, 60, 100};
+    uint8_t cc[3] = {0xB1, 7, 99};
+    uint8_t note_off[3] = {0x80, 60, 0};
+    MIDI_CHECK(encoder.write(1000, note_on, 3));
+    MIDI_CHECK(encoder.write(1003, cc, 3));
+    MIDI_CHECK(encoder.write(1010, note_off, 3));
+    MIDI_CHECK(encoder.write(1011, note_on, 3));
+
+    MidiTestAction action;
+    MidiParser parser(&action);
+    MidiBleDecoder decoder;
+    decoder.begin(&parser);
+    MIDI_CHECK_EQUAL(4, decoder.decode(encoder.data(), encoder.size(), 5000000));
+    MIDI_CHECK_EQUAL(4, action.events.size());
+    MIDI_CHECK_EQUAL(0x90, action.events[0].status);
+    MIDI_CHECK_EQUAL(0xB0, action.events[1].status);
+    MIDI_CHECK_EQUAL(1, action.events[1].channel);
+    MIDI_CHECK_EQUAL(99, action.events[1].p2);
+    MIDI_CHECK_EQUAL(0x80, action.events[2].status);
+    MIDI_CHECK_EQUAL(0, decoder.statistics().invalid);
+    MIDI_CHECK_EQUAL(4, decoder.statistics().messages);
+}
+
+/// decodes a packet with one note which was created at timeMs and received at nowUs
+void decodeNote(MidiBleDecoder &decoder, uint32_t timeMs, uint32_t nowUs) {
+    MidiBleEncoder encoder;
+    uint8_t note_on[3] = {0x90, 60, 100};
+    encoder.write(timeMs, note_on, 3);
+    decoder.decode(encoder.data(), encoder.size(), nowUs);
+}
+
+void testTimestamps() {
+    MidiTestAction action;
+    TimestampParser parser(&action);
+    MidiBleDecoder decoder;
+    decoder.begin(&parser);
+    parser.p_decoder = &decoder;
+    // the spacing of the sender is kept: also when the lower 7 bits wrap around
+    decodeNote(decoder, 120, 1000000);
+    decodeNote(decoder, 126, 1006000);
+    decodeNote(decoder, 129, 1009000);
+    // the packet was delayed by 2 ms: the timestamp is the one of the sender
+    decodeNote(decoder, 140, 1022000);
+    MIDI_CHECK_EQUAL(4, parser.timestamps.size());
+    MIDI_CHECK_EQUAL(6000, parser.timestamps[1] - parser.timestamps[0]);
+    MIDI_CHECK_EQUAL(9000, parser.timestamps[2] - parser.timestamps[0]);
+    int32_t delayed = parser.timestamps[3] - parser.timestamps[0];
+    MIDI_CHECK(delayed >= 20000 && delayed < 20100);
+    // a message can not be from the future
+    decodeNote(decoder, 200, 1030000);
+    MIDI_CHECK_EQUAL(1030000, parser.timestamps[4]);
+}
+
+void testRunningStatus() {
+    MidiTestAction action;
+    MidiParser parser(&action);
+    MidiBleDecoder decoder;
+    decoder.begin(&parser);
+    // running status without and with a timestamp
+    uint8_t packet[] = {0x80, 0x81, 0x90, 60, 100, 62, 100, 0x82, 64, 100};
+    MIDI_CHECK_EQUAL(3, decoder.decode(packet, sizeof(packet), 1000));
+    MIDI_CHECK_EQUAL(3, action.count(0x90));
+    MIDI_CHECK_EQUAL(64, action.events[2].p1);
+    // a packet which ends in the middle of a message is invalid
+    uint8_t truncated[] = {0x80, 0x81, 0x90, 60};
+    MIDI_CHECK_EQUAL(0, decoder.decode(truncated, sizeof(truncated), 2000));
+    MIDI_CHECK_EQUAL(1, decoder.statistics().invalid);
+    // wrong header
+    uint8_t header[] = {0x40, 0x81, 0x90, 60, 100};
+    MIDI_CHECK_EQUAL(0, decoder.decode(header, sizeof(header), 3000));
+    MIDI_CHECK_EQUAL(2, decoder.statistics().invalid);
+}
+
+void testSysEx() {
+    MidiTestAction action;
+    MidiParser parser(&action);
+    MidiSysExAssembler sysex;
+    sysex.begin(&parser);
+    MidiBleDecoder decoder;
+    decoder.begin(&parser);
+    decoder.setSysEx(&sysex, 1);
+    // the SysEx continues in the next packet without timestamp and a real time message is inserted
+    uint8_t first[] = {0x80, 0x81, 0xF0, 1, 2, 3};
+    uint8_t second[] = {0x80, 4, 5, 0x82, 0xF8, 6, 0x83, 0xF7, 0x84, 0x90, 60, 100};
+    decoder.decode(first, sizeof(first), 1000);
+    MIDI_CHECK_EQUAL(0, action.sysex_complete);
+    decoder.decode(second, sizeof(second), 2000);
+    MIDI_CHECK_EQUAL(1, action.sysex_complete);
+    MIDI_CHECK_EQUAL(6, action.sysex.size());
+    for (int j = 0; j < (int)action.sysex.size(); j++) {
+        MIDI_CHECK_EQUAL(j + 1, action.sysex[j]);
+    }
+    MIDI_CHECK_EQUAL(1, action.count(0x90));
+    MIDI_CHECK_EQUAL(0, sysex.available());
+}
+
+void testJitterBuffer() {
+    MidiTestAction action;
+    MidiParser parser(&action);
+    MidiJitterBuffer jitter;
+    jitter.begin(&parser);
+    jitter.setLatency(2000, 50000);
+    MidiBleDecoder decoder;
+    decoder.begin(&parser, &jitter);
+
+    // two notes 5 ms apart which arrive with the same transit time
+    uint32_t played_us[2] = {0, 0};
+    for (uint32_t now = 100000; now < 200000 && action.events.size() < 2; now += 100) {
+        if (now == 100000) decodeNote(decoder, 0, now);
+        if (now == 105000) decodeNote(decoder, 5, now);
+        size_t before = action.events.size();
+        jitter.play(now);
+        for (size_t j = before; j < action.events.size(); j++) played_us[j] = now;
+    }
+    MIDI_CHECK_EQUAL(2, action.events.size());
+    // they are delayed by the min latency and keep their spacing
+    MIDI_CHECK_EQUAL(102000, played_us[0]);
+    MIDI_CHECK_EQUAL(5000, played_us[1] - played_us[0]);
+    MIDI_CHECK_EQUAL(0, jitter.available());
+}
+
+int main() {
+    MidiLogLevel = MidiError;
+    testRoundTrip();
+    testTimestamps();
+    testRunningStatus();
+    testSysEx();
+    testJitterBuffer();
+    return midiTestResult("ble-decoder");
+}
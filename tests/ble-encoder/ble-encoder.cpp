@@ -0,0 +1,64 @@
+/**
+ * @file ble-encoder.cpp
+ * @author Phil Schatzmann
+ * @brief Unit test of the BLE MIDI encoder without BLE: the header and timestamp bytes,
+ * the packet size which is limited by the MTU and the messages which need a new packet
+ * because their timestamp can not be represented.
+ *
+ * @copyright Copyright (c) 2021
+ */
+#include "MidiTest.h"
+
+using namespace midi;
+
+void testPacket() {
+    MidiBleEncoder encoder;
+    encoder.setMtu(23);
+    MIDI_CHECK_EQUAL(20, encoder.maxSize());
+    uint8_t note_on[3] = {0x90, 60, 100};
+    uint8_t cc[3] = {0xB1, 7, 99};
+    uint8_t note_off[3] = {0x80, 60, 0};
+    MIDI_CHECK(encoder.write(1000, note_on, 3));
+    MIDI_CHECK(encoder.write(1003, cc, 3));
+    MIDI_CHECK(encoder.write(1010, note_off, 3));
+    MIDI_CHECK_EQUAL(3, encoder.available());
+    // header + 3 x (timestamp + 3 bytes)
+    MIDI_CHECK_EQUAL(13, encoder.size());
+    MIDI_CHECK_EQUAL(0x80 | ((1000 >> 7) & 0x3F), encoder.data()[0]);
+    MIDI_CHECK_EQUAL(0x80 | (1000 & 0x7F), encoder.data()[1]);
+    MIDI_CHECK_EQUAL(0x90, encoder.data()[2]);
+    MIDI_CHECK_EQUAL(0x80 | (1003 & 0x7F), encoder.data()[5]);
+    MIDI_CHECK_EQUAL(0xB1, encoder.data()[6]);
+    // the packet is full: 20 bytes with the MTU of 23
+    MIDI_CHECK(encoder.write(1011, note_on, 3));
+    MIDI_CHECK(!encoder.write(1012, note_on, 3));
+    MIDI_CHECK_EQUAL(17, encoder.size());
+
+    encoder.clear();
+    MIDI_CHECK_EQUAL(0, encoder.size());
+    MIDI_CHECK_EQUAL(0, encoder.available());
+    // a bigger MTU is limited by the buffer size
+    encoder.setMtu(1000);
+    MIDI_CHECK_EQUAL(MIDI_BLE_PACKET_SIZE, encoder.maxSize());
+}
+
+void testTimestamps() {
+    MidiBleEncoder encoder;
+    uint8_t note_on[3] = {0x90, 60, 100};
+    // the lower 7 bits wrap around: the receiver increments the upper bits
+    MIDI_CHECK(encoder.write(120, note_on, 3));
+    MIDI_CHECK(encoder.write(129, note_on, 3));
+    MIDI_CHECK_EQUAL(0x80 | (129 & 0x7F), encoder.data()[5]);
+    // a gap of more than 128 ms can not be represented
+    MIDI_CHECK(!encoder.write(260, note_on, 3));
+    // the timestamps must not go back
+    MIDI_CHECK(!encoder.write(125, note_on, 3));
+    MIDI_CHECK_EQUAL(2, encoder.available());
+}
+
+int main() {
+    MidiLogLevel = MidiError;
+    testPacket();
+    testTimestamps();
+    return midiTestResult("ble-encoder");
+}
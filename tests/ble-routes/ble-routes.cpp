@@ -0,0 +1,98 @@
+/**
+ * @file ble-routes.cpp
+ * @author Phil Schatzmann
+ * @brief Unit test of the MidiBleRoutes: the notifications are routed on a separate
+ * thread (like the BLE task) while the routes are removed and their receivers deleted.
+ * remove() must wait until the receiver has processed the current packet.
+ *
+ * @copyright Copyright (c) 2021
+ */
+#include "MidiTest.h"
+#include <atomic>
+#include <thread>
+
+using namespace midi;
+
+/// Receiver which stays in receive() until it is released
+class BlockingReceiver : public MidiPacketReceiver {
+  public:
+    std::atomic<bool> is_entered{false};
+    std::atomic<bool> is_released{false};
+    void receive(const uint8_t *data, int len) override {
+        is_entered = true;
+        while (!is_released) std::this_thread::yield();
+    }
+};
+
+/// number of packets which were passed to a deleted receiver
+std::atomic<int> deleted_packets{0};
+
+/// Receiver which counts the packets: the counter is invalidated when it is deleted
+class CountingReceiver : public MidiPacketReceiver {
+  public:
+    int packets = 0;
+    ~CountingReceiver() { packets = -1000000; }
+    void receive(const uint8_t *data, int len) override {
+        if (packets < 0) deleted_packets++;
+        packets++;
+    }
+};
+
+void testRemoveWaits() {
+    MidiBleRoutes routes;
+    BlockingReceiver receiver;
+    int characteristic = 0;
+    uint8_t packet[] = {0x80, 0x80, 0x90, 60, 100};
+    MIDI_CHECK(routes.add(&characteristic, &receiver));
+
+    std::thread ble([&]() { routes.route(&characteristic, packet, sizeof(packet)); });
+    while (!receiver.is_entered) std::this_thread::yield();
+    std::atomic<bool> is_removed{false};
+    std::thread application([&]() {
+        routes.remove(&characteristic);
+        is_removed = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    // the receiver is still in use
+    MIDI_CHECK(!is_removed);
+    receiver.is_released = true;
+    ble.join();
+    application.join();
+    MIDI_CHECK(is_removed);
+    MIDI_CHECK_EQUAL(0, routes.size());
+    MIDI_CHECK(!routes.route(&characteristic, packet, sizeof(packet)));
+    MIDI_CHECK(!routes.remove(nullptr));
+}
+
+void testDeleteAfterRemove() {
+    MidiBleRoutes routes;
+    int characteristics[2] = {0, 0};
+    uint8_t packet[] = {0x80, 0x80, 0x90, 60, 100};
+    std::atomic<bool> is_active{true};
+    // the BLE task routes the notifications of both characteristics
+    std::thread ble([&]() {
+        while (is_active) {
+            routes.route(&characteristics[0], packet, sizeof(packet));
+            routes.route(&characteristics[1], packet, sizeof(packet));
+        }
+    });
+    // the application reconnects the clients: the receiver is deleted after its route has been removed
+    for (int j = 0; j < 2000; j++) {
+        CountingReceiver *receiver = new CountingReceiver();
+        routes.add(&characteristics[j % 2], receiver);
+        std::this_thread::yield();
+        routes.remove(&characteristics[j % 2]);
+        delete receiver;
+    }
+    is_active = false;
+    ble.join();
+    MIDI_CHECK_EQUAL(0, deleted_packets);
+    MIDI_CHECK_EQUAL(0, routes.size());
+}
+
+int main() {
+    MidiLogLevel = MidiError;
+    testRemoveWaits();
+    testDeleteAfterRemove();
+    return midiTestResult("ble-routes");
+}
@@ -0,0 +1,149 @@
+/**
+ * @file parser.cpp
+ * @author Phil Schatzmann
+ * @brief Unit test of the MidiParser and of MidiStreamIn: channel messages, running status
+ * (also when it is split between two reads), the channel filter and the boundaries of the
+ * complete messages in a byte stream.
+ *
+ * @copyright Copyright (c) 2021
+ */
+#include "MidiTest.h"
+
+using namespace midi;
+
+void testMessages() {
+    MidiTestAction action;
+    MidiParser parser(&action);
+    uint8_t msg[] = {0x91, 60, 100, 0x81, 60, 0, 0x92, 61, 0, 0xB3, 7, 99, 0xE4, 64, 0};
+    parser.parse(msg, sizeof(msg));
+    MIDI_CHECK_EQUAL(5, action.events.size());
+    MIDI_CHECK_EQUAL(0x90, action.events[0].status);
+    MIDI_CHECK_EQUAL(1, action.events[0].channel);
+    MIDI_CHECK_EQUAL(60, action.events[0].p1);
+    MIDI_CHECK_EQUAL(100, action.events[0].p2);
+    MIDI_CHECK_EQUAL(0x80, action.events[1].status);
+    // note on with velocity 0 is a note off
+    MIDI_CHECK_EQUAL(0x80, action.events[2].status);
+    MIDI_CHECK_EQUAL(2, action.events[2].channel);
+    MIDI_CHECK_EQUAL(0xB0, action.events[3].status);
+    MIDI_CHECK_EQUAL(3, action.events[3].channel);
+    MIDI_CHECK_EQUAL(7, action.events[3].p1);
+    MIDI_CHECK_EQUAL(99, action.events[3].p2);
+    MIDI_CHECK_EQUAL(0xE0, action.events[4].status);
+    MIDI_CHECK_EQUAL(64, action.events[4].p1);
+}
+
+void testRunningStatus() {
+    MidiTestAction action;
+    MidiParser parser(&action);
+    uint8_t msg[] = {0x90, 60, 100, 62, 100, 64, 0};
+    parser.parse(msg, sizeof(msg));
+    MIDI_CHECK_EQUAL(2, action.count(0x90));
+    MIDI_CHECK_EQUAL(1, action.count(0x80));
+    MIDI_CHECK_EQUAL(62, action.events[1].p1);
+}
+
+void testSplitRunningStatus() {
+    MidiTestAction action;
+    MidiParser parser(&action);
+    // the data bytes of the running status arrive in the next call
+    uint8_t first[] = {0x90, 0x3C, 0x64};
+    uint8_t second[] = {0x3E, 0x64, 0x40, 0x00};
+    parser.parse(first, sizeof(first));
+    parser.parse(second, sizeof(second));
+    MIDI_CHECK_EQUAL(2, action.count(0x90));
+    MIDI_CHECK_EQUAL(1, action.count(0x80));
+    MIDI_CHECK_EQUAL(0x40, action.events[2].p1);
+
+    // real time messages do not change the running status, also not between the data bytes
+    action.clear();
+    uint8_t real_time[] = {0xF8, 0x3C, 0xF8, 0x10, 0xFE};
+    parser.parse(real_time, sizeof(real_time));
+    MIDI_CHECK_EQUAL(1, action.events.size());
+    MIDI_CHECK_EQUAL(0x10, action.events[0].p2);
+
+    // system common messages cancel it: the following data bytes are ignored
+    action.clear();
+    uint8_t song_select[] = {0xF3, 0x01};
+    uint8_t data[] = {0x3C, 0x64};
+    parser.parse(song_select, sizeof(song_select));
+    parser.parse(data, sizeof(data));
+    MIDI_CHECK_EQUAL(0, action.events.size());
+
+    // a program change has only one data byte
+    uint8_t program[] = {0xC0, 0x05, 0x06, 0xB0, 0x07, 0x64};
+    parser.parse(program, sizeof(program));
+    MIDI_CHECK_EQUAL(1, action.events.size());
+    MIDI_CHECK_EQUAL(0xB0, action.events[0].status);
+
+    // after a reset the data bytes are ignored until the next status
+    action.clear();
+    parser.reset();
+    parser.parse(data, sizeof(data));
+    MIDI_CHECK_EQUAL(0, action.events.size());
+}
+
+void testFilter() {
+    MidiTestAction action;
+    MidiParser parser(&action, 2);
+    uint8_t msg[] = {0x91, 60, 100, 0x92, 61, 100};
+    parser.parse(msg, sizeof(msg));
+    MIDI_CHECK_EQUAL(1, action.events.size());
+    MIDI_CHECK_EQUAL(61, action.events[0].p1);
+}
+
+void testCompleteLength() {
+    uint8_t complete[] = {0x90, 60, 100, 0xC0, 5};
+    MIDI_CHECK_EQUAL(5, MidiParser::completeLength(complete, sizeof(complete)));
+    uint8_t partial[] = {0x90, 60, 100, 0x90, 60};
+    MIDI_CHECK_EQUAL(3, MidiParser::completeLength(partial, sizeof(partial)));
+    uint8_t running[] = {0x90, 60, 100, 62};
+    MIDI_CHECK_EQUAL(3, MidiParser::completeLength(running, sizeof(running)));
+    // a real time message inside of a message does not end it
+    uint8_t real_time[] = {0x90, 60, 0xF8, 100, 0xF8};
+    MIDI_CHECK_EQUAL(5, MidiParser::completeLength(real_time, sizeof(real_time)));
+    MIDI_CHECK_EQUAL(2, MidiParser::dataLength(0x93));
+    MIDI_CHECK_EQUAL(1, MidiParser::dataLength(0xC3));
+    MIDI_CHECK_EQUAL(-1, MidiParser::dataLength(0xF0));
+    MIDI_CHECK_EQUAL(0, MidiParser::dataLength(0xF8));
+}
+
+void testStreamIn() {
+    // a message which is split between two reads is kept until it is complete
+    MidiTestAction action;
+    uint8_t buffer[64];
+    MidiMemoryStream stream(buffer, sizeof(buffer));
+    MidiStreamIn in(stream, action);
+    uint8_t first[] = {0x90, 60, 100, 0x80};
+    uint8_t second[] = {60, 0};
+    stream.write(first, sizeof(first));
+    in.loop();
+    MIDI_CHECK_EQUAL(1, action.events.size());
+    stream.write(second, sizeof(second));
+    in.loop();
+    MIDI_CHECK_EQUAL(2, action.events.size());
+    MIDI_CHECK_EQUAL(0x80, action.events[1].status);
+    MIDI_CHECK_EQUAL(60, action.events[1].p1);
+
+    // running status which continues in the next read
+    action.clear();
+    uint8_t running[] = {0x90, 0x3C, 0x64};
+    uint8_t continued[] = {0x3E, 0x64, 0x40, 0x00};
+    stream.write(running, sizeof(running));
+    in.loop();
+    stream.write(continued, sizeof(continued));
+    in.loop();
+    MIDI_CHECK_EQUAL(2, action.count(0x90));
+    MIDI_CHECK_EQUAL(1, action.count(0x80));
+}
+
+int main() {
+    MidiLogLevel = MidiError;
+    testMessages();
+    testRunningStatus();
+    testSplitRunningStatus();
+    testFilter();
+    testCompleteLength();
+    testStreamIn();
+    return midiTestResult("parser");
+}
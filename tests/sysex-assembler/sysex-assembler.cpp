@@ -0,0 +1,105 @@
+/**
+ * @file sysex-assembler.cpp
+ * @author Phil Schatzmann
+ * @brief Unit test of the MidiSysExAssembler: messages in several parts of multiple
+ * sources, aborted, oversize and dropped messages, the timeout and the streaming mode.
+ *
+ * @copyright Copyright (c) 2021
+ */
+#include "MidiTest.h"
+
+using namespace midi;
+
+void testParts() {
+    MidiTestAction action;
+    MidiParser parser(&action);
+    MidiSysExAssembler sysex;
+    sysex.begin(&parser);
+    uint8_t a[] = {1, 2, 3};
+    uint8_t b[] = {10, 11};
+    // the parts of two sources are interleaved
+    sysex.write(1, a, 3, 0, 0);
+    sysex.write(2, b, 2, 0, 0);
+    sysex.write(1, a, 3, 3, 1);
+    MIDI_CHECK_EQUAL(2, sysex.available());
+    sysex.end(1);
+    MIDI_CHECK_EQUAL(1, action.sysex_complete);
+    MIDI_CHECK_EQUAL(6, action.sysex.size());
+    MIDI_CHECK_EQUAL(3, action.sysex[5]);
+    sysex.end(2);
+    MIDI_CHECK_EQUAL(2, action.sysex_complete);
+    MIDI_CHECK_EQUAL(2, action.sysex.size());
+    MIDI_CHECK_EQUAL(10, action.sysex[0]);
+    MIDI_CHECK_EQUAL(0, sysex.available());
+    MIDI_CHECK_EQUAL(2, sysex.statistics().messages);
+    MIDI_CHECK_EQUAL(6, sysex.statistics().max_len);
+}
+
+void testErrors() {
+    MidiTestAction action;
+    MidiParser parser(&action);
+    MidiSysExAssembler sysex;
+    sysex.begin(&parser);
+    sysex.setStreaming(false, 4);
+    uint8_t data[] = {1, 2, 3};
+
+    // restarted before the end
+    sysex.write(1, data, 3, 0, 0);
+    sysex.write(1, data, 3, 0, 0);
+    MIDI_CHECK_EQUAL(1, sysex.statistics().aborted);
+    // bigger than the max size: it is not passed on
+    sysex.write(1, data, 3, 3, 0);
+    sysex.end(1);
+    MIDI_CHECK_EQUAL(1, sysex.statistics().oversize);
+    MIDI_CHECK_EQUAL(0, action.sysex_complete);
+
+    // all buffers are in use
+    for (int j = 0; j <= MIDI_SYSEX_POOL_SIZE; j++) {
+        sysex.write(10 + j, data, 1, 0, 100);
+    }
+    MIDI_CHECK_EQUAL(1, sysex.statistics().exhausted);
+    // the buffer of a source which stopped is reused after the timeout
+    sysex.setTimeout(1000);
+    sysex.write(20, data, 1, 0, 2000);
+    MIDI_CHECK_EQUAL(1, sysex.statistics().exhausted);
+    MIDI_CHECK_EQUAL(2, sysex.statistics().aborted);
+    sysex.end(20);
+    MIDI_CHECK_EQUAL(1, action.sysex_complete);
+
+    // the end of a message which was never started is ignored
+    sysex.end(30);
+    MIDI_CHECK_EQUAL(1, action.sysex_complete);
+    // the buffer of 10 has been reused: only 11 is incomplete
+    MIDI_CHECK_EQUAL(1, sysex.available());
+    sysex.abort(11);
+    MIDI_CHECK_EQUAL(0, sysex.available());
+    MIDI_CHECK_EQUAL(3, sysex.statistics().aborted);
+}
+
+void testStreaming() {
+    MidiTestAction action;
+    MidiParser parser(&action);
+    MidiSysExAssembler sysex;
+    sysex.begin(&parser);
+    sysex.setStreaming(true);
+    // the parts are passed on immediatly: there is no size limit
+    uint8_t data[100];
+    for (int j = 0; j < 100; j++) data[j] = j;
+    for (int pos = 0; pos < 2000; pos += 100) {
+        sysex.write(1, data, 100, pos, 0);
+    }
+    MIDI_CHECK_EQUAL(2000, action.sysex.size());
+    MIDI_CHECK_EQUAL(99, action.sysex[1999]);
+    MIDI_CHECK_EQUAL(0, action.sysex_complete);
+    sysex.end(1);
+    MIDI_CHECK_EQUAL(1, action.sysex_complete);
+    MIDI_CHECK_EQUAL(2000, sysex.statistics().max_len);
+}
+
+int main() {
+    MidiLogLevel = MidiError;
+    testParts();
+    testErrors();
+    testStreaming();
+    return midiTestResult("sysex-assembler");
+}
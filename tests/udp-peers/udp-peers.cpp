@@ -0,0 +1,95 @@
+/**
+ * @file udp-peers.cpp
+ * @author Phil Schatzmann
+ * @brief Unit test of the MidiUdpPeers table: the peers are added and removed in random
+ * order and compared with a simple model, so that the backward shift deletion of the hash
+ * index and the compaction of the dense array are verified. Also the full table and the
+ * expiry of idle peers are checked.
+ *
+ * @copyright Copyright (c) 2021
+ */
+#include "MidiTest.h"
+#include <stdlib.h>
+
+using namespace midi;
+
+const int address_count = 3 * MIDI_UDP_MAX_PEERS;
+
+IPAddress address(int j) {
+    return IPAddress(192, 168, j / 16, 1 + j % 16);
+}
+
+uint16_t port(int j) {
+    return 5000 + j % 3;
+}
+
+/// all peers of the model can be found and no other ones
+void verify(MidiUdpPeers &peers, bool *model) {
+    int count = 0;
+    for (int j = 0; j < address_count; j++) {
+        MidiUdpPeer *peer = peers.find(address(j), port(j));
+        if (model[j]) {
+            count++;
+            MIDI_CHECK(peer != nullptr && peer->address == address(j) && peer->port == port(j));
+        } else {
+            MIDI_CHECK(peer == nullptr);
+        }
+    }
+    MIDI_CHECK_EQUAL(count, peers.size());
+}
+
+void testRandom() {
+    MidiUdpPeers peers;
+    bool model[address_count] = {false};
+    int count = 0;
+    srand(1);
+    for (int round = 0; round < 20000; round++) {
+        int j = rand() % address_count;
+        if (rand() % 2 == 0) {
+            MidiUdpPeer *peer = peers.update(address(j), port(j), round);
+            if (!model[j] && count == MIDI_UDP_MAX_PEERS) {
+                // the table is full
+                MIDI_CHECK(peer == nullptr);
+            } else {
+                MIDI_CHECK(peer != nullptr);
+                if (!model[j]) count++;
+                model[j] = true;
+            }
+        } else {
+            MIDI_CHECK_EQUAL(model[j], peers.remove(address(j), port(j)));
+            if (model[j]) count--;
+            model[j] = false;
+        }
+        if (round % 97 == 0) {
+            verify(peers, model);
+        }
+    }
+    verify(peers, model);
+}
+
+void testExpire() {
+    MidiUdpPeers peers;
+    for (int j = 0; j < 10; j++) {
+        peers.update(address(j), port(j), j * 100);
+    }
+    MIDI_CHECK_EQUAL(2, peers.update(address(3), port(3), 900)->datagrams_received);
+    // all peers which were idle for more than 500 ms at 1000 ms: 0..4 without 3
+    MIDI_CHECK_EQUAL(4, peers.expire(1000, 500));
+    MIDI_CHECK_EQUAL(6, peers.size());
+    MIDI_CHECK(peers.find(address(3), port(3)) != nullptr);
+    MIDI_CHECK(peers.find(address(4), port(4)) == nullptr);
+    MIDI_CHECK(peers.find(address(5), port(5)) != nullptr);
+    for (int j = 0; j < peers.size(); j++) {
+        MIDI_CHECK(peers.find(peers[j].address, peers[j].port) == &peers[j]);
+    }
+    peers.clear();
+    MIDI_CHECK_EQUAL(0, peers.size());
+    MIDI_CHECK(peers.find(address(5), port(5)) == nullptr);
+}
+
+int main() {
+    MidiLogLevel = MidiError;
+    testRandom();
+    testExpire();
+    return midiTestResult("udp-peers");
+}